@@ -37,12 +37,26 @@
 #include <common/timer.h>
 #include <common/init.h>
 #include <common/data_frag.h>
+#include <common/img_sync.h>
 
 #include "client.h"
 
 
-#define CLI_FRAGMENT_MAX_LEN 	(512)
+/* state image fragment size until the path MTU is known. */
+#define CLI_FRAGMENT_DEF_LEN 	(512)
+/* IPv4 and UDP headers, in front of every packet. */
+#define CLI_IP_UDP_HDR_LEN 		(28)
+/* one parity fragment per 8 state image fragments. */
+#define CLI_FRAGMENT_FEC_GROUP 	(8)
+/* state images kept for retransmission. */
+#define CLI_FRAGMENT_WINDOW 	(4)
+/* state image pacing, bytes per second. */
+#define CLI_PACE_MIN_RATE 		(128 * 1024)
+#define CLI_PACE_MAX_RATE 		(64 * 1024 * 1024)
 #define CLI_DATA_MAX_LEN        (4*1024*1024)
+/* the checkin is sent again until the node server has it. */
+#define CLI_CHECKIN_RETRY_MS    (200)
+#define CLI_CHECKIN_RETRIES     (25)
 
 
 struct pack_cli_msg {
@@ -51,16 +65,29 @@ struct pack_cli_msg {
     uint8_t type;
 
     /*struct fragment {*/
-    uint16_t seq;
     uint8_t frag:1;
     uint8_t mf:1;
-    uint8_t _reserved:6;
-    uint32_t frag_ofs:22;    /* max data len: 4MB */
-    uint32_t datalen:10;     /* packet len */
+    uint8_t parity:1;
+    uint8_t _reserved:5;
+    uint16_t seq;
+    uint16_t fraglen;       /* fragment size of this image */
+    uint16_t datalen;       /* packet len */
+    uint32_t frag_ofs;
     uint8_t data[0];
     /*}; */
 };
 
+/* PACK_STATE_IMG_NACK payload, every member gets it, the sender answers. */
+struct pack_cli_nack {
+    uint32_t userid;    /* sender of the state image */
+    uint16_t seq;
+    uint8_t nr_ranges;
+    struct {
+        uint32_t start;
+        int32_t count;
+    } ranges[0];
+};
+
 
 struct client_peer {
     uint32_t taskid;
@@ -91,7 +118,11 @@ struct client {
     iowait_t waits;
     int running;
     data_frags_t *frags;
+    int mtu;                /* configured, 0: the path MTU */
+    img_sync_t *img_sync;   /* state images as deltas, see client_set_state_img_sync() */
     struct timer_list hbeat_timer;
+    struct timer_list checkin_timer;
+    int checkin_tries;
 
     struct client_peer control; 	/* connect with center serv, taskid is invaild */
     struct client_peer task;
@@ -164,10 +195,12 @@ int client_login(void)
     if(!cli->running)
         return -EINVAL;
 
-    data = client_pkt_alloc(&cli->control);
-
+    /* the responses carry no request seq, one request of a type at a time. */
     iowait_watcher_init(&watcher, MSG_LOGIN_RESPONSE, 0, &userid, sizeof(int));
-    iowait_register_watcher(&cli->waits, &watcher);
+    if(iowait_register_watcher(&cli->waits, &watcher))
+        return -EBUSY;
+
+    data = client_pkt_alloc(&cli->control);
 
     client_pkt_send(&cli->control, MSG_CLI_LOGIN, data, 0);
 
@@ -211,6 +244,10 @@ int client_create_group(int open, const char *name, const char *passwd)
     if(!cli->running)
         return -EINVAL;
 
+    iowait_watcher_init(&watcher, MSG_CREATE_GROUP_RESPONSE, 0, &result, sizeof(result));
+    if(iowait_register_watcher(&cli->waits, &watcher))
+        return -EBUSY;
+
     p = (struct pack_creat_group *)client_pkt_alloc(&cli->control);
 
     p->userid = cli->userid;
@@ -226,9 +263,6 @@ int client_create_group(int open, const char *name, const char *passwd)
         strncpy((char *)p->passwd, passwd, GROUP_PASSWD_MAX);
     }
 
-    iowait_watcher_init(&watcher, MSG_CREATE_GROUP_RESPONSE, 0, &result, sizeof(result));
-    iowait_register_watcher(&cli->waits, &watcher);
-
     client_pkt_send(&cli->control, MSG_CLI_CREATE_GROUP, p, sizeof(*p));
 
     ret = wait_for_response(&cli->waits, &watcher); /* XXX seq */
@@ -263,12 +297,17 @@ void client_delete_group(void)
     client_pkt_send(&cli->control, MSG_CLI_DELETE_GROUP, p, sizeof(*p));
 }
 
-int client_list_group(int pos, int count, struct group_description *gres, int *rescount)
+/*
+ * @cursor: 0 for the first page, the next page is listed from the
+ * cursor returned, LIST_GROUP_CURSOR_END after the last group.
+ */
+int client_list_group_from(uint32_t *cursor, int count,
+        struct group_description *gres, int *rescount)
 {
-#define RESULT_MAX_LEN 	 	(4000)
     int ret;
-    char result[RESULT_MAX_LEN];
+    char result[sizeof(struct pack_list_group_result) + LIST_GROUP_RESULT_MAX];
     struct pack_list_group *p;
+    struct pack_list_group_result *res = (struct pack_list_group_result *)result;
     group_desc_t *gdesc;
     iowait_watcher_t watcher;
     int retlen = 0;
@@ -276,18 +315,19 @@ int client_list_group(int pos, int count, struct group_description *gres, int *r
     struct group_description *gp = gres;
     struct client *cli = &_client;
 
-    if(!cli->running)
+    if(!cli->running || *cursor == LIST_GROUP_CURSOR_END)
         return -EINVAL;
 
+    iowait_watcher_init(&watcher, MSG_LIST_GROUP_RESPONSE, 0, result, sizeof(result));
+    if(iowait_register_watcher(&cli->waits, &watcher))
+        return -EBUSY;
+
     p = (struct pack_list_group *)client_pkt_alloc(&cli->control);
 
     p->userid = cli->userid;
-    p->pos = pos;
+    p->pos = *cursor;
     p->count = count;
 
-    iowait_watcher_init(&watcher, MSG_LIST_GROUP_RESPONSE, 0, result, sizeof(result));
-    iowait_register_watcher(&cli->waits, &watcher);
-
     client_pkt_send(&cli->control, MSG_CLI_LIST_GROUP, p, sizeof(*p));
 
     ret = wait_for_response_data(&cli->waits, &watcher, &retlen); /* XXX */
@@ -297,10 +337,18 @@ int client_list_group(int pos, int count, struct group_description *gres, int *r
     logd("%s result:%d\n", __func__, retlen);
 
     *rescount = 0;
+    if(retlen < sizeof(*res))
+        return -EINVAL;
+
+    *cursor = res->cursor;
+    retlen -= sizeof(*res);
 
     /* XXX: current version: group_desc_t equals struct group_description */
-    while(ofs < retlen) {
-        gdesc = (group_desc_t *)(result + ofs);
+    while(ofs + sizeof(group_desc_t) <= retlen && *rescount < count) {
+        gdesc = (group_desc_t *)(res->data + ofs);
+        if(gdesc->namelen >= NAME_MAX_LEN ||
+                ofs + sizeof(group_desc_t) + gdesc->namelen > retlen)
+            break;
 
         gp->groupid = gdesc->groupid;
         gp->flags = gdesc->flags;
@@ -316,6 +364,14 @@ int client_list_group(int pos, int count, struct group_description *gres, int *r
     return 0;
 }
 
+/* the first page when @pos is 0, see client_list_group_from(). */
+int client_list_group(int pos, int count, struct group_description *gres, int *rescount)
+{
+    uint32_t cursor = pos;
+
+    return client_list_group_from(&cursor, count, gres, rescount);
+}
+
 
 int client_join_group(struct group_description *group, const char *passwd)
 {
@@ -328,14 +384,15 @@ int client_join_group(struct group_description *group, const char *passwd)
     if(!cli->running)
         return -EINVAL;
 
+    iowait_watcher_init(&watcher, MSG_JOIN_GROUP_RESPONSE, 0, &result, sizeof(result));
+    if(iowait_register_watcher(&cli->waits, &watcher))
+        return -EBUSY;
+
     p = (struct pack_join_group *)client_pkt_alloc(&cli->control);
 
     p->userid = cli->userid;
     p->groupid = group->groupid;
 
-    iowait_watcher_init(&watcher, MSG_JOIN_GROUP_RESPONSE, 0, &result, sizeof(result));
-    iowait_register_watcher(&cli->waits, &watcher);
-
     client_pkt_send(&cli->control, MSG_CLI_JOIN_GROUP, p, sizeof(*p));
 
     ret = wait_for_response(&cli->waits, &watcher); /* XXX */
@@ -393,9 +450,24 @@ static void task_req_pack_send(struct client *cli, void *data, int size)
 }
 
 
-void client_checkin(void)
+static void cli_checkin_send(struct client *cli)
 {
     struct pack_cli_msg *p;
+
+    p = create_task_req_pack(cli, TASK_TURN);
+
+    p->type = PACK_CHECKIN;
+    p->datalen = 0;
+    task_req_pack_send(cli, p, sizeof(*p));
+}
+
+/*
+ * The task may not be on its node server yet when the address comes
+ * from a reserved slot, the checkin is sent again until the node server
+ * acknowledges it or relays a packet of the group.
+ */
+void client_checkin(void)
+{
     struct client *cli = &_client;
 
     if(cli->task.taskid == INVAILD_TASKID) {
@@ -403,11 +475,25 @@ void client_checkin(void)
         return;	
     }
 
-    p = create_task_req_pack(cli, TASK_TURN);
+    cli_checkin_send(cli);
+    cli->checkin_tries = 0;
+    mod_timer(&cli->checkin_timer, curr_time_ms() + CLI_CHECKIN_RETRY_MS);
+}
 
-    p->type = PACK_CHECKIN;
-    p->datalen = 0;
-    task_req_pack_send(cli, p, sizeof(*p));
+static void cli_checkin_timer_handle(unsigned long data)
+{
+    struct client *cli = (struct client *)data;
+
+    if(cli->task.taskid == INVAILD_TASKID)
+        return;
+
+    if(++cli->checkin_tries >= CLI_CHECKIN_RETRIES) {
+        logw("checkin not acknowledged by task %d.\n", cli->task.taskid);
+        return;
+    }
+
+    cli_checkin_send(cli);
+    mod_timer(&cli->checkin_timer, curr_time_ms() + CLI_CHECKIN_RETRY_MS);
 }
 
 void client_send_command(void *data, int len)
@@ -436,10 +522,13 @@ static void cli_frag_output(void *opaque, data_vec_t *v)
     struct client *cli = (struct client *)opaque;
 
     p = create_task_req_pack(cli, TASK_TURN);
+    p->base.userid = cli->userid;
     p->type = PACK_STATE_IMG;
     p->seq = v->seq;
+    p->fraglen = v->fraglen;
     p->frag = 1;
     p->mf = v->mf;
+    p->parity = v->parity;
     p->frag_ofs = v->ofs;
     p->datalen = v->len;
     memcpy(p->data, v->data, v->len);
@@ -448,20 +537,100 @@ static void cli_frag_output(void *opaque, data_vec_t *v)
             p->seq, p->mf, p->frag_ofs, p->datalen);
 
     task_req_pack_send(cli, p, sizeof(*p) + v->len);
-    usleep(100); /* XXX */
 }
 
-void client_send_state_img(void *data, int len)
+static void cli_frag_sent(void *opaque, int seq)
 {
+    int ret;
+    struct client *cli = (struct client *)opaque;
+    unsigned long s = seq;
+
+    ret = cli->callback(EVENT_STATE_IMG_SENT, (void *)s, NULL);
+    if(ret) {
+        loge("client EVENT_STATE_IMG_SENT handle fail.\n");	
+    }
+}
+
+static void cli_frag_nack(void *opaque, data_nack_t *nack)
+{
+    int i;
+    struct pack_cli_msg *p;
+    struct pack_cli_nack *n;
+    struct client *cli = (struct client *)opaque;
+
+    if(cli->task.taskid == INVAILD_TASKID)
+        return;
+
+    p = create_task_req_pack(cli, TASK_TURN);
+    p->type = PACK_STATE_IMG_NACK;
+    p->frag = 0;
+
+    n = (struct pack_cli_nack *)p->data;
+    n->userid = nack->src;
+    n->seq = nack->seq;
+    n->nr_ranges = nack->nr_ranges;
+    for(i=0; i<nack->nr_ranges; i++) {
+        n->ranges[i].start = nack->ranges[i].start;
+        n->ranges[i].count = nack->ranges[i].count;
+    }
+    p->datalen = sizeof(*n) + nack->nr_ranges * sizeof(n->ranges[0]);
+
+    logd("pack state img nack: user:%d, seq:%d, ranges:%d\n",
+            n->userid, n->seq, n->nr_ranges);
+
+    task_req_pack_send(cli, p, sizeof(*p) + p->datalen);
+}
+
+/* returns at once, EVENT_STATE_IMG_SENT tells when it is out. */
+int client_send_state_img(void *data, int len)
+{
+    int ret;
+    void *buf;
     struct client *cli = &_client;
 
     if(cli->task.taskid == INVAILD_TASKID) {
-        return;	
+        return -EINVAL;	
     }
 
     logv("client send state img, len:%d\n", len);
 
-    data_frag(cli->frags, data, len);
+    if(!cli->img_sync)
+        return data_frag_async(cli->frags, data, len);
+
+    if(len <= 0 || img_sync_bound(len) > CLI_DATA_MAX_LEN)
+        return -EINVAL;
+
+    buf = malloc(img_sync_bound(len));
+    if(!buf)
+        return -ENOMEM;
+
+    ret = img_sync_encode(cli->img_sync, cli->userid, data, len, buf);
+    if(ret > 0)
+        ret = data_frag_async(cli->frags, buf, ret);
+    /* the receivers never see this image, the next delta would not apply. */
+    if(ret < 0)
+        img_sync_force_key(cli->img_sync);
+
+    free(buf);
+    return ret;
+}
+
+/*
+ * Send state images as deltas against the previous one, with a keyframe
+ * at least every @keyint images. Every member of the group must use the
+ * same mode, call it before the first state image.
+ */
+int client_set_state_img_sync(int keyint)
+{
+    struct client *cli = &_client;
+
+    if(cli->img_sync)
+        return -EBUSY;
+
+    cli->img_sync = img_sync_init(keyint);
+    if(!cli->img_sync)
+        return -ENOMEM;
+    return 0;
 }
 
 
@@ -492,6 +661,39 @@ static void cli_group_delete_handle(void)
     cli->task.taskid = INVAILD_TASKID;
 }
 
+static void cli_group_migrate_handle(struct pack_creat_group_result *gres)
+{
+    struct client *cli = &_client;
+
+    if(gres->groupid != cli->groupid || gres->taskid != cli->task.taskid)
+        return;
+
+    cli->task.serv_addr = *((struct sockaddr_in*)&gres->addr);
+    logi("group %d task moved to %s, port:%d\n", cli->groupid,
+            inet_ntoa(cli->task.serv_addr.sin_addr), ntohs(cli->task.serv_addr.sin_port));
+
+    /* a task assigned again does not know the address yet. */
+    client_checkin();
+}
+
+/* log in again at the home center server, the login still waits. */
+static void cli_login_redirect_handle(struct client *cli, struct sockaddr *addr)
+{
+    uint32_t *redirected;
+
+    if(cli->userid != (uint32_t)INVAILD_USERID)
+        return;
+
+    cli->control.serv_addr = *((struct sockaddr_in *)addr);
+    logi("login redirected to %s, port:%d\n", inet_ntoa(cli->control.serv_addr.sin_addr),
+            ntohs(cli->control.serv_addr.sin_port));
+
+    redirected = (uint32_t *)client_pkt_alloc(&cli->control);
+    *redirected = 1;
+
+    client_pkt_send(&cli->control, MSG_CLI_LOGIN, redirected, sizeof(uint32_t));
+}
+
 static void cli_msg_handle(void* user, uint8_t *data, int len, void *from)
 {
     struct client *cli = user;
@@ -527,6 +729,9 @@ static void cli_msg_handle(void* user, uint8_t *data, int len, void *from)
             response_post(&cli->waits, head->type, 0, &userid);
             break;
         }
+        case MSG_LOGIN_REDIRECT:
+            cli_login_redirect_handle(cli, (struct sockaddr *)payload);
+            break;
         case MSG_CREATE_GROUP_RESPONSE:
         case MSG_JOIN_GROUP_RESPONSE:
         {
@@ -544,6 +749,9 @@ static void cli_msg_handle(void* user, uint8_t *data, int len, void *from)
         case MSG_GROUP_DELETE:
             cli_group_delete_handle();
             break;
+        case MSG_GROUP_MIGRATE:
+            cli_group_migrate_handle((struct pack_creat_group_result *)payload);
+            break;
         case MSG_HANDLE_ERR:
             break;
         default:
@@ -581,7 +789,7 @@ static void pack_command_handle(struct pack_cli_msg *msg)
     }
 }
 
-static void cli_frag_input(void *opaque, void *data, int datalen)
+static void cli_state_img(void *opaque, int src, void *data, int datalen)
 {
     int ret;
     struct client *cli = (struct client *)opaque;
@@ -593,6 +801,22 @@ static void cli_frag_input(void *opaque, void *data, int datalen)
     }
 }
 
+static void cli_frag_input(void *opaque, void *data, int datalen)
+{
+    int ret;
+    struct client *cli = (struct client *)opaque;
+
+    if(!cli->img_sync) {
+        cli_state_img(cli, 0, data, datalen);
+        return;
+    }
+
+    /* -EAGAIN: its base image was lost, wait for the next keyframe. */
+    ret = img_sync_decode(cli->img_sync, data, datalen, cli_state_img, cli);
+    if(ret < 0 && ret != -EAGAIN)
+        loge("client state img decode fail, %d.\n", ret);
+}
+
 static pack_buf_t *payload_to_pack_buf(void *p)
 {
     pack_buf_t *pkb;
@@ -623,6 +847,9 @@ static void pack_state_img_handle(struct pack_cli_msg *msg)
     pack_buf_t *pkb;
 
     v.seq = msg->seq;
+    v.src = msg->base.userid;
+    v.fraglen = msg->fraglen;
+    v.parity = msg->parity;
     v.mf = msg->mf;
     v.ofs = msg->frag_ofs;
     v.data = msg->data;
@@ -636,6 +863,36 @@ static void pack_state_img_handle(struct pack_cli_msg *msg)
     data_defrag(cli->frags, &v, msg);
 }
 
+static void pack_state_img_nack_handle(struct pack_cli_msg *msg) 
+{
+    int i;
+    struct client *cli = &_client;
+    struct pack_cli_nack *n = (struct pack_cli_nack *)msg->data;
+    data_nack_t nack;
+
+    if(msg->datalen < sizeof(*n) || n->userid != cli->userid)
+        return;
+
+    if(n->nr_ranges > FRAG_NACK_RANGES_MAX ||
+            msg->datalen < sizeof(*n) + n->nr_ranges * sizeof(n->ranges[0]))
+        return;
+
+    nack.src = n->userid;
+    nack.seq = n->seq;
+    nack.nr_ranges = n->nr_ranges;
+    for(i=0; i<n->nr_ranges; i++) {
+        nack.ranges[i].start = n->ranges[i].start;
+        nack.ranges[i].count = n->ranges[i].count;
+    }
+
+    /*
+     * gone from the window, the receiver cannot complete it. 0 is data
+     * still queued, its fragments are on their way.
+     */
+    if(data_frag_retransmit(cli->frags, &nack) == -ENOENT && cli->img_sync)
+        img_sync_force_key(cli->img_sync);
+}
+
 static void cli_pack_handle(struct pack_cli_msg *msg) 
 {
     logd("client packet handle. type:%d\n", msg->type);
@@ -650,6 +907,9 @@ static void cli_pack_handle(struct pack_cli_msg *msg)
         case PACK_STATE_IMG:
             pack_state_img_handle(msg);
             break;
+        case PACK_STATE_IMG_NACK:
+            pack_state_img_nack_handle(msg);
+            break;
         default:
             break;
     }
@@ -657,7 +917,7 @@ static void cli_pack_handle(struct pack_cli_msg *msg)
 
 static void cli_task_handle(void* user, uint8_t *data, int len, void *from)
 {
-    //	struct client *cli = user;
+    struct client *cli = user;
     pack_head_t *head;
     void *payload;
 
@@ -684,10 +944,16 @@ static void cli_task_handle(void* user, uint8_t *data, int len, void *from)
     //cli_mgr_send_ack(cm, head);
 
     switch(head->type) {
+        case MSG_TURN_CHECKIN_ACK:
+            del_timer(&cli->checkin_timer);
+            break;
         case MSG_TURN_PACK:
         case MSG_P2P_PACK:
         {
             struct pack_cli_msg *msg = (struct pack_cli_msg *)payload;
+
+            /* relayed to it, the node server has its checkin. */
+            del_timer(&cli->checkin_timer);
             cli_pack_handle(msg);
             break;
         }
@@ -711,6 +977,59 @@ static void *client_thread_handle(void *args)
 #endif
 
 
+/*
+ * Largest state image fragment for @mtu. The packet carries the pack
+ * head, the task request and the cli msg in front of the data, and has
+ * to fit the receive buffers of the node server and the other clients.
+ */
+static int cli_fraglen(int mtu)
+{
+    int hdrs = pack_head_len() + sizeof(struct pack_task_req) +
+        sizeof(struct pack_cli_msg);
+    int fraglen = min(mtu - CLI_IP_UDP_HDR_LEN, PACKET_MAX_PAYLOAD) - hdrs;
+
+    /* whole words, the parity is computed a word at a time. */
+    fraglen &= ~(sizeof(unsigned long) - 1);
+    return max(fraglen, FRAG_MIN_LEN);
+}
+
+static void cli_update_fraglen(struct client *cli)
+{
+    int mtu = cli->mtu;
+    int fraglen;
+
+    if(!mtu) {
+        mtu = socket_path_mtu(&cli->task.serv_addr);
+        if(mtu < 0) {
+            logw("path mtu unknown, state image fragments of %d bytes.\n",
+                    CLI_FRAGMENT_DEF_LEN);
+            return;
+        }
+    }
+
+    fraglen = cli_fraglen(mtu);
+    data_frag_set_fraglen(cli->frags, fraglen);
+    logi("mtu %d, state image fragments of %d bytes.\n", mtu, fraglen);
+}
+
+/*
+ * Size the state image fragments for @mtu instead of the path MTU
+ * towards the node server, 0 goes back to the path MTU.
+ */
+int client_set_mtu(int mtu)
+{
+    struct client *cli = &_client;
+
+    if(mtu && mtu < CLI_IP_UDP_HDR_LEN + FRAG_MIN_LEN)
+        return -EINVAL;
+
+    cli->mtu = mtu;
+    /* otherwise client_task_start() does it. */
+    if(cli->frags && (mtu || cli->task.taskid != INVAILD_TASKID))
+        cli_update_fraglen(cli);
+    return 0;
+}
+
 int client_task_start(void)
 {
     int sock;
@@ -732,6 +1051,8 @@ int client_task_start(void)
     logi("communicate with node server. bind to %s, %d.\n",
             inet_ntoa(addr.sin_addr), ntohs(addr.sin_port));
 
+    cli_update_fraglen(cli);
+
     /* report receive port */
     client_checkin();
     return 0;
@@ -785,13 +1106,18 @@ int client_init(const char *host, int mode, event_cb callback)
     signals_init();
     common_init();
 
-    iowait_init(&cli->waits);
+    if(iowait_init(&cli->waits))
+        return -ENOMEM;
 
     cli->callback = callback;
     cli->mode = mode;
     pthread_mutex_init(&cli->lock, NULL);
-    cli->frags = data_frag_init(CLI_FRAGMENT_MAX_LEN, cli_frag_input, 
+    cli->frags = data_frag_init(CLI_FRAGMENT_DEF_LEN, cli_frag_input, 
             cli_frag_output, cli_frag_pkt_free, cli);
+    data_frag_set_fec(cli->frags, CLI_FRAGMENT_FEC_GROUP);
+    data_frag_set_nack(cli->frags, CLI_FRAGMENT_WINDOW, cli_frag_nack);
+    data_frag_set_pacing(cli->frags, CLI_PACE_MIN_RATE, CLI_PACE_MAX_RATE,
+            cli_frag_sent);
 
     /*	if(mode == CLI_MODE_CONTROL_ONLY || mode == CLI_MODE_TASK_ONLY) { */
     /* dynamic alloc port by system. */
@@ -820,6 +1146,8 @@ int client_init(const char *host, int mode, event_cb callback)
 
     init_timer(&cli->hbeat_timer);
     setup_timer(&cli->hbeat_timer, cli_hbeat_timer_handle, (unsigned long)cli);
+    init_timer(&cli->checkin_timer);
+    setup_timer(&cli->checkin_timer, cli_checkin_timer_handle, (unsigned long)cli);
     cli->control.hand = iohandler_udp_create(get_global_ioasync(), sock,
             cli_msg_handle, cli_msg_close, cli);
 
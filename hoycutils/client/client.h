@@ -48,17 +48,36 @@ struct cli_context_state {
  * return: 0 success, other fail */
 typedef int (*event_cb)(int event, void *arg1, void *arg2);
 
+/*
+ * login, create, list and join wait for the response, they return
+ * -EBUSY while another request of the same kind is waiting.
+ */
 int client_login(void);
 void client_logout(void);
 int client_create_group(int open, const char *name, const char *passwd);
 void client_delete_group(void);
 
+/*
+ * Groups are listed in groupid order, a page of up to @count from a
+ * cursor. The cursor is opaque, not an offset: 0 for the first page,
+ * then the one returned, until LIST_GROUP_CURSOR_END. A page may hold
+ * groups of several center servers, one asked for more than a packet
+ * takes is cut short. client_list_group() takes the cursor in @pos and
+ * gives no next one, client_list_group_from() updates @cursor.
+ */
 int client_list_group(int pos, int count, struct group_description *gres, int *rescount);
+int client_list_group_from(uint32_t *cursor, int count,
+        struct group_description *gres, int *rescount);
 int client_join_group(struct group_description *group, const char *passwd);
 void client_leave_group(void);
 
 void client_send_command(void *data, int len);
-void client_send_state_img(void *data, int len);
+/* returns the image seq, see EVENT_STATE_IMG_SENT. */
+int client_send_state_img(void *data, int len);
+/* send state images as deltas, keyframe every @keyint images. */
+int client_set_state_img_sync(int keyint);
+/* state image fragments sized for @mtu, 0: the path MTU. */
+int client_set_mtu(int mtu);
 
 int client_init(const char *host, int mode, event_cb callback);
 int client_task_start(void);
@@ -92,6 +111,10 @@ enum {
     /* arg1: NULL
      * arg2: NULL */
     EVENT_GROUP_DELETE,
+
+    /* arg1: int, seq returned by client_send_state_img.
+     * arg2: NULL */
+    EVENT_STATE_IMG_SENT,
 };
 
 
@@ -143,7 +143,7 @@ void __bitmap_shift_left(unsigned long *dst, const unsigned long *src,
 		memset(dst, 0, off*sizeof(unsigned long));
 }
 
-int __bitmap_and(unsigned long *dst, const unsigned long *bitmap1,
+int __bitmap_and_generic(unsigned long *dst, const unsigned long *bitmap1,
 				const unsigned long *bitmap2, unsigned int bits)
 {
 	unsigned int k;
@@ -158,7 +158,7 @@ int __bitmap_and(unsigned long *dst, const unsigned long *bitmap1,
 	return result != 0;
 }
 
-void __bitmap_or(unsigned long *dst, const unsigned long *bitmap1,
+void __bitmap_or_generic(unsigned long *dst, const unsigned long *bitmap1,
 				const unsigned long *bitmap2, unsigned int bits)
 {
 	unsigned int k;
@@ -168,7 +168,7 @@ void __bitmap_or(unsigned long *dst, const unsigned long *bitmap1,
 		dst[k] = bitmap1[k] | bitmap2[k];
 }
 
-void __bitmap_xor(unsigned long *dst, const unsigned long *bitmap1,
+void __bitmap_xor_generic(unsigned long *dst, const unsigned long *bitmap1,
 				const unsigned long *bitmap2, unsigned int bits)
 {
 	unsigned int k;
@@ -178,7 +178,7 @@ void __bitmap_xor(unsigned long *dst, const unsigned long *bitmap1,
 		dst[k] = bitmap1[k] ^ bitmap2[k];
 }
 
-int __bitmap_andnot(unsigned long *dst, const unsigned long *bitmap1,
+int __bitmap_andnot_generic(unsigned long *dst, const unsigned long *bitmap1,
 				const unsigned long *bitmap2, unsigned int bits)
 {
 	unsigned int k;
@@ -221,20 +221,66 @@ int __bitmap_subset(const unsigned long *bitmap1,
 	return 1;
 }
 
-int __bitmap_weight(const unsigned long *bitmap, unsigned int bits)
+int __bitmap_weight_generic(const unsigned long *bitmap, unsigned int bits)
 {
 	unsigned int k, lim = bits/BITS_PER_LONG;
 	int w = 0;
 
 	for (k = 0; k < lim; k++)
-		w += hweight_long(bitmap[k]);
+		w += __hweight64_generic(bitmap[k]);
 
 	if (bits % BITS_PER_LONG)
-		w += hweight_long(bitmap[k] & BITMAP_LAST_WORD_MASK(bits));
+		w += __hweight64_generic(bitmap[k] & BITMAP_LAST_WORD_MASK(bits));
 
 	return w;
 }
 
+/*
+ * and/or/andnot/weight are dispatched through bitmap_ops, which
+ * bitmap_ops_init() points at the best variant for this cpu, from
+ * BITMAP_OPS_MIN_BITS on.
+ */
+int __bitmap_and(unsigned long *dst, const unsigned long *bitmap1,
+				const unsigned long *bitmap2, unsigned int bits)
+{
+	if (bits < BITMAP_OPS_MIN_BITS)
+		return __bitmap_and_generic(dst, bitmap1, bitmap2, bits);
+	return bitmap_ops->and_bits(dst, bitmap1, bitmap2, bits);
+}
+
+void __bitmap_or(unsigned long *dst, const unsigned long *bitmap1,
+				const unsigned long *bitmap2, unsigned int bits)
+{
+	if (bits < BITMAP_OPS_MIN_BITS)
+		__bitmap_or_generic(dst, bitmap1, bitmap2, bits);
+	else
+		bitmap_ops->or_bits(dst, bitmap1, bitmap2, bits);
+}
+
+void __bitmap_xor(unsigned long *dst, const unsigned long *bitmap1,
+				const unsigned long *bitmap2, unsigned int bits)
+{
+	if (bits < BITMAP_OPS_MIN_BITS)
+		__bitmap_xor_generic(dst, bitmap1, bitmap2, bits);
+	else
+		bitmap_ops->xor_bits(dst, bitmap1, bitmap2, bits);
+}
+
+int __bitmap_andnot(unsigned long *dst, const unsigned long *bitmap1,
+				const unsigned long *bitmap2, unsigned int bits)
+{
+	if (bits < BITMAP_OPS_MIN_BITS)
+		return __bitmap_andnot_generic(dst, bitmap1, bitmap2, bits);
+	return bitmap_ops->andnot_bits(dst, bitmap1, bitmap2, bits);
+}
+
+int __bitmap_weight(const unsigned long *bitmap, unsigned int bits)
+{
+	if (bits < BITMAP_OPS_MIN_BITS)
+		return __bitmap_weight_generic(bitmap, bits);
+	return bitmap_ops->weight(bitmap, bits);
+}
+
 void bitmap_set(unsigned long *map, unsigned int start, int len)
 {
 	unsigned long *p = map + BIT_WORD(start);
@@ -0,0 +1,426 @@
+/*
+ * common/bitmap_simd.c
+ *
+ * 2016-01-01  written by Hoyleeson <hoyleeson@gmail.com>
+ *	Copyright (C) 2015-2016 by Hoyleeson.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; version 2.
+ *
+ * SSE2/AVX2/POPCNT variants of the bitmap word kernels and the runtime
+ * selection between them. The results are identical to the generic
+ * versions in find_bit.c, bitmap.c and hweight.c.
+ *
+ */
+
+#include <stdio.h>
+
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
+
+#include <common/log.h>
+#include <common/core.h>
+#include <common/bitops.h>
+#include <common/bitmap.h>
+#include <common/cpufeature.h>
+
+
+static const struct bitmap_ops bitmap_ops_generic = {
+	.name 			= "generic",
+	.features 		= 0,
+	.find_next_bit 	= _find_next_bit_generic,
+	.and_bits 		= __bitmap_and_generic,
+	.or_bits 		= __bitmap_or_generic,
+	.xor_bits 		= __bitmap_xor_generic,
+	.andnot_bits 	= __bitmap_andnot_generic,
+	.weight 		= __bitmap_weight_generic,
+	.weight32 		= __hweight32_generic,
+	.weight64 		= __hweight64_generic,
+};
+
+#ifdef __x86_64__
+
+/*
+ * The vector loops only cover whole words, the first (partial) word and
+ * the tail are handled like the generic code does.
+ */
+
+static unsigned long find_next_bit_sse2(const unsigned long *addr,
+		unsigned long nbits, unsigned long start, unsigned long invert)
+{
+	unsigned long tmp, idx, nwords;
+	__m128i inv, zero, v;
+
+	if (!nbits || start >= nbits)
+		return nbits;
+
+	idx = start / BITS_PER_LONG;
+	tmp = (addr[idx] ^ invert) & BITMAP_FIRST_WORD_MASK(start);
+	if (tmp)
+		goto found;
+
+	nwords = BITS_TO_LONGS(nbits);
+	inv = _mm_set1_epi64x(invert);
+	zero = _mm_setzero_si128();
+
+	for (idx++; idx + 4 <= nwords; idx += 4) {
+		v = _mm_or_si128(
+			_mm_xor_si128(_mm_loadu_si128((const __m128i *)(addr + idx)), inv),
+			_mm_xor_si128(_mm_loadu_si128((const __m128i *)(addr + idx + 2)), inv));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero)) != 0xffff)
+			break;
+	}
+
+	for (; idx < nwords; idx++) {
+		tmp = addr[idx] ^ invert;
+		if (tmp)
+			goto found;
+	}
+	return nbits;
+
+found:
+	return min(idx * BITS_PER_LONG + __ffs(tmp), nbits);
+}
+
+static inline int sse2_nonzero(__m128i v)
+{
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128())) != 0xffff;
+}
+
+static int bitmap_and_sse2(unsigned long *dst, const unsigned long *bitmap1,
+		const unsigned long *bitmap2, unsigned int bits)
+{
+	unsigned int k = 0, lim = bits / BITS_PER_LONG;
+	unsigned long result = 0;
+	__m128i v, acc = _mm_setzero_si128();
+
+	for (; k + 2 <= lim; k += 2) {
+		v = _mm_and_si128(_mm_loadu_si128((const __m128i *)(bitmap1 + k)),
+				_mm_loadu_si128((const __m128i *)(bitmap2 + k)));
+		_mm_storeu_si128((__m128i *)(dst + k), v);
+		acc = _mm_or_si128(acc, v);
+	}
+	result = sse2_nonzero(acc);
+
+	for (; k < lim; k++)
+		result |= (dst[k] = bitmap1[k] & bitmap2[k]);
+	if (bits % BITS_PER_LONG)
+		result |= (dst[k] = bitmap1[k] & bitmap2[k] &
+			   BITMAP_LAST_WORD_MASK(bits));
+	return result != 0;
+}
+
+static void bitmap_or_sse2(unsigned long *dst, const unsigned long *bitmap1,
+		const unsigned long *bitmap2, unsigned int bits)
+{
+	unsigned int k = 0, nr = BITS_TO_LONGS(bits);
+
+	for (; k + 2 <= nr; k += 2)
+		_mm_storeu_si128((__m128i *)(dst + k),
+				_mm_or_si128(_mm_loadu_si128((const __m128i *)(bitmap1 + k)),
+					_mm_loadu_si128((const __m128i *)(bitmap2 + k))));
+
+	for (; k < nr; k++)
+		dst[k] = bitmap1[k] | bitmap2[k];
+}
+
+static void bitmap_xor_sse2(unsigned long *dst, const unsigned long *bitmap1,
+		const unsigned long *bitmap2, unsigned int bits)
+{
+	unsigned int k = 0, nr = BITS_TO_LONGS(bits);
+
+	for (; k + 2 <= nr; k += 2)
+		_mm_storeu_si128((__m128i *)(dst + k),
+				_mm_xor_si128(_mm_loadu_si128((const __m128i *)(bitmap1 + k)),
+					_mm_loadu_si128((const __m128i *)(bitmap2 + k))));
+
+	for (; k < nr; k++)
+		dst[k] = bitmap1[k] ^ bitmap2[k];
+}
+
+static int bitmap_andnot_sse2(unsigned long *dst, const unsigned long *bitmap1,
+		const unsigned long *bitmap2, unsigned int bits)
+{
+	unsigned int k = 0, lim = bits / BITS_PER_LONG;
+	unsigned long result = 0;
+	__m128i v, acc = _mm_setzero_si128();
+
+	for (; k + 2 <= lim; k += 2) {
+		/* andnot(a, b) is ~a & b */
+		v = _mm_andnot_si128(_mm_loadu_si128((const __m128i *)(bitmap2 + k)),
+				_mm_loadu_si128((const __m128i *)(bitmap1 + k)));
+		_mm_storeu_si128((__m128i *)(dst + k), v);
+		acc = _mm_or_si128(acc, v);
+	}
+	result = sse2_nonzero(acc);
+
+	for (; k < lim; k++)
+		result |= (dst[k] = bitmap1[k] & ~bitmap2[k]);
+	if (bits % BITS_PER_LONG)
+		result |= (dst[k] = bitmap1[k] & ~bitmap2[k] &
+			   BITMAP_LAST_WORD_MASK(bits));
+	return result != 0;
+}
+
+
+__attribute__((target("popcnt")))
+static unsigned int hweight32_popcnt(unsigned int w)
+{
+	return __builtin_popcount(w);
+}
+
+__attribute__((target("popcnt")))
+static unsigned long hweight64_popcnt(uint64_t w)
+{
+	return __builtin_popcountll(w);
+}
+
+__attribute__((target("popcnt")))
+static int bitmap_weight_popcnt(const unsigned long *bitmap, unsigned int bits)
+{
+	unsigned int k = 0, lim = bits / BITS_PER_LONG;
+	unsigned long w0 = 0, w1 = 0;
+
+	/* two accumulators, popcnt has a false dependency on its output. */
+	for (; k + 2 <= lim; k += 2) {
+		w0 += __builtin_popcountl(bitmap[k]);
+		w1 += __builtin_popcountl(bitmap[k + 1]);
+	}
+	for (; k < lim; k++)
+		w0 += __builtin_popcountl(bitmap[k]);
+
+	if (bits % BITS_PER_LONG)
+		w0 += __builtin_popcountl(bitmap[k] & BITMAP_LAST_WORD_MASK(bits));
+
+	return w0 + w1;
+}
+
+
+__attribute__((target("avx2")))
+static unsigned long find_next_bit_avx2(const unsigned long *addr,
+		unsigned long nbits, unsigned long start, unsigned long invert)
+{
+	unsigned long tmp, idx, nwords;
+	__m256i inv, v;
+
+	if (!nbits || start >= nbits)
+		return nbits;
+
+	idx = start / BITS_PER_LONG;
+	tmp = (addr[idx] ^ invert) & BITMAP_FIRST_WORD_MASK(start);
+	if (tmp)
+		goto found;
+
+	nwords = BITS_TO_LONGS(nbits);
+	inv = _mm256_set1_epi64x(invert);
+
+	for (idx++; idx + 8 <= nwords; idx += 8) {
+		v = _mm256_or_si256(
+			_mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(addr + idx)), inv),
+			_mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(addr + idx + 4)), inv));
+		if (!_mm256_testz_si256(v, v))
+			break;
+	}
+
+	for (; idx < nwords; idx++) {
+		tmp = addr[idx] ^ invert;
+		if (tmp)
+			goto found;
+	}
+	return nbits;
+
+found:
+	return min(idx * BITS_PER_LONG + __ffs(tmp), nbits);
+}
+
+__attribute__((target("avx2")))
+static int bitmap_and_avx2(unsigned long *dst, const unsigned long *bitmap1,
+		const unsigned long *bitmap2, unsigned int bits)
+{
+	unsigned int k = 0, lim = bits / BITS_PER_LONG;
+	unsigned long result = 0;
+	__m256i v, acc = _mm256_setzero_si256();
+
+	for (; k + 4 <= lim; k += 4) {
+		v = _mm256_and_si256(_mm256_loadu_si256((const __m256i *)(bitmap1 + k)),
+				_mm256_loadu_si256((const __m256i *)(bitmap2 + k)));
+		_mm256_storeu_si256((__m256i *)(dst + k), v);
+		acc = _mm256_or_si256(acc, v);
+	}
+	result = !_mm256_testz_si256(acc, acc);
+
+	for (; k < lim; k++)
+		result |= (dst[k] = bitmap1[k] & bitmap2[k]);
+	if (bits % BITS_PER_LONG)
+		result |= (dst[k] = bitmap1[k] & bitmap2[k] &
+			   BITMAP_LAST_WORD_MASK(bits));
+	return result != 0;
+}
+
+__attribute__((target("avx2")))
+static void bitmap_or_avx2(unsigned long *dst, const unsigned long *bitmap1,
+		const unsigned long *bitmap2, unsigned int bits)
+{
+	unsigned int k = 0, nr = BITS_TO_LONGS(bits);
+
+	for (; k + 4 <= nr; k += 4)
+		_mm256_storeu_si256((__m256i *)(dst + k),
+				_mm256_or_si256(_mm256_loadu_si256((const __m256i *)(bitmap1 + k)),
+					_mm256_loadu_si256((const __m256i *)(bitmap2 + k))));
+
+	for (; k < nr; k++)
+		dst[k] = bitmap1[k] | bitmap2[k];
+}
+
+__attribute__((target("avx2")))
+static void bitmap_xor_avx2(unsigned long *dst, const unsigned long *bitmap1,
+		const unsigned long *bitmap2, unsigned int bits)
+{
+	unsigned int k = 0, nr = BITS_TO_LONGS(bits);
+
+	for (; k + 4 <= nr; k += 4)
+		_mm256_storeu_si256((__m256i *)(dst + k),
+				_mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(bitmap1 + k)),
+					_mm256_loadu_si256((const __m256i *)(bitmap2 + k))));
+
+	for (; k < nr; k++)
+		dst[k] = bitmap1[k] ^ bitmap2[k];
+}
+
+__attribute__((target("avx2")))
+static int bitmap_andnot_avx2(unsigned long *dst, const unsigned long *bitmap1,
+		const unsigned long *bitmap2, unsigned int bits)
+{
+	unsigned int k = 0, lim = bits / BITS_PER_LONG;
+	unsigned long result = 0;
+	__m256i v, acc = _mm256_setzero_si256();
+
+	for (; k + 4 <= lim; k += 4) {
+		v = _mm256_andnot_si256(_mm256_loadu_si256((const __m256i *)(bitmap2 + k)),
+				_mm256_loadu_si256((const __m256i *)(bitmap1 + k)));
+		_mm256_storeu_si256((__m256i *)(dst + k), v);
+		acc = _mm256_or_si256(acc, v);
+	}
+	result = !_mm256_testz_si256(acc, acc);
+
+	for (; k < lim; k++)
+		result |= (dst[k] = bitmap1[k] & ~bitmap2[k]);
+	if (bits % BITS_PER_LONG)
+		result |= (dst[k] = bitmap1[k] & ~bitmap2[k] &
+			   BITMAP_LAST_WORD_MASK(bits));
+	return result != 0;
+}
+
+/*
+ * Nibble lookup popcount (vpshufb), the byte counts of each 64 bit lane
+ * are summed with vpsadbw.
+ */
+__attribute__((target("avx2,popcnt")))
+static int bitmap_weight_avx2(const unsigned long *bitmap, unsigned int bits)
+{
+	unsigned int k = 0, lim = bits / BITS_PER_LONG;
+	unsigned long w = 0;
+	const __m256i lookup = _mm256_setr_epi8(
+			0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+			0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+	const __m256i low = _mm256_set1_epi8(0x0f);
+	__m256i v, cnt, acc = _mm256_setzero_si256();
+
+	for (; k + 4 <= lim; k += 4) {
+		v = _mm256_loadu_si256((const __m256i *)(bitmap + k));
+		cnt = _mm256_add_epi8(
+				_mm256_shuffle_epi8(lookup, _mm256_and_si256(v, low)),
+				_mm256_shuffle_epi8(lookup,
+					_mm256_and_si256(_mm256_srli_epi16(v, 4), low)));
+		acc = _mm256_add_epi64(acc, _mm256_sad_epu8(cnt, _mm256_setzero_si256()));
+	}
+	w = _mm256_extract_epi64(acc, 0) + _mm256_extract_epi64(acc, 1) +
+		_mm256_extract_epi64(acc, 2) + _mm256_extract_epi64(acc, 3);
+
+	for (; k < lim; k++)
+		w += __builtin_popcountl(bitmap[k]);
+
+	if (bits % BITS_PER_LONG)
+		w += __builtin_popcountl(bitmap[k] & BITMAP_LAST_WORD_MASK(bits));
+
+	return w;
+}
+
+
+static const struct bitmap_ops bitmap_ops_sse2 = {
+	.name 			= "sse2",
+	.features 		= CPU_FEATURE(X86_FEATURE_SSE2),
+	.find_next_bit 	= find_next_bit_sse2,
+	.and_bits 		= bitmap_and_sse2,
+	.or_bits 		= bitmap_or_sse2,
+	.xor_bits 		= bitmap_xor_sse2,
+	.andnot_bits 	= bitmap_andnot_sse2,
+	.weight 		= __bitmap_weight_generic,
+	.weight32 		= __hweight32_generic,
+	.weight64 		= __hweight64_generic,
+};
+
+static const struct bitmap_ops bitmap_ops_popcnt = {
+	.name 			= "sse2+popcnt",
+	.features 		= CPU_FEATURE(X86_FEATURE_SSE2) |
+		CPU_FEATURE(X86_FEATURE_POPCNT),
+	.find_next_bit 	= find_next_bit_sse2,
+	.and_bits 		= bitmap_and_sse2,
+	.or_bits 		= bitmap_or_sse2,
+	.xor_bits 		= bitmap_xor_sse2,
+	.andnot_bits 	= bitmap_andnot_sse2,
+	.weight 		= bitmap_weight_popcnt,
+	.weight32 		= hweight32_popcnt,
+	.weight64 		= hweight64_popcnt,
+};
+
+static const struct bitmap_ops bitmap_ops_avx2 = {
+	.name 			= "avx2+popcnt",
+	.features 		= CPU_FEATURE(X86_FEATURE_AVX2) |
+		CPU_FEATURE(X86_FEATURE_POPCNT),
+	.find_next_bit 	= find_next_bit_avx2,
+	.and_bits 		= bitmap_and_avx2,
+	.or_bits 		= bitmap_or_avx2,
+	.xor_bits 		= bitmap_xor_avx2,
+	.andnot_bits 	= bitmap_andnot_avx2,
+	.weight 		= bitmap_weight_avx2,
+	.weight32 		= hweight32_popcnt,
+	.weight64 		= hweight64_popcnt,
+};
+
+#endif /* __x86_64__ */
+
+
+/* ordered from slowest to fastest. */
+const struct bitmap_ops *bitmap_ops_table[] = {
+	&bitmap_ops_generic,
+#ifdef __x86_64__
+	&bitmap_ops_sse2,
+	&bitmap_ops_popcnt,
+	&bitmap_ops_avx2,
+#endif
+	NULL,
+};
+
+const struct bitmap_ops *bitmap_ops = &bitmap_ops_generic;
+
+int bitmap_ops_usable(const struct bitmap_ops *ops)
+{
+	return (cpu_features & ops->features) == ops->features;
+}
+
+/* needs cpu_features_init() first. */
+void bitmap_ops_init(void)
+{
+	const struct bitmap_ops **ops;
+
+	for (ops = bitmap_ops_table; *ops; ops++) {
+		if (bitmap_ops_usable(*ops))
+			bitmap_ops = *ops;
+	}
+
+	logd("bitmap ops: %s\n", bitmap_ops->name);
+}
+
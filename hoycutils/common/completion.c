@@ -63,10 +63,20 @@ unsigned long wait_for_completion_timeout(struct completion *x, unsigned long ms
     gettimeofday(&now, NULL);
     timeout.tv_sec = now.tv_sec + ms / 1000;
     timeout.tv_nsec = now.tv_usec * 1000 + ms2ns(ms % 1000);
+    if(timeout.tv_nsec >= ms2ns(1000)) {
+        timeout.tv_sec++;
+        timeout.tv_nsec -= ms2ns(1000);
+    }
 
     pthread_mutex_lock(&x->lock);
 
-    ret = pthread_cond_timedwait(&x->cond, &x->lock, &timeout);
+    /* complete() may have been called before we get here. */
+    ret = 0;
+    while(!x->done && ret == 0)
+        ret = pthread_cond_timedwait(&x->cond, &x->lock, &timeout);
+
+    if(ret == ETIMEDOUT && x->done)
+        ret = 0;
 
     if(ret == ETIMEDOUT) {
         logi("wait for completion timeout!\n");
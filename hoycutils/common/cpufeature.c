@@ -0,0 +1,71 @@
+/*
+ * common/cpufeature.c
+ * 
+ * 2016-01-01  written by Hoyleeson <hoyleeson@gmail.com>
+ *	Copyright (C) 2015-2016 by Hoyleeson.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; version 2.
+ *
+ */
+
+#include <stdio.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+#include <common/log.h>
+#include <common/cpufeature.h>
+
+unsigned long cpu_features;
+
+#if defined(__x86_64__) || defined(__i386__)
+
+/* ymm state must be enabled by the OS, not only supported by the cpu. */
+static int os_saves_ymm(void)
+{
+    unsigned int eax, edx;
+
+    __asm__ __volatile__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return (eax & 0x6) == 0x6;
+}
+
+void cpu_features_init(void)
+{
+    unsigned int eax, ebx, ecx, edx;
+    unsigned long features = 0;
+
+    if(!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+        goto out;
+
+    if(edx & bit_SSE2)
+        features |= CPU_FEATURE(X86_FEATURE_SSE2);
+    if(ecx & bit_POPCNT)
+        features |= CPU_FEATURE(X86_FEATURE_POPCNT);
+
+    if((ecx & bit_OSXSAVE) && (ecx & bit_AVX) && os_saves_ymm()) {
+        if(__get_cpuid_max(0, NULL) >= 7) {
+            __cpuid_count(7, 0, eax, ebx, ecx, edx);
+            if(ebx & bit_AVX2)
+                features |= CPU_FEATURE(X86_FEATURE_AVX2);
+        }
+    }
+
+out:
+    cpu_features = features;
+    logd("cpu features: sse2:%d popcnt:%d avx2:%d\n",
+            cpu_has(X86_FEATURE_SSE2), cpu_has(X86_FEATURE_POPCNT),
+            cpu_has(X86_FEATURE_AVX2));
+}
+
+#else
+
+void cpu_features_init(void)
+{
+    cpu_features = 0;
+}
+
+#endif
+
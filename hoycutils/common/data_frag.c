@@ -18,41 +18,103 @@
 
 #include <common/timer.h>
 #include <common/log.h>
-#include <common/hash.h>
 #include <common/list.h>
+#include <common/htable.h>
+#include <common/bitmap.h>
+#include <common/non-atomic.h>
 #include <common/data_frag.h>
 
 
-#define FRAG_HASH_SHIFT     (8)
-#define FRAG_HASH_SZ    (1<<FRAG_HASH_SHIFT)
-
-#define FRAG_HASH_FN(idx, bits) \
-    (hash_long((idx), bits))
-
-#define frag_hash_key(id) \
-    (FRAG_HASH_FN((id), FRAG_HASH_SHIFT))
-
-
-
 #define FRAGS_HASH_CAPACITY     (256)
 
 #define DATA_MAX_LEN        (1024*1024*1024)
+/* initial reassembly buffer, in fragments. it grows until the last arrives. */
+#define FRAG_QUEUE_INIT_FRAGS   (16)
+/* the parity needs to be found in the buffers, keep groups small. */
+#define FEC_GROUP_MAX           (64)
+
+/* seq is 16 bits on the wire, see frag_t. */
+#define FRAG_SEQ_MASK           (0xffff)
+#define FRAG_KEY(src, seq)      (((u64)(uint32_t)(src) << 32) | (uint32_t)(seq))
+
+/* a queue without progress for an interval asks for what it misses. */
+#define FRAG_NACK_INTERVAL      (100)
+#define FRAG_NACK_RETRIES       (8)
+/* nacks collected by one scan, the rest wait for the next one. */
+#define FRAG_NACK_BATCH         (8)
+/* recently finished data, late and retransmitted fragments are dropped. */
+#define FRAG_DONE_HISTORY       (64)
+/* the retransmit window keeps at most this much data besides its images. */
+#define FRAG_SENT_MAX_BYTES     (16 * 1024 * 1024)
+
+/* paced sender: rates in bytes per second, adapted once per period. */
+#define FRAG_PACE_TICK          (1)
+#define FRAG_PACE_PERIOD        (50)
+#define FRAG_PACE_BURST         (4)     /* ms of data the bucket holds */
+#define FRAG_PACE_INIT_RATE     (4 * 1024 * 1024)
+#define FRAG_PACE_AI_STEP       (256 * 1024)
+#define FRAG_PACE_QUEUE_MAX     (8)
+
+struct frag_sent {
+    int seq;
+    int len;
+    int fraglen;
+    uint8_t *data;
+};
 
-typedef struct _frag_node {
-    uint16_t id;
-    uint8_t mf;
-    uint32_t frag_ofs;    /* max data len: 1MB */
-    uint32_t datalen;     /* packet len */
-    void *data;
-    struct list_head node;
-    void *pkt;
-} frag_node_t;
+/* data on its way out, one fragment (or parity) at a time. */
+struct frag_job {
+    struct list_head entry;
+    int seq;
+    int len;
+    int fraglen;            /* fixed when the job is queued */
+    int ofs;                /* next data fragment */
+    int out;                /* ofs as seen under sent_lock */
+    int parity_out;         /* the parity of the group at ofs is out */
+    uint8_t *data;
+    uint8_t *parity;        /* FEC scratch, NULL if off */
+};
 
 struct data_frags {
-    int fraglen;
+    int fraglen;            /* sender, data_frag_set_fraglen() */
     int nextseq;
+    int fec_group;          /* data fragments per parity fragment, 0: off */
     int stat_timeout;
-    struct hlist_head hlist[FRAG_HASH_SZ];
+    int stat_recovered;
+    int stat_nacks;
+    struct htable queues;   /* key: FRAG_KEY(src, seq) */
+    u64 done[FRAG_DONE_HISTORY];
+    int done_next;
+
+    /* receiver: nack the gaps of stalled queues. */
+    void (*nack)(void *opaque, data_nack_t *nack);
+    struct timer_list nack_timer;
+
+    /* sender: the last images sent, for retransmission. */
+    struct frag_sent *sent;
+    int window;
+    int sent_next;
+    long sent_bytes;
+    pthread_mutex_t sent_lock;  /* also the paced sender */
+
+    /*
+     * paced sender: a token bucket drained by a timer. The rate grows
+     * while there is no loss, doubling until the first nack, by
+     * FRAG_PACE_AI_STEP after that, and halves on nacks, at most once
+     * per period.
+     */
+    struct list_head jobs;
+    int nr_jobs;
+    struct timer_list pace_timer;
+    long rate;
+    long min_rate;
+    long max_rate;
+    long tokens;            /* bytes that may go out, < 0 after a burst */
+    int slow_start;
+    uint64_t pace_last;     /* last refill */
+    uint64_t rate_changed;  /* last increase */
+    uint64_t rate_cut;      /* last decrease */
+    void (*sent_cb)(void *opaque, int seq);
 
     void (*input)(void *opaque, void *data, int len);
     void (*output)(void *opaque, data_vec_t *v);
@@ -61,103 +123,365 @@ struct data_frags {
     pthread_mutex_t lock;
 };
 
+/*
+ * Every fragment but the last one is exactly fraglen bytes, so fragment
+ * i lands at i * fraglen in buf, and one bit per fragment is enough to
+ * drop duplicates and to know when the data is complete.
+ *
+ * With FEC, fragments [g * k, g * k + k) form group g and its parity,
+ * the XOR of the fragments zero padded to fraglen, is kept at
+ * g * fraglen in parity. Any single lost fragment of a group is rebuilt
+ * from the parity and the others.
+ */
 typedef struct _frag_queue {
+    u64 key;
     int id;
+    int src;
+    int fraglen;            /* the sender's, from the first fragment */
+    int nr_frags;           /* fragments received */
+    int nr_recovered;       /* fragments rebuilt from parity */
+    int last;               /* index of the last fragment, -1 if unknown */
     int total_len;
-    int recv_len;
-    struct list_head list;
-    struct hlist_node entry;
+    int capacity;           /* fragments buf and received can hold */
+    int nack_frags;         /* nr_frags at the previous nack scan */
+    int nr_nacks;           /* nacks since the last progress */
+    uint8_t *buf;
+    unsigned long *received;
+    uint8_t *parity;
+    unsigned long *parity_received;
     pthread_mutex_t lock;
     struct timer_list timer;
     struct data_frags *owner;
 } frag_queue_t;
 
 
-static inline int alloc_frag_seq(data_frags_t *frags)
+static inline int alloc_frag_seq(data_frags_t *frags, int *fraglen)
 {
     int seq;
 
     pthread_mutex_lock(&frags->lock);
-    seq = frags->nextseq++;
+    *fraglen = frags->fraglen;
+    seq = frags->nextseq;
+    frags->nextseq = (seq + 1) & FRAG_SEQ_MASK;
     pthread_mutex_unlock(&frags->lock);
     return seq;
 }
 
-int data_frag(data_frags_t *frags, void *data, int len)
+static void frag_xor(uint8_t *dst, const uint8_t *src, int len)
 {
-    int i = 0;
-    int ofs = 0;
+    int i;
+    int words = len / sizeof(unsigned long);
+
+    if(words)
+        bitmap_xor((unsigned long *)dst, (unsigned long *)dst,
+                (const unsigned long *)src, words * BITS_PER_LONG);
+
+    for(i=words * sizeof(unsigned long); i<len; i++)
+        dst[i] ^= src[i];
+}
+
+/*
+ * Output the parity of the group starting at @ofs. It goes out ahead
+ * of the group, so the last packet of an image is always data and no
+ * parity arrives after the image has been completed.
+ *
+ * The parity of the final group has mf set and carries the offset of
+ * the last byte of the data, the receiver needs the total length to
+ * rebuild the last fragment.
+ */
+static int data_frag_parity(data_frags_t *frags, int seq, int fraglen,
+        void *data, int len, int ofs, uint8_t *parity)
+{
+    int o, flen;
+    int end = min(len, ofs + frags->fec_group * fraglen);
     data_vec_t v;
-    int seq = alloc_frag_seq(frags);
 
-    while(ofs < len) {
-        v.ofs = ofs;
-        v.data = data + ofs;
-        v.len = (len - ofs) > frags->fraglen ? frags->fraglen : len - ofs; 
-        v.seq = seq;
+    memset(parity, 0, fraglen);
+    for(o=ofs; o<end; o+=fraglen) {
+        flen = min(fraglen, end - o);
+        frag_xor(parity, data + o, flen);
+    }
 
-        ofs += v.len;
-        if(ofs == len)
-            v.mf = 1;
-        else
-            v.mf = 0;
+    v.seq = seq;
+    v.src = 0;
+    v.fraglen = fraglen;
+    v.parity = 1;
+    v.mf = (end == len);
+    v.ofs = v.mf ? len - 1 : ofs;
+    v.data = parity;
+    v.len = min(fraglen, end - ofs);
+
+    frags->output(frags->data, &v);
+    return v.len;
+}
 
-        frags->output(frags->data, &v);
-        i++;
+/*
+ * Keep @data (malloced, taken over) for retransmission, the oldest
+ * data goes once the window is full. Called with sent_lock held.
+ */
+static void frag_sent_save(data_frags_t *frags, int seq, int fraglen,
+        uint8_t *data, int len)
+{
+    int i, saved;
+    struct frag_sent *sent;
+
+    saved = frags->sent_next;
+    sent = &frags->sent[saved];
+    frags->sent_bytes -= sent->len;
+    free(sent->data);
+
+    sent->seq = seq;
+    sent->fraglen = fraglen;
+    sent->len = data ? len : 0;
+    sent->data = data;
+    frags->sent_bytes += sent->len;
+    frags->sent_next = (saved + 1) % frags->window;
+
+    /* oldest first, the one just saved is always kept. */
+    for(i=frags->sent_next; i != saved && frags->sent_bytes > FRAG_SENT_MAX_BYTES;
+            i=(i + 1) % frags->window) {
+        sent = &frags->sent[i];
+        frags->sent_bytes -= sent->len;
+        free(sent->data);
+        sent->data = NULL;
+        sent->len = 0;
     }
+}
 
-    return i;
+static int frag_job_init(data_frags_t *frags, struct frag_job *job,
+        void *data, int len)
+{
+    job->seq = alloc_frag_seq(frags, &job->fraglen);
+    job->len = len;
+    job->ofs = 0;
+    job->out = 0;
+    job->parity_out = 0;
+    job->data = data;
+    job->parity = NULL;
+
+    if(frags->fec_group) {
+        job->parity = malloc(ALIGN(job->fraglen, sizeof(unsigned long)));
+        if(!job->parity)
+            return -ENOMEM;
+    }
+    return 0;
 }
 
+/*
+ * Output the next fragment of @job, the parity of a group goes ahead
+ * of it. Returns the bytes output.
+ */
+static int frag_job_output(data_frags_t *frags, struct frag_job *job)
+{
+    data_vec_t v;
+    int fraglen = job->fraglen;
+
+    if(job->parity && !job->parity_out &&
+            (job->ofs / fraglen) % frags->fec_group == 0) {
+        job->parity_out = 1;
+        return data_frag_parity(frags, job->seq, fraglen, job->data,
+                job->len, job->ofs, job->parity);
+    }
+
+    v.ofs = job->ofs;
+    v.data = job->data + job->ofs;
+    v.len = min(fraglen, job->len - job->ofs);
+    v.seq = job->seq;
+    v.src = 0;
+    v.fraglen = fraglen;
+    v.parity = 0;
+    v.mf = (job->ofs + v.len == job->len);
 
-static frag_node_t *frag_node_create(data_vec_t *v, void *frag_pkt)
+    frags->output(frags->data, &v);
+
+    job->ofs += v.len;
+    job->parity_out = 0;
+    return v.len;
+}
+
+/*
+ * output every fragment of @data right away, returns the count, -ENOMEM
+ * if the fec parity can't be allocated.
+ */
+int data_frag(data_frags_t *frags, void *data, int len)
 {
-    frag_node_t *frag;
+    int i = 0;
+    uint8_t *copy;
+    struct frag_job job;
+
+    if(frag_job_init(frags, &job, data, len))
+        return -ENOMEM;
+
+    if(frags->window) {
+        copy = malloc(len);
+        if(copy)
+            memcpy(copy, data, len);
+        pthread_mutex_lock(&frags->sent_lock);
+        frag_sent_save(frags, job.seq, job.fraglen, copy, len);
+        pthread_mutex_unlock(&frags->sent_lock);
+    }
 
-    frag = (frag_node_t *)malloc(sizeof(*frag));
-    if(!frag)
-        return NULL;
+    while(job.ofs < len) {
+        frag_job_output(frags, &job);
+        i++;
+    }
+
+    free(job.parity);
+    return i;
+}
 
-    frag->id = v->seq;
-    frag->mf = v->mf;
-    frag->frag_ofs = v->ofs;
-    frag->data = v->data;
-    frag->datalen = v->len;
-    frag->pkt = frag_pkt;
+/* refill the bucket and adapt the rate, called with sent_lock held. */
+static void frag_pace_refill(data_frags_t *frags, uint64_t now)
+{
+    long burst;
+
+    if(now - frags->rate_changed >= FRAG_PACE_PERIOD) {
+        if(frags->slow_start)
+            frags->rate = min(frags->rate * 2, frags->max_rate);
+        else
+            frags->rate = min(frags->rate + FRAG_PACE_AI_STEP, frags->max_rate);
+        frags->rate_changed = now;
+    }
 
-    return frag;
+    burst = max((long)(frags->rate * FRAG_PACE_BURST / MSEC_PER_SEC),
+            2L * frags->fraglen);
+    frags->tokens += (long)(frags->rate * (now - frags->pace_last) / MSEC_PER_SEC);
+    frags->tokens = min(frags->tokens, burst);
+    frags->pace_last = now;
 }
 
-static void frag_node_free(frag_node_t *frag)
+/*
+ * Only this timer outputs and removes jobs, the output goes without
+ * sent_lock and the others see how far a job is from job->out.
+ */
+static void frag_pace_handle(unsigned long data)
 {
-    free(frag);
+    long budget, spent;
+    uint64_t now = curr_time_ms();
+    struct frag_job *job, *tmp;
+    struct list_head done;
+    data_frags_t *frags = (data_frags_t *)data;
+
+    INIT_LIST_HEAD(&done);
+
+    pthread_mutex_lock(&frags->sent_lock);
+    frag_pace_refill(frags, now);
+
+    while(frags->tokens > 0 && !list_empty(&frags->jobs)) {
+        job = list_first_entry(&frags->jobs, struct frag_job, entry);
+        budget = frags->tokens;
+        pthread_mutex_unlock(&frags->sent_lock);
+
+        spent = 0;
+        while(spent < budget && job->ofs < job->len)
+            spent += frag_job_output(frags, job);
+
+        pthread_mutex_lock(&frags->sent_lock);
+        frags->tokens -= spent;
+        job->out = job->ofs;
+        if(job->ofs < job->len)
+            continue;
+
+        list_move_tail(&job->entry, &done);
+        frags->nr_jobs--;
+        if(frags->window) {
+            frag_sent_save(frags, job->seq, job->fraglen, job->data, job->len);
+            job->data = NULL;
+        }
+    }
+
+    if(!list_empty(&frags->jobs))
+        mod_timer(&frags->pace_timer, now + FRAG_PACE_TICK);
+    pthread_mutex_unlock(&frags->sent_lock);
+
+    list_for_each_entry_safe(job, tmp, &done, entry) {
+        if(frags->sent_cb)
+            frags->sent_cb(frags->data, job->seq);
+        free(job->data);
+        free(job->parity);
+        free(job);
+    }
 }
 
-static void frag_queue_free(frag_queue_t *fq) 
+/*
+ * Queue a copy of @data on the paced sender and return at once, the
+ * sent callback tells when its last fragment is out. Returns the seq.
+ */
+int data_frag_async(data_frags_t *frags, void *data, int len)
 {
-    frag_node_t *frag, *p;
-    data_frags_t *frags = fq->owner;
+    uint64_t now;
+    struct frag_job *job;
 
-    pthread_mutex_lock(&fq->lock);
-    list_for_each_entry_safe(frag, p, &fq->list, node) {
-        list_del(&frag->node);
-        if(frags->free && frag->pkt)
-            frags->free(frags->data, frag->pkt);
+    if(!frags->max_rate || len <= 0)
+        return -EINVAL;
 
-        frag_node_free(frag);
+    job = malloc(sizeof(*job));
+    if(!job)
+        return -ENOMEM;
+
+    if(frag_job_init(frags, job, malloc(len), len) || !job->data) {
+        free(job->data);
+        free(job->parity);
+        free(job);
+        return -ENOMEM;
     }
-    pthread_mutex_unlock(&fq->lock);
+    memcpy(job->data, data, len);
+
+    pthread_mutex_lock(&frags->sent_lock);
+    if(frags->nr_jobs >= FRAG_PACE_QUEUE_MAX) {
+        pthread_mutex_unlock(&frags->sent_lock);
+        free(job->data);
+        free(job->parity);
+        free(job);
+        return -EBUSY;
+    }
+
+    /* an idle bucket starts over, tokens don't pile up while idle. */
+    if(list_empty(&frags->jobs)) {
+        now = curr_time_ms();
+        frags->pace_last = now;
+        frags->rate_changed = now;
+        frags->tokens = 2 * frags->fraglen;
+        mod_timer(&frags->pace_timer, now);
+    }
+    list_add_tail(&job->entry, &frags->jobs);
+    frags->nr_jobs++;
+    pthread_mutex_unlock(&frags->sent_lock);
+
+    return job->seq;
+}
 
+static void frag_queue_free(frag_queue_t *fq) 
+{
+    free(fq->buf);
+    free(fq->received);
+    free(fq->parity);
+    free(fq->parity_received);
     free(fq);
 }
 
 
+static int frag_done(data_frags_t *frags, u64 key)
+{
+    int i;
+
+    for(i=0; i<FRAG_DONE_HISTORY; i++) {
+        if(frags->done[i] == key)
+            return 1;
+    }
+    return 0;
+}
+
 static void rm_frag_queue(data_frags_t *frags, frag_queue_t *fq)
 {
     pthread_mutex_lock(&frags->lock);
 
-    hlist_del(&fq->entry);
+    frags->done[frags->done_next] = fq->key;
+    frags->done_next = (frags->done_next + 1) % FRAG_DONE_HISTORY;
+
+    htable_remove(&frags->queues, fq->key);
     del_timer(&fq->timer);
+    frags->stat_recovered += fq->nr_recovered;
     frag_queue_free(fq);
 
     pthread_mutex_unlock(&frags->lock);
@@ -165,19 +489,13 @@ static void rm_frag_queue(data_frags_t *frags, frag_queue_t *fq)
 
 static void __attribute__ ((unused)) dump_frag_queue(frag_queue_t *fq)
 {
-    int nextofs = 0;
-    frag_node_t *frag;
-
-    list_for_each_entry_reverse(frag, &fq->list, node) {
-        logi("[%d].\n", frag->frag_ofs);
-    }
+    int nbits = fq->last >= 0 ? fq->last + 1 : fq->capacity;
+    unsigned long lost, next;
 
-    list_for_each_entry_reverse(frag, &fq->list, node) {
-        if(nextofs != frag->frag_ofs) {
-            logi("frag [%d %d] lost.\n", nextofs, frag->frag_ofs);
-            nextofs = frag->frag_ofs + frag->datalen;
-        } else
-            nextofs += frag->datalen;
+    for_each_clear_bit(lost, fq->received, nbits) {
+        next = find_next_bit(fq->received, nbits, lost);
+        logi("frag [%lu %lu) lost.\n", lost, next);
+        lost = next;
     }
 }
 
@@ -188,7 +506,8 @@ static void defrag_timeout_handle(unsigned long data)
 
     frags = fq->owner;
 
-    logw("defrag timout, seq:%d, (%d times)\n", fq->id, frags->stat_timeout);
+    logw("defrag timout, seq:%d, (%d times, %d fragments recovered)\n",
+            fq->id, frags->stat_timeout, frags->stat_recovered);
 
 #ifdef VDEBUG
     dump_frag_queue(fq);
@@ -200,18 +519,32 @@ static void defrag_timeout_handle(unsigned long data)
     pthread_mutex_unlock(&frags->lock);
 }
 
-static frag_queue_t *frag_queue_create(data_frags_t *frags, int id)
+static frag_queue_t *frag_queue_create(data_frags_t *frags, int src, int id,
+        int fraglen)
 {
     frag_queue_t *fq;
 
     fq = (frag_queue_t *)malloc(sizeof(*fq));
+    if(!fq)
+        return NULL;
 
+    fq->key = FRAG_KEY(src, id);
     fq->id = id;
+    fq->src = src;
+    fq->fraglen = fraglen;
+    fq->nr_frags = 0;
+    fq->nr_recovered = 0;
+    fq->last = -1;
     fq->total_len = 0;
-    fq->recv_len = 0;
+    fq->capacity = 0;
+    fq->nack_frags = 0;
+    fq->nr_nacks = 0;
+    fq->buf = NULL;
+    fq->received = NULL;
+    fq->parity = NULL;
+    fq->parity_received = NULL;
     fq->owner = frags;
 
-    INIT_LIST_HEAD(&fq->list);
     pthread_mutex_init(&fq->lock, NULL);
 
     init_timer(&fq->timer);
@@ -221,155 +554,484 @@ static frag_queue_t *frag_queue_create(data_frags_t *frags, int id)
     return fq;
 }
 
-static frag_queue_t *find_frag_queue(data_frags_t *frags, frag_node_t *frag)
+/*
+ * Returns NULL with *err set if the data is already finished or the
+ * queue can't be created.
+ */
+static frag_queue_t *find_frag_queue(data_frags_t *frags, int src, int id,
+        int fraglen, int *err)
 {
-    int key;
-    struct hlist_node *pos;
-    frag_queue_t *fq = NULL;
-
-    key = frag_hash_key(frag->id);
+    frag_queue_t *fq;
+    u64 key = FRAG_KEY(src, id);
 
     pthread_mutex_lock(&frags->lock);
 
-    hlist_for_each_entry(fq, pos, &frags->hlist[key], entry) {
-        if(fq->id == frag->id)
-            break;
+    fq = htable_lookup(&frags->queues, key);
+    if(fq)
+        goto out;
+
+    if(frag_done(frags, key)) {
+        *err = -EEXIST;
+        goto out;
     }
 
+    fq = frag_queue_create(frags, src, id, fraglen);
     if(!fq) {
-        fq = frag_queue_create(frags, frag->id);
-        hlist_add_head(&fq->entry, &frags->hlist[key]);        
+        *err = -ENOMEM;
+        goto out;
     }
-    pthread_mutex_unlock(&frags->lock);
+    htable_insert(&frags->queues, fq);
 
+    if(frags->nack && htable_size(&frags->queues) == 1)
+        mod_timer(&frags->nack_timer, curr_time_ms() + FRAG_NACK_INTERVAL);
+out:
+    pthread_mutex_unlock(&frags->lock);
     return fq;
 }
 
+static int bitmap_grow(unsigned long **map, int old_bits, int new_bits)
+{
+    int old_longs = BITS_TO_LONGS(old_bits);
+    int new_longs = BITS_TO_LONGS(new_bits);
+    unsigned long *p;
+
+    p = realloc(*map, new_longs * sizeof(unsigned long));
+    if(!p)
+        return -ENOMEM;
+    memset(p + old_longs, 0, (new_longs - old_longs) * sizeof(unsigned long));
+    *map = p;
+    return 0;
+}
 
-static int data_frag_insert(frag_queue_t *fq, frag_node_t *frag)
+/* make room for fragment @idx, doubling to keep appends amortized O(1). */
+static int frag_queue_reserve(frag_queue_t *fq, int idx, int fraglen, int group)
 {
-    frag_node_t *p;
+    int capacity;
+    int old_groups, new_groups;
+    uint8_t *buf;
 
-    list_for_each_entry(p, &fq->list, node) {
-        if(p->frag_ofs < frag->frag_ofs) {
-            list_add(&frag->node, p->node.prev);
-            return 0;
-        }
-        else if(p->frag_ofs == frag->frag_ofs) {
-            return -EEXIST;
-        }
-    }
+    if(idx < fq->capacity)
+        return 0;
+
+    capacity = max(fq->capacity * 2, FRAG_QUEUE_INIT_FRAGS);
+    if(fq->last >= 0)
+        capacity = fq->last + 1;
+    capacity = max(capacity, idx + 1);
+
+    if((long)capacity * fraglen > DATA_MAX_LEN)
+        return -EINVAL;
+
+    buf = realloc(fq->buf, (size_t)capacity * fraglen);
+    if(!buf)
+        return -ENOMEM;
+    fq->buf = buf;
+
+    if(bitmap_grow(&fq->received, fq->capacity, capacity))
+        return -ENOMEM;
+
+    if(group) {
+        old_groups = DIV_ROUND_UP(fq->capacity, group);
+        new_groups = DIV_ROUND_UP(capacity, group);
+        buf = realloc(fq->parity, (size_t)new_groups * fraglen);
+        if(!buf)
+            return -ENOMEM;
+        fq->parity = buf;
 
-    list_add_tail(&frag->node, &p->node);
+        if(bitmap_grow(&fq->parity_received, old_groups, new_groups))
+            return -ENOMEM;
+    }
 
+    fq->capacity = capacity;
     return 0;
 }
 
-static int __attribute__((warn_unused_result)) check_defrag(frag_queue_t *fq) 
+static inline int frag_queue_complete(frag_queue_t *fq)
 {
-    int ret = 0;
-    int nextofs = 0;
-    frag_node_t *frag;
+    return fq->last >= 0 && fq->nr_frags == fq->last + 1;
+}
 
-    list_for_each_entry_reverse(frag, &fq->list, node) {
-        if(nextofs != frag->frag_ofs) {
-            ret = -EINVAL;
-            goto out;
-        }
-        nextofs += frag->datalen;
+/*
+ * Rebuild the missing fragment of group @g if its parity is here and
+ * exactly one of its fragments is lost. Returns 1 if one was rebuilt.
+ */
+static int frag_queue_recover(frag_queue_t *fq, int g, int fraglen, int group)
+{
+    int i, start, end;
+    int lost, flen;
+    uint8_t *dst;
+
+    if(!test_bit(g, fq->parity_received))
+        return 0;
+
+    /* without the final parity, the group of a parity is a full one. */
+    start = g * group;
+    end = start + group;
+    if(fq->last >= 0)
+        end = min(end, fq->last + 1);
+
+    lost = find_next_zero_bit(fq->received, end, start);
+    if(lost >= end || find_next_zero_bit(fq->received, end, lost + 1) < end)
+        return 0;
+
+    dst = fq->buf + lost * fraglen;
+    memcpy(dst, fq->parity + g * fraglen, fraglen);
+    for(i=start; i<end; i++) {
+        if(i == lost)
+            continue;
+        flen = (i == fq->last) ? fq->total_len - i * fraglen : fraglen;
+        frag_xor(dst, fq->buf + i * fraglen, flen);
     }
 
-out:
-    return ret;
+    __set_bit(lost, fq->received);
+    fq->nr_frags++;
+    fq->nr_recovered++;
+    return 1;
 }
 
-static int data_frag_queue(frag_queue_t *fq, frag_node_t *frag)
+/*
+ * Keep the parity of one group, it may rebuild a fragment right away.
+ * The parity of the final group also tells where the data ends.
+ */
+static int data_frag_queue_parity(frag_queue_t *fq, data_vec_t *v,
+        int fraglen, int group)
 {
-    int ret;
+    int g, last;
 
-    pthread_mutex_lock(&fq->lock);
-    ret = data_frag_insert(fq, frag);
-    if(ret == -EEXIST) {
-        pthread_mutex_unlock(&fq->lock);
-        return ret;
-    }
+    if(v->len <= 0 || v->len > fraglen)
+        return -EINVAL;
 
-    fq->recv_len += frag->datalen;
-    if(frag->mf) {
-        fq->total_len = frag->frag_ofs + frag->datalen;
+    if(v->mf) {
+        last = v->ofs / fraglen;
+        g = last / group;
+        if(fq->last >= 0 && (last != fq->last || v->ofs + 1 != fq->total_len))
+            return -EINVAL;
+        if(last < fq->capacity &&
+                find_next_bit(fq->received, fq->capacity, last + 1) < fq->capacity)
+            return -EINVAL;
+    } else {
+        if(v->ofs % (group * fraglen))
+            return -EINVAL;
+        g = v->ofs / (group * fraglen);
+        last = g * group + group - 1;
+        if(fq->last >= 0 && last >= fq->last)
+            return -EINVAL;
     }
-    pthread_mutex_unlock(&fq->lock);
 
-    if(!fq->total_len ||
-            fq->total_len != fq->recv_len) 
-        return 0;
+    if(frag_queue_reserve(fq, last, fraglen, group))
+        return -ENOMEM;
 
-    if(check_defrag(fq)) {
-        logw("check defrag fail.\n");
-        return -EINVAL;
+    if(__test_and_set_bit(g, fq->parity_received))
+        return -EEXIST;
+
+    if(v->mf) {
+        fq->last = last;
+        fq->total_len = v->ofs + 1;
     }
 
-    return fq->total_len;
+    memcpy(fq->parity + g * fraglen, v->data, v->len);
+    memset(fq->parity + g * fraglen + v->len, 0, fraglen - v->len);
+
+    return frag_queue_recover(fq, g, fraglen, group);
 }
 
-int data_frag_reasm(frag_queue_t *fq, void *data)
+/*
+ * Copy one fragment into place. Returns the total length once every
+ * fragment has arrived, 0 if some are still missing.
+ */
+static int data_frag_queue(frag_queue_t *fq, data_vec_t *v, int group)
 {
-    int ret = 0;
-    frag_node_t *frag;
+    int idx;
+    int ret;
+    int fraglen = fq->fraglen;
+
+    /* all fragments of some data have the same size. */
+    if(v->fraglen && v->fraglen != fraglen)
+        return -EINVAL;
+
+    if(v->parity) {
+        if(!group)
+            return 0;
+
+        pthread_mutex_lock(&fq->lock);
+        ret = data_frag_queue_parity(fq, v, fraglen, group);
+        goto done;
+    }
+
+    if(v->ofs % fraglen || v->len > fraglen || v->len <= 0 ||
+            (!v->mf && v->len != fraglen))
+        return -EINVAL;
+
+    idx = v->ofs / fraglen;
+
+    pthread_mutex_lock(&fq->lock);
+    if(fq->last >= 0 && (idx > fq->last || (v->mf && idx != fq->last) ||
+                (!v->mf && idx == fq->last) ||
+                (v->mf && v->ofs + v->len != fq->total_len))) {
+        ret = -EINVAL;
+        goto out;
+    }
+
+    ret = frag_queue_reserve(fq, idx, fraglen, group);
+    if(ret)
+        goto out;
+
+    if(__test_and_set_bit(idx, fq->received)) {
+        ret = -EEXIST;
+        goto out;
+    }
 
-    list_for_each_entry_reverse(frag, &fq->list, node) {
-        memcpy(data + frag->frag_ofs, frag->data, frag->datalen);
-        ret += frag->datalen;
+    memcpy(fq->buf + v->ofs, v->data, v->len);
+    fq->nr_frags++;
+    if(v->mf) {
+        fq->last = idx;
+        fq->total_len = v->ofs + v->len;
     }
+
+    ret = group ? frag_queue_recover(fq, idx / group, fraglen, group) : 0;
+done:
+    if(ret >= 0 && frag_queue_complete(fq))
+        ret = fq->total_len;
+    else if(ret > 0)
+        ret = 0;
+out:
+    pthread_mutex_unlock(&fq->lock);
     return ret;
 }
 
 
+/*
+ * Takes over @frag_pkt: the data is copied into the reassembly buffer
+ * and the packet is released right away, whatever the outcome.
+ */
 int data_defrag(data_frags_t *frags, data_vec_t *v, void *frag_pkt)
 {
-    int ret;
-    void *data;
-    int len;
+    int ret, fraglen;
     frag_queue_t *fq;
-    frag_node_t *frag;
-
-    frag = frag_node_create(v, frag_pkt);
-    fq = find_frag_queue(frags, frag);
 
-    if(!fq) {
+    fraglen = v->fraglen ? v->fraglen : frags->fraglen;
+    if(fraglen < FRAG_MIN_LEN || fraglen > FRAG_MAX_LEN) {
         ret = -EINVAL;
-        goto fail;
+        goto out;
     }
 
-    ret = data_frag_queue(fq, frag);
-    if(ret <= 0) {
+    fq = find_frag_queue(frags, v->src, v->seq, fraglen, &ret);
+    if(fq)
+        ret = data_frag_queue(fq, v, frags->fec_group);
+
+out:
+
+    if(frags->free && frag_pkt)
+        frags->free(frags->data, frag_pkt);
+
+    if(ret <= 0)
         return ret;
-    }
 
     /* All data have been successfully received, submit now. */
-    len = fq->total_len;
-    if(len > DATA_MAX_LEN) {
-        ret = -EINVAL;
-        goto fail;
+    frags->input(frags->data, fq->buf, ret);
+
+    rm_frag_queue(frags, fq);
+    return 0;
+}
+
+/*
+ * Fill @nack with the gaps of @fq from fragment @start on. Returns where
+ * the next nack should go on, -1 once all gaps are in.
+ */
+static int frag_queue_gaps(frag_queue_t *fq, data_nack_t *nack, int start)
+{
+    int nbits = fq->last >= 0 ? fq->last + 1 : fq->capacity;
+    unsigned long lost, next;
+
+    nack->src = fq->src;
+    nack->seq = fq->id;
+    nack->nr_ranges = 0;
+
+    if(fq->last < 0 && nbits == 0) {
+        nack->ranges[0].start = 0;
+        nack->ranges[0].count = -1;
+        nack->nr_ranges = 1;
+        return -1;
+    }
+
+    for(lost = find_next_zero_bit(fq->received, nbits, start); lost < nbits;
+            lost = find_next_zero_bit(fq->received, nbits, next)) {
+        if(nack->nr_ranges == FRAG_NACK_RANGES_MAX)
+            return lost;
+
+        next = find_next_bit(fq->received, nbits, lost);
+        nack->ranges[nack->nr_ranges].start = lost;
+        /* without the last fragment, the tail is open. */
+        if(fq->last < 0 && next == nbits)
+            nack->ranges[nack->nr_ranges].count = -1;
+        else
+            nack->ranges[nack->nr_ranges].count = next - lost;
+        nack->nr_ranges++;
+    }
+    return -1;
+}
+
+/*
+ * Runs every FRAG_NACK_INTERVAL while there are queues. A queue that
+ * got nothing since the previous run has stalled: the sender is done
+ * with it, whatever is missing by now was lost.
+ */
+static void frag_nack_handle(unsigned long data)
+{
+    int i, n = 0;
+    int start;
+    frag_queue_t *fq;
+    struct htable_iter iter;
+    data_frags_t *frags = (data_frags_t *)data;
+    data_nack_t nacks[FRAG_NACK_BATCH];
+
+    pthread_mutex_lock(&frags->lock);
+    htable_for_each(&frags->queues, &iter, fq) {
+        if(n == FRAG_NACK_BATCH)
+            break;
+
+        pthread_mutex_lock(&fq->lock);
+        if(fq->nr_frags != fq->nack_frags) {
+            fq->nack_frags = fq->nr_frags;
+            fq->nr_nacks = 0;
+        } else if(fq->nr_nacks < FRAG_NACK_RETRIES) {
+            start = 0;
+            while(start >= 0 && n < FRAG_NACK_BATCH)
+                start = frag_queue_gaps(fq, &nacks[n++], start);
+            fq->nr_nacks++;
+        }
+        pthread_mutex_unlock(&fq->lock);
+    }
+    frags->stat_nacks += n;
+
+    if(htable_size(&frags->queues))
+        mod_timer(&frags->nack_timer, curr_time_ms() + FRAG_NACK_INTERVAL);
+    pthread_mutex_unlock(&frags->lock);
+
+    for(i=0; i<n; i++) {
+        logd("defrag nack, src:%d, seq:%d, %d ranges\n",
+                nacks[i].src, nacks[i].seq, nacks[i].nr_ranges);
+        frags->nack(frags->data, &nacks[i]);
+    }
+}
+
+/*
+ * a nack means loss, back off. The nacks of one loss come together,
+ * they halve the rate once per period. Called with sent_lock held.
+ */
+static void frag_pace_loss(data_frags_t *frags)
+{
+    uint64_t now = curr_time_ms();
+
+    if(!frags->max_rate)
+        return;
+
+    frags->slow_start = 0;
+    if(now - frags->rate_cut < FRAG_PACE_PERIOD)
+        return;
+
+    frags->rate = max(frags->rate / 2, frags->min_rate);
+    frags->rate_cut = now;
+    frags->rate_changed = now;
+}
+
+/*
+ * Output the fragments asked by @nack again, if the data is still in
+ * the window or being sent. They are copied under sent_lock and output
+ * after it. Returns the number of fragments sent, 0 if none went out
+ * yet, -ENOENT if the data is gone.
+ */
+int data_frag_retransmit(data_frags_t *frags, data_nack_t *nack)
+{
+    int i, idx, end, nr;
+    int count = 0, bytes = 0;
+    int fraglen = 0;
+    int len = 0, out = 0;
+    uint8_t *data = NULL, *copy;
+    struct frag_job *job;
+    data_vec_t *vecs = NULL, *v;
+
+    if(!frags->window || nack->nr_ranges > FRAG_NACK_RANGES_MAX)
+        return -EINVAL;
+
+    pthread_mutex_lock(&frags->sent_lock);
+    for(i=0; i<frags->window; i++) {
+        if(frags->sent[i].data && frags->sent[i].seq == nack->seq) {
+            data = frags->sent[i].data;
+            fraglen = frags->sent[i].fraglen;
+            len = out = frags->sent[i].len;
+            break;
+        }
+    }
+
+    /* only what went out already. */
+    list_for_each_entry(job, &frags->jobs, entry) {
+        if(!data && job->seq == nack->seq) {
+            data = job->data;
+            fraglen = job->fraglen;
+            len = job->len;
+            out = job->out;
+            break;
+        }
     }
 
-    data = malloc(len);
     if(!data) {
-        ret = -ENOMEM;
-        goto fail;
+        pthread_mutex_unlock(&frags->sent_lock);
+        logw("retransmit seq:%d, not in window.\n", nack->seq);
+        return -ENOENT;
     }
 
-    ret = data_frag_reasm(fq, data);
+    nr = DIV_ROUND_UP(out, fraglen);
+    for(i=0; i<nack->nr_ranges; i++) {
+        idx = nack->ranges[i].start;
+        end = nack->ranges[i].count < 0 ? nr : idx + nack->ranges[i].count;
+        if(idx < 0 || end > nr || idx >= end)
+            continue;
 
-    frags->input(frags->data, data, len);
-    free(data);
+        count += end - idx;
+        bytes += min(end * fraglen, len) - idx * fraglen;
+    }
 
-    rm_frag_queue(frags, fq);
-    return 0;
+    if(count) {
+        vecs = malloc(count * sizeof(*vecs) + bytes);
+        if(!vecs) {
+            pthread_mutex_unlock(&frags->sent_lock);
+            return -ENOMEM;
+        }
+    }
 
-fail:
-    frag_node_free(frag);
-    return ret;
+    v = vecs;
+    copy = (uint8_t *)&vecs[count];
+    for(i=0; i<nack->nr_ranges && count; i++) {
+        idx = nack->ranges[i].start;
+        end = nack->ranges[i].count < 0 ? nr : idx + nack->ranges[i].count;
+        if(idx < 0 || end > nr)
+            continue;
+
+        for(; idx<end; idx++, v++) {
+            v->seq = nack->seq;
+            v->src = 0;
+            v->fraglen = fraglen;
+            v->parity = 0;
+            v->ofs = idx * fraglen;
+            v->len = min(fraglen, len - v->ofs);
+            v->mf = (v->ofs + v->len == len);
+            v->data = copy;
+            memcpy(copy, data + v->ofs, v->len);
+            copy += v->len;
+        }
+    }
+
+    if(count) {
+        frag_pace_loss(frags);
+        frags->tokens -= bytes;
+    }
+    pthread_mutex_unlock(&frags->sent_lock);
+
+    for(i=0; i<count; i++)
+        frags->output(frags->data, &vecs[i]);
+    free(vecs);
+
+    return count;
 }
 
 data_frags_t *data_frag_init(int fraglen, 
@@ -378,43 +1040,164 @@ data_frags_t *data_frag_init(int fraglen,
         void (*free_pkt)(void *opaque, void *frag_pkt),
         void *opaque)
 {
-    int i;
     data_frags_t *frags;
+    struct htable_params params =
+        HTABLE_PARAMS(frag_queue_t, key, FRAGS_HASH_CAPACITY);
 
     frags = (data_frags_t *)malloc(sizeof(*frags));
     if(!frags)
         return NULL;
 
     frags->fraglen = fraglen;
+    frags->fec_group = 0;
     frags->stat_timeout = 0;
+    frags->stat_recovered = 0;
+    frags->stat_nacks = 0;
+    frags->done_next = 0;
+    frags->nack = NULL;
+    frags->sent = NULL;
+    frags->window = 0;
+    frags->sent_next = 0;
+    frags->sent_bytes = 0;
+    INIT_LIST_HEAD(&frags->jobs);
+    frags->nr_jobs = 0;
+    frags->rate = 0;
+    frags->min_rate = 0;
+    frags->max_rate = 0;
+    frags->tokens = 0;
+    frags->slow_start = 1;
+    frags->pace_last = 0;
+    frags->rate_changed = 0;
+    frags->rate_cut = 0;
+    frags->sent_cb = NULL;
     frags->input = input;
     frags->output = output;
     frags->free = free_pkt;
     frags->data = opaque;
     frags->nextseq = 0;
 
-    for(i=0; i<FRAG_HASH_SZ; i++) {
-        INIT_HLIST_HEAD(&frags->hlist[i]);
+    if(htable_init(&frags->queues, &params)) {
+        free(frags);
+        return NULL;
     }
 
+    /* seq is 16 bits, no key has all bits set. */
+    memset(frags->done, 0xff, sizeof(frags->done));
+
     pthread_mutex_init(&frags->lock, NULL);
+    pthread_mutex_init(&frags->sent_lock, NULL);
+    init_timer(&frags->nack_timer);
+    setup_timer(&frags->nack_timer, frag_nack_handle, (unsigned long)frags);
+    init_timer(&frags->pace_timer);
+    setup_timer(&frags->pace_timer, frag_pace_handle, (unsigned long)frags);
 
     return frags;
 }
 
+/*
+ * Send one XOR parity fragment per @group data fragments, 0 turns it
+ * off. Both ends must use the same group size, call it before any data
+ * goes through.
+ */
+int data_frag_set_fec(data_frags_t *frags, int group)
+{
+    if(group < 0 || group > FEC_GROUP_MAX)
+        return -EINVAL;
+
+    frags->fec_group = group;
+    return 0;
+}
+
+/*
+ * Turn on nacks and retransmission. The receiver calls @nack with the
+ * missing ranges of data that stopped coming in, the sender keeps its
+ * last @window data for data_frag_retransmit(). Call it before any
+ * data goes through.
+ */
+int data_frag_set_nack(data_frags_t *frags, int window,
+        void (*nack)(void *opaque, data_nack_t *nack))
+{
+    if(window <= 0 || frags->window)
+        return -EINVAL;
+
+    frags->sent = calloc(window, sizeof(struct frag_sent));
+    if(!frags->sent)
+        return -ENOMEM;
+
+    frags->window = window;
+    frags->nack = nack;
+    return 0;
+}
+
+/*
+ * Fragment size of the data sent from now on, e.g. once the path MTU
+ * is known. Data already queued or in the window keeps its own size.
+ */
+int data_frag_set_fraglen(data_frags_t *frags, int fraglen)
+{
+    if(fraglen < FRAG_MIN_LEN || fraglen > FRAG_MAX_LEN)
+        return -EINVAL;
+
+    pthread_mutex_lock(&frags->lock);
+    frags->fraglen = fraglen;
+    pthread_mutex_unlock(&frags->lock);
+    return 0;
+}
+
+/*
+ * Send data_frag_async() data paced between @min_rate and @max_rate
+ * bytes per second, @sent is called once the last fragment of some
+ * data is out. With nacks on, they slow the sender down.
+ */
+int data_frag_set_pacing(data_frags_t *frags, long min_rate, long max_rate,
+        void (*sent)(void *opaque, int seq))
+{
+    if(min_rate <= 0 || max_rate < min_rate)
+        return -EINVAL;
+
+    pthread_mutex_lock(&frags->sent_lock);
+    frags->min_rate = min_rate;
+    frags->max_rate = max_rate;
+    frags->rate = clamp_t(long, FRAG_PACE_INIT_RATE, min_rate, max_rate);
+    frags->sent_cb = sent;
+    pthread_mutex_unlock(&frags->sent_lock);
+    return 0;
+}
+
+long data_frag_pace_rate(data_frags_t *frags)
+{
+    long rate;
+
+    pthread_mutex_lock(&frags->sent_lock);
+    rate = frags->rate;
+    pthread_mutex_unlock(&frags->sent_lock);
+    return rate;
+}
+
 void data_frag_release(data_frags_t *frags)
 {
     int i;
+    frag_queue_t *fq;
+    struct frag_job *job, *tmp;
+    struct htable_iter iter;
+
+    del_timer_sync(&frags->nack_timer);
+    del_timer_sync(&frags->pace_timer);
+    list_for_each_entry_safe(job, tmp, &frags->jobs, entry) {
+        free(job->data);
+        free(job->parity);
+        free(job);
+    }
 
-    for(i=0; i<FRAG_HASH_SZ; i++) {
-        frag_queue_t *fq;
-        struct hlist_node *pos; 
-
-        hlist_for_each_entry(fq, pos, &frags->hlist[i], entry) {
-            rm_frag_queue(frags, fq);
-        }
+    htable_for_each(&frags->queues, &iter, fq) {
+        rm_frag_queue(frags, fq);
     }
 
+    htable_destroy(&frags->queues);
+
+    for(i=0; i<frags->window; i++)
+        free(frags->sent[i].data);
+    free(frags->sent);
     free(frags);
 }
 
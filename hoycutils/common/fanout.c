@@ -0,0 +1,268 @@
+/*
+ * common/fanout.c
+ *
+ * 2016-01-01  written by Hoyleeson <hoyleeson@gmail.com>
+ *	Copyright (C) 2015-2016 by Hoyleeson.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; version 2.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <common/log.h>
+#include <common/fanout.h>
+
+
+static struct fanout_peers *fanout_peers_alloc(int count)
+{
+    struct fanout_peers *peers;
+
+    peers = malloc(sizeof(*peers) + count * (sizeof(struct sockaddr) + sizeof(uint32_t)));
+    if(!peers)
+        return NULL;
+
+    peers->count = count;
+    peers->ids = (uint32_t *)&peers->dst[count];
+    return peers;
+}
+
+static void fanout_peers_free_rcu(struct rcu_head *head)
+{
+    struct fanout_peers *peers = container_of(head, struct fanout_peers, rcu);
+
+    free(peers);
+}
+
+static void fanout_member_free_rcu(struct rcu_head *head)
+{
+    struct fanout_member *m = container_of(head, struct fanout_member, rcu);
+
+    free(m);
+}
+
+/* under fo->lock, readers may still hold the old array. */
+static void fanout_peers_publish(fanout_t *fo, struct fanout_peers *peers)
+{
+    struct fanout_peers *old = fo->peers;
+
+    rcu_assign_pointer(fo->peers, peers);
+    call_rcu(&old->rcu, fanout_peers_free_rcu);
+}
+
+/* append @m to the running members, under fo->lock. */
+static int fanout_peers_append(fanout_t *fo, struct fanout_member *m)
+{
+    struct fanout_peers *old = fo->peers;
+    struct fanout_peers *peers;
+    int n = old->count;
+
+    peers = fanout_peers_alloc(n + 1);
+    if(!peers)
+        return -ENOMEM;
+
+    memcpy(peers->dst, old->dst, n * sizeof(struct sockaddr));
+    memcpy(peers->ids, old->ids, n * sizeof(uint32_t));
+    peers->dst[n] = m->addr;
+    peers->ids[n] = m->id;
+
+    m->index = n;
+    m->running = 1;
+    fanout_peers_publish(fo, peers);
+    return 0;
+}
+
+/* the last running member takes the place of @m, under fo->lock. */
+static int fanout_peers_remove(fanout_t *fo, struct fanout_member *m)
+{
+    struct fanout_peers *old = fo->peers;
+    struct fanout_peers *peers;
+    struct fanout_member *last;
+    int i = m->index;
+    int n = old->count - 1;
+
+    peers = fanout_peers_alloc(n);
+    if(!peers)
+        return -ENOMEM;
+
+    memcpy(peers->dst, old->dst, n * sizeof(struct sockaddr));
+    memcpy(peers->ids, old->ids, n * sizeof(uint32_t));
+    if(i < n) {
+        peers->dst[i] = old->dst[n];
+        peers->ids[i] = old->ids[n];
+        last = htable_lookup(&fo->members, old->ids[n]);
+        if(last)
+            last->index = i;
+    }
+
+    m->index = -1;
+    m->running = 0;
+    fanout_peers_publish(fo, peers);
+    return 0;
+}
+
+int fanout_add(fanout_t *fo, uint32_t id, struct sockaddr *addr, int running)
+{
+    int ret;
+    struct fanout_member *m;
+
+    m = malloc(sizeof(*m));
+    if(!m)
+        return -ENOMEM;
+
+    m->id = id;
+    m->addr = *addr;
+    m->running = 0;
+    m->index = -1;
+
+    pthread_mutex_lock(&fo->lock);
+    if(htable_lookup(&fo->members, id)) {
+        ret = -EEXIST;
+        goto fail;
+    }
+
+    ret = htable_insert(&fo->members, m);
+    if(ret)
+        goto fail;
+
+    if(running && fanout_peers_append(fo, m))
+        logw("fanout: member %u not running, out of memory.\n", id);
+
+    fo->count++;
+    pthread_mutex_unlock(&fo->lock);
+    return 0;
+
+fail:
+    pthread_mutex_unlock(&fo->lock);
+    free(m);
+    return ret;
+}
+
+int fanout_del(fanout_t *fo, uint32_t id)
+{
+    int ret = 0;
+    struct fanout_member *m;
+
+    pthread_mutex_lock(&fo->lock);
+    m = htable_lookup(&fo->members, id);
+    if(!m) {
+        ret = -ENOENT;
+        goto out;
+    }
+
+    if(m->running) {
+        ret = fanout_peers_remove(fo, m);
+        if(ret)
+            goto out;
+    }
+
+    htable_remove(&fo->members, id);
+    fo->count--;
+    call_rcu(&m->rcu, fanout_member_free_rcu);
+out:
+    pthread_mutex_unlock(&fo->lock);
+    return ret;
+}
+
+int fanout_run(fanout_t *fo, uint32_t id, struct sockaddr *addr)
+{
+    int ret = 0;
+    struct fanout_member *m;
+
+    pthread_mutex_lock(&fo->lock);
+    m = htable_lookup(&fo->members, id);
+    if(!m) {
+        ret = -ENOENT;
+        goto out;
+    }
+
+    if(!m->running) {
+        m->addr = *addr;
+        ret = fanout_peers_append(fo, m);
+    }
+out:
+    pthread_mutex_unlock(&fo->lock);
+    return ret;
+}
+
+fanout_t *fanout_create(int size)
+{
+    fanout_t *fo;
+    struct htable_params params =
+        HTABLE_PARAMS(struct fanout_member, id, size);
+
+    fo = malloc(sizeof(*fo));
+    if(!fo)
+        return NULL;
+
+    fo->peers = fanout_peers_alloc(0);
+    if(!fo->peers)
+        goto fail;
+
+    if(htable_init(&fo->members, &params)) {
+        free(fo->peers);
+        goto fail;
+    }
+
+    fo->count = 0;
+    pthread_mutex_init(&fo->lock, NULL);
+    return fo;
+
+fail:
+    free(fo);
+    return NULL;
+}
+
+fanout_t *fanout_copy(fanout_t *fo)
+{
+    fanout_t *copy;
+    struct fanout_member *m;
+    struct fanout_peers *peers;
+    struct htable_iter iter;
+    int i;
+
+    pthread_mutex_lock(&fo->lock);
+    copy = fanout_create(fo->count);
+    if(!copy)
+        goto out;
+
+    /* running members first, in the order of the peers array. */
+    peers = fo->peers;
+    for(i=0; i<peers->count; i++) {
+        if(fanout_add(copy, peers->ids[i], &peers->dst[i], 1))
+            goto fail;
+    }
+
+    htable_for_each(&fo->members, &iter, m) {
+        if(!m->running && fanout_add(copy, m->id, &m->addr, 0))
+            goto fail;
+    }
+out:
+    pthread_mutex_unlock(&fo->lock);
+    return copy;
+
+fail:
+    pthread_mutex_unlock(&fo->lock);
+    fanout_release(copy);
+    return NULL;
+}
+
+void fanout_release(fanout_t *fo)
+{
+    struct fanout_member *m;
+    struct htable_iter iter;
+
+    htable_for_each(&fo->members, &iter, m) {
+        htable_remove(&fo->members, m->id);
+        free(m);
+    }
+    htable_destroy(&fo->members);
+
+    free(fo->peers);
+    free(fo);
+}
+
@@ -286,3 +286,88 @@ void __fifo_skip_r(struct __fifo *fifo, size_t recsize)
     fifo->out += n + recsize;
 }
 
+
+/*
+ * lock-free single producer/single consumer mode.
+ *
+ * The writer owns fifo->in and the reader owns fifo->out. Each side reads
+ * the index of the other side with acquire semantic before touching the
+ * buffer, and publishes its own index with release semantic after it is done
+ * with the buffer. So the reader never sees an index covering data that is
+ * not written yet, and the writer never overwrites data that is still read.
+ */
+unsigned int __fifo_in_spsc(struct __fifo *fifo,
+        const void *buf, unsigned int len)
+{
+    unsigned int in = fifo->in;
+    unsigned int out = smp_load_acquire(&fifo->out);
+    unsigned int l;
+
+    l = (fifo->mask + 1) - (in - out);
+    if (len > l)
+        len = l;
+
+    fifo_copy_in(fifo, buf, len, in);
+    smp_store_release(&fifo->in, in + len);
+    return len;
+}
+
+unsigned int __fifo_out_spsc(struct __fifo *fifo,
+        void *buf, unsigned int len)
+{
+    unsigned int out = fifo->out;
+    unsigned int in = smp_load_acquire(&fifo->in);
+    unsigned int l;
+
+    l = in - out;
+    if (len > l)
+        len = l;
+
+    fifo_copy_out(fifo, buf, len, out);
+    smp_store_release(&fifo->out, out + len);
+    return len;
+}
+
+unsigned int __fifo_prepare(struct __fifo *fifo,
+        void **ptr, unsigned int len)
+{
+    unsigned int size = fifo->mask + 1;
+    unsigned int in = fifo->in;
+    unsigned int out = smp_load_acquire(&fifo->out);
+    unsigned int off = in & fifo->mask;
+    unsigned int l;
+
+    l = min(size - (in - out), size - off);
+    if (len > l)
+        len = l;
+
+    *ptr = fifo->data + off * fifo->esize;
+    return len;
+}
+
+void __fifo_commit(struct __fifo *fifo, unsigned int len)
+{
+    smp_store_release(&fifo->in, fifo->in + len);
+}
+
+unsigned int __fifo_out_linear(struct __fifo *fifo,
+        void **ptr, unsigned int len)
+{
+    unsigned int size = fifo->mask + 1;
+    unsigned int out = fifo->out;
+    unsigned int in = smp_load_acquire(&fifo->in);
+    unsigned int off = out & fifo->mask;
+    unsigned int l;
+
+    l = min(in - out, size - off);
+    if (len > l)
+        len = l;
+
+    *ptr = fifo->data + off * fifo->esize;
+    return len;
+}
+
+void __fifo_skip_count(struct __fifo *fifo, unsigned int len)
+{
+    smp_store_release(&fifo->out, fifo->out + len);
+}
@@ -25,8 +25,9 @@
  * This is a common helper function for find_next_bit and
  * find_next_zero_bit.  The difference is the "invert" argument, which
  * is XORed with each fetched word before searching it for one bits.
+ * SIMD variants live in bitmap_simd.c, see bitmap_ops_init().
  */
-static unsigned long _find_next_bit(const unsigned long *addr,
+unsigned long _find_next_bit_generic(const unsigned long *addr,
 		unsigned long nbits, unsigned long start, unsigned long invert)
 {
 	unsigned long tmp;
@@ -52,48 +53,15 @@ static unsigned long _find_next_bit(const unsigned long *addr,
 }
 
 /*
- * Find the next set bit in a memory region.
+ * The SIMD variants pay for their setup on large bitmaps only, the
+ * small ones are searched by the generic code without the indirect call.
  */
-unsigned long find_next_bit(const unsigned long *addr, unsigned long size,
-			    unsigned long offset)
-{
-	return _find_next_bit(addr, size, offset, 0UL);
-}
-
-unsigned long find_next_zero_bit(const unsigned long *addr, unsigned long size,
-				 unsigned long offset)
-{
-	return _find_next_bit(addr, size, offset, ~0UL);
-}
-
-/*
- * Find the first set bit in a memory region.
- */
-unsigned long find_first_bit(const unsigned long *addr, unsigned long size)
-{
-	unsigned long idx;
-
-	for (idx = 0; idx * BITS_PER_LONG < size; idx++) {
-		if (addr[idx])
-			return min(idx * BITS_PER_LONG + __ffs(addr[idx]), size);
-	}
-
-	return size;
-}
-
-/*
- * Find the first cleared bit in a memory region.
- */
-unsigned long find_first_zero_bit(const unsigned long *addr, unsigned long size)
+unsigned long _find_next_bit(const unsigned long *addr,
+		unsigned long nbits, unsigned long start, unsigned long invert)
 {
-	unsigned long idx;
-
-	for (idx = 0; idx * BITS_PER_LONG < size; idx++) {
-		if (addr[idx] != ~0UL)
-			return min(idx * BITS_PER_LONG + ffz(addr[idx]), size);
-	}
-
-	return size;
+	if (nbits < BITMAP_OPS_MIN_BITS)
+		return _find_next_bit_generic(addr, nbits, start, invert);
+	return bitmap_ops->find_next_bit(addr, nbits, start, invert);
 }
 
 unsigned long find_last_bit(const unsigned long *addr, unsigned long size)
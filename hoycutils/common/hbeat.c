@@ -14,60 +14,126 @@
 
 #include <common/timer.h>
 #include <common/log.h>
+#include <common/rcu.h>
 #include <common/hbeat.h>
 #include <common/list.h>
 
 
+static inline unsigned long hbeat_now(void)
+{
+    return curr_time_ms() / HBEAT_TICK;
+}
+
+/* a new deadline for @hbeat, under god->lock. */
+static void __hbeat_renew(hbeat_god_t *god, hbeat_node_t *hbeat)
+{
+    unsigned long expire = hbeat_now() + god->timeout;
+
+    /* most heartbeats of a tick leave the node where it is. */
+    if(expire == hbeat->expire && !list_empty(&hbeat->node))
+        return;
+
+    hbeat->expire = expire;
+    list_move_tail(&hbeat->node, &god->wheel[expire % HBEAT_WHEEL_SLOTS]);
+}
+
 void user_heartbeat(hbeat_node_t *hbeat)
 {
-    hbeat->count = HBEAT_INIT;
-    hbeat->online = 1;
+    hbeat_god_t *god = hbeat->god;
+
+    pthread_mutex_lock(&god->lock);
+    if(hbeat->online)
+        __hbeat_renew(god, hbeat);
+    pthread_mutex_unlock(&god->lock);
 }
 
 void hbeat_add_to_god(hbeat_god_t *god, hbeat_node_t *hbeat) 
 {
-    hbeat->count = HBEAT_INIT;
-    hbeat->online = 1;
+    hbeat->god = god;
+    hbeat->expire = 0;
+    INIT_LIST_HEAD(&hbeat->node);
 
     pthread_mutex_lock(&god->lock);
-    list_add_tail(&hbeat->node, &god->list);
+    hbeat->online = 1;
+    __hbeat_renew(god, hbeat);
     pthread_mutex_unlock(&god->lock);
 }
 
 void hbeat_rm_from_god(hbeat_god_t *god, hbeat_node_t *hbeat) 
 {
     pthread_mutex_lock(&god->lock);
-    list_del(&hbeat->node);
+    hbeat->online = 0;
+    list_del_init(&hbeat->node);
     pthread_mutex_unlock(&god->lock);
 }
 
 void hbeat_god_handle(unsigned long data)
 {
+    int n;
+    unsigned long now = hbeat_now();
     hbeat_node_t *hbeat, *tmp;
     hbeat_god_t *god = (hbeat_god_t *)data;
+    struct list_head *slot;
 
-    list_for_each_entry_safe(hbeat, tmp, &god->list, node) {
-        hbeat->count--;
-
-        if(hbeat->count <= 0) {
-            hbeat->online = 0;
-            god->dead(hbeat);
+    pthread_mutex_lock(&god->lock);
+    /* a late timer catches up, one lap covers all the buckets. */
+    for(n=0; god->tick <= now && n < HBEAT_WHEEL_SLOTS; god->tick++, n++) {
+        slot = &god->wheel[god->tick % HBEAT_WHEEL_SLOTS];
+        list_for_each_entry_safe(hbeat, tmp, slot, node) {
+            if(hbeat->expire <= now)
+                list_move_tail(&hbeat->node, &god->expired);
         }
     }
+    god->tick = now + 1;
+
+    /* dead() usually removes the node, it is called without the lock. */
+    rcu_read_lock();
+    while(!list_empty(&god->expired)) {
+        hbeat = list_first_entry(&god->expired, hbeat_node_t, node);
+        list_del_init(&hbeat->node);
+        hbeat->online = 0;
+
+        pthread_mutex_unlock(&god->lock);
+        god->dead(hbeat);
+        pthread_mutex_lock(&god->lock);
+    }
+    pthread_mutex_unlock(&god->lock);
+    rcu_read_unlock();
+
+    mod_timer(&god->timer, (now + 1) * HBEAT_TICK);
+}
+
+void hbeat_god_set_timeout(hbeat_god_t *god, int ms)
+{
+    int ticks = (ms + HBEAT_TICK - 1) / HBEAT_TICK;
+
+    if(ticks < 1)
+        ticks = 1;
+    if(ticks >= HBEAT_WHEEL_SLOTS) {
+        logw("hbeat timeout %dms over a lap of the wheel.\n", ms);
+        ticks = HBEAT_WHEEL_SLOTS - 1;
+    }
 
-    mod_timer(&god->timer, curr_time_ms() + HBEAD_DEAD_LINE);
+    pthread_mutex_lock(&god->lock);
+    god->timeout = ticks;
+    pthread_mutex_unlock(&god->lock);
 }
 
 void hbeat_god_init(hbeat_god_t *god, void (*dead)(hbeat_node_t *))
 {
-    INIT_LIST_HEAD(&god->list);
+    int i;
+
+    for(i=0; i<HBEAT_WHEEL_SLOTS; i++)
+        INIT_LIST_HEAD(&god->wheel[i]);
+    INIT_LIST_HEAD(&god->expired);
 
     god->dead = dead;
+    god->tick = hbeat_now();
+    god->timeout = HBEAT_INIT * HBEAD_DEAD_LINE / HBEAT_TICK;
     init_timer(&god->timer);
     setup_timer(&god->timer, hbeat_god_handle, (unsigned long)god);
     pthread_mutex_init(&god->lock, NULL);
 
-    mod_timer(&god->timer, curr_time_ms() + HBEAD_DEAD_LINE);
+    mod_timer(&god->timer, (god->tick + 1) * HBEAT_TICK);
 }
 
-
@@ -0,0 +1,474 @@
+/*
+ * common/htable.c
+ *
+ * 2016-01-01  written by Hoyleeson <hoyleeson@gmail.com>
+ *	Copyright (C) 2015-2016 by Hoyleeson.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; version 2.
+ *
+ * Resizable open addressing hash table. See include/common/htable.h.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <common/core.h>
+#include <common/bug.h>
+#include <common/log.h>
+#include <common/bitops.h>
+#include <common/htable.h>
+
+#define HT_GROUP_SIZE       (16)
+#define HT_MIN_CAPACITY     (HT_GROUP_SIZE)
+/* number of old slots moved by each insert while resizing. */
+#define HT_MIGRATE_STEP     (64)
+
+/* control bytes: a full slot holds the top 7 bits of its hash. */
+#define HT_CTRL_EMPTY       ((u8)0x80)
+#define HT_CTRL_DELETED     ((u8)0xfe)
+
+struct htable_tbl {
+    unsigned int capacity;      /* power of 2, at least one group */
+    unsigned int used;          /* full and deleted slots */
+    unsigned int size;          /* full slots */
+    void **slots;
+    struct rcu_head rcu;
+    u8 ctrl[] __attribute__((aligned(HT_GROUP_SIZE)));
+};
+
+
+static inline u64 htable_hash(u64 key)
+{
+    /* murmur3 finalizer, keys are often small sequential ids. */
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ULL;
+    key ^= key >> 33;
+    return key;
+}
+
+static inline u8 htable_h2(u64 hash)
+{
+    return (u8)(hash >> 57);
+}
+
+static inline u64 htable_obj_key(struct htable *ht, const void *obj)
+{
+    const char *p = (const char *)obj + ht->p.key_offset;
+
+    if(ht->p.key_len == sizeof(u64))
+        return *(const u64 *)p;
+    return *(const u32 *)p;
+}
+
+/*
+ * Scan one group of control bytes: @match gets a bit per slot holding
+ * @h2, @empty a bit per empty slot. The group is read once so both
+ * masks describe the same snapshot.
+ */
+#ifdef __SSE2__
+static inline void group_scan(const u8 *ctrl, u8 h2,
+        unsigned int *match, unsigned int *empty)
+{
+    __m128i g = _mm_load_si128((const __m128i *)ctrl);
+
+    *match = _mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8(h2)));
+    *empty = _mm_movemask_epi8(_mm_cmpeq_epi8(g,
+                _mm_set1_epi8((char)HT_CTRL_EMPTY)));
+}
+
+/* empty or deleted slots: the only control bytes with the top bit set. */
+static inline unsigned int group_free(const u8 *ctrl)
+{
+    return _mm_movemask_epi8(_mm_load_si128((const __m128i *)ctrl));
+}
+#else
+static inline void group_scan(const u8 *ctrl, u8 h2,
+        unsigned int *match, unsigned int *empty)
+{
+    int i;
+    u8 c;
+
+    *match = *empty = 0;
+    for(i=0; i<HT_GROUP_SIZE; i++) {
+        c = READ_ONCE(ctrl[i]);
+        if(c == h2)
+            *match |= 1U << i;
+        else if(c == HT_CTRL_EMPTY)
+            *empty |= 1U << i;
+    }
+}
+
+static inline unsigned int group_free(const u8 *ctrl)
+{
+    unsigned int mask = 0;
+    int i;
+
+    for(i=0; i<HT_GROUP_SIZE; i++)
+        if(ctrl[i] & 0x80)
+            mask |= 1U << i;
+    return mask;
+}
+#endif
+
+static struct htable_tbl *htable_tbl_alloc(unsigned int capacity)
+{
+    struct htable_tbl *t;
+    size_t ctrl_sz = capacity * sizeof(u8);
+
+    if(posix_memalign((void **)&t, 64, sizeof(*t) + ctrl_sz +
+                capacity * sizeof(void *)))
+        return NULL;
+
+    t->capacity = capacity;
+    t->used = 0;
+    t->size = 0;
+    t->slots = (void **)(t->ctrl + ctrl_sz);
+    memset(t->ctrl, HT_CTRL_EMPTY, ctrl_sz);
+    memset(t->slots, 0, capacity * sizeof(void *));
+    return t;
+}
+
+static void htable_tbl_free_rcu(struct rcu_head *head)
+{
+    free(container_of(head, struct htable_tbl, rcu));
+}
+
+/*
+ * Groups are probed triangularly (g, g+1, g+3, g+6 ...), with a power of
+ * 2 number of groups this visits every group exactly once.
+ */
+#define for_each_probe_group(t, hash, i, base) \
+    for(i = 0, base = ((hash) & ((t)->capacity / HT_GROUP_SIZE - 1)) * HT_GROUP_SIZE; \
+        i < (t)->capacity / HT_GROUP_SIZE; \
+        i++, base = (base + i * HT_GROUP_SIZE) & ((t)->capacity - 1))
+
+/*
+ * Returns the slot index of @key in @t, or -1. The object is returned in
+ * @objp, readers must not load the slot again: it may have been moved.
+ */
+static int htable_tbl_find(struct htable *ht, struct htable_tbl *t,
+        u64 key, u64 hash, void **objp)
+{
+    unsigned int i, base, match, empty, bit;
+    u8 h2 = htable_h2(hash);
+    void *obj;
+
+    for_each_probe_group(t, hash, i, base) {
+        group_scan(t->ctrl + base, h2, &match, &empty);
+        /* pairs with the release in htable_tbl_add(). */
+        smp_rmb();
+
+        while(match) {
+            bit = __builtin_ctz(match);
+            obj = rcu_dereference(t->slots[base + bit]);
+            if(obj && htable_obj_key(ht, obj) == key) {
+                *objp = obj;
+                return base + bit;
+            }
+            match &= match - 1;
+        }
+        if(empty)
+            break;
+    }
+    return -1;
+}
+
+static void htable_tbl_add(struct htable_tbl *t, void *obj, u64 hash)
+{
+    unsigned int i, base, mask, pos;
+
+    for_each_probe_group(t, hash, i, base) {
+        mask = group_free(t->ctrl + base);
+        if(!mask)
+            continue;
+
+        pos = base + __builtin_ctz(mask);
+        if(t->ctrl[pos] == HT_CTRL_EMPTY)
+            t->used++;
+        t->size++;
+        /* the object must be visible before its control byte. */
+        rcu_assign_pointer(t->slots[pos], obj);
+        smp_store_release(&t->ctrl[pos], htable_h2(hash));
+        return;
+    }
+    /* the load factor guarantees a free slot. */
+    BUG();
+}
+
+static void htable_tbl_del(struct htable_tbl *t, unsigned int pos)
+{
+    unsigned int base = pos & ~(HT_GROUP_SIZE - 1);
+    unsigned int match, empty;
+    u8 c = HT_CTRL_DELETED;
+
+    /*
+     * If the group still has an empty slot it was never full, so no
+     * probe sequence went past it and the slot can be made empty again.
+     */
+    group_scan(t->ctrl + base, 0, &match, &empty);
+    if(empty) {
+        c = HT_CTRL_EMPTY;
+        t->used--;
+    }
+    t->size--;
+
+    smp_store_release(&t->ctrl[pos], c);
+    RCU_INIT_POINTER(t->slots[pos], NULL);
+}
+
+static void htable_migrate_done(struct htable *ht)
+{
+    struct htable_tbl *old = ht->old;
+
+    rcu_assign_pointer(ht->old, NULL);
+    smp_store_release(&ht->seq, ht->seq + 1);
+    call_rcu(&old->rcu, htable_tbl_free_rcu);
+}
+
+/*
+ * Move up to @count slots of the old table into the new one. An object
+ * is added to the new table before it is removed from the old one, so a
+ * reader searching old then new always finds it.
+ */
+static void htable_migrate(struct htable *ht, unsigned int count)
+{
+    struct htable_tbl *old = ht->old;
+    unsigned int end;
+    void *obj;
+
+    if(!old)
+        return;
+
+    end = min(ht->migrate_pos + count, old->capacity);
+    for(; ht->migrate_pos < end; ht->migrate_pos++) {
+        if(old->ctrl[ht->migrate_pos] & 0x80)
+            continue;
+
+        obj = old->slots[ht->migrate_pos];
+        htable_tbl_add(ht->tbl, obj, htable_hash(htable_obj_key(ht, obj)));
+        htable_tbl_del(old, ht->migrate_pos);
+    }
+
+    if(ht->migrate_pos == old->capacity)
+        htable_migrate_done(ht);
+}
+
+static inline int htable_over_loaded(struct htable *ht)
+{
+    unsigned int used = ht->tbl->used + 1;
+
+    /* the objects left in the old table will be moved in as well. */
+    if(ht->old)
+        used += ht->old->size;
+    return used * 8 > ht->tbl->capacity * 7;
+}
+
+/* smallest capacity holding @size objects below the maximum load. */
+static unsigned int htable_capacity_for(unsigned int size)
+{
+    unsigned int capacity = HT_MIN_CAPACITY;
+
+    while(capacity / 8 * 7 < size)
+        capacity <<= 1;
+    return capacity;
+}
+
+static int htable_resize(struct htable *ht, unsigned int capacity)
+{
+    struct htable_tbl *n;
+
+    n = htable_tbl_alloc(capacity);
+    if(!n)
+        return -ENOMEM;
+
+    /* readers load tbl before old, publish them in the reverse order. */
+    rcu_assign_pointer(ht->old, ht->tbl);
+    rcu_assign_pointer(ht->tbl, n);
+    /* must be visible before any object leaves the old table. */
+    smp_store_release(&ht->seq, ht->seq + 1);
+    ht->migrate_pos = 0;
+    return 0;
+}
+
+static int htable_grow(struct htable *ht)
+{
+    struct htable_tbl *t;
+    unsigned int capacity;
+
+    /* a resize is still running, finish it first. */
+    if(ht->old)
+        htable_migrate(ht, ht->old->capacity);
+
+    if(!htable_over_loaded(ht))
+        return 0;
+
+    /* mostly tombstones: rebuild at the same size. */
+    t = ht->tbl;
+    capacity = t->capacity;
+    if(ht->size * 2 >= capacity)
+        capacity *= 2;
+
+    return htable_resize(ht, capacity);
+}
+
+/* shrink to a quarter of the load once less than 1/8 is used. */
+static void htable_shrink(struct htable *ht)
+{
+    unsigned int capacity;
+
+    if(ht->old || ht->size * 8 >= ht->tbl->capacity)
+        return;
+
+    capacity = max(htable_capacity_for(ht->size * 2), ht->min_capacity);
+    if(capacity < ht->tbl->capacity)
+        htable_resize(ht, capacity);
+}
+
+int htable_init(struct htable *ht, const struct htable_params *params)
+{
+    if(params->key_len != sizeof(u32) && params->key_len != sizeof(u64))
+        return -EINVAL;
+
+    ht->min_capacity = htable_capacity_for(params->min_size);
+    ht->tbl = htable_tbl_alloc(ht->min_capacity);
+    if(!ht->tbl)
+        return -ENOMEM;
+
+    ht->old = NULL;
+    ht->migrate_pos = 0;
+    ht->size = 0;
+    ht->seq = 0;
+    ht->p = *params;
+    return 0;
+}
+
+/* The caller must make sure no reader can still access the table. */
+void htable_destroy(struct htable *ht)
+{
+    free(ht->old);
+    free(ht->tbl);
+    ht->old = ht->tbl = NULL;
+    ht->size = 0;
+}
+
+/**
+ * htable_lookup - find the object with @key
+ *
+ * Must be called under rcu_read_lock() or with the updaters' lock held.
+ */
+void *htable_lookup(struct htable *ht, u64 key)
+{
+    struct htable_tbl *t, *old;
+    u64 hash = htable_hash(key);
+    unsigned long seq;
+    void *obj;
+
+    do {
+        seq = smp_load_acquire(&ht->seq);
+        t = rcu_dereference(ht->tbl);
+        old = rcu_dereference(ht->old);
+
+        if(old && old != t && htable_tbl_find(ht, old, key, hash, &obj) >= 0)
+            return obj;
+
+        if(htable_tbl_find(ht, t, key, hash, &obj) >= 0)
+            return obj;
+
+        /* a resize started, the object may have moved behind our back. */
+        smp_rmb();
+    } while(seq != READ_ONCE(ht->seq));
+
+    return NULL;
+}
+
+/**
+ * htable_insert - add @obj to the table
+ *
+ * Returns -EEXIST if an object with the same key is already present.
+ */
+int htable_insert(struct htable *ht, void *obj)
+{
+    u64 key = htable_obj_key(ht, obj);
+    int ret;
+
+    if(htable_lookup(ht, key))
+        return -EEXIST;
+
+    if(htable_over_loaded(ht)) {
+        ret = htable_grow(ht);
+        if(ret)
+            return ret;
+    } else {
+        /* removals do not move objects, so shrinking is done here. */
+        htable_shrink(ht);
+    }
+
+    htable_tbl_add(ht->tbl, obj, htable_hash(key));
+    ht->size++;
+
+    htable_migrate(ht, HT_MIGRATE_STEP);
+    return 0;
+}
+
+/**
+ * htable_remove - remove the object with @key
+ *
+ * Returns the removed object, or NULL. Concurrent readers may still
+ * hold it until a grace period has elapsed.
+ */
+void *htable_remove(struct htable *ht, u64 key)
+{
+    struct htable_tbl *t;
+    u64 hash = htable_hash(key);
+    void *obj;
+    int pos;
+
+    /* no migration here, so removing while iterating is safe. */
+    t = ht->old;
+    if(!t || (pos = htable_tbl_find(ht, t, key, hash, &obj)) < 0) {
+        t = ht->tbl;
+        pos = htable_tbl_find(ht, t, key, hash, &obj);
+        if(pos < 0)
+            return NULL;
+    }
+
+    htable_tbl_del(t, pos);
+    ht->size--;
+    return obj;
+}
+
+void htable_iter_init(struct htable *ht, struct htable_iter *iter)
+{
+    iter->tbl[0] = rcu_dereference(ht->old);
+    iter->tbl[1] = rcu_dereference(ht->tbl);
+    iter->idx = iter->tbl[0] ? 0 : 1;
+    iter->pos = 0;
+}
+
+void *htable_iter_next(struct htable_iter *iter)
+{
+    struct htable_tbl *t;
+    void *obj;
+
+    for(; iter->idx < 2; iter->idx++, iter->pos = 0) {
+        t = iter->tbl[iter->idx];
+        while(iter->pos < t->capacity) {
+            obj = rcu_dereference(t->slots[iter->pos++]);
+            if(obj)
+                return obj;
+        }
+    }
+    return NULL;
+}
+
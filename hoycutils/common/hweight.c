@@ -1,5 +1,6 @@
 #include <common/bitops.h>
 #include <common/types.h>
+#include <common/bitmap.h>
 
 /**
  * hweightN - returns the hamming weight of a N-bit word
@@ -8,13 +9,9 @@
  * The Hamming Weight of a number is the total number of bits set in it.
  */
 
-unsigned int __hweight32(unsigned int w)
+unsigned int __hweight32_generic(unsigned int w)
 {
-	unsigned int res = w - ((w >> 1) & 0x55555555);
-	res = (res & 0x33333333) + ((res >> 2) & 0x33333333);
-	res = (res + (res >> 4)) & 0x0F0F0F0F;
-	res = res + (res >> 8);
-	return (res + (res >> 16)) & 0x000000FF;
+	return __sw_hweight32(w);
 }
 
 unsigned int __hweight16(unsigned int w)
@@ -32,18 +29,7 @@ unsigned int __hweight8(unsigned int w)
 	return (res + (res >> 4)) & 0x0F;
 }
 
-unsigned long __hweight64(uint64_t w)
+unsigned long __hweight64_generic(uint64_t w)
 {
-#if BITS_PER_LONG == 32
-	return __hweight32((unsigned int)(w >> 32)) +
-	       __hweight32((unsigned int)w);
-#elif BITS_PER_LONG == 64
-	uint64_t res = w - ((w >> 1) & 0x5555555555555555ul);
-	res = (res & 0x3333333333333333ul) + ((res >> 2) & 0x3333333333333333ul);
-	res = (res + (res >> 4)) & 0x0F0F0F0F0F0F0F0Ful;
-	res = res + (res >> 8);
-	res = res + (res >> 16);
-	return (res + (res >> 32)) & 0x00000000000000FFul;
-#endif
+	return __sw_hweight64(w);
 }
-
@@ -108,7 +108,6 @@ static struct idr_layer *idr_layer_alloc(struct idr *layer_idr)
 	return mempool_zalloc(idr_layer_cache);
 }
 
-#if 0
 static void idr_layer_rcu_free(struct rcu_head *head)
 {
 	struct idr_layer *layer;
@@ -116,15 +115,14 @@ static void idr_layer_rcu_free(struct rcu_head *head)
 	layer = container_of(head, struct idr_layer, rcu_head);
 	mempool_free(idr_layer_cache, layer);
 }
-#endif
 
 static inline void free_layer(struct idr *idr, struct idr_layer *p)
 {
 	if (idr->hint == p)
 		IDR_INIT_POINTER(idr->hint, NULL);
 
-	mempool_free(idr_layer_cache, p);
-	//call_rcu(&p->rcu_head, idr_layer_rcu_free);
+	/* lock-free idr_find() may still be walking through @p */
+	call_rcu(&p->rcu_head, idr_layer_rcu_free);
 }
 
 /* only called when idp->lock is held */
@@ -0,0 +1,305 @@
+/*
+ * common/img_sync.c
+ *
+ * 2016-01-01  written by Hoyleeson <hoyleeson@gmail.com>
+ *	Copyright (C) 2015-2016 by Hoyleeson.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; version 2.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <errno.h>
+
+#include <common/log.h>
+#include <common/htable.h>
+#include <common/bitmap.h>
+#include <common/lz.h>
+#include <common/img_sync.h>
+
+
+#define IMG_SYNC_MAGIC          (0x5349)    /* "IS" */
+
+#define IMG_SYNC_KEY            (0)
+#define IMG_SYNC_DELTA          (1)
+
+/* hdr flags: the body is lz compressed. */
+#define IMG_SYNC_LZ             (1 << 0)
+
+/* the largest image taken from the network. */
+#define IMG_SYNC_MAX_LEN        (64 * 1024 * 1024)
+#define IMG_SYNC_REFS_CAPACITY  (16)
+
+/* IMG_SYNC_HDR_LEN bytes. */
+struct img_sync_hdr {
+    uint16_t magic;
+    uint8_t type;
+    uint8_t flags;
+    uint32_t src;
+    uint32_t id;        /* image number of this sender */
+    uint32_t base;      /* delta: the image it applies to */
+    uint32_t len;       /* image length */
+};
+
+/* last image received from a sender. */
+struct img_ref {
+    uint32_t src;
+    uint32_t id;
+    int valid;
+    int len;
+    uint8_t *data;
+};
+
+struct img_sync {
+    int keyint;
+
+    /* encoder, the last image sent and the delta scratch. */
+    pthread_mutex_t lock;
+    uint32_t id;
+    int since_key;
+    int force_key;
+    uint8_t *ref;
+    uint8_t *delta;
+    int ref_len;
+
+    /* decoder */
+    pthread_mutex_t refs_lock;
+    struct htable refs;     /* key: src */
+    uint8_t *scratch;
+    int scratch_len;
+};
+
+
+static void img_xor(uint8_t *dst, const uint8_t *a, const uint8_t *b, int len)
+{
+    int i;
+    int words = len / sizeof(unsigned long);
+
+    if(words)
+        bitmap_xor((unsigned long *)dst, (const unsigned long *)a,
+                (const unsigned long *)b, words * BITS_PER_LONG);
+
+    for(i=words * sizeof(unsigned long); i<len; i++)
+        dst[i] = a[i] ^ b[i];
+}
+
+/*
+ * The delta is taken against the previous image sent. There is no ack
+ * of whole images, a receiver that lost one is out of sync until the
+ * next keyframe, see img_sync_force_key().
+ */
+int img_sync_encode(img_sync_t *sync, int src, const void *data, int len,
+        void *out)
+{
+    int key, ret;
+    const uint8_t *body = data;
+    struct img_sync_hdr *hdr = out;
+    uint8_t *obody = (uint8_t *)out + IMG_SYNC_HDR_LEN;
+
+    if(len <= 0)
+        return -EINVAL;
+
+    pthread_mutex_lock(&sync->lock);
+    if(len != sync->ref_len) {
+        free(sync->ref);
+        free(sync->delta);
+        sync->ref = malloc(len);
+        sync->delta = malloc(len);
+        if(!sync->ref || !sync->delta) {
+            free(sync->ref);
+            free(sync->delta);
+            sync->ref = sync->delta = NULL;
+            sync->ref_len = 0;
+            pthread_mutex_unlock(&sync->lock);
+            return -ENOMEM;
+        }
+        sync->ref_len = len;
+        sync->force_key = 1;
+    }
+
+    key = sync->force_key || (sync->keyint && sync->since_key >= sync->keyint);
+    if(!key) {
+        img_xor(sync->delta, data, sync->ref, len);
+        body = sync->delta;
+    }
+
+    hdr->magic = IMG_SYNC_MAGIC;
+    hdr->type = key ? IMG_SYNC_KEY : IMG_SYNC_DELTA;
+    hdr->src = src;
+    hdr->base = sync->id;
+    hdr->id = ++sync->id;
+    hdr->len = len;
+
+    /* sent as is if compressing does not make it smaller. */
+    ret = lz_compress(body, len, obody, len);
+    if(ret > 0 && ret < len) {
+        hdr->flags = IMG_SYNC_LZ;
+    } else {
+        hdr->flags = 0;
+        memcpy(obody, body, len);
+        ret = len;
+    }
+
+    memcpy(sync->ref, data, len);
+    sync->since_key = key ? 1 : sync->since_key + 1;
+    sync->force_key = 0;
+    pthread_mutex_unlock(&sync->lock);
+
+    logv("img sync encode: id:%d, %s, %d -> %d bytes\n",
+            hdr->id, key ? "key" : "delta", len, ret);
+    return IMG_SYNC_HDR_LEN + ret;
+}
+
+void img_sync_force_key(img_sync_t *sync)
+{
+    pthread_mutex_lock(&sync->lock);
+    sync->force_key = 1;
+    pthread_mutex_unlock(&sync->lock);
+}
+
+static struct img_ref *img_ref_get(img_sync_t *sync, uint32_t src, int len)
+{
+    struct img_ref *ref;
+    uint8_t *data;
+
+    ref = htable_lookup(&sync->refs, src);
+    if(!ref) {
+        ref = calloc(1, sizeof(*ref));
+        if(!ref)
+            return NULL;
+        ref->src = src;
+        htable_insert(&sync->refs, ref);
+    }
+
+    if(ref->len != len) {
+        data = realloc(ref->data, len);
+        if(!data)
+            return NULL;
+        ref->data = data;
+        ref->len = len;
+    }
+    return ref;
+}
+
+int img_sync_decode(img_sync_t *sync, const void *in, int len,
+        void (*image)(void *arg, int src, void *data, int len), void *arg)
+{
+    int ret, imglen;
+    uint8_t *dst;
+    struct img_ref *ref;
+    const struct img_sync_hdr *hdr = in;
+    const uint8_t *body = (const uint8_t *)in + IMG_SYNC_HDR_LEN;
+    int bodylen = len - IMG_SYNC_HDR_LEN;
+
+    if(len < IMG_SYNC_HDR_LEN || hdr->magic != IMG_SYNC_MAGIC ||
+            !hdr->len || hdr->len > IMG_SYNC_MAX_LEN)
+        return -EINVAL;
+
+    imglen = hdr->len;
+    if(!(hdr->flags & IMG_SYNC_LZ) && bodylen != imglen)
+        return -EINVAL;
+
+    pthread_mutex_lock(&sync->refs_lock);
+    switch(hdr->type) {
+        case IMG_SYNC_KEY:
+            ref = img_ref_get(sync, hdr->src, imglen);
+            if(!ref) {
+                ret = -ENOMEM;
+                goto out;
+            }
+            ref->valid = 0;
+            dst = ref->data;
+            break;
+        case IMG_SYNC_DELTA:
+            ref = htable_lookup(&sync->refs, hdr->src);
+            if(!ref || !ref->valid || ref->id != hdr->base || ref->len != imglen) {
+                logd("img sync: src:%d, no base %d for image %d\n",
+                        hdr->src, hdr->base, hdr->id);
+                ret = -EAGAIN;
+                goto out;
+            }
+            if(sync->scratch_len < imglen) {
+                dst = realloc(sync->scratch, imglen);
+                if(!dst) {
+                    ret = -ENOMEM;
+                    goto out;
+                }
+                sync->scratch = dst;
+                sync->scratch_len = imglen;
+            }
+            dst = sync->scratch;
+            break;
+        default:
+            ret = -EINVAL;
+            goto out;
+    }
+
+    if(hdr->flags & IMG_SYNC_LZ) {
+        ret = lz_decompress(body, bodylen, dst, imglen);
+        if(ret != imglen) {
+            loge("img sync: src:%d, image %d corrupted\n", hdr->src, hdr->id);
+            ret = -EINVAL;
+            goto out;
+        }
+    } else {
+        memcpy(dst, body, imglen);
+    }
+
+    if(hdr->type == IMG_SYNC_DELTA)
+        img_xor(ref->data, ref->data, dst, imglen);
+
+    ref->id = hdr->id;
+    ref->valid = 1;
+    image(arg, hdr->src, ref->data, imglen);
+    ret = imglen;
+
+out:
+    pthread_mutex_unlock(&sync->refs_lock);
+    return ret;
+}
+
+img_sync_t *img_sync_init(int keyint)
+{
+    img_sync_t *sync;
+    struct htable_params params =
+        HTABLE_PARAMS(struct img_ref, src, IMG_SYNC_REFS_CAPACITY);
+
+    sync = calloc(1, sizeof(*sync));
+    if(!sync)
+        return NULL;
+
+    if(htable_init(&sync->refs, &params)) {
+        free(sync);
+        return NULL;
+    }
+
+    sync->keyint = keyint;
+    sync->force_key = 1;
+    pthread_mutex_init(&sync->lock, NULL);
+    pthread_mutex_init(&sync->refs_lock, NULL);
+    return sync;
+}
+
+void img_sync_release(img_sync_t *sync)
+{
+    struct img_ref *ref;
+    struct htable_iter iter;
+
+    htable_for_each(&sync->refs, &iter, ref) {
+        htable_remove(&sync->refs, ref->src);
+        free(ref->data);
+        free(ref);
+    }
+    htable_destroy(&sync->refs);
+
+    free(sync->ref);
+    free(sync->delta);
+    free(sync->scratch);
+    free(sync);
+}
+
@@ -20,11 +20,18 @@
 #include <common/ioasync.h>
 #include <common/workqueue.h>
 #include <common/idr.h>
+#include <common/rcu.h>
+#include <common/bitmap.h>
+#include <common/cpufeature.h>
 
 
 int common_init(void)
 {
+    cpu_features_init();
+    bitmap_ops_init();
+
     mem_cache_init();
+    rcu_init();
     init_workqueues();
     global_ioasync_init();
     init_timers();
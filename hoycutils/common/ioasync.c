@@ -10,6 +10,10 @@
  *
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE     /* sendmmsg */
+#endif
+
 #include <stdint.h>
 #include <stdarg.h>
 #include <stdio.h>
@@ -28,9 +32,16 @@
 #include <common/workqueue.h>
 
 
+/* addresses in one sendmmsg call. */
+#define IOHANDLER_MMSG_MAX      (64)
+
 struct iopacket {
     struct packet packet;
     struct sockaddr addr;
+
+    /* multicast: sent to each of dst instead, see iohandler_pkt_multicast(). */
+    struct sockaddr *dst;
+    int count;
 };
 
 
@@ -67,6 +78,7 @@ enum iohandler_type {
     HANDLER_TYPE_TCP_ACCEPT,
     HANDLER_TYPE_TCP,
     HANDLER_TYPE_UDP,
+    HANDLER_TYPE_LOCAL,
 };
 
 
@@ -87,14 +99,21 @@ struct iohandler {
     struct list_head entry;
     pthread_mutex_t lock;
     struct ioasync* owner;
+
+    /* the other end of a HANDLER_TYPE_LOCAL pair */
+    struct iohandler *peer;
 };
 
+static void iohandler_in_pack_queue(iohandler_t *ioh, struct iopacket *pack);
+
 static struct iopacket *iohandler_pack_alloc(iohandler_t *ioh, int allocbuf)
 {
     struct iopacket *pkt;
     ioasync_t *aio = ioh->owner;
 
     pkt = (struct iopacket *)mempool_alloc(aio->pkt_pool);
+    pkt->dst = NULL;
+    pkt->count = 0;
     if(allocbuf) {
         pkt->packet.buf = (pack_buf_t *)pack_buf_alloc(aio->buf_pool);
     }
@@ -109,6 +128,7 @@ static void iohandler_pack_free(iohandler_t *ioh, struct iopacket *pkt, int free
     if(freebuf) {
         pack_buf_free(pkt->packet.buf);
     }
+    free(pkt->dst);
     mempool_free(aio->pkt_pool, pkt);
 }
 
@@ -127,10 +147,34 @@ void iohandler_pack_buf_free(pack_buf_t *pkb)
     pack_buf_free(pkb);
 }
 
+/*
+ * local handlers have no fd, the packet is handed over to the input
+ * queue of the peer and handled by its workqueue, as if it were read
+ * from a socket.
+ */
+static void iohandler_local_submit(iohandler_t *ioh, struct iopacket *pack)
+{
+    pthread_mutex_lock(&ioh->lock);
+    if(!ioh->peer) {
+        pthread_mutex_unlock(&ioh->lock);
+        logw("local iohandler not connected, dropped.\n");
+        iohandler_pack_free(ioh, pack, 1);
+        return;
+    }
+
+    iohandler_in_pack_queue(ioh->peer, pack);
+    pthread_mutex_unlock(&ioh->lock);
+}
+
 void iohandler_pack_submit(iohandler_t *ioh, struct iopacket *pack)
 {
     int empty;
 
+    if(ioh->type == HANDLER_TYPE_LOCAL) {
+        iohandler_local_submit(ioh, pack);
+        return;
+    }
+
     pthread_mutex_lock(&ioh->lock);
 
     empty = !queue_count(ioh->q_out);
@@ -164,6 +208,55 @@ void iohandler_pkt_sendto(iohandler_t *ioh, pack_buf_t *pkb, struct sockaddr *to
     iohandler_pack_submit(ioh, pack);
 }
 
+/*
+ * The same buffer to @count addresses. On udp it is one packet in the
+ * queue, written with sendmmsg. The reference of the caller goes with
+ * it as in iohandler_pkt_sendto(), nothing is copied.
+ */
+void iohandler_pkt_multicast(iohandler_t *ioh, pack_buf_t *pkb,
+        struct sockaddr *dst, int count)
+{
+    int i;
+    struct iopacket *pack;
+
+    if(count <= 0) {
+        pack_buf_free(pkb);
+        return;
+    }
+
+    if(count == 1) {
+        iohandler_pkt_sendto(ioh, pkb, dst);
+        return;
+    }
+
+    /* a local peer takes them one by one. */
+    if(ioh->type != HANDLER_TYPE_UDP) {
+        pack_buf_get_n(pkb, count - 1);
+        for(i=0; i<count; i++)
+            iohandler_pkt_sendto(ioh, pkb, &dst[i]);
+        return;
+    }
+
+    pack = iohandler_pack_alloc(ioh, 0);
+    pack->packet.buf = pkb;
+    pack->dst = malloc(sizeof(*dst) * count);
+    if(!pack->dst) {
+        loge("multicast to %d addresses: out of memory, dropped.\n", count);
+        iohandler_pack_free(ioh, pack, 1);
+        return;
+    }
+    memcpy(pack->dst, dst, sizeof(*dst) * count);
+    pack->count = count;
+
+    iohandler_pack_submit(ioh, pack);
+}
+
+/* packets waiting to be handled or sent. */
+int iohandler_queue_depth(iohandler_t *ioh)
+{
+    return queue_count(ioh->q_in) + queue_count(ioh->q_out);
+}
+
 void iohandler_send(iohandler_t *ioh, const uint8_t *data, int len)
 {
     pack_buf_t *pkb;
@@ -191,6 +284,23 @@ static void iohandler_close(iohandler_t *ioh)
 {
     ioasync_t *aio = ioh->owner;
 
+    if(ioh->type == HANDLER_TYPE_LOCAL) {
+        iohandler_t *peer;
+
+        pthread_mutex_lock(&ioh->lock);
+        peer = ioh->peer;
+        ioh->peer = NULL;
+        pthread_mutex_unlock(&ioh->lock);
+
+        /* like a socket, closing one end disconnects the other end. */
+        if(peer) {
+            pthread_mutex_lock(&peer->lock);
+            peer->peer = NULL;
+            pthread_mutex_unlock(&peer->lock);
+            iohandler_close(peer);
+        }
+    }
+
     if(ioh->h_ops.close)
         ioh->h_ops.close(ioh->priv_data);
 
@@ -215,7 +325,7 @@ void iohandler_shutdown(iohandler_t *ioh)
 
     ioh->h_ops.close = NULL;
 
-    q_empty = !!queue_count(ioh->q_out);
+    q_empty = !queue_count(ioh->q_out);
 
     if(q_empty) {
         iohandler_close(ioh);
@@ -315,6 +425,42 @@ fail:
     return -EINVAL;
 }
 
+/* returns the number of addresses sent to. */
+static int iohandler_sendmmsg(int fd, pack_buf_t *pkb, struct sockaddr *dst, int count)
+{
+    int i, n, ret;
+    int sent = 0;
+    struct iovec iov;
+    struct mmsghdr msgs[IOHANDLER_MMSG_MAX];
+
+    iov.iov_base = pack_buf_data(pkb);
+    iov.iov_len = pkb->len;
+
+    while(sent < count) {
+        n = count - sent;
+        if(n > IOHANDLER_MMSG_MAX)
+            n = IOHANDLER_MMSG_MAX;
+
+        memset(msgs, 0, sizeof(msgs[0]) * n);
+        for(i=0; i<n; i++) {
+            msgs[i].msg_hdr.msg_name = &dst[sent + i];
+            msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr);
+            msgs[i].msg_hdr.msg_iov = &iov;
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        ret = sendmmsg(fd, msgs, n, 0);
+        if(ret < 0) {
+            if(errno == EINTR)
+                continue;
+            return sent ? sent : -errno;
+        }
+        sent += ret;
+    }
+
+    return sent;
+}
+
 static int iohandler_write_packet(iohandler_t *ioh, struct iopacket *pkt)
 {
     int len = -EINVAL;
@@ -330,7 +476,7 @@ static int iohandler_write_packet(iohandler_t *ioh, struct iopacket *pkt)
             while(out_pos < pkb->len) {
                 avail = pkb->len - out_pos;
 
-                len = xwrite(ioh->fd, (&pkb->data) + out_pos, avail);
+                len = xwrite(ioh->fd, pack_buf_data(pkb) + out_pos, avail);
                 if(len < 0) 
                     goto fail;
                 out_pos += len;
@@ -340,7 +486,17 @@ static int iohandler_write_packet(iohandler_t *ioh, struct iopacket *pkt)
         case HANDLER_TYPE_UDP:
         {
             pack_buf_t *pkb = pkt->packet.buf;
-            len = sendto(ioh->fd, &pkb->data, pkb->len, 0, 
+
+            if(pkt->dst) {
+                len = iohandler_sendmmsg(ioh->fd, pkb, pkt->dst, pkt->count);
+                if(len < 0)
+                    goto fail;
+                if(len < pkt->count)
+                    logw("multicast sent to %d of %d addresses.\n", len, pkt->count);
+                break;
+            }
+
+            len = sendto(ioh->fd, pack_buf_data(pkb), pkb->len, 0, 
                     &pkt->addr, sizeof(struct sockaddr));
             if(len < 0)
                 goto fail;
@@ -428,6 +584,7 @@ static iohandler_t *ioasync_create_context(ioasync_t *aio, int fd, int type)
     ioh->type = type;
     ioh->flags = 0;
     ioh->closing = 0;
+    ioh->peer = NULL;
 
     /*XXX*/
     ioh->wq = alloc_workqueue(0, WQ_CPU_INTENSIVE);
@@ -443,8 +600,10 @@ static iohandler_t *ioasync_create_context(ioasync_t *aio, int fd, int type)
     list_add(&ioh->entry, &aio->active_list);
     pthread_mutex_unlock(&aio->lock);
 
-    poller_event_add(&aio->poller, fd, iohandler_event, ioh);
-    poller_event_enable(&aio->poller, fd, EV_READ);
+    if(fd >= 0) {
+        poller_event_add(&aio->poller, fd, iohandler_event, ioh);
+        poller_event_enable(&aio->poller, fd, EV_READ);
+    }
     return ioh;
 }
 
@@ -458,7 +617,7 @@ static void iohandler_normal_post(void* priv, struct iopacket *pkt)
         return;
 
     if(ioh->h_ops.handle)
-        ioh->h_ops.handle(ioh->priv_data, pkb->data, pkb->len);
+        ioh->h_ops.handle(ioh->priv_data, pack_buf_data(pkb), pkb->len);
 }
 
 iohandler_t *iohandler_create(ioasync_t *aio, int fd,
@@ -538,7 +697,7 @@ static void iohandler_udp_post(void* priv, struct iopacket *pkt)
         return;
 
     if(ioh->h_ops.handlefrom)
-        ioh->h_ops.handlefrom(ioh->priv_data, pkb->data, pkb->len, &pkt->addr);
+        ioh->h_ops.handlefrom(ioh->priv_data, pack_buf_data(pkb), pkb->len, &pkt->addr);
 }
 
 iohandler_t *iohandler_udp_create(ioasync_t *aio, int fd,
@@ -558,6 +717,48 @@ iohandler_t *iohandler_udp_create(ioasync_t *aio, int fd,
     return ioh;
 }
 
+/*
+ * local iohandler: an in-process channel without fd. Packets sent on one
+ * end are delivered to the handle callback of the connected peer, message
+ * boundaries are kept. Both ends must belong to the same ioasync.
+ */
+iohandler_t *iohandler_local_create(ioasync_t *aio,
+        void (*handle)(void *, uint8_t *, int), void (*close)(void *), void *priv)
+{
+    iohandler_t *ioh;
+
+    ioh = ioasync_create_context(aio, -1, HANDLER_TYPE_LOCAL);
+    if(!ioh)
+        return NULL;
+
+    ioh->h_ops.post = iohandler_normal_post;
+    ioh->h_ops.handle = handle;
+    ioh->h_ops.close = close;
+
+    ioh->priv_data = priv;
+
+    return ioh;
+}
+
+int iohandler_local_connect(iohandler_t *ioh, iohandler_t *peer)
+{
+    if(ioh->type != HANDLER_TYPE_LOCAL || peer->type != HANDLER_TYPE_LOCAL)
+        return -EINVAL;
+
+    if(ioh->owner != peer->owner || ioh == peer)
+        return -EINVAL;
+
+    pthread_mutex_lock(&ioh->lock);
+    ioh->peer = peer;
+    pthread_mutex_unlock(&ioh->lock);
+
+    pthread_mutex_lock(&peer->lock);
+    peer->peer = ioh;
+    pthread_mutex_unlock(&peer->lock);
+
+    return 0;
+}
+
 static void *ioasync_handle(void *args)
 {
     ioasync_t *aio = (ioasync_t *)args;
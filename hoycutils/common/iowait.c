@@ -16,31 +16,37 @@
 #include <errno.h>
 
 #include <common/iowait.h>
-#include <common/hash.h>
 
-#define RES_SLOT_SHIFT          (6)
-#define RES_SLOT_CAPACITY       (1 << RES_SLOT_SHIFT)
-#define RES_SLOT_MASK           (RES_SLOT_CAPACITY - 1)
+#define RES_SLOT_CAPACITY       (64)
 
 int iowait_init(iowait_t *wait)
 {
-    int i;
+    int ret;
+    struct htable_params params =
+        HTABLE_PARAMS(iowait_watcher_t, key, RES_SLOT_CAPACITY);
 
-    pthread_mutex_init(&wait->lock, NULL);
-    wait->slots = malloc(sizeof(struct hlist_head) * RES_SLOT_CAPACITY);
+    ret = htable_init(&wait->watchers, &params);
+    if(ret)
+        return ret;
 
-    for (i = 0; i < RES_SLOT_CAPACITY; i++)
-        INIT_HLIST_HEAD(&wait->slots[i]);
+    pthread_mutex_init(&wait->lock, NULL);
     return 0;
 }
 
-static struct hlist_head *watcher_slot_head(iowait_t *wait, int type, int seq)
+void iowait_destroy(iowait_t *wait)
 {
-    unsigned long key;
+    htable_destroy(&wait->watchers);
+    pthread_mutex_destroy(&wait->lock);
+}
 
-    key = type << 16 | seq;
-    key = hash_long(key, RES_SLOT_SHIFT);
-    return &wait->slots[key];
+static iowait_watcher_t *find_watcher(iowait_t *wait, int type, int seq)
+{
+    iowait_watcher_t *watcher;
+
+    pthread_mutex_lock(&wait->lock);
+    watcher = htable_lookup(&wait->watchers, IOWAIT_KEY(type, seq));
+    pthread_mutex_unlock(&wait->lock);
+    return watcher;
 }
 
 void iowait_watcher_init(iowait_watcher_t *watcher, 
@@ -50,21 +56,21 @@ void iowait_watcher_init(iowait_watcher_t *watcher,
     watcher->seq = seq;
     watcher->res = result;
     watcher->count = count;
+    watcher->key = IOWAIT_KEY(type, seq);
 
     init_completion(&watcher->done);
 }
 
+/* returns -EEXIST if a watcher is already waiting for the same type and seq. */
 int iowait_register_watcher(iowait_t *wait, iowait_watcher_t *watcher)
 {
-    struct hlist_head *rsh;
-
-    rsh = watcher_slot_head(wait, watcher->type, watcher->seq);
+    int ret;
 
     pthread_mutex_lock(&wait->lock);
-    hlist_add_head(&watcher->hentry, rsh);
+    ret = htable_insert(&wait->watchers, watcher);
     pthread_mutex_unlock(&wait->lock);
 
-	return 0;
+	return ret;
 }
 
 int wait_for_response_data(iowait_t *wait, iowait_watcher_t *watcher, int *res)
@@ -77,7 +83,8 @@ int wait_for_response_data(iowait_t *wait, iowait_watcher_t *watcher, int *res)
 		*res = watcher->count;
 
     pthread_mutex_lock(&wait->lock);
-    hlist_del_init(&watcher->hentry);
+    if(htable_lookup(&wait->watchers, watcher->key) == watcher)
+        htable_remove(&wait->watchers, watcher->key);
     pthread_mutex_unlock(&wait->lock);
     return ret;
 }
@@ -86,23 +93,12 @@ int wait_for_response_data(iowait_t *wait, iowait_watcher_t *watcher, int *res)
 int post_response_data(iowait_t *wait, int type, int seq, 
         void *result, int count)
 {
-    iowait_watcher_t *watcher = NULL;
-    struct hlist_head *rsh;
-    struct hlist_node *tmp;
+    iowait_watcher_t *watcher;
 
-    rsh = watcher_slot_head(wait, type, seq);
+    watcher = find_watcher(wait, type, seq);
+    if(!watcher)
+        return -EINVAL;
 
-    pthread_mutex_lock(&wait->lock);
-    hlist_for_each_entry(watcher, tmp, rsh, hentry) {
-        if(watcher->type == type && watcher->seq == seq) {
-            pthread_mutex_unlock(&wait->lock);
-            goto found; 
-        }
-    }
-    pthread_mutex_unlock(&wait->lock);
-    return -EINVAL;
-
-found:
     if((watcher->count == 0) || 
             (watcher->count != 0 && watcher->count > count))
         watcher->count = count;
@@ -123,23 +119,12 @@ int wait_for_response(iowait_t *wait, iowait_watcher_t *watcher)
 int post_response(iowait_t *wait, int type, int seq, void *result,
         void (*fn)(void *dst, void *src))
 {
-    struct hlist_head *rsh;
-    struct hlist_node *r;
     iowait_watcher_t *watcher;
 
-    rsh = watcher_slot_head(wait, type, seq);
-
-    pthread_mutex_lock(&wait->lock);
-    hlist_for_each_entry(watcher, r, rsh, hentry) {
-        if(watcher->type == type && watcher->seq == seq) {
-            pthread_mutex_unlock(&wait->lock);
-            goto found; 
-        }
-    }
-    pthread_mutex_unlock(&wait->lock);
-    return -EINVAL;
+    watcher = find_watcher(wait, type, seq);
+    if(!watcher)
+        return -EINVAL;
 
-found:
     fn(watcher->res, result);
 
     complete(&watcher->done);
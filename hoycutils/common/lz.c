@@ -0,0 +1,267 @@
+/*
+ * common/lz.c
+ *
+ * 2016-01-01  written by Hoyleeson <hoyleeson@gmail.com>
+ *	Copyright (C) 2015-2016 by Hoyleeson.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; version 2.
+ *
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include <common/lz.h>
+
+/*
+ * sequence: token, [literal length bytes], literals, offset (le16),
+ * [match length bytes]. The token keeps the literal length in the high
+ * nibble and the match length - LZ_MIN_MATCH in the low one, 15 means
+ * more length bytes follow, each adding up to 255. The last sequence
+ * has literals only.
+ */
+#define LZ_MIN_MATCH        (4)
+#define LZ_MAX_OFFSET       (65535)
+#define LZ_HASH_BITS        (14)
+/* no match starts in the last bytes, they go out as literals. */
+#define LZ_MF_LIMIT         (12)
+#define LZ_LAST_LITERALS    (5)
+/* the search step grows while nothing matches, incompressible data is cheap. */
+#define LZ_SKIP_TRIGGER     (6)
+
+#define LZ_RUN_MASK         (15)
+
+
+static inline uint32_t lz_read32(const uint8_t *p)
+{
+    uint32_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t lz_read64(const uint8_t *p)
+{
+    uint64_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t lz_hash(uint32_t v)
+{
+    return (v * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+/* number of equal bytes at @p and @ref, not going past @limit. */
+static inline int lz_match_len(const uint8_t *p, const uint8_t *ref,
+        const uint8_t *limit)
+{
+    const uint8_t *start = p;
+    uint64_t diff;
+
+    while(p + sizeof(uint64_t) <= limit) {
+        diff = lz_read64(p) ^ lz_read64(ref);
+        if(diff) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            return p - start + (__builtin_ctzll(diff) >> 3);
+#else
+            return p - start + (__builtin_clzll(diff) >> 3);
+#endif
+        }
+        p += sizeof(uint64_t);
+        ref += sizeof(uint64_t);
+    }
+
+    while(p < limit && *p == *ref) {
+        p++;
+        ref++;
+    }
+    return p - start;
+}
+
+static inline uint8_t *lz_put_len(uint8_t *op, int len)
+{
+    for(; len >= 255; len -= 255)
+        *op++ = 255;
+    *op++ = len;
+    return op;
+}
+
+/* token with the literal length, then the literals. */
+static inline uint8_t *lz_put_literals(uint8_t *op, uint8_t **token,
+        const uint8_t *anchor, int litlen)
+{
+    *token = op++;
+    if(litlen >= LZ_RUN_MASK) {
+        **token = LZ_RUN_MASK << 4;
+        op = lz_put_len(op, litlen - LZ_RUN_MASK);
+    } else {
+        **token = litlen << 4;
+    }
+    memcpy(op, anchor, litlen);
+    return op + litlen;
+}
+
+int lz_compress(const void *src, int len, void *dst, int dstlen)
+{
+    uint32_t table[1 << LZ_HASH_BITS];
+    const uint8_t *base = src;
+    const uint8_t *ip = base, *anchor = base, *ref;
+    const uint8_t *iend = base + len;
+    const uint8_t *mflimit = iend - LZ_MF_LIMIT;
+    const uint8_t *matchlimit = iend - LZ_LAST_LITERALS;
+    uint8_t *op = dst, *oend = op + dstlen;
+    uint8_t *token;
+    uint32_t h;
+    int litlen, mlen, off, step;
+
+    if(len < 0)
+        return -EINVAL;
+    if(len <= LZ_MF_LIMIT)
+        goto last_literals;
+
+    memset(table, 0, sizeof(table));
+    table[lz_hash(lz_read32(ip))] = 0;
+    ip++;
+
+    for(;;) {
+        step = 1 << LZ_SKIP_TRIGGER;
+        for(;;) {
+            if(ip > mflimit)
+                goto last_literals;
+
+            h = lz_hash(lz_read32(ip));
+            ref = base + table[h];
+            table[h] = ip - base;
+            if(ref < ip && ip - ref <= LZ_MAX_OFFSET &&
+                    lz_read32(ref) == lz_read32(ip))
+                break;
+            ip += step++ >> LZ_SKIP_TRIGGER;
+        }
+
+        while(ip > anchor && ref > base && ip[-1] == ref[-1]) {
+            ip--;
+            ref--;
+        }
+
+        mlen = LZ_MIN_MATCH + lz_match_len(ip + LZ_MIN_MATCH,
+                ref + LZ_MIN_MATCH, matchlimit);
+        litlen = ip - anchor;
+        off = ip - ref;
+
+        if(op + 1 + litlen + litlen / 255 + 2 + mlen / 255 + 1 > oend)
+            return -ENOSPC;
+
+        op = lz_put_literals(op, &token, anchor, litlen);
+        *op++ = off;
+        *op++ = off >> 8;
+
+        if(mlen - LZ_MIN_MATCH >= LZ_RUN_MASK) {
+            *token |= LZ_RUN_MASK;
+            op = lz_put_len(op, mlen - LZ_MIN_MATCH - LZ_RUN_MASK);
+        } else {
+            *token |= mlen - LZ_MIN_MATCH;
+        }
+
+        ip += mlen;
+        anchor = ip;
+        if(ip > mflimit)
+            break;
+
+        /* the bytes just matched are likely to match again. */
+        table[lz_hash(lz_read32(ip - 2))] = ip - 2 - base;
+    }
+
+last_literals:
+    litlen = iend - anchor;
+    if(op + 1 + litlen + litlen / 255 > oend)
+        return -ENOSPC;
+
+    op = lz_put_literals(op, &token, anchor, litlen);
+
+    return op - (uint8_t *)dst;
+}
+
+static inline int lz_get_len(const uint8_t **ip, const uint8_t *iend, int *len)
+{
+    const uint8_t *p = *ip;
+    int c;
+
+    do {
+        if(p >= iend)
+            return -EINVAL;
+        c = *p++;
+        *len += c;
+        if(*len < 0)
+            return -EINVAL;
+    } while(c == 255);
+
+    *ip = p;
+    return 0;
+}
+
+int lz_decompress(const void *src, int len, void *dst, int dstlen)
+{
+    const uint8_t *ip = src, *iend = ip + len;
+    uint8_t *op = dst, *oend = op + dstlen;
+    const uint8_t *match;
+    int token, litlen, mlen, off, n;
+
+    while(ip < iend) {
+        token = *ip++;
+
+        litlen = token >> 4;
+        if(litlen == LZ_RUN_MASK && lz_get_len(&ip, iend, &litlen))
+            return -EINVAL;
+        if(litlen > iend - ip || litlen > oend - op)
+            return -EINVAL;
+        memcpy(op, ip, litlen);
+        ip += litlen;
+        op += litlen;
+
+        /* the last sequence ends with its literals. */
+        if(ip == iend)
+            break;
+
+        if(iend - ip < 2)
+            return -EINVAL;
+        off = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if(!off || off > op - (uint8_t *)dst)
+            return -EINVAL;
+
+        mlen = token & LZ_RUN_MASK;
+        if(mlen == LZ_RUN_MASK && lz_get_len(&ip, iend, &mlen))
+            return -EINVAL;
+        mlen += LZ_MIN_MATCH;
+        if(mlen > oend - op)
+            return -EINVAL;
+
+        match = op - off;
+        if(off >= mlen) {
+            memcpy(op, match, mlen);
+            op += mlen;
+            continue;
+        }
+
+        /*
+         * overlapping: what lies between match and op repeats with
+         * period off, so it can be copied forward in growing chunks.
+         */
+        while(mlen) {
+            n = op - match;
+            if(n > mlen)
+                n = mlen;
+            memcpy(op, match, n);
+            op += n;
+            mlen -= n;
+        }
+    }
+
+    return op - (uint8_t *)dst;
+}
+
@@ -11,7 +11,10 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
 
+#include <common/core.h>
 #include <common/log.h>
 #include <common/pack_head.h>
 
@@ -46,3 +49,109 @@ void free_pack(pack_head_t *pack)
     free(pack);
 }
 
+void pack_stream_init(struct pack_stream *ps)
+{
+    ps->buf = NULL;
+    ps->len = 0;
+    ps->size = 0;
+}
+
+void pack_stream_release(struct pack_stream *ps)
+{
+    free(ps->buf);
+    pack_stream_init(ps);
+}
+
+static int pack_stream_append(struct pack_stream *ps, uint8_t *data, int len)
+{
+    int size;
+    uint8_t *buf;
+
+    if(ps->len + len > ps->size) {
+        size = ps->size ? ps->size : pack_head_len();
+        while(size < ps->len + len)
+            size *= 2;
+
+        buf = realloc(ps->buf, size);
+        if(!buf)
+            return -ENOMEM;
+        ps->buf = buf;
+        ps->size = size;
+    }
+
+    memcpy(ps->buf + ps->len, data, len);
+    ps->len += len;
+    return 0;
+}
+
+/* the length of the pack at @head, -EINVAL if it cannot be one. */
+static inline int pack_stream_plen(pack_head_t *head)
+{
+    if(head->datalen > PACK_STREAM_MAX_LEN - pack_head_len())
+        return -EINVAL;
+    return pack_head_len() + head->datalen;
+}
+
+int pack_stream_input(struct pack_stream *ps, uint8_t *data, int len,
+        void (*fn)(void *opaque, uint8_t *pack, int len), void *opaque)
+{
+    int n, plen, ret;
+
+    /* complete the kept pack first, its header may be cut too. */
+    if(ps->len) {
+        if(ps->len < pack_head_len()) {
+            n = min_t(int, len, pack_head_len() - ps->len);
+            ret = pack_stream_append(ps, data, n);
+            if(ret)
+                goto drop;
+            data += n;
+            len -= n;
+            if(ps->len < pack_head_len())
+                return 0;
+        }
+
+        plen = pack_stream_plen((pack_head_t *)ps->buf);
+        if(plen < 0) {
+            ret = plen;
+            goto drop;
+        }
+
+        n = min(len, plen - ps->len);
+        ret = pack_stream_append(ps, data, n);
+        if(ret)
+            goto drop;
+        data += n;
+        len -= n;
+        if(ps->len < plen)
+            return 0;
+
+        fn(opaque, ps->buf, plen);
+        ps->len = 0;
+    }
+
+    while(len >= (int)pack_head_len()) {
+        plen = pack_stream_plen((pack_head_t *)data);
+        if(plen < 0)
+            goto corrupt;
+        if(plen > len)
+            break;
+
+        fn(opaque, data, plen);
+        data += plen;
+        len -= plen;
+    }
+
+    if(len > 0) {
+        ret = pack_stream_append(ps, data, len);
+        if(ret)
+            goto drop;
+    }
+    return 0;
+
+corrupt:
+    ret = -EINVAL;
+drop:
+    loge("pack stream: %s, %d bytes dropped.\n", strerror(-ret), ps->len + len);
+    ps->len = 0;
+    return ret;
+}
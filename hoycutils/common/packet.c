@@ -43,6 +43,7 @@ pack_buf_t *pack_buf_alloc(pack_buf_pool_t *pool)
     pkb = mempool_alloc(pool->pool);
 
     pkb->owner = pool;
+    pkb->ofs = 0;
     fake_atomic_init(&pkb->refcount, 1); 
 
     return pkb;
@@ -54,6 +55,13 @@ pack_buf_t *pack_buf_get(pack_buf_t *pkb)
     return pkb;
 }
 
+/* @n references at once, one for each packet sent from the same buffer. */
+pack_buf_t *pack_buf_get_n(pack_buf_t *pkb, int n)
+{
+    fake_atomic_add(n, &pkb->refcount);
+    return pkb;
+}
+
 void pack_buf_free(pack_buf_t *pkb)
 {
     if(fake_atomic_dec_and_test(&pkb->refcount)) {
@@ -0,0 +1,232 @@
+/*
+ * common/rcu.c
+ * 
+ * 2016-01-01  written by Hoyleeson <hoyleeson@gmail.com>
+ *	Copyright (C) 2015-2016 by Hoyleeson.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; version 2.
+ *
+ * Userspace read-copy-update, epoch based. See include/common/rcu.h.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sched.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include <common/log.h>
+#include <common/rcu.h>
+#include <common/completion.h>
+
+/* callbacks are handled in batches, wait a bit to let a batch build up. */
+#define RCU_BATCH_DELAY_MS 	(10)
+#define RCU_BATCH_HIGH 		(1024)
+
+/* 0 means "not in a critical section", so counting starts from 1. */
+unsigned long rcu_gp_ctr = 1;
+__thread struct rcu_reader rcu_reader;
+
+/* protects the reader registry and serializes grace periods. */
+static pthread_mutex_t rcu_gp_lock = PTHREAD_MUTEX_INITIALIZER;
+static LIST_HEAD(rcu_registry);
+
+static pthread_key_t rcu_key;
+static pthread_once_t rcu_key_once = PTHREAD_ONCE_INIT;
+
+static pthread_mutex_t rcu_cb_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t rcu_cb_cond = PTHREAD_COND_INITIALIZER;
+static struct rcu_head *rcu_cb_head;
+static struct rcu_head **rcu_cb_tail = &rcu_cb_head;
+static int rcu_cb_count;
+
+
+static void rcu_thread_exit(void *arg)
+{
+    rcu_unregister_thread();
+}
+
+static void rcu_key_init(void)
+{
+    pthread_key_create(&rcu_key, rcu_thread_exit);
+}
+
+void rcu_register_thread(void)
+{
+    struct rcu_reader *r = &rcu_reader;
+
+    if(r->registered)
+        return;
+
+    pthread_once(&rcu_key_once, rcu_key_init);
+    /* any non-NULL value, just to get the destructor called. */
+    pthread_setspecific(rcu_key, r);
+
+    r->ctr = 0;
+    r->nesting = 0;
+
+    pthread_mutex_lock(&rcu_gp_lock);
+    list_add(&r->entry, &rcu_registry);
+    r->registered = 1;
+    pthread_mutex_unlock(&rcu_gp_lock);
+}
+
+void rcu_unregister_thread(void)
+{
+    struct rcu_reader *r = &rcu_reader;
+
+    if(!r->registered)
+        return;
+
+    BUG_ON(r->nesting);
+
+    pthread_mutex_lock(&rcu_gp_lock);
+    list_del(&r->entry);
+    r->registered = 0;
+    pthread_mutex_unlock(&rcu_gp_lock);
+}
+
+static inline int rcu_reader_in_old_epoch(struct rcu_reader *r, unsigned long gp)
+{
+    unsigned long ctr = __atomic_load_n(&r->ctr, __ATOMIC_ACQUIRE);
+
+    return ctr && ctr != gp;
+}
+
+/**
+ * synchronize_rcu - wait until a grace period has elapsed
+ *
+ * On return, every read-side critical section which was running when
+ * synchronize_rcu() was called has completed. Must not be called from
+ * inside a read-side critical section.
+ */
+void synchronize_rcu(void)
+{
+    unsigned long gp;
+    struct rcu_reader *r;
+    int spins;
+
+    BUG_ON(rcu_reader.nesting);
+
+    pthread_mutex_lock(&rcu_gp_lock);
+
+    /* order the removals done by the caller before the epoch change. */
+    smp_mb();
+    gp = rcu_gp_ctr + 1;
+    if(!gp)
+        gp = 1;
+    __atomic_store_n(&rcu_gp_ctr, gp, __ATOMIC_SEQ_CST);
+    smp_mb();
+
+    list_for_each_entry(r, &rcu_registry, entry) {
+        spins = 0;
+        while(rcu_reader_in_old_epoch(r, gp)) {
+            if(++spins < 100)
+                sched_yield();
+            else
+                usleep(1000);
+        }
+    }
+
+    /* order the readers' accesses before the caller frees memory. */
+    smp_mb();
+    pthread_mutex_unlock(&rcu_gp_lock);
+}
+
+/**
+ * call_rcu - queue a callback to be invoked after a grace period
+ * @head: structure to be used for queueing the RCU updates.
+ * @func: actual callback function to be invoked after the grace period
+ *
+ * Never blocks on readers, can be called from anywhere, including
+ * read-side critical sections.
+ */
+void call_rcu(struct rcu_head *head, void (*func)(struct rcu_head *head))
+{
+    head->func = func;
+    head->next = NULL;
+
+    pthread_mutex_lock(&rcu_cb_lock);
+    *rcu_cb_tail = head;
+    rcu_cb_tail = &head->next;
+    if(rcu_cb_count++ == 0 || rcu_cb_count >= RCU_BATCH_HIGH)
+        pthread_cond_signal(&rcu_cb_cond);
+    pthread_mutex_unlock(&rcu_cb_lock);
+}
+
+struct rcu_barrier_head {
+    struct rcu_head head;
+    struct completion done;
+};
+
+static void rcu_barrier_func(struct rcu_head *head)
+{
+    struct rcu_barrier_head *barrier;
+
+    barrier = container_of(head, struct rcu_barrier_head, head);
+    complete(&barrier->done);
+}
+
+/**
+ * rcu_barrier - wait for all queued call_rcu() callbacks to complete
+ */
+void rcu_barrier(void)
+{
+    struct rcu_barrier_head barrier;
+
+    init_completion(&barrier.done);
+    call_rcu(&barrier.head, rcu_barrier_func);
+    wait_for_completion(&barrier.done);
+}
+
+static void *rcu_reclaim_thread(void *args)
+{
+    struct rcu_head *list, *next;
+
+    for(;;) {
+        pthread_mutex_lock(&rcu_cb_lock);
+        while(!rcu_cb_count)
+            pthread_cond_wait(&rcu_cb_cond, &rcu_cb_lock);
+
+        if(rcu_cb_count < RCU_BATCH_HIGH) {
+            pthread_mutex_unlock(&rcu_cb_lock);
+            usleep(RCU_BATCH_DELAY_MS * 1000);
+            pthread_mutex_lock(&rcu_cb_lock);
+        }
+
+        list = rcu_cb_head;
+        rcu_cb_head = NULL;
+        rcu_cb_tail = &rcu_cb_head;
+        rcu_cb_count = 0;
+        pthread_mutex_unlock(&rcu_cb_lock);
+
+        synchronize_rcu();
+
+        for(; list; list = next) {
+            next = list->next;
+            list->func(list);
+        }
+    }
+
+    return 0;
+}
+
+int rcu_init(void)
+{
+    int ret;
+    pthread_t thread;
+
+    ret = pthread_create(&thread, NULL, rcu_reclaim_thread, NULL);
+    if(ret) {
+        loge("create rcu reclaim thread failed.\n");
+        return -EINVAL;
+    }
+
+    pthread_detach(thread);
+    return 0;
+}
+
@@ -36,8 +36,11 @@
 
 #define LISTEN_BACKLOG 4
 
-/* open listen() port on any interface */
-int socket_inaddr_any_server(int port, int type)
+#ifndef SO_REUSEPORT
+#define SO_REUSEPORT    (15)
+#endif
+
+static int socket_inaddr_any_bind(int port, int type, int reuseport)
 {
     struct sockaddr_in addr;
     int s, n;
@@ -52,6 +55,10 @@ int socket_inaddr_any_server(int port, int type)
 
     n = 1;
     setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &n, sizeof(n));
+    if(reuseport && setsockopt(s, SOL_SOCKET, SO_REUSEPORT, &n, sizeof(n)) < 0) {
+        close(s);
+        return -1;
+    }
 
     if(bind(s, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
         close(s);
@@ -73,6 +80,22 @@ int socket_inaddr_any_server(int port, int type)
 }
 
 
+/* open listen() port on any interface */
+int socket_inaddr_any_server(int port, int type)
+{
+    return socket_inaddr_any_bind(port, type, 0);
+}
+
+/*
+ * like socket_inaddr_any_server(), the port can be shared by more
+ * sockets of the same user, the kernel spreads the traffic over them.
+ */
+int socket_reuseport_server(int port, int type)
+{
+    return socket_inaddr_any_bind(port, type, 1);
+}
+
+
 /* Connect to port on the IP interface. type is
  * SOCK_STREAM or SOCK_DGRAM. 
  * return is a file descriptor or -1 on error
@@ -118,3 +141,30 @@ int socket_network_client(const char *host, int port, int type)
 
 }
 
+/*
+ * Path MTU towards @addr as the kernel knows it, from a connected udp
+ * socket with path MTU discovery on. return is the MTU or -1 on error.
+ */
+int socket_path_mtu(const struct sockaddr_in *addr)
+{
+#if defined(IP_MTU) && defined(IP_MTU_DISCOVER)
+    int s, mtu, val = IP_PMTUDISC_DO;
+    socklen_t len = sizeof(mtu);
+
+    s = socket(AF_INET, SOCK_DGRAM, 0);
+    if(s < 0) return -1;
+
+    setsockopt(s, IPPROTO_IP, IP_MTU_DISCOVER, &val, sizeof(val));
+
+    if(connect(s, (const struct sockaddr *)addr, sizeof(*addr)) < 0 ||
+            getsockopt(s, IPPROTO_IP, IP_MTU, &mtu, &len) < 0) {
+        close(s);
+        return -1;
+    }
+
+    close(s);
+    return mtu;
+#else
+    return -1;
+#endif
+}
@@ -16,6 +16,7 @@
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
+#include <sched.h>
 
 #include <common/timer.h>
 #include <common/ioasync.h>
@@ -28,6 +29,7 @@ struct timer_base {
 
     pthread_mutex_t lock;
     uint64_t next_expires;
+    struct timer_list *running_timer;
 };
 
 struct timer_base _timers;
@@ -45,6 +47,9 @@ static void timer_set_interval(struct timer_list *timer, uint64_t expires)
 
     itval.it_value.tv_sec = i_sec;
     itval.it_value.tv_nsec = i_msec * NSEC_PER_MSEC;
+    /* a zero value disarms the timer, due now means as soon as possible. */
+    if(!expires)
+        itval.it_value.tv_nsec = 1;
 
     logv("timer set interval:sec:%d, msec:%d\n", i_sec, i_msec);
     if (timerfd_settime(base->clockid, 0, &itval, NULL) == -1)
@@ -56,7 +61,7 @@ static void timer_set_expires(struct timer_list *timer, uint64_t expires) {
     struct timer_base *base = timer->base;
 
     base->next_expires = expires;
-    timer_set_interval(timer, expires - now);
+    timer_set_interval(timer, time_after(expires, now) ? expires - now : 0);
 }
 
 static void update_timer_recent_expires(struct timer_base *base) 
@@ -68,7 +73,8 @@ static void update_timer_recent_expires(struct timer_base *base)
     if(RB_EMPTY_ROOT(root))
         return;
 
-    recent = rb_entry(root->rb_node, struct timer_list, entry);
+    /* the leftmost node expires first. */
+    recent = rb_entry(rb_first(root), struct timer_list, entry);
 
     if(time_before(recent->expires, base->next_expires) ||
             time_before_eq(base->next_expires, now)) {
@@ -109,14 +115,17 @@ static void timer_erase_tree(struct timer_list *timer)
     if(!RB_EMPTY_NODE(&timer->entry)) {
         struct timer_base* base = timer->base;
 
-        rb_erase_init(&timer->entry, &base->timer_tree);
+        /* the next timer with the same expires takes over the node. */
         if(!list_empty(&timer->list)) {
-            struct timer_list *entry = NULL;
+            struct timer_list *entry;
+
             entry = list_entry(timer->list.next, struct timer_list, list);
-            timer_insert_tree(entry);
-			list_del_init(&timer->list);
-			return;
+            list_del_init(&timer->list);
+            rb_replace_node(&timer->entry, &entry->entry, &base->timer_tree);
+            RB_CLEAR_NODE(&timer->entry);
+            return;
         }
+        rb_erase_init(&timer->entry, &base->timer_tree);
     }
 
     list_del_init(&timer->list);
@@ -133,12 +142,8 @@ static inline void detach_timer(struct timer_list *timer)
 static int internal_add_timer(struct timer_list* timer)
 {
     struct timer_base* base = timer->base;
-    uint64_t expires = timer->expires;
-    uint64_t now = curr_time_ms();
-
-    if(time_before(expires, now))
-        return -EINVAL;
 
+    /* an expires already past runs as soon as possible, like a due one. */
     timer_insert_tree(timer);
 
     update_timer_recent_expires(base);
@@ -223,6 +228,32 @@ int del_timer(struct timer_list *timer)
     return ret;
 }
 
+/*
+ * del_timer_sync - deactivate a timer and wait for the handler to finish.
+ * The handler may rearm the timer, it is deleted again then. Must not
+ * be called from the timer's own handler.
+ */
+int del_timer_sync(struct timer_list *timer)
+{
+    int ret = 0;
+    struct timer_base* base = timer->base;
+
+    for(;;) {
+        pthread_mutex_lock(&base->lock);
+        if(timer_pending(timer)) {
+            detach_timer(timer);
+            update_timer_recent_expires(base);
+            ret = 1;
+        }
+        if(base->running_timer != timer) {
+            pthread_mutex_unlock(&base->lock);
+            return ret;
+        }
+        pthread_mutex_unlock(&base->lock);
+        sched_yield();
+    }
+}
+
 #define trace_timer_expire_entry(timer)
 #define trace_timer_expire_exit(timer)
 
@@ -236,7 +267,7 @@ static void call_timer_fn(struct timer_list *timer,
 
 static void run_timers(struct timer_base* base)
 {
-    struct timer_list *timer, *tmp;
+    struct timer_list *timer;
     uint64_t now = curr_time_ms();
     struct rb_root *root = &base->timer_tree;
     struct rb_node *node;
@@ -247,33 +278,26 @@ next:
 	if(RB_EMPTY_ROOT(root))
 		goto empty;
 
-    node = root->rb_node;
+    node = rb_first(root);
     timer = rb_entry(node, struct timer_list, entry);
 
     if(time_before_eq(timer->expires, now)) {
         void (*fn)(unsigned long);
         unsigned long data;
-        struct list_head *l;
 
         fn = timer->function;
         data = timer->data;
-        l = &timer->list;
 
-        rb_erase_init(&timer->entry, &base->timer_tree);
+        /* one at a time, the handler may add or delete timers. */
+        detach_timer(timer);
 
+        base->running_timer = timer;
         pthread_mutex_unlock(&base->lock);
 
         call_timer_fn(timer, fn, data);
 
-        list_for_each_entry_safe(timer, tmp, l, list) {
-            fn = timer->function;
-            data = timer->data;
-            list_del_init(&timer->list);
-
-            call_timer_fn(timer, fn, data);
-        }
-
         pthread_mutex_lock(&base->lock);
+        base->running_timer = NULL;
 
 		goto next;
     }
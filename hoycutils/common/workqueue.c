@@ -899,6 +899,9 @@ static void *worker_thread(void *__worker)
     struct global_wq *gwq = worker->gwq;
     struct hlist_head *bwh;
 
+    /* the thread runs as soon as it is created, wait for start_worker(). */
+    wait_event(worker->waitq, worker->flags & WORKER_STARTED);
+
 woke_up:
     pthread_mutex_lock(&gwq->lock);
 
@@ -116,6 +116,52 @@ extern int __bitmap_subset(const unsigned long *bitmap1,
 			const unsigned long *bitmap2, unsigned int nbits);
 extern int __bitmap_weight(const unsigned long *bitmap, unsigned int nbits);
 
+/*
+ * Word array kernels with SIMD variants. bitmap_ops_init() points
+ * bitmap_ops at the fastest table the cpu supports, until then (and on
+ * non-x86 builds) the generic C versions are used.
+ */
+struct bitmap_ops {
+	const char *name;
+	unsigned long features;		/* CPU_FEATURE() mask required */
+
+	unsigned long (*find_next_bit)(const unsigned long *addr,
+			unsigned long nbits, unsigned long start, unsigned long invert);
+	int (*and_bits)(unsigned long *dst, const unsigned long *bitmap1,
+			const unsigned long *bitmap2, unsigned int nbits);
+	void (*or_bits)(unsigned long *dst, const unsigned long *bitmap1,
+			const unsigned long *bitmap2, unsigned int nbits);
+	void (*xor_bits)(unsigned long *dst, const unsigned long *bitmap1,
+			const unsigned long *bitmap2, unsigned int nbits);
+	int (*andnot_bits)(unsigned long *dst, const unsigned long *bitmap1,
+			const unsigned long *bitmap2, unsigned int nbits);
+	int (*weight)(const unsigned long *bitmap, unsigned int nbits);
+	unsigned int (*weight32)(unsigned int w);
+	unsigned long (*weight64)(uint64_t w);
+};
+
+/* smaller bitmaps skip bitmap_ops, the generic code is faster on them. */
+#define BITMAP_OPS_MIN_BITS	(8 * BITS_PER_LONG)
+
+extern const struct bitmap_ops *bitmap_ops;
+/* all tables, generic first, NULL terminated. */
+extern const struct bitmap_ops *bitmap_ops_table[];
+
+void bitmap_ops_init(void);
+int bitmap_ops_usable(const struct bitmap_ops *ops);
+
+extern unsigned long _find_next_bit_generic(const unsigned long *addr,
+		unsigned long nbits, unsigned long start, unsigned long invert);
+extern int __bitmap_and_generic(unsigned long *dst, const unsigned long *bitmap1,
+			const unsigned long *bitmap2, unsigned int nbits);
+extern void __bitmap_or_generic(unsigned long *dst, const unsigned long *bitmap1,
+			const unsigned long *bitmap2, unsigned int nbits);
+extern void __bitmap_xor_generic(unsigned long *dst, const unsigned long *bitmap1,
+			const unsigned long *bitmap2, unsigned int nbits);
+extern int __bitmap_andnot_generic(unsigned long *dst, const unsigned long *bitmap1,
+			const unsigned long *bitmap2, unsigned int nbits);
+extern int __bitmap_weight_generic(const unsigned long *bitmap, unsigned int nbits);
+
 extern void bitmap_set(unsigned long *map, unsigned int start, int len);
 extern void bitmap_clear(unsigned long *map, unsigned int start, int len);
 
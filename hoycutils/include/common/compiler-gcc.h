@@ -19,5 +19,19 @@
 
 #define barrier() __asm__ __volatile__("": : :"memory")
 
+/*
+ * SMP memory ordering, mapped onto the gcc __atomic builtins. Used by the
+ * lock-free single-producer/single-consumer paths (see fifo.h).
+ */
+#define smp_mb()    __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define smp_rmb()   __atomic_thread_fence(__ATOMIC_ACQUIRE)
+#define smp_wmb()   __atomic_thread_fence(__ATOMIC_RELEASE)
+
+#define smp_load_acquire(p)         __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define smp_store_release(p, v)     __atomic_store_n(p, v, __ATOMIC_RELEASE)
+
+#define READ_ONCE(x)        (*(volatile typeof(x) *)&(x))
+#define WRITE_ONCE(x, val)  do { *(volatile typeof(x) *)&(x) = (val); } while(0)
+
 #endif
 
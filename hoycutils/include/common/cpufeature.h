@@ -0,0 +1,38 @@
+/*
+ * include/common/cpufeature.h
+ * 
+ * 2016-01-01  written by Hoyleeson <hoyleeson@gmail.com>
+ *	Copyright (C) 2015-2016 by Hoyleeson.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; version 2.
+ *
+ * Runtime cpu feature detection.
+ *
+ */
+
+#ifndef _COMMON_CPUFEATURE_H_
+#define _COMMON_CPUFEATURE_H_
+
+enum {
+	X86_FEATURE_SSE2,
+	X86_FEATURE_POPCNT,
+	X86_FEATURE_AVX2,
+	NR_CPU_FEATURES,
+};
+
+#define CPU_FEATURE(f) 	(1UL << (f))
+
+/* filled by cpu_features_init(), 0 on non-x86 builds. */
+extern unsigned long cpu_features;
+
+void cpu_features_init(void);
+
+static inline int cpu_has(int feature)
+{
+	return !!(cpu_features & CPU_FEATURE(feature));
+}
+
+#endif
+
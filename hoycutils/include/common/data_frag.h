@@ -19,15 +19,24 @@
 /* Reference */
 typedef struct _frag {
     uint16_t id;
-    uint32_t frag:1;
-    uint32_t mf:1;
-    uint32_t frag_ofs:20;    /* max data len: 1MB */
-    uint32_t datalen:10;     /* packet len */
+    uint8_t frag:1;
+    uint8_t mf:1;
+    uint8_t _reserved:6;
+    uint16_t fraglen;       /* fragment size of this data */
+    uint16_t datalen;       /* packet len */
+    uint32_t frag_ofs;
     uint8_t data[0];
 } frag_t;
 
+/* fragment sizes, the largest one fits frag_t.fraglen. */
+#define FRAG_MIN_LEN        (64)
+#define FRAG_MAX_LEN        (65535)
+
 typedef struct _data_vec {
     int seq;
+    int src;        /* sender, tells apart data from several senders */
+    int fraglen;    /* the sender's fragment size, 0: the receiver's */
+    int parity;     /* FEC parity of a group, see data_frag_set_fec() */
     int mf;
     int ofs;
     void *data;
@@ -35,6 +44,19 @@ typedef struct _data_vec {
 } data_vec_t;
 
 
+#define FRAG_NACK_RANGES_MAX    (16)
+
+/* fragments missing from data @seq of @src, by index. */
+typedef struct _data_nack {
+    int src;
+    int seq;
+    int nr_ranges;
+    struct {
+        int start;
+        int count;  /* -1: up to the last fragment */
+    } ranges[FRAG_NACK_RANGES_MAX];
+} data_nack_t;
+
 typedef struct data_frags data_frags_t;
 
 data_frags_t *data_frag_init(int fraglen, 
@@ -43,10 +65,21 @@ data_frags_t *data_frag_init(int fraglen,
         void (*free_pkt)(void *opaque, void *frag_pkt),
         void *opaque);
 
+int data_frag_set_fec(data_frags_t *frags, int group);
+int data_frag_set_fraglen(data_frags_t *frags, int fraglen);
+int data_frag_set_nack(data_frags_t *frags, int window,
+        void (*nack)(void *opaque, data_nack_t *nack));
 void data_frag_release(data_frags_t *frags);
 
+int data_frag_set_pacing(data_frags_t *frags, long min_rate, long max_rate,
+        void (*sent)(void *opaque, int seq));
+/* the current rate of the paced sender, bytes per second. */
+long data_frag_pace_rate(data_frags_t *frags);
+
 int data_frag(data_frags_t *frags, void *data, int len);
+int data_frag_async(data_frags_t *frags, void *data, int len);
 int data_defrag(data_frags_t *frags, data_vec_t *v, void *frag_pkt);
+int data_frag_retransmit(data_frags_t *frags, data_nack_t *nack);
 
 #endif
 
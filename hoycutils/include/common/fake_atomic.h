@@ -30,9 +30,10 @@ typedef struct _fake_atomic_long {
 
 #define COUNTER_OFFSET  sizeof(pthread_mutex_t)
 
+/* COUNTER_OFFSET is in bytes, not in longs. */
 static inline unsigned long *counter_entry(unsigned long *addr)
 {
-    return addr + COUNTER_OFFSET;
+    return (unsigned long *)((char *)addr + COUNTER_OFFSET);
 }
 
 static inline void fake_atomic_init(fake_atomic_t *v, int val)
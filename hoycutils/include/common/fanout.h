@@ -0,0 +1,99 @@
+/*
+ * include/common/fanout.h
+ *
+ * 2016-01-01  written by Hoyleeson <hoyleeson@gmail.com>
+ *	Copyright (C) 2015-2016 by Hoyleeson.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; version 2.
+ *
+ */
+
+#ifndef _COMMON_FANOUT_H_
+#define _COMMON_FANOUT_H_
+
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+#include <common/rcu.h>
+#include <common/htable.h>
+
+/*
+ * Fan-out membership of a relay group. Members are found by id with one
+ * hash lookup, and the addresses of the running members are kept in a
+ * dense array that is handed to iohandler_pkt_multicast() as is.
+ *
+ * fanout_lookup() and fanout_peers() are lock-free, call them under
+ * rcu_read_lock(). Updates are serialized by the table lock, each one
+ * publishes a new peers array and frees the old one after a grace
+ * period, so the array a reader holds never changes.
+ */
+
+struct fanout_member {
+    uint32_t id;
+    int running;
+    int index;              /* in the peers array, when running */
+    struct sockaddr addr;
+    struct rcu_head rcu;
+};
+
+struct fanout_peers {
+    struct rcu_head rcu;
+    int count;
+    uint32_t *ids;          /* the member of each address */
+    struct sockaddr dst[0];
+};
+
+typedef struct fanout {
+    pthread_mutex_t lock;
+    struct htable members;  /* key: id */
+    struct fanout_peers *peers;
+    int count;
+} fanout_t;
+
+fanout_t *fanout_create(int size);
+/* no reader may be left, e.g. from a call_rcu() callback. */
+void fanout_release(fanout_t *fo);
+/* the same members, for a task that moves. */
+fanout_t *fanout_copy(fanout_t *fo);
+
+/* a new member, running at @addr or pending until fanout_run(). */
+int fanout_add(fanout_t *fo, uint32_t id, struct sockaddr *addr, int running);
+int fanout_del(fanout_t *fo, uint32_t id);
+/* the pending member @id is running at @addr now. */
+int fanout_run(fanout_t *fo, uint32_t id, struct sockaddr *addr);
+
+static inline struct fanout_member *fanout_lookup(fanout_t *fo, uint32_t id)
+{
+    return htable_lookup(&fo->members, id);
+}
+
+static inline struct fanout_peers *fanout_peers(fanout_t *fo)
+{
+    return rcu_dereference(fo->peers);
+}
+
+static inline int fanout_size(fanout_t *fo)
+{
+    return fo->count;
+}
+
+/* the index of @m in @peers, -1 if it is not in this array. */
+static inline int fanout_peer_index(struct fanout_peers *peers,
+        struct fanout_member *m)
+{
+    int i;
+
+    if(!m)
+        return -1;
+
+    i = m->index;
+    if(i < 0 || i >= peers->count || peers->ids[i] != m->id)
+        return -1;
+    return i;
+}
+
+#endif
+
@@ -53,6 +53,12 @@
  *  For multiple writer and one reader there is only a need to lock the writer.
  * And vice versa for only one writer and multiple reader there is only a need
  * to lock the reader.
+ *
+ * Note about SMP: the plain fifo_in()/fifo_out() helpers carry no memory
+ * barriers. When the writer and the reader run on different threads without
+ * a lock, use the *_spsc() helpers, or the zero-copy fifo_prepare()/
+ * fifo_commit() (writer) and fifo_out_linear()/fifo_skip_count() (reader)
+ * pairs. They publish fifo->in and fifo->out with release/acquire ordering.
  */
 
 struct __fifo {
@@ -627,6 +633,128 @@ __fifo_uint_must_check_helper( \
 }) \
 )
 
+/**
+ * fifo_in_spsc - lock-free put data into the fifo
+ * @fifo: address of the fifo to be used
+ * @buf: the data to be added
+ * @n: number of elements to be added
+ *
+ * Same as fifo_in(), but safe for one concurrent writer and one concurrent
+ * reader running on different threads without any locking. Not usable with
+ * record fifos, for those it returns 0.
+ */
+#define	fifo_in_spsc(fifo, buf, n) \
+({ \
+	typeof((fifo) + 1) __tmp = (fifo); \
+	typeof((buf) + 1) __buf = (buf); \
+	unsigned long __n = (n); \
+	const size_t __recsize = sizeof(*__tmp->rectype); \
+	struct __fifo *__fifo = &__tmp->fifo; \
+	if (0) { \
+		typeof(__tmp->ptr_const) __dummy __attribute__ ((unused)); \
+		__dummy = (typeof(__buf))NULL; \
+	} \
+	(__recsize) ? 0 : \
+	__fifo_in_spsc(__fifo, __buf, __n); \
+})
+
+/**
+ * fifo_out_spsc - lock-free get data from the fifo
+ * @fifo: address of the fifo to be used
+ * @buf: pointer to the storage buffer
+ * @n: max. number of elements to get
+ *
+ * Same as fifo_out(), but safe for one concurrent writer and one concurrent
+ * reader running on different threads without any locking. Not usable with
+ * record fifos, for those it returns 0.
+ */
+#define	fifo_out_spsc(fifo, buf, n) \
+__fifo_uint_must_check_helper( \
+({ \
+	typeof((fifo) + 1) __tmp = (fifo); \
+	typeof((buf) + 1) __buf = (buf); \
+	unsigned long __n = (n); \
+	const size_t __recsize = sizeof(*__tmp->rectype); \
+	struct __fifo *__fifo = &__tmp->fifo; \
+	if (0) { \
+		typeof(__tmp->ptr) __dummy = NULL; \
+		__buf = __dummy; \
+	} \
+	(__recsize) ? 0 : \
+	__fifo_out_spsc(__fifo, __buf, __n); \
+}) \
+)
+
+/**
+ * fifo_prepare - reserve a contiguous region for writing
+ * @fifo: address of the fifo to be used
+ * @pptr: where to store the address of the region
+ * @n: max. number of elements wanted
+ *
+ * This macro returns the number of elements which can be written in place
+ * starting at *@pptr, without wrapping around the end of the buffer. It may be
+ * less than @n, and 0 if the fifo is full. Nothing becomes visible to the
+ * reader until fifo_commit() is called.
+ *
+ * Writer side of the lock-free single producer/single consumer mode.
+ */
+#define	fifo_prepare(fifo, pptr, n) \
+__fifo_uint_must_check_helper( \
+({ \
+	typeof((fifo) + 1) __tmp = (fifo); \
+	typeof(__tmp->ptr) *__ptr = (pptr); \
+	unsigned long __n = (n); \
+	struct __fifo *__fifo = &__tmp->fifo; \
+	__fifo_prepare(__fifo, (void **)__ptr, __n); \
+}) \
+)
+
+/**
+ * fifo_commit - publish elements written after fifo_prepare()
+ * @fifo: address of the fifo to be used
+ * @n: number of elements written, must not exceed the prepared count
+ */
+#define	fifo_commit(fifo, n) \
+(void)({ \
+	typeof((fifo) + 1) __tmp = (fifo); \
+	__fifo_commit(&__tmp->fifo, (n)); \
+})
+
+/**
+ * fifo_out_linear - get a contiguous region for reading
+ * @fifo: address of the fifo to be used
+ * @pptr: where to store the address of the region
+ * @n: max. number of elements wanted
+ *
+ * This macro returns the number of elements which can be read in place
+ * starting at *@pptr, without wrapping around the end of the buffer. It may be
+ * less than @n, and 0 if the fifo is empty. The elements stay in the fifo
+ * until they are released with fifo_skip_count().
+ *
+ * Reader side of the lock-free single producer/single consumer mode.
+ */
+#define	fifo_out_linear(fifo, pptr, n) \
+__fifo_uint_must_check_helper( \
+({ \
+	typeof((fifo) + 1) __tmp = (fifo); \
+	typeof(__tmp->ptr) *__ptr = (pptr); \
+	unsigned long __n = (n); \
+	struct __fifo *__fifo = &__tmp->fifo; \
+	__fifo_out_linear(__fifo, (void **)__ptr, __n); \
+}) \
+)
+
+/**
+ * fifo_skip_count - release elements read after fifo_out_linear()
+ * @fifo: address of the fifo to be used
+ * @n: number of elements consumed, must not exceed the linear count
+ */
+#define	fifo_skip_count(fifo, n) \
+(void)({ \
+	typeof((fifo) + 1) __tmp = (fifo); \
+	__fifo_skip_count(&__tmp->fifo, (n)); \
+})
+
 extern int __fifo_alloc(struct __fifo *fifo, unsigned int size, size_t esize);
 
 extern void __fifo_free(struct __fifo *fifo);
@@ -658,6 +786,22 @@ extern unsigned int __fifo_out_peek_r(struct __fifo *fifo,
 
 extern unsigned int __fifo_max_r(unsigned int len, size_t recsize);
 
+extern unsigned int __fifo_in_spsc(struct __fifo *fifo,
+	const void *buf, unsigned int len);
+
+extern unsigned int __fifo_out_spsc(struct __fifo *fifo,
+	void *buf, unsigned int len);
+
+extern unsigned int __fifo_prepare(struct __fifo *fifo,
+	void **ptr, unsigned int len);
+
+extern void __fifo_commit(struct __fifo *fifo, unsigned int len);
+
+extern unsigned int __fifo_out_linear(struct __fifo *fifo,
+	void **ptr, unsigned int len);
+
+extern void __fifo_skip_count(struct __fifo *fifo, unsigned int len);
+
 
 
 #endif
@@ -1,6 +1,7 @@
 #ifndef _COMMON_FIND_BIT_H_
 #define _COMMON_FIND_BIT_H_
 
+#include <common/bitops.h>
 
 #define for_each_set_bit(bit, addr, size) \
 	for ((bit) = find_first_bit((addr), (size));		\
@@ -25,6 +26,25 @@
 	     (bit) = find_next_zero_bit((addr), (size), (bit) + 1))
 
 
+extern unsigned long _find_next_bit(const unsigned long *addr,
+		unsigned long nbits, unsigned long start, unsigned long invert);
+
+/*
+ * A bitmap of one word is searched inline, the others by
+ * _find_next_bit().
+ */
+static inline unsigned long _find_next_bit_word(const unsigned long *addr,
+		unsigned long nbits, unsigned long start, unsigned long invert)
+{
+	unsigned long tmp;
+
+	if (start >= nbits)
+		return nbits;
+
+	tmp = (*addr ^ invert) & (~0UL << start) & (~0UL >> (BITS_PER_LONG - nbits));
+	return tmp ? __ffs(tmp) : nbits;
+}
+
 /**
  * find_next_bit - find the next set bit in a memory region
  * @addr: The address to base the search on
@@ -34,8 +54,13 @@
  * Returns the bit number for the next set bit
  * If no bits are set, returns @size.
  */
-extern unsigned long find_next_bit(const unsigned long *addr, unsigned long
-		size, unsigned long offset);
+static inline unsigned long find_next_bit(const unsigned long *addr,
+		unsigned long size, unsigned long offset)
+{
+	if (size <= BITS_PER_LONG)
+		return _find_next_bit_word(addr, size, offset, 0UL);
+	return _find_next_bit(addr, size, offset, 0UL);
+}
 
 /**
  * find_next_zero_bit - find the next cleared bit in a memory region
@@ -46,9 +71,13 @@ extern unsigned long find_next_bit(const unsigned long *addr, unsigned long
  * Returns the bit number of the next zero bit
  * If no bits are zero, returns @size.
  */
-extern unsigned long find_next_zero_bit(const unsigned long *addr, unsigned
-		long size, unsigned long offset);
-
+static inline unsigned long find_next_zero_bit(const unsigned long *addr,
+		unsigned long size, unsigned long offset)
+{
+	if (size <= BITS_PER_LONG)
+		return _find_next_bit_word(addr, size, offset, ~0UL);
+	return _find_next_bit(addr, size, offset, ~0UL);
+}
 
 /**
  * find_first_bit - find the first set bit in a memory region
@@ -58,8 +87,11 @@ extern unsigned long find_next_zero_bit(const unsigned long *addr, unsigned
  * Returns the bit number of the first set bit.
  * If no bits are set, returns @size.
  */
-extern unsigned long find_first_bit(const unsigned long *addr,
-				    unsigned long size);
+static inline unsigned long find_first_bit(const unsigned long *addr,
+		unsigned long size)
+{
+	return find_next_bit(addr, size, 0);
+}
 
 /**
  * find_first_zero_bit - find the first cleared bit in a memory region
@@ -69,7 +101,10 @@ extern unsigned long find_first_bit(const unsigned long *addr,
  * Returns the bit number of the first cleared bit.
  * If no bits are zero, returns @size.
  */
-extern unsigned long find_first_zero_bit(const unsigned long *addr,
-					 unsigned long size);
+static inline unsigned long find_first_zero_bit(const unsigned long *addr,
+		unsigned long size)
+{
+	return find_next_zero_bit(addr, size, 0);
+}
 
 #endif /*_COMMON_FIND_BIT_H_*/
@@ -18,18 +18,31 @@
 #include <common/list.h>
 #include <common/timer.h>
 
+/* a node is dead after HBEAT_INIT heartbeat periods without one. */
 #define HBEAT_INIT 		    (3)
 #define HBEAD_DEAD_LINE     (10 * MSEC_PER_SEC)
 
+/*
+ * Nodes wait in a wheel of HBEAT_WHEEL_SLOTS buckets, by the tick of
+ * their deadline. A heartbeat moves its node to the bucket of the new
+ * deadline and each tick only looks at the bucket due, so a tick costs
+ * about the nodes expiring in it. The timeout is at most a lap.
+ */
+#define HBEAT_TICK 		    (MSEC_PER_SEC)
+#define HBEAT_WHEEL_SLOTS   (64)
 
 typedef struct hbeat_node {
-    int count;
     int online;
+    unsigned long expire;   /* tick of the deadline */
+    struct hbeat_god *god;
     struct list_head node;
 } hbeat_node_t;
 
 typedef struct hbeat_god {
-    struct list_head list;
+    struct list_head wheel[HBEAT_WHEEL_SLOTS];
+    struct list_head expired;   /* due, dead() not called yet */
+    unsigned long tick;         /* the next to expire */
+    int timeout;                /* ticks */
     struct timer_list timer;
     void (*dead)(hbeat_node_t *hbeat);
     pthread_mutex_t lock;
@@ -41,6 +54,15 @@ void user_heartbeat(hbeat_node_t *hbeat);
 void hbeat_add_to_god(hbeat_god_t *god, hbeat_node_t *hbeat);
 void hbeat_rm_from_god(hbeat_god_t *god, hbeat_node_t *hbeat);
 
+/*
+ * dead() runs on the timer thread without the god lock, under
+ * rcu_read_lock(): a node freed with call_rcu() after
+ * hbeat_rm_from_god() may still be passed to it.
+ */
 void hbeat_god_init(hbeat_god_t *god, void (*dead)(hbeat_node_t *));
+/* from the next heartbeat on, HBEAT_INIT * HBEAD_DEAD_LINE by default. */
+void hbeat_god_set_timeout(hbeat_god_t *god, int ms);
+/* a tick of @data, the god, run by its timer. */
+void hbeat_god_handle(unsigned long data);
 
 #endif
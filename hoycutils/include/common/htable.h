@@ -0,0 +1,95 @@
+/*
+ * include/common/htable.h
+ * 
+ * 2016-01-01  written by Hoyleeson <hoyleeson@gmail.com>
+ *	Copyright (C) 2015-2016 by Hoyleeson.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; version 2.
+ *
+ * Resizable open addressing hash table.
+ *
+ */
+
+#ifndef _COMMON_HTABLE_H_
+#define _COMMON_HTABLE_H_
+
+#include <common/types.h>
+#include <stddef.h>
+
+#include <common/rcu.h>
+
+/*
+ * The table stores pointers to objects, the key is an integer (4 or 8
+ * bytes) embedded in the object at @key_offset. Slots are grouped by 16,
+ * each slot has a one byte control word in a separate array holding 7
+ * bits of the hash, so a lookup usually compares one group of control
+ * bytes (one SSE2 instruction) and touches a single object.
+ *
+ * The table grows when it is 7/8 full and shrinks when less than 1/8 is
+ * used. Resizing is incremental: the old table is kept and every
+ * following insert moves a few slots into the new one, so no single
+ * insert pays for rehashing everything.
+ *
+ * Locking: updates (htable_insert/htable_remove) must be serialized by
+ * the caller. htable_lookup() and the iterator can run concurrently with
+ * updates under rcu_read_lock(), provided the objects are freed after a
+ * grace period.
+ */
+
+struct htable_tbl;
+
+struct htable_params {
+	size_t key_offset;	/* offset of the key in the object */
+	unsigned int key_len;	/* sizeof the key, 4 or 8 */
+	unsigned int min_size;	/* expected number of objects */
+};
+
+struct htable {
+	struct htable_tbl *tbl;
+	struct htable_tbl *old;	/* being moved into tbl, or NULL */
+	unsigned int migrate_pos;
+	unsigned int min_capacity;
+	unsigned int size;
+	unsigned long seq;	/* changes when a resize starts or ends */
+	struct htable_params p;
+};
+
+struct htable_iter {
+	struct htable_tbl *tbl[2];
+	unsigned int pos;
+	int idx;
+};
+
+#define HTABLE_PARAMS(type, member, size) { \
+	.key_offset = offsetof(type, member), \
+	.key_len = sizeof(((type *)0)->member), \
+	.min_size = (size), \
+}
+
+int htable_init(struct htable *ht, const struct htable_params *params);
+void htable_destroy(struct htable *ht);
+
+void *htable_lookup(struct htable *ht, u64 key);
+int htable_insert(struct htable *ht, void *obj);
+void *htable_remove(struct htable *ht, u64 key);
+
+static inline unsigned int htable_size(struct htable *ht)
+{
+	return ht->size;
+}
+
+/*
+ * Iteration. Removing the object just returned is allowed, inserting
+ * while iterating is not. Under rcu_read_lock() with concurrent updates
+ * an object may be missed or seen twice.
+ */
+void htable_iter_init(struct htable *ht, struct htable_iter *iter);
+void *htable_iter_next(struct htable_iter *iter);
+
+#define htable_for_each(ht, iter, obj) \
+	for (htable_iter_init(ht, iter); ((obj) = htable_iter_next(iter)); )
+
+#endif
+
@@ -21,10 +21,52 @@
 #define __const_hweight32(w) (__const_hweight16(w) + __const_hweight16((w) >> 16))
 #define __const_hweight64(w) (__const_hweight32(w) + __const_hweight32((w) >> 32))
 
-unsigned int __hweight32(unsigned int w);
 unsigned int __hweight16(unsigned int w);
 unsigned int __hweight8(unsigned int w);
-unsigned long __hweight64(uint64_t w);
+
+unsigned int __hweight32_generic(unsigned int w);
+unsigned long __hweight64_generic(uint64_t w);
+
+static inline unsigned int __sw_hweight32(unsigned int w)
+{
+	unsigned int res = w - ((w >> 1) & 0x55555555);
+	res = (res & 0x33333333) + ((res >> 2) & 0x33333333);
+	res = (res + (res >> 4)) & 0x0F0F0F0F;
+	res = res + (res >> 8);
+	return (res + (res >> 16)) & 0x000000FF;
+}
+
+static inline unsigned long __sw_hweight64(uint64_t w)
+{
+	uint64_t res = w - ((w >> 1) & 0x5555555555555555ull);
+	res = (res & 0x3333333333333333ull) + ((res >> 2) & 0x3333333333333333ull);
+	res = (res + (res >> 4)) & 0x0F0F0F0F0F0F0F0Full;
+	res = res + (res >> 8);
+	res = res + (res >> 16);
+	return (res + (res >> 32)) & 0x00000000000000FFull;
+}
+
+/*
+ * A single word is weighed inline, an indirect call to the POPCNT
+ * variant costs more than it saves. bitmap_weight() dispatches.
+ */
+static inline unsigned int __hweight32(unsigned int w)
+{
+#ifdef __POPCNT__
+	return __builtin_popcount(w);
+#else
+	return __sw_hweight32(w);
+#endif
+}
+
+static inline unsigned long __hweight64(uint64_t w)
+{
+#ifdef __POPCNT__
+	return __builtin_popcountll(w);
+#else
+	return __sw_hweight64(w);
+#endif
+}
 
 /*
  * Generic interface.
@@ -21,6 +21,7 @@
 #include <common/types.h>
 #include <common/bitops.h>
 #include <common/bitmap.h>
+#include <common/rcu.h>
 
 /*
  * We want shallower trees and thus more bits covered at each layer.  8
@@ -39,6 +40,7 @@ struct idr_layer {
 	int			count;	/* When zero, we can release it */
 
     DECLARE_BITMAP(bitmap, IDR_SIZE);
+	struct rcu_head		rcu_head;
 };
 
 struct idr {
@@ -58,20 +60,9 @@ struct idr {
 #define DEFINE_IDR(name)	struct idr name = IDR_INIT(name)
 
 
-/*XXX*/
-#define IDR_INIT_POINTER(p, v) do { \
-    p = v;  \
-} while(0)
-
-#define idr_assign_pointer(p, v) do { \
-    barrier();      \
-    p = v;          \
-} while(0)
-
-#define idr_dereference_raw(p)  \
-({          \
-    p;      \
-})
+#define IDR_INIT_POINTER(p, v)      RCU_INIT_POINTER(p, v)
+#define idr_assign_pointer(p, v)    rcu_assign_pointer(p, v)
+#define idr_dereference_raw(p)      rcu_dereference(p)
 
 
 /**
@@ -0,0 +1,61 @@
+/*
+ * include/common/img_sync.h
+ *
+ * 2016-01-01  written by Hoyleeson <hoyleeson@gmail.com>
+ *	Copyright (C) 2015-2016 by Hoyleeson.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; version 2.
+ *
+ */
+
+#ifndef _COMMON_IMG_SYNC_H_
+#define _COMMON_IMG_SYNC_H_
+
+#include <stdint.h>
+
+/*
+ * State image sync. The sender encodes each image as a keyframe or as
+ * the XOR of it and the previous image, both compressed with lz when it
+ * helps. Receivers keep the last image of every sender and apply the
+ * deltas to it. A receiver that missed an image cannot apply the next
+ * deltas, it waits for the next keyframe.
+ */
+
+/* header in front of every encoded image, see img_sync_encode(). */
+#define IMG_SYNC_HDR_LEN        (20)
+
+typedef struct img_sync img_sync_t;
+
+/* a keyframe at least every @keyint images, 0: only when forced. */
+img_sync_t *img_sync_init(int keyint);
+void img_sync_release(img_sync_t *sync);
+
+/* worst case encoded size of an image of @len bytes. */
+static inline int img_sync_bound(int len)
+{
+    return IMG_SYNC_HDR_LEN + len;
+}
+
+/*
+ * Encode @data of sender @src into @out, at least img_sync_bound(len)
+ * bytes. Returns the encoded length.
+ */
+int img_sync_encode(img_sync_t *sync, int src, const void *data, int len,
+        void *out);
+
+/* the next image is a keyframe, e.g. a receiver lost the previous one. */
+void img_sync_force_key(img_sync_t *sync);
+
+/*
+ * Decode an encoded image and update the copy kept for its sender. On
+ * success @image is called with the new image, under the decoder lock,
+ * and the image length is returned. -EAGAIN: a delta whose base image
+ * is missing here, it waits for a keyframe.
+ */
+int img_sync_decode(img_sync_t *sync, const void *in, int len,
+        void (*image)(void *arg, int src, void *data, int len), void *arg);
+
+#endif
+
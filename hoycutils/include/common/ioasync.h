@@ -37,6 +37,10 @@ void iohandler_sendto(iohandler_t *ioh, const uint8_t *data, int len, struct soc
 
 void iohandler_pkt_send(iohandler_t *ioh, pack_buf_t *pkb);
 void iohandler_pkt_sendto(iohandler_t *ioh, pack_buf_t *pkb, struct sockaddr *to);
+void iohandler_pkt_multicast(iohandler_t *ioh, pack_buf_t *pkb,
+        struct sockaddr *dst, int count);
+
+int iohandler_queue_depth(iohandler_t *ioh);
 
 iohandler_t *iohandler_create(ioasync_t *aio, int fd,
         void (*handle)(void *, uint8_t *, int), void (*close)(void *), void *priv);
@@ -48,6 +52,10 @@ iohandler_t *iohandler_udp_create(ioasync_t *aio, int fd,
         void (*handlefrom)(void *, uint8_t *, int, void *),
         void (*close)(void *), void *priv);
 
+iohandler_t *iohandler_local_create(ioasync_t *aio,
+        void (*handle)(void *, uint8_t *, int), void (*close)(void *), void *priv);
+int iohandler_local_connect(iohandler_t *ioh, iohandler_t *peer);
+
 void iohandler_shutdown(iohandler_t* ioh);
 
 ioasync_t *ioasync_init(void);
@@ -16,12 +16,15 @@
 #include <string.h>
 #include <pthread.h>
 
-#include <common/list.h>
+#include <common/types.h>
+#include <common/htable.h>
 #include <common/completion.h>
 
 #define MAX_RESPONSE_CAPACITY   (256)
 #define WAIT_RES_DEAD_LINE      (5 * 1000)
 
+#define IOWAIT_KEY(type, seq) 	(((u64)(u32)(type) << 32) | (u32)(seq))
+
 
 typedef struct iowait_watcher {
 	/* in param */
@@ -30,13 +33,13 @@ typedef struct iowait_watcher {
     int count;
     void *res;
 
+    u64 key; 	/* IOWAIT_KEY(type, seq) */
     struct completion done;
-    struct hlist_node hentry;
 } iowait_watcher_t;
 
 
 typedef struct _iowait {
-    struct hlist_head *slots;
+    struct htable watchers;
     pthread_mutex_t lock;
 } iowait_t;
 
@@ -46,6 +49,7 @@ typedef struct _iowait {
 	.seq = _seq, 		\
 	.res = _res, 		\
 	.count = _count, 	\
+	.key = IOWAIT_KEY(_type, _seq), 	\
 	.done = COMPLETION_INITIALIZER((name).done) 	\
 }
 
@@ -54,6 +58,8 @@ typedef struct _iowait {
 
 
 int iowait_init(iowait_t *wait);
+/* no watcher may be left. */
+void iowait_destroy(iowait_t *wait);
 void iowait_watcher_init(iowait_watcher_t *watcher, 
 		int type, int seq, void *result, int count);
 int iowait_register_watcher(iowait_t *wait, iowait_watcher_t *watcher);
@@ -0,0 +1,38 @@
+/*
+ * include/common/lz.h
+ *
+ * 2016-01-01  written by Hoyleeson <hoyleeson@gmail.com>
+ *	Copyright (C) 2015-2016 by Hoyleeson.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; version 2.
+ *
+ */
+
+#ifndef _COMMON_LZ_H_
+#define _COMMON_LZ_H_
+
+/*
+ * A fast byte oriented LZ77 codec, lz4 block style: every sequence is a
+ * token (literal length, match length), the literals, and a 16 bits
+ * offset back into the output. No entropy coding, speed first.
+ */
+
+/* worst case compressed size of @len bytes. */
+static inline int lz_compress_bound(int len)
+{
+    return len + len / 255 + 16;
+}
+
+/* returns the compressed length, -ENOSPC if it does not fit in @dstlen. */
+int lz_compress(const void *src, int len, void *dst, int dstlen);
+
+/*
+ * returns the decompressed length, -EINVAL on malformed input or if
+ * it does not fit in @dstlen. @src may come from the network.
+ */
+int lz_decompress(const void *src, int len, void *dst, int dstlen);
+
+#endif
+
@@ -36,6 +36,28 @@ pack_head_t *create_pack(uint8_t type, uint32_t len);
 void init_pack(pack_head_t *pack, uint8_t type, uint32_t len);
 void free_pack(pack_head_t *pack);
 
+/* the largest pack a stream takes, a longer one means it is corrupt. */
+#define PACK_STREAM_MAX_LEN     (1024 * 1024)
+
+/*
+ * Packs from a byte stream, where reads end anywhere. A pack cut by the
+ * end of a read is kept until the rest of it is read.
+ */
+struct pack_stream {
+    uint8_t *buf;
+    int len;
+    int size;
+};
+
+void pack_stream_init(struct pack_stream *ps);
+void pack_stream_release(struct pack_stream *ps);
+/*
+ * @fn is called for each pack completed by @data. On a corrupt length
+ * what is kept is dropped and -EINVAL returned.
+ */
+int pack_stream_input(struct pack_stream *ps, uint8_t *data, int len,
+        void (*fn)(void *opaque, uint8_t *pack, int len), void *opaque);
+
 
 #endif
 
@@ -39,6 +39,7 @@ struct _pack_buf {
     fake_atomic_t refcount;
 
     int len;
+    int ofs;        /* the packet starts at data[ofs], see pack_buf_pull() */
     uint8_t data[0];
 };
 
@@ -53,8 +54,22 @@ void free_pack_buf_pool(pack_buf_pool_t *pool);
 
 pack_buf_t *pack_buf_alloc(pack_buf_pool_t *pool);
 pack_buf_t *pack_buf_get(pack_buf_t *pkb);
+pack_buf_t *pack_buf_get_n(pack_buf_t *pkb, int n);
 void pack_buf_free(pack_buf_t *pkb);
 
+static inline uint8_t *pack_buf_data(pack_buf_t *pkb)
+{
+    return pkb->data + pkb->ofs;
+}
+
+/* drop @len bytes from the front, e.g. headers not forwarded. */
+static inline uint8_t *pack_buf_pull(pack_buf_t *pkb, int len)
+{
+    pkb->ofs += len;
+    pkb->len -= len;
+    return pack_buf_data(pkb);
+}
+
 
 #endif
 
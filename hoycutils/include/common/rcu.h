@@ -0,0 +1,110 @@
+/*
+ * include/common/rcu.h
+ * 
+ * 2016-01-01  written by Hoyleeson <hoyleeson@gmail.com>
+ *	Copyright (C) 2015-2016 by Hoyleeson.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; version 2.
+ *
+ * Userspace read-copy-update, epoch based.
+ *
+ */
+
+#ifndef _COMMON_RCU_H_
+#define _COMMON_RCU_H_
+
+#include <common/core.h>
+#include <common/compiler.h>
+#include <common/list.h>
+
+/*
+ * Each thread which enters a read-side critical section owns a reader
+ * record holding the global grace period counter it observed on entry,
+ * or 0 while it is outside of any critical section. synchronize_rcu()
+ * advances the counter and waits until no reader is left in an older
+ * epoch. Readers never block and never write shared cache lines, the
+ * cost of rcu_read_lock() is one full memory barrier.
+ *
+ * Threads are registered on their first rcu_read_lock() and removed from
+ * the registry when they exit.
+ *
+ * synchronize_rcu() must not be called inside a read-side critical
+ * section. Callers that can't block use call_rcu(), the callbacks are
+ * batched and run from the rcu reclaim thread after a grace period.
+ */
+
+struct rcu_head {
+	struct rcu_head *next;
+	void (*func)(struct rcu_head *head);
+};
+
+struct rcu_reader {
+	unsigned long ctr;
+	int nesting;
+	int registered;
+	struct list_head entry;
+};
+
+extern unsigned long rcu_gp_ctr;
+extern __thread struct rcu_reader rcu_reader;
+
+void rcu_register_thread(void);
+void rcu_unregister_thread(void);
+
+static inline void rcu_read_lock(void)
+{
+	struct rcu_reader *r = &rcu_reader;
+
+	if (unlikely(!r->registered))
+		rcu_register_thread();
+
+	if (r->nesting++ == 0) {
+		__atomic_store_n(&r->ctr, __atomic_load_n(&rcu_gp_ctr,
+					__ATOMIC_RELAXED), __ATOMIC_RELAXED);
+		smp_mb();
+	}
+}
+
+static inline void rcu_read_unlock(void)
+{
+	struct rcu_reader *r = &rcu_reader;
+
+	if (--r->nesting == 0)
+		smp_store_release(&r->ctr, 0);
+}
+
+/**
+ * rcu_dereference - fetch an RCU-protected pointer for dereferencing
+ * @p: the pointer to read, prior to dereferencing
+ *
+ * Must be used inside rcu_read_lock()/rcu_read_unlock(), or with the
+ * update side lock held.
+ */
+#define rcu_dereference(p)	__atomic_load_n(&(p), __ATOMIC_CONSUME)
+
+/**
+ * rcu_assign_pointer - assign to RCU-protected pointer
+ * @p: pointer to assign to
+ * @v: value to assign (publish)
+ *
+ * Orders the initialization of the pointed-to structure before the
+ * publication of the pointer.
+ */
+#define rcu_assign_pointer(p, v) \
+do { \
+	typeof(p) __v = (v); \
+	__atomic_store_n(&(p), __v, __ATOMIC_RELEASE); \
+} while (0)
+
+#define RCU_INIT_POINTER(p, v)	do { (p) = (v); } while (0)
+
+void synchronize_rcu(void);
+void call_rcu(struct rcu_head *head, void (*func)(struct rcu_head *head));
+void rcu_barrier(void);
+
+int rcu_init(void);
+
+#endif
+
@@ -37,6 +37,10 @@ extern "C" {
 
 extern int socket_network_client(const char *host, int port, int type);
 extern int socket_inaddr_any_server(int port, int type);
+extern int socket_reuseport_server(int port, int type);
+
+struct sockaddr_in;
+extern int socket_path_mtu(const struct sockaddr_in *addr);
 
 #ifdef __cplusplus
 }
@@ -81,6 +81,7 @@ static inline void setup_timer(struct timer_list * timer,
 void init_timer(struct timer_list* timer);
 int add_timer(struct timer_list *timer);
 int del_timer(struct timer_list *timer);
+int del_timer_sync(struct timer_list *timer);
 int mod_timer(struct timer_list* timer, unsigned long expires);
 
 
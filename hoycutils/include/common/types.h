@@ -28,7 +28,7 @@ typedef signed long long s64;
 typedef unsigned long long u64;
 
 
-#ifdef CONFIG_64BIT
+#if defined(CONFIG_64BIT) || defined(__LP64__)
 #define BITS_PER_LONG 64
 #else
 #define BITS_PER_LONG 32
@@ -25,7 +25,11 @@
 #define INVAILD_GROUPID 	(~0L)
 #define INVAILD_TASKID 		(~0L)
 
-/*client  ---->  center server */
+/*
+ * client  ---->  center server
+ * MSG_CLI_LOGIN is empty, or the uint32_t 1 when sent again after
+ * MSG_LOGIN_REDIRECT, such a login is not redirected again.
+ */
 enum cli_center_msg_type {
     MSG_CLI_ACK,
     MSG_CLI_HBEAT,
@@ -48,12 +52,16 @@ enum center_cli_msg_type {
     MSG_JOIN_GROUP_RESPONSE,
     MSG_GROUP_DELETE,
     MSG_HANDLE_ERR,
+    MSG_GROUP_MIGRATE,      /* struct pack_creat_group_result, new task address */
+    MSG_LOGIN_REDIRECT,     /* struct sockaddr, the home center server to log in */
 };
 
 enum {
     MSG_TASK_REQ,
     MSG_TURN_PACK,
     MSG_P2P_PACK,
+    MSG_TASK_LINK,      /* node server to node server, a request of a peer task */
+    MSG_TURN_CHECKIN_ACK,   /* node server to client, uint32_t userid, it is running */
 };
 
 /* client A <----------> client B */
@@ -61,6 +69,7 @@ enum client_msg_type {
     PACK_CHECKIN = 1,
     PACK_COMMAND,
     PACK_STATE_IMG,
+    PACK_STATE_IMG_NACK,
 };
 
 enum task_type {
@@ -86,6 +95,11 @@ struct pack_del_group {
     uint32_t groupid;
 };
 
+/*
+ * Groups are listed in groupid order. @pos is the cursor of the list
+ * result before, 0 for the first page. The cursor is opaque, it stays
+ * valid while groups are created or deleted.
+ */
 struct pack_list_group {
     uint32_t userid;
     uint32_t pos;
@@ -133,6 +147,22 @@ typedef struct _group_description {
     char name[0];
 } group_desc_t;
 
+#define LIST_GROUP_CURSOR_END   (~0U)
+/*
+ * the group_desc_t of a list result, each followed by namelen bytes of
+ * name without '\0', packed back to back. A page ends after the count
+ * asked for, or before the group that would take it past this, so that
+ * the result and its headers fit one packet buffer (PACKET_MAX_PAYLOAD).
+ * With names of GROUP_NAME_MAX that is 40 groups a page at least.
+ */
+#define LIST_GROUP_RESULT_MAX   (1800)
+
+struct pack_list_group_result {
+    uint32_t cursor;    /* the pos of the next page, or LIST_GROUP_CURSOR_END */
+    uint32_t count;
+    uint8_t data[0];    /* group_desc_t */
+};
+
 
 #endif
 
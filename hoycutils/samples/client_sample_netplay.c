@@ -72,6 +72,8 @@ int cli_callback(int event, void *arg1, void *arg2)
 #define IMG_FILE_NAME       "test.bmp"
 //#define IMG_FILE_NAME       "readme.txt"
 #define DATA_MAX_LEN        (4*1024*1024)
+/* images go out as deltas, a full one every 30 images. */
+#define IMG_KEYFRAME_INTERVAL   (30)
 
 int main(int argc, char **argv)
 {
@@ -98,6 +100,7 @@ int main(int argc, char **argv)
     client_state_dump(&state);
 
     client_init(DEFAULT_IP, CLI_MODE_TASK_ONLY, cli_callback);
+    client_set_state_img_sync(IMG_KEYFRAME_INTERVAL);
     client_state_load(&state);
     client_task_start();
 
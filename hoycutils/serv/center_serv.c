@@ -11,28 +11,120 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <netdb.h>
+#include <arpa/inet.h>
 
 #include <common/log.h>
 
 #include "cli_mgr.h"
 #include "node_mgr.h"
+#include "serv.h"
 
 typedef struct _center_serv {
     cli_mgr_t *climgr;
     node_mgr_t *nodemgr;
+    int leg_users;
+    int user_shards;
+    int partition;
+    const char *centers;
 } center_serv_t;
 
 static center_serv_t center_serv;
 
 
+/* "host:port,host:port", the client address of each center server. */
+static int center_serv_parse_centers(const char *list, struct center_partition *part)
+{
+    char buf[1024];
+    char *tok, *save, *port;
+    struct hostent *hp;
+    struct sockaddr_in *addr;
+
+    strncpy(buf, list, sizeof(buf) - 1);
+    buf[sizeof(buf) - 1] = '\0';
+
+    part->count = 0;
+    for(tok = strtok_r(buf, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        if(part->count >= CENTER_PARTITIONS_MAX)
+            return -EINVAL;
+
+        addr = &part->centers[part->count];
+        memset(addr, 0, sizeof(*addr));
+        addr->sin_family = AF_INET;
+
+        port = strchr(tok, ':');
+        addr->sin_port = htons(port ? atoi(port + 1) : CLIENT_LOGIN_PORT);
+        if(port)
+            *port = '\0';
+
+        hp = gethostbyname(tok);
+        if(!hp)
+            return -EINVAL;
+        memcpy(&addr->sin_addr, hp->h_addr, hp->h_length);
+        part->count++;
+    }
+
+    return part->count ? 0 : -EINVAL;
+}
+
 int center_serv_init(void) 
 {
     logi("center server start.\n");
     center_serv_t *cs = &center_serv;
+    struct center_partition part;
+    struct center_partition *ppart = NULL;
 
-    cs->nodemgr = node_mgr_init();
-    cs->climgr = cli_mgr_init(cs->nodemgr);
+    if(cs->centers) {
+        if(center_serv_parse_centers(cs->centers, &part) ||
+                cs->partition < 0 || cs->partition >= part.count) {
+            loge("bad center servers %s, partition %d.\n", cs->centers, cs->partition);
+            return -EINVAL;
+        }
+        part.index = cs->partition;
+        ppart = &part;
+    } else if(cs->partition) {
+        logw("partition %d without center servers, the only one.\n", cs->partition);
+        cs->partition = 0;
+    }
+
+    cs->nodemgr = node_mgr_init(cs->partition);
+    cs->climgr = cli_mgr_init(cs->nodemgr, cs->user_shards, ppart);
+    if(cs->climgr && cs->leg_users)
+        cli_mgr_set_leg_users(cs->climgr, cs->leg_users);
 
     return 0;
 }
 
+/* before center_serv_init(), the users of a group on one node. */
+void center_serv_set_leg_users(int count)
+{
+    center_serv.leg_users = count;
+}
+
+/* before center_serv_init(), 0 for one shard per online cpu. */
+void center_serv_set_user_shards(int count)
+{
+    center_serv.user_shards = count;
+}
+
+/* before center_serv_init(), this center keeps the ids of @partition. */
+void center_serv_set_partition(int partition)
+{
+    center_serv.partition = partition;
+}
+
+/* before center_serv_init(), see center_serv_parse_centers(). */
+void center_serv_set_centers(const char *centers)
+{
+    center_serv.centers = centers;
+}
+
+int center_serv_local_connect(iohandler_t *peer)
+{
+    center_serv_t *cs = &center_serv;
+
+    return nodemgr_local_connect(cs->nodemgr, peer);
+}
+
@@ -17,10 +17,14 @@
 #include <stddef.h>
 #include <pthread.h>
 #include <errno.h>
+#include <sys/socket.h>
 #include <arpa/inet.h>
+#include <linux/filter.h>
 
 #include <common/log.h>
+#include <common/utils.h>
 #include <common/hash.h>
+#include <common/rcu.h>
 #include <common/iowait.h>
 #include <common/packet.h>
 #include <common/pack_head.h>
@@ -28,27 +32,38 @@
 #include <common/sockets.h>
 #include <common/ioasync.h>
 
+#include "protos_internal.h"
 #include "node_mgr.h"
 #include "turn.h"
 #include "cli_mgr.h"
 
-static int create_cli_mgr_channel(void)
+static const struct htable_params user_map_params =
+    HTABLE_PARAMS(user_info_t, userid, USER_MAP_INIT_SIZE);
+static const struct htable_params group_map_params =
+    HTABLE_PARAMS(group_info_t, groupid, GROUP_MAP_INIT_SIZE);
+
+static int create_cli_mgr_channel(int port)
+{
+    return socket_inaddr_any_server(port, SOCK_DGRAM);
+}
+
+static inline cli_shard_t *cli_mgr_shard(cli_mgr_t *cm, uint32_t id)
 {
-    return socket_inaddr_any_server(CLIENT_LOGIN_PORT, SOCK_DGRAM);
+    return cm->shards[(id & CENTER_ID_MASK) % cm->shard_count];
 }
 
 
-static void *client_pkt_alloc(cli_mgr_t *cm)
+static void *client_pkt_alloc(cli_shard_t *shard)
 {
     pack_buf_t *pkb;
 
-    pkb = iohandler_pack_buf_alloc(cm->hand);
+    pkb = iohandler_pack_buf_alloc(shard->hand);
 
     return pkb->data + pack_head_len();
 
 }
 
-static void client_pkt_sendto(cli_mgr_t *cm, int type, 
+static void client_pkt_sendto(cli_shard_t *shard, int type, 
         void *data, int len, struct sockaddr *to)
 {
     pack_buf_t *pkb;
@@ -59,241 +74,477 @@ static void client_pkt_sendto(cli_mgr_t *cm, int type,
 
     /* init header */
     init_pack(head, type, len);
-    head->seqnum = cm->nextseq++;
+    /*
+     * not only from the shard's thread: the timer thread logs out dead
+     * users and the node manager thread answers assigns through it.
+     */
+    head->seqnum = __atomic_fetch_add(&shard->nextseq, 1, __ATOMIC_RELAXED);
 
     pkb->len = len + pack_head_len();
 
     dump_data("client mgr send data", pkb->data, pkb->len);
-    iohandler_pkt_sendto(cm->hand, pkb, to);
+    iohandler_pkt_sendto(shard->hand, pkb, to);
 }
 
 
-static void cli_mgr_send_ack(cli_mgr_t *cm, pack_head_t *head)
+static void cli_mgr_send_ack(cli_shard_t *shard, pack_head_t *head)
 {
 
 }
 
-static int cli_mgr_alloc_uid(cli_mgr_t *cm)
+/*
+ * the ids of a shard are its index modulo the shard count, below the
+ * partition of the center server.
+ */
+static int cli_shard_alloc_id(cli_shard_t *shard, struct ida *pool)
 {
     int ret;
     int id;
-
-    pthread_mutex_lock(&cm->lock);
-    ida_pre_get(&cm->uid_pool);
-    ret = ida_get_new(&cm->uid_pool, &id);
+    cli_mgr_t *cm = shard->mgr;
+
+    pthread_mutex_lock(&shard->lock);
+    ida_pre_get(pool);
+    ret = ida_get_new(pool, &id);
+    if(!ret && id >= (CENTER_ID_MASK + 1) / cm->shard_count) {
+        ida_remove(pool, id);
+        ret = -ENOSPC;
+    }
+    pthread_mutex_unlock(&shard->lock);
     if(ret)
-        id = ret;
-    pthread_mutex_unlock(&cm->lock);
+        return ret;
 
-    return id;
+    id = id * cm->shard_count + shard->index;
+    return id | (cm->part.index << CENTER_ID_SHIFT);
 }
 
-static inline void cli_mgr_free_uid(cli_mgr_t *cm, int id)
+static void cli_shard_free_id(cli_shard_t *shard, struct ida *pool, uint32_t id)
 {
-    ida_remove(&cm->uid_pool, id);
+    pthread_mutex_lock(&shard->lock);
+    ida_remove(pool, (id & CENTER_ID_MASK) / shard->mgr->shard_count);
+    pthread_mutex_unlock(&shard->lock);
 }
 
-
-static int cli_mgr_alloc_gid(cli_mgr_t *cm)
+static inline int cli_shard_alloc_uid(cli_shard_t *shard)
 {
-    int ret;
-    int id;
-
-    pthread_mutex_lock(&cm->lock);
-    ida_pre_get(&cm->gid_pool);
-    ret = ida_get_new(&cm->gid_pool, &id);
-    if(ret)
-        id = ret;
-    pthread_mutex_unlock(&cm->lock);
+    return cli_shard_alloc_id(shard, &shard->uid_pool);
+}
 
-    return id;
+static inline void cli_shard_free_uid(cli_shard_t *shard, uint32_t id)
+{
+    cli_shard_free_id(shard, &shard->uid_pool, id);
 }
 
+static inline int cli_shard_alloc_gid(cli_shard_t *shard)
+{
+    return cli_shard_alloc_id(shard, &shard->gid_pool);
+}
 
-static inline void cli_mgr_free_gid(cli_mgr_t *cm, int id)
+static inline void cli_shard_free_gid(cli_shard_t *shard, uint32_t id)
 {
-    ida_remove(&cm->gid_pool, id);
+    cli_shard_free_id(shard, &shard->gid_pool, id);
 }
 
 
-static int cli_ack_handle(cli_mgr_t *cm, uint16_t seqnum)
+static int cli_ack_handle(cli_shard_t *shard, uint16_t seqnum)
 {
     return 0;
 }
 
-static void cli_mgr_add_user(cli_mgr_t *cm, user_info_t *user) 
+static void cli_shard_add_user(cli_shard_t *shard, user_info_t *user) 
 {
-    uint32_t key;
+    pthread_mutex_lock(&shard->lock);
 
-    key = hash_32(user->userid, HASH_USER_SHIFT);
+    htable_insert(&shard->user_map, user);
+    shard->user_count++;
 
-    pthread_mutex_lock(&cm->lock);
-
-    hlist_add_head(&user->hentry, &cm->user_map[key]);
-    cm->user_count++;
+    pthread_mutex_unlock(&shard->lock);
+}
 
-    pthread_mutex_unlock(&cm->lock);
+/* lock-free, call under rcu_read_lock(). users are freed by call_rcu(). */
+static user_info_t *cli_shard_get_user(cli_shard_t *shard, uint32_t userid)
+{
+    return htable_lookup(&shard->user_map, userid);
 }
 
-static user_info_t *__cli_mgr_get_user(cli_mgr_t *cm, uint32_t userid)
+/* the group the user was in is left in @groupid. */
+static user_info_t *cli_shard_del_user(cli_shard_t *shard, uint32_t userid,
+        uint32_t *groupid)
 {
-    uint32_t key;
     user_info_t *user;
-    struct hlist_node *tmp;
 
-    key = hash_32(userid, HASH_USER_SHIFT);
 
-    hlist_for_each_entry(user, tmp, &cm->user_map[key], hentry) {
-        if(user->userid == userid) {
-            return user;
-        }
-    }
+    pthread_mutex_lock(&shard->lock);
 
-    return NULL;
-}
-
-static user_info_t *cli_mgr_get_user(cli_mgr_t *cm, uint32_t userid)
-{
-    user_info_t *user;
+    user = htable_remove(&shard->user_map, userid);
+    if(!user)
+        goto out;
 
-    pthread_mutex_lock(&cm->lock);
-    user = __cli_mgr_get_user(cm, userid);
-    pthread_mutex_unlock(&cm->lock);
+    *groupid = user->groupid;
+    user->groupid = GROUP_NONE;
+    shard->user_count--;
 
+out:
+    pthread_mutex_unlock(&shard->lock);
     return user;
 }
 
-static user_info_t *cli_mgr_del_user(cli_mgr_t *cm, uint32_t userid)
+
+static struct group_dir *group_dir_alloc(int count)
 {
-    user_info_t *user;
+    struct group_dir *dir;
 
+    dir = malloc(sizeof(*dir) + count * sizeof(struct group_entry));
+    if(!dir)
+        return NULL;
 
-    pthread_mutex_lock(&cm->lock);
+    dir->count = count;
+    return dir;
+}
 
-    user = __cli_mgr_get_user(cm, userid);
-    if(!user)
-        goto out;
+static void group_dir_free_rcu(struct rcu_head *head)
+{
+    struct group_dir *dir = container_of(head, struct group_dir, rcu);
 
-    hlist_del_init(&user->hentry);
-    cm->user_count--;
+    free(dir);
+}
 
-out:
-    pthread_mutex_unlock(&cm->lock);
-    return user;
+/* the first entry at or after @groupid. */
+static int group_dir_search(struct group_dir *dir, uint32_t groupid)
+{
+    int lo = 0, hi = dir->count, mid;
+
+    while(lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if(dir->entries[mid].groupid < groupid)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
 }
 
+/* cm->lock held. */
+static void group_dir_publish(cli_mgr_t *cm, struct group_dir *dir)
+{
+    struct group_dir *old = cm->group_dir;
+
+    rcu_assign_pointer(cm->group_dir, dir);
+    call_rcu(&old->rcu, group_dir_free_rcu);
+}
 
-static void cli_mgr_add_group(cli_mgr_t *cm, group_info_t *group) 
+/* cm->lock held. */
+static void group_dir_insert(cli_mgr_t *cm, group_info_t *group)
 {
-    uint32_t key;
+    int i;
+    struct group_dir *old = cm->group_dir;
+    struct group_dir *dir;
+    struct group_entry *e;
 
-    key = hash_32(group->groupid, HASH_GROUP_SHIFT);
+    dir = group_dir_alloc(old->count + 1);
+    if(!dir) {
+        logw("group %d not listed, out of memory.\n", group->groupid);
+        return;
+    }
 
-    pthread_mutex_lock(&cm->lock);
+    i = group_dir_search(old, group->groupid);
+    memcpy(dir->entries, old->entries, i * sizeof(*e));
+    memcpy(&dir->entries[i + 1], &old->entries[i], (old->count - i) * sizeof(*e));
 
-    hlist_add_head(&group->hentry, &cm->group_map[key]);
-    cm->group_count++;
+    e = &dir->entries[i];
+    e->groupid = group->groupid;
+    e->flags = group->flags;
+    e->namelen = strnlen(group->name, GROUP_NAME_MAX);
+    memcpy(e->name, group->name, e->namelen);
 
-    pthread_mutex_unlock(&cm->lock);
+    group_dir_publish(cm, dir);
 }
 
-static group_info_t *__cli_mgr_get_group(cli_mgr_t *cm, uint32_t groupid)
+/* cm->lock held. */
+static void group_dir_remove(cli_mgr_t *cm, uint32_t groupid)
 {
-    uint32_t key;
-    group_info_t *group;
-    struct hlist_node *tmp;
+    int i;
+    struct group_dir *old = cm->group_dir;
+    struct group_dir *dir;
 
-    key = hash_32(groupid, HASH_GROUP_SHIFT);
+    i = group_dir_search(old, groupid);
+    if(i == old->count || old->entries[i].groupid != groupid)
+        return;
 
-    hlist_for_each_entry(group, tmp, &cm->group_map[key], hentry) {
-        if(group->groupid == groupid) {
-            return group;
-        }
+    dir = group_dir_alloc(old->count - 1);
+    if(!dir) {
+        logw("group %d still listed, out of memory.\n", groupid);
+        return;
     }
 
-    return NULL;
+    memcpy(dir->entries, old->entries, i * sizeof(struct group_entry));
+    memcpy(&dir->entries[i], &old->entries[i + 1],
+            (old->count - i - 1) * sizeof(struct group_entry));
+
+    group_dir_publish(cm, dir);
 }
 
-static group_info_t *cli_mgr_get_group(cli_mgr_t *cm, uint32_t groupid)
+
+/* shard->lock held. */
+static void __cli_shard_add_group(cli_shard_t *shard, group_info_t *group) 
 {
-    group_info_t *group;
+    cli_mgr_t *cm = shard->mgr;
+
+    htable_insert(&shard->group_map, group);
+    shard->group_count++;
 
     pthread_mutex_lock(&cm->lock);
-    group = __cli_mgr_get_group(cm, groupid);
+    group_dir_insert(cm, group);
     pthread_mutex_unlock(&cm->lock);
+}
 
-    return group;
+/* lock-free, call under rcu_read_lock(). groups are freed by call_rcu(). */
+static group_info_t *cli_shard_get_group(cli_shard_t *shard, uint32_t groupid)
+{
+    return htable_lookup(&shard->group_map, groupid);
 }
 
-static group_info_t *cli_mgr_del_group(cli_mgr_t *cm, uint32_t groupid)
+/* shard->lock held. */
+static group_info_t *__cli_shard_del_group(cli_shard_t *shard, uint32_t groupid)
 {
+    cli_mgr_t *cm = shard->mgr;
     group_info_t *group;
 
-    pthread_mutex_lock(&cm->lock);
-
-    group = __cli_mgr_get_group(cm, groupid);
+    group = htable_remove(&shard->group_map, groupid);
     if(!group)
-        goto out;
+        return NULL;
 
-    hlist_del_init(&group->hentry);
-    cm->group_count--;
+    shard->group_count--;
 
-out:
+    pthread_mutex_lock(&cm->lock);
+    group_dir_remove(cm, groupid);
     pthread_mutex_unlock(&cm->lock);
     return group;
 }
 
 
-static void login_result_response(cli_mgr_t *cm, 
+static void user_info_free_rcu(struct rcu_head *head)
+{
+    user_info_t *user = container_of(head, user_info_t, rcu);
+
+    free(user);
+}
+
+static void group_info_free_rcu(struct rcu_head *head)
+{
+    group_info_t *group = container_of(head, group_info_t, rcu);
+
+    free(group);
+}
+
+
+/*
+ * a struct pack_center_msg from another shard, through the inbox of the
+ * shard, or another center, on the client port.
+ */
+struct shard_msg {
+    int type;
+    struct pack_center_msg body;
+};
+
+static void shard_msg_dispatch(cli_shard_t *shard, int type, struct pack_center_msg *msg);
+
+static void shard_msg_post(cli_shard_t *from, cli_shard_t *to, int type,
+        struct pack_center_msg *body)
+{
+    pack_buf_t *pkb;
+    struct shard_msg *msg;
+
+    if(from == to) {
+        shard_msg_dispatch(to, type, body);
+        return;
+    }
+
+    pkb = iohandler_pack_buf_alloc(to->post);
+    msg = (struct shard_msg *)pkb->data;
+    msg->type = type;
+    msg->body = *body;
+
+    pkb->len = sizeof(*msg);
+    iohandler_pkt_send(to->post, pkb);
+}
+
+/*
+ * @type to the shard keeping @id, in this center or another one. A
+ * message for @from itself is handled right away, so no shard lock may
+ * be held.
+ */
+static void cli_mgr_post(cli_shard_t *from, int type, uint32_t id,
+        uint32_t arg, struct center_client *client)
+{
+    int part = center_id_partition(id);
+    cli_mgr_t *cm = from->mgr;
+    struct pack_center_msg *msg;
+    struct pack_center_msg body;
+
+    if(part == cm->part.index) {
+        memset(&body, 0, sizeof(body));
+        body.id = id;
+        body.arg = arg;
+        if(client)
+            body.client = *client;
+
+        shard_msg_post(from, cli_mgr_shard(cm, id), type, &body);
+        return;
+    }
+
+    if(part >= cm->part.count) {
+        logw("no center server keeps id %u.\n", id);
+        return;
+    }
+
+    msg = (struct pack_center_msg *)client_pkt_alloc(from);
+    memset(msg, 0, sizeof(*msg));
+    msg->id = id;
+    msg->arg = arg;
+    if(client)
+        msg->client = *client;
+
+    client_pkt_sendto(from, type, msg, sizeof(*msg),
+            (struct sockaddr *)&cm->part.centers[part]);
+}
+
+/*
+ * A response to a client of another center goes out of that center: the
+ * client talks to it only, an address-restricted NAT drops the others.
+ * @data is from client_pkt_alloc(), it is moved behind the relay message.
+ */
+static void client_pkt_respond(cli_shard_t *shard, int type, void *data, int len,
+        uint32_t userid, struct sockaddr *to)
+{
+    int part = center_id_partition(userid);
+    cli_mgr_t *cm = shard->mgr;
+    struct pack_center_msg *msg;
+    struct sockaddr addr = *to;
+
+    if(part == cm->part.index || part >= cm->part.count ||
+            pack_head_len() + sizeof(*msg) + len > PACKET_MAX_PAYLOAD) {
+        client_pkt_sendto(shard, type, data, len, to);
+        return;
+    }
+
+    msg = (struct pack_center_msg *)data;
+    memmove(msg + 1, data, len);
+    msg->id = userid;
+    msg->arg = type;
+    msg->client.userid = userid;
+    msg->client.addr = addr;
+
+    client_pkt_sendto(shard, MSG_CENTER_RELAY, msg, sizeof(*msg) + len,
+            (struct sockaddr *)&cm->part.centers[part]);
+}
+
+/* on the shard of the user, a response from the center that made it. */
+static void client_relay_handle(cli_shard_t *shard, struct pack_center_msg *msg, int len)
+{
+    void *data;
+
+    if(len < 0 || pack_head_len() + len > PACKET_MAX_PAYLOAD)
+        return;
+
+    data = client_pkt_alloc(shard);
+    memcpy(data, msg + 1, len);
+    client_pkt_sendto(shard, msg->arg, data, len, &msg->client.addr);
+}
+
+static void login_result_response(cli_shard_t *shard, 
         user_info_t *uinfo, struct sockaddr *to)
 {
     uint32_t *userid;
 
-    userid = (uint32_t *)client_pkt_alloc(cm);
+    userid = (uint32_t *)client_pkt_alloc(shard);
     *userid = uinfo->userid;
 
-    client_pkt_sendto(cm, MSG_LOGIN_RESPONSE, userid, sizeof(uint32_t), to);
+    client_pkt_sendto(shard, MSG_LOGIN_RESPONSE, userid, sizeof(uint32_t), to);
+}
+
+/* the center server a client is kept by, from its address. */
+static int cli_mgr_home(cli_mgr_t *cm, struct sockaddr *from)
+{
+    struct sockaddr_in *addr = (struct sockaddr_in *)from;
+
+    if(cm->part.count == 1)
+        return cm->part.index;
+
+    /*
+     * by the high bits of the hash: its low bits follow the port parity,
+     * and the ports the kernel picks on bind() are all of one parity.
+     */
+    return ((uint64_t)hash_32(ntohl(addr->sin_addr.s_addr) ^ ntohs(addr->sin_port), 32)
+        * cm->part.count) >> 32;
+}
+
+static void login_redirect_response(cli_shard_t *shard, int home, struct sockaddr *to)
+{
+    struct sockaddr *addr;
+
+    addr = (struct sockaddr *)client_pkt_alloc(shard);
+    memcpy(addr, &shard->mgr->part.centers[home], sizeof(*addr));
+
+    client_pkt_sendto(shard, MSG_LOGIN_REDIRECT, addr, sizeof(*addr), to);
 }
 
-static int cmd_login_handle(cli_mgr_t *cm, struct sockaddr *from)
+static int cmd_login_handle(cli_shard_t *shard, struct sockaddr *from, int redirected)
 {
+    int id, home;
     user_info_t *uinfo;
     struct sockaddr_in *addr = (struct sockaddr_in *)from;
 
+    home = cli_mgr_home(shard->mgr, from);
+    if(!redirected && home != shard->mgr->part.index) {
+        logd("user from %s, %d to center %d.\n", inet_ntoa(addr->sin_addr),
+                ntohs(addr->sin_port), home);
+        login_redirect_response(shard, home, from);
+        return 0;
+    }
+
     uinfo = malloc(sizeof(*uinfo));
     if(!uinfo)
         return -EINVAL;
 
-    uinfo->userid = cli_mgr_alloc_uid(cm);
+    id = cli_shard_alloc_uid(shard);
+    if(id < 0) {
+        free(uinfo);
+        return id;
+    }
+
+    uinfo->userid = id;
     uinfo->addr = *from;
-    uinfo->group = NULL;
+    uinfo->groupid = GROUP_NONE;
     uinfo->state = 0;
-    uinfo->mgr = cm;
-    hbeat_add_to_god(&cm->hbeat_god, &uinfo->hbeat);
+    uinfo->shard = shard;
+    hbeat_add_to_god(&shard->hbeat_god, &uinfo->hbeat);
 
-    cli_mgr_add_user(cm, uinfo);
+    cli_shard_add_user(shard, uinfo);
 
     logi("user login. from %s, %d, alloc userid:%u.\n", 
             inet_ntoa(addr->sin_addr), ntohs(addr->sin_port), uinfo->userid);
 
-    login_result_response(cm, uinfo, from);
+    login_result_response(shard, uinfo, from);
 
     return 0;
 }
 
-static int cmd_logout_handle(cli_mgr_t *cm, uint32_t uid)
+static int cmd_logout_handle(cli_shard_t *shard, uint32_t uid)
 {
+    uint32_t groupid;
     user_info_t *uinfo;
 
-    uinfo = cli_mgr_del_user(cm, uid);
-    if(uinfo->group != NULL) {
-        //exit_from_group(); /* XXX */
-    }
+    uinfo = cli_shard_del_user(shard, uid, &groupid);
+    if(!uinfo)
+        return -EINVAL;
+
+    if(groupid != GROUP_NONE)
+        cli_mgr_post(shard, MSG_CENTER_LEAVE, groupid, uid, NULL);
 
-    hbeat_rm_from_god(&cm->hbeat_god, &uinfo->hbeat);
+    hbeat_rm_from_god(&shard->hbeat_god, &uinfo->hbeat);
 
-    cli_mgr_free_uid(cm, uid);
-    free(uinfo);
+    cli_shard_free_uid(shard, uid);
+    call_rcu(&uinfo->rcu, user_info_free_rcu);
     return 0;
 }
 
@@ -304,46 +555,171 @@ void client_user_dead(hbeat_node_t *hbeat)
     user = container_of(hbeat, user_info_t, hbeat);
     logi("user %d dead.\n", user->userid);
 
-    cmd_logout_handle(user->mgr, user->userid); /* XXX */
+    rcu_read_lock();
+    cmd_logout_handle(user->shard, user->userid);
+    rcu_read_unlock();
 }
 
+/*
+ * the group shard tells the user shard, a user gone or in another
+ * group meanwhile is taken out of the group again.
+ */
+static void user_set_group(cli_shard_t *shard, uint32_t userid,
+        uint32_t groupid, int member)
+{
+    int stale = 0;
+    user_info_t *uinfo;
+
+    pthread_mutex_lock(&shard->lock);
+    uinfo = cli_shard_get_user(shard, userid);
+    if(!member) {
+        if(uinfo && uinfo->groupid == groupid)
+            uinfo->groupid = GROUP_NONE;
+    } else if(uinfo && (uinfo->groupid == GROUP_NONE || uinfo->groupid == groupid)) {
+        uinfo->groupid = groupid;
+    } else {
+        stale = 1;
+    }
+    pthread_mutex_unlock(&shard->lock);
 
-static void create_group_response(cli_mgr_t *cm, group_info_t *ginfo, struct sockaddr *to)
+    if(stale)
+        cli_mgr_post(shard, MSG_CENTER_LEAVE, groupid, userid, NULL);
+}
+
+
+static void create_group_response(cli_shard_t *shard, group_info_t *ginfo, struct sockaddr *to)
 {
     struct turn_info info;
     struct pack_creat_group_result *result;
 
-    result = (struct pack_creat_group_result *)client_pkt_alloc(cm);
+    result = (struct pack_creat_group_result *)client_pkt_alloc(shard);
 
-    get_turn_info(cm->node_mgr, ginfo->turn_handle, &info);
+    get_turn_info(shard->mgr->node_mgr, ginfo->legs[0], &info);
 
     result->groupid = ginfo->groupid;
     result->taskid = info.taskid;
     result->addr = *((struct sockaddr *)&info.addr);
 
-    client_pkt_sendto(cm, MSG_CREATE_GROUP_RESPONSE, result, sizeof(*result), to);
+    client_pkt_sendto(shard, MSG_CREATE_GROUP_RESPONSE, result, sizeof(*result), to);
+}
+
+static group_member_t *group_find_member(group_info_t *ginfo, uint32_t userid)
+{
+    group_member_t *m;
+
+    list_for_each_entry(m, &ginfo->userlist, entry) {
+        if(m->userid == userid)
+            return m;
+    }
+    return NULL;
+}
+
+static void group_free_members(group_info_t *ginfo)
+{
+    group_member_t *m, *n;
+
+    list_for_each_entry_safe(m, n, &ginfo->userlist, entry) {
+        list_del(&m->entry);
+        free(m);
+    }
 }
 
-static int cmd_create_group_handle(cli_mgr_t *cm, struct pack_creat_group *pr)
+/* a create group waiting for its turn task. */
+struct group_assign {
+    cli_shard_t *shard;
+    group_info_t *ginfo;
+    uint32_t userid;
+};
+
+static void create_group_assigned(task_handle_t *task, int err, void *arg)
 {
+    struct group_assign *ga = arg;
+    cli_shard_t *shard = ga->shard;
+    group_info_t *ginfo = ga->ginfo;
+    user_info_t *creater;
+
+    rcu_read_lock();
+    pthread_mutex_lock(&shard->lock);
+    creater = cli_shard_get_user(shard, ga->userid);
+    if(err) {
+        loge("assign turn task failed: %d.\n", err);
+        goto fail;
+    }
+
+    ginfo->legs[0] = (unsigned long)task;
+    ginfo->nlegs = 1;
+
+    /* the creator left while the task was assigned. */
+    if(!creater || creater->groupid != ginfo->groupid) {
+        logw("group %d creator %u gone.\n", ginfo->groupid, ga->userid);
+        turn_task_reclaim(shard->mgr->node_mgr, ginfo->legs[0]);
+        goto fail;
+    }
+
+    /* found by a leave from now on, see cmd_leave_group_handle(). */
+    __cli_shard_add_group(shard, ginfo);
+    pthread_mutex_unlock(&shard->lock);
+
+    create_group_response(shard, ginfo, &creater->addr);
+    rcu_read_unlock();
+    free(ga);
+    return;
+
+fail:
+    if(creater && creater->groupid == ginfo->groupid)
+        creater->groupid = GROUP_NONE;
+    pthread_mutex_unlock(&shard->lock);
+    rcu_read_unlock();
+
+    group_free_members(ginfo);
+    cli_shard_free_gid(shard, ginfo->groupid);
+    call_rcu(&ginfo->rcu, group_info_free_rcu);
+    free(ga);
+}
+
+/*
+ * The group is kept by the shard of its creator. The turn task is
+ * assigned asynchronously, the response is sent by create_group_assigned()
+ * when the node server answers.
+ */
+static int cmd_create_group_handle(cli_shard_t *shard, struct pack_creat_group *pr)
+{
+    int ret, id;
     group_info_t *ginfo;
+    group_member_t *m;
     user_info_t *creater;
+    struct group_assign *ga;
 
     logd("create group request from user:%u.\n", pr->userid);
 
-    creater = cli_mgr_get_user(cm, pr->userid);
+    creater = cli_shard_get_user(shard, pr->userid);
     if(!creater) {
         loge("user %u not found.\n", pr->userid);
         return -EINVAL;
     }
 
     ginfo = malloc(sizeof(*ginfo));
-    if(!ginfo) {
-        return -ENOMEM;
+    m = malloc(sizeof(*m));
+    ga = malloc(sizeof(*ga));
+    if(!ginfo || !m || !ga) {
+        ret = -ENOMEM;
+        goto fail;
+    }
+
+    id = cli_shard_alloc_gid(shard);
+    if(id < 0) {
+        ret = id;
+        goto fail;
     }
 
-    ginfo->groupid = cli_mgr_alloc_gid(cm);
+    ginfo->groupid = id;
     ginfo->flags = pr->flags;
+    ginfo->users = 0;
+    memset(ginfo->legs, 0, sizeof(ginfo->legs));
+    memset(ginfo->leg_users, 0, sizeof(ginfo->leg_users));
+    ginfo->nlegs = 0;
+    ginfo->leg_pending = 0;
+    ginfo->deleted = 0;
     INIT_LIST_HEAD(&ginfo->userlist);
 
     strncpy(ginfo->name, (char *)pr->name, GROUP_NAME_MAX);
@@ -351,43 +727,120 @@ static int cmd_create_group_handle(cli_mgr_t *cm, struct pack_creat_group *pr)
     if(ginfo->flags & GROUP_TYPE_NEED_PASSWD)
         strncpy(ginfo->passwd, (char *)pr->passwd, GROUP_PASSWD_MAX);
 
-    creater->group = ginfo;
-    list_add_tail(&creater->entry, &ginfo->userlist);
+    pthread_mutex_lock(&shard->lock);
+    ret = (creater->groupid != GROUP_NONE) ? -EBUSY : 0;
+    if(!ret)
+        creater->groupid = ginfo->groupid;
+    pthread_mutex_unlock(&shard->lock);
+    if(ret) {
+        logw("user %u is in group %u already.\n", pr->userid, creater->groupid);
+        cli_shard_free_gid(shard, ginfo->groupid);
+        goto fail;
+    }
+
+    m->userid = creater->userid;
+    m->addr = creater->addr;
+    m->leg = 0;
+    list_add_tail(&m->entry, &ginfo->userlist);
     ginfo->users++;
+    ginfo->leg_users[0]++;
+
+    ga->shard = shard;
+    ga->ginfo = ginfo;
+    ga->userid = pr->userid;
 
-    ginfo->turn_handle = turn_task_assign(cm->node_mgr, ginfo);
-    if(ginfo->turn_handle == 0) {
+    ret = turn_task_assign_async(shard->mgr->node_mgr, ginfo, create_group_assigned, ga);
+    if(ret) {
         loge("assign turn task failed.\n");
+        pthread_mutex_lock(&shard->lock);
+        if(creater->groupid == ginfo->groupid)
+            creater->groupid = GROUP_NONE;
+        pthread_mutex_unlock(&shard->lock);
+        cli_shard_free_gid(shard, ginfo->groupid);
+        ret = -EINVAL;
         goto fail;
     }
-
-    cli_mgr_add_group(cm, ginfo);
-
-    create_group_response(cm, ginfo, &creater->addr);
     return 0;
 
 fail:
+    free(ga);
+    free(m);
     free(ginfo);
-    return -EINVAL;
+    return ret;
 }
 
 
-static void group_delete_notify(cli_mgr_t *cm, user_info_t *user)
+/*
+ * a turn task of a group moved, the users of that leg relay through
+ * task->addr now, and so do the other legs.
+ */
+static void group_task_migrated(task_handle_t *task, void *arg)
+{
+    int i, s, leg;
+    cli_mgr_t *cm = arg;
+    cli_shard_t *shard;
+    group_info_t *ginfo;
+    group_member_t *m;
+    struct htable_iter iter;
+    struct pack_creat_group_result *result;
+
+    rcu_read_lock();
+    for(s=0; s<cm->shard_count; s++) {
+        shard = cm->shards[s];
+
+        htable_for_each(&shard->group_map, &iter, ginfo) {
+            for(leg=0; leg<ginfo->nlegs; leg++) {
+                if(ginfo->legs[leg] == (unsigned long)task)
+                    break;
+            }
+            if(leg == ginfo->nlegs)
+                continue;
+
+            pthread_mutex_lock(&shard->lock);
+            for(i=0; i<ginfo->nlegs; i++) {
+                if(i != leg)
+                    turn_task_link(cm->node_mgr, ginfo->legs[i], ginfo->legs[leg]);
+            }
+
+            list_for_each_entry(m, &ginfo->userlist, entry) {
+                if(m->leg != leg)
+                    continue;
+
+                result = (struct pack_creat_group_result *)client_pkt_alloc(shard);
+                result->groupid = ginfo->groupid;
+                result->taskid = task->taskid;
+                result->addr = *((struct sockaddr *)&task->addr);
+
+                client_pkt_respond(shard, MSG_GROUP_MIGRATE, result, sizeof(*result),
+                        m->userid, &m->addr);
+            }
+            pthread_mutex_unlock(&shard->lock);
+            goto out;
+        }
+    }
+out:
+    rcu_read_unlock();
+}
+
+static void group_delete_notify(cli_shard_t *shard, uint32_t gid, group_member_t *m)
 {
     uint32_t *groupid;
-    group_info_t *ginfo = user->group;
 
-    groupid = (uint32_t *)client_pkt_alloc(cm);
-    *groupid = ginfo->groupid;
+    groupid = (uint32_t *)client_pkt_alloc(shard);
+    *groupid = gid;
 
-    client_pkt_sendto(cm, MSG_GROUP_DELETE, groupid, sizeof(uint32_t), &user->addr);
+    client_pkt_respond(shard, MSG_GROUP_DELETE, groupid, sizeof(uint32_t),
+            m->userid, &m->addr);
 }
 
-static int cmd_delete_group_handle(cli_mgr_t *cm, struct pack_del_group *pr)
+/* on the shard of the group, @userid asked for it. */
+static int group_delete(cli_shard_t *shard, uint32_t userid, uint32_t groupid)
 {
-    int ret;
+    int i, nlegs, pending;
+    cli_mgr_t *cm = shard->mgr;
     group_info_t *ginfo;
-    user_info_t *user;
+    group_member_t *m, *n;
+    LIST_HEAD(members);
 
 #if 0
     user_info_t *creater;
@@ -398,147 +851,443 @@ static int cmd_delete_group_handle(cli_mgr_t *cm, struct pack_del_group *pr)
     }
 #endif
 
-    ginfo = cli_mgr_del_group(cm, pr->groupid);
+    /* a leg still being assigned frees the group, see group_leg_assigned(). */
+    pthread_mutex_lock(&shard->lock);
+    ginfo = __cli_shard_del_group(shard, groupid);
+    if(!ginfo) {
+        pthread_mutex_unlock(&shard->lock);
+        return -EINVAL;
+    }
+
+    list_splice_init(&ginfo->userlist, &members);
+    ginfo->users = 0;
+    nlegs = ginfo->nlegs;
+    pending = ginfo->leg_pending;
+    ginfo->deleted = 1;
+    pthread_mutex_unlock(&shard->lock);
 
-    list_for_each_entry(user, &ginfo->userlist, entry) {
-        if(pr->userid == user->userid)
-            continue;
+    list_for_each_entry_safe(m, n, &members, entry) {
+        if(m->userid != userid)
+            group_delete_notify(shard, groupid, m);
 
-        group_delete_notify(cm, user);
-        user->group = NULL;
+        cli_mgr_post(shard, MSG_CENTER_UNMEMBER, m->userid, groupid, NULL);
+        list_del(&m->entry);
+        free(m);
     }
 
-    ret = turn_task_reclaim(cm->node_mgr, ginfo->turn_handle);
-    if(ret)
-        logw("turn task reclaim fail.\n");
+    for(i=0; i<nlegs; i++) {
+        if(turn_task_reclaim(cm->node_mgr, ginfo->legs[i]))
+            logw("turn task reclaim fail.\n");
+    }
 
-    cli_mgr_free_gid(cm, ginfo->groupid);
-    free(ginfo);
+    cli_shard_free_gid(shard, groupid);
+    if(!pending)
+        call_rcu(&ginfo->rcu, group_info_free_rcu);
     return 0;
 }
 
-#define RESULT_MAX_LEN 	 	(4000)
+static int cmd_delete_group_handle(cli_shard_t *shard, struct pack_del_group *pr)
+{
+    if(!cli_shard_get_user(shard, pr->userid))
+        return -EINVAL;
+
+    cli_mgr_post(shard, MSG_CENTER_DELETE, pr->groupid, pr->userid, NULL);
+    return 0;
+}
 
-static int cmd_list_group_handle(cli_mgr_t *cm, struct pack_list_group *pr)
+/*
+ * A page of the group directory from the cursor, the groupid to go on
+ * from. The directory is read without lock, creates and deletes meanwhile
+ * are seen by the next page. Each center lists the groups it keeps, a
+ * page not full after the last of them goes on to the next center with
+ * the groups so far, @prev of @prevlen bytes.
+ */
+static int group_list_page(cli_shard_t *shard, uint32_t pos, int count,
+        struct center_client *to, struct pack_list_group_result *prev, int prevlen)
 {
-    int i;
-    int index = 0;
-    user_info_t *uinfo;
-    group_info_t *group;
-    group_desc_t *gdest;
-    struct hlist_node *tmp;
-    uint8_t *data;
+    int i, len;
     int offset = 0;
-    int rescount = 0;
+    cli_mgr_t *cm = shard->mgr;
+    uint32_t next = LIST_GROUP_CURSOR_END;
+    struct group_dir *dir;
+    struct group_entry *e;
+    group_desc_t *gdesc;
+    struct pack_list_group_result *res;
+    struct pack_center_msg *msg;
+
+    logd("list group. pos:%u, count:%d.\n", pos, count);
+
+    if(cm->part.index + 1 < cm->part.count)
+        next = (cm->part.index + 1) << CENTER_ID_SHIFT;
+
+    dir = rcu_dereference(cm->group_dir);
+    if(pos == LIST_GROUP_CURSOR_END)
+        i = dir->count;
+    else
+        i = group_dir_search(dir, pos);
+
+    /* room for the relay of the page, see client_pkt_respond(). */
+    msg = (struct pack_center_msg *)client_pkt_alloc(shard);
+    res = (struct pack_list_group_result *)(msg + 1);
+    res->count = 0;
+    if(prev && prevlen >= 0 && prevlen <= LIST_GROUP_RESULT_MAX) {
+        memcpy(res, prev, sizeof(*res) + prevlen);
+        offset = prevlen;
+    }
 
-    data = client_pkt_alloc(cm);
+    for(; i<dir->count && res->count < count; i++) {
+        e = &dir->entries[i];
+        len = sizeof(group_desc_t) + e->namelen;
+        if(offset + len > LIST_GROUP_RESULT_MAX)
+            break;
 
-    logd("list group request from user:%u.\n", pr->userid);
-    uinfo = cli_mgr_get_user(cm, pr->userid);
-    if(!uinfo)
-        return -EINVAL;
+        gdesc = (group_desc_t *)(res->data + offset);
+        gdesc->groupid = e->groupid;
+        gdesc->flags = e->flags;
+        gdesc->namelen = e->namelen;
+        memcpy(gdesc->name, e->name, e->namelen);
 
-    logd("list group. pos:%d, count:%d.\n", pr->pos, pr->count);
+        offset += len;
+        res->count++;
+    }
 
-    for(i=0; i<HASH_GROUP_CAPACITY; i++) {
-        hlist_for_each_entry(group, tmp, &cm->group_map[i], hentry) {
-            if(index++ < pr->pos)
-                continue;
+    /* nothing left here and room in the page, the next center goes on. */
+    if(i == dir->count && next != LIST_GROUP_CURSOR_END &&
+            pos != LIST_GROUP_CURSOR_END && res->count < count) {
+        memset(msg, 0, sizeof(*msg));
+        msg->id = next;
+        msg->arg = count;
+        msg->client = *to;
+        client_pkt_sendto(shard, MSG_CENTER_LIST, msg,
+                sizeof(*msg) + sizeof(*res) + offset,
+                (struct sockaddr *)&cm->part.centers[center_id_partition(next)]);
+        return 0;
+    }
 
-            if(rescount >= pr->count) {
-                break;
-            }
-            if(offset + sizeof(group_desc_t) + strlen(group->name) >= RESULT_MAX_LEN) {
-                break; /* submit */
-            }
+    res->cursor = (i < dir->count) ? dir->entries[i].groupid : next;
+
+    memmove(msg, res, sizeof(*res) + offset);
+    client_pkt_respond(shard, MSG_LIST_GROUP_RESPONSE, msg, sizeof(*res) + offset,
+            to->userid, &to->addr);
+    return 0;
+}
 
-            gdest = (group_desc_t *)(data + offset);
-            gdest->groupid = group->groupid;
-            gdest->flags = group->flags;
-            gdest->namelen = strlen(group->name);
+static int cmd_list_group_handle(cli_shard_t *shard, struct pack_list_group *pr)
+{
+    user_info_t *uinfo;
+    struct center_client client;
 
-            strncpy(gdest->name, group->name, GROUP_NAME_MAX);
-            offset += (sizeof(group_desc_t) + gdest->namelen);
-            rescount++;
-        }
+    logd("list group request from user:%u.\n", pr->userid);
+    uinfo = cli_shard_get_user(shard, pr->userid);
+    if(!uinfo)
+        return -EINVAL;
+
+    client.userid = pr->userid;
+    client.addr = uinfo->addr;
+
+    if(pr->pos != LIST_GROUP_CURSOR_END &&
+            center_id_partition(pr->pos) != shard->mgr->part.index) {
+        cli_mgr_post(shard, MSG_CENTER_LIST, pr->pos, pr->count, &client);
+        return 0;
     }
 
-    client_pkt_sendto(cm, MSG_LIST_GROUP_RESPONSE, data, offset, &uinfo->addr);
-    return 0;
+    return group_list_page(shard, pr->pos, pr->count, &client, NULL, 0);
 }
 
-static void join_group_response(cli_mgr_t *cm, group_info_t *ginfo, struct sockaddr *to)
+static void join_group_response(cli_shard_t *shard, group_info_t *ginfo, int leg,
+        group_member_t *m)
 {
     struct turn_info info;
     struct pack_creat_group_result *result; 	/* XXX */
 
-    result = (struct pack_creat_group_result *)client_pkt_alloc(cm);
+    result = (struct pack_creat_group_result *)client_pkt_alloc(shard);
 
-    get_turn_info(cm->node_mgr, ginfo->turn_handle, &info);
+    get_turn_info(shard->mgr->node_mgr, ginfo->legs[leg], &info);
 
     result->groupid = ginfo->groupid;
     result->taskid = info.taskid;
     result->addr = *((struct sockaddr *)&info.addr);
 
-    client_pkt_sendto(cm, MSG_JOIN_GROUP_RESPONSE, result, sizeof(*result), to);
+    client_pkt_respond(shard, MSG_JOIN_GROUP_RESPONSE, result, sizeof(*result),
+            m->userid, &m->addr);
 }
 
-static int cmd_join_group_handle(cli_mgr_t *cm, struct pack_join_group *pr)
+/* the first leg with room, -1 if all have cm->leg_users. */
+static int group_choice_leg(cli_mgr_t *cm, group_info_t *ginfo)
 {
-    user_info_t *uinfo;
+    int i;
+
+    for(i=0; i<ginfo->nlegs; i++) {
+        if(ginfo->leg_users[i] < cm->leg_users)
+            return i;
+    }
+    return -1;
+}
+
+static int group_least_leg(group_info_t *ginfo)
+{
+    int i, leg = 0;
+
+    for(i=1; i<ginfo->nlegs; i++) {
+        if(ginfo->leg_users[i] < ginfo->leg_users[leg])
+            leg = i;
+    }
+    return leg;
+}
+
+/* shard->lock held. */
+static void group_add_member(group_info_t *ginfo, group_member_t *m, int leg)
+{
+    m->leg = leg;
+    list_add_tail(&m->entry, &ginfo->userlist);
+    ginfo->users++;
+    ginfo->leg_users[leg]++;
+}
+
+/* a join waiting for a new leg of the group. */
+struct leg_assign {
+    cli_shard_t *shard;
     group_info_t *ginfo;
+    group_member_t *member;
+};
 
-    logd("join group request from user:%u, group:%u.\n", pr->userid, pr->groupid);
+/*
+ * the new leg is linked with each of the others both ways, it has the
+ * user already. Without a new leg the user goes to the least used.
+ */
+static void group_leg_assigned(task_handle_t *task, int err, void *arg)
+{
+    int i, leg;
+    struct leg_assign *la = arg;
+    cli_shard_t *shard = la->shard;
+    cli_mgr_t *cm = shard->mgr;
+    group_info_t *ginfo = la->ginfo;
+    group_member_t *m = la->member;
+    uint32_t userid = m->userid;
+
+    pthread_mutex_lock(&shard->lock);
+    ginfo->leg_pending = 0;
+    if(ginfo->deleted) {
+        pthread_mutex_unlock(&shard->lock);
+        if(!err)
+            turn_task_reclaim(cm->node_mgr, (unsigned long)task);
+        call_rcu(&ginfo->rcu, group_info_free_rcu);
+        free(m);
+        free(la);
+        return;
+    }
 
-    uinfo = cli_mgr_get_user(cm, pr->userid);
-    if(!uinfo) {
-        loge("not found user by id:%d.\n", pr->userid);
-        return -EINVAL;
+    if(!err) {
+        leg = ginfo->nlegs;
+        ginfo->legs[leg] = (unsigned long)task;
+        ginfo->leg_users[leg] = 0;
+        smp_wmb();
+        ginfo->nlegs++;
+
+        for(i=0; i<leg; i++) {
+            turn_task_link(cm->node_mgr, ginfo->legs[i], ginfo->legs[leg]);
+            turn_task_link(cm->node_mgr, ginfo->legs[leg], ginfo->legs[i]);
+        }
+        logi("group %d leg %d on task %d.\n", ginfo->groupid, leg, task->taskid);
+    } else {
+        loge("assign group %d leg failed: %d.\n", ginfo->groupid, err);
+        leg = group_least_leg(ginfo);
+        turn_task_user_join(cm->node_mgr, ginfo->legs[leg], m);
     }
 
-    ginfo = cli_mgr_get_group(cm, pr->groupid);
+    group_add_member(ginfo, m, leg);
+    join_group_response(shard, ginfo, leg, m);
+    pthread_mutex_unlock(&shard->lock);
+
+    cli_mgr_post(shard, MSG_CENTER_MEMBER, userid, ginfo->groupid, NULL);
+    free(la);
+}
+
+/* a further leg for @m, placed apart from the last one. */
+static int group_leg_assign(cli_shard_t *shard, group_info_t *ginfo, group_member_t *m)
+{
+    int ret;
+    struct leg_assign *la;
+
+    la = malloc(sizeof(*la));
+    if(!la)
+        return -ENOMEM;
+
+    la->shard = shard;
+    la->ginfo = ginfo;
+    la->member = m;
+
+    ret = turn_leg_assign_async(shard->mgr->node_mgr, ginfo, m,
+            ginfo->legs[ginfo->nlegs - 1], group_leg_assigned, la);
+    if(ret)
+        free(la);
+    return ret;
+}
+
+/* on the shard of the group, a join passed on by the shard of the user. */
+static int group_join(cli_shard_t *shard, uint32_t userid, uint32_t groupid,
+        struct center_client *client)
+{
+    int leg;
+    cli_mgr_t *cm = shard->mgr;
+    group_info_t *ginfo;
+    group_member_t *m, *old;
+
+    ginfo = cli_shard_get_group(shard, groupid);
     if(!ginfo) {
-        loge("not found group by id:%d.\n", pr->groupid);
+        loge("not found group by id:%d.\n", groupid);
         return -EINVAL;
     }
 
-    uinfo->group = ginfo;
-    list_add_tail(&uinfo->entry, &ginfo->userlist);
-    ginfo->users++;
+    m = malloc(sizeof(*m));
+    if(!m)
+        return -ENOMEM;
+
+    m->userid = userid;
+    m->addr = client->addr;
 
-    turn_task_user_join(cm->node_mgr, ginfo->turn_handle, uinfo);
+    pthread_mutex_lock(&shard->lock);
+    if(ginfo->deleted || !ginfo->nlegs)
+        goto fail;
+
+    /* a join sent again, answer as before. */
+    old = group_find_member(ginfo, userid);
+    if(old) {
+        join_group_response(shard, ginfo, old->leg, m);
+        pthread_mutex_unlock(&shard->lock);
+        free(m);
+        return 0;
+    }
 
-    join_group_response(cm, ginfo, &uinfo->addr);
+    /* not on the list yet, group_leg_assigned() answers it. */
+    if(ginfo->leg_pending && ginfo->leg_userid == userid) {
+        pthread_mutex_unlock(&shard->lock);
+        free(m);
+        return 0;
+    }
+
+    if(ginfo->users >= GROUP_MAX_USER) {
+        loge("group %d is full.\n", groupid);
+        goto fail;
+    }
+
+    /* the join is answered once the new leg is placed. */
+    leg = group_choice_leg(cm, ginfo);
+    if(leg < 0 && ginfo->nlegs < GROUP_MAX_LEGS && !ginfo->leg_pending) {
+        ginfo->leg_pending = 1;
+        ginfo->leg_userid = userid;
+        pthread_mutex_unlock(&shard->lock);
+
+        if(!group_leg_assign(shard, ginfo, m))
+            return 0;
+
+        pthread_mutex_lock(&shard->lock);
+        ginfo->leg_pending = 0;
+        if(ginfo->deleted) {
+            pthread_mutex_unlock(&shard->lock);
+            call_rcu(&ginfo->rcu, group_info_free_rcu);
+            free(m);
+            return -EINVAL;
+        }
+    }
+    if(leg < 0)
+        leg = group_least_leg(ginfo);
+
+    group_add_member(ginfo, m, leg);
+    turn_task_user_join(cm->node_mgr, ginfo->legs[leg], m);
+    join_group_response(shard, ginfo, leg, m);
+    pthread_mutex_unlock(&shard->lock);
+
+    cli_mgr_post(shard, MSG_CENTER_MEMBER, userid, groupid, NULL);
     return 0;
-}
 
+fail:
+    pthread_mutex_unlock(&shard->lock);
+    free(m);
+    return -EINVAL;
+}
 
-static int cmd_leave_group_handle(cli_mgr_t *cm, struct pack_leave_group *pr)
+static int cmd_join_group_handle(cli_shard_t *shard, struct pack_join_group *pr)
 {
     user_info_t *uinfo;
+    struct center_client client;
+
+    logd("join group request from user:%u, group:%u.\n", pr->userid, pr->groupid);
+
+    uinfo = cli_shard_get_user(shard, pr->userid);
+    if(!uinfo) {
+        loge("not found user by id:%d.\n", pr->userid);
+        return -EINVAL;
+    }
+
+    if(uinfo->groupid != GROUP_NONE && uinfo->groupid != pr->groupid) {
+        logw("user %u is in group %u already.\n", pr->userid, uinfo->groupid);
+        return -EBUSY;
+    }
+
+    client.userid = pr->userid;
+    client.addr = uinfo->addr;
+    cli_mgr_post(shard, MSG_CENTER_JOIN, pr->groupid, pr->userid, &client);
+    return 0;
+}
+
+
+/* on the shard of the group. */
+static int group_leave(cli_shard_t *shard, uint32_t userid, uint32_t groupid)
+{
     group_info_t *ginfo;
+    group_member_t *m = NULL;
 
-    uinfo = cli_mgr_get_user(cm, pr->userid);
-    if(!uinfo)
+    ginfo = cli_shard_get_group(shard, groupid);
+    if(!ginfo)
         return -EINVAL;
 
-    ginfo = uinfo->group;
-    if(!ginfo) 
+    /* no turn task to tell before the create is assigned. */
+    pthread_mutex_lock(&shard->lock);
+    if(!ginfo->deleted && ginfo->nlegs)
+        m = group_find_member(ginfo, userid);
+    if(m) {
+        ginfo->users--;
+        ginfo->leg_users[m->leg]--;
+        list_del(&m->entry);
+
+        turn_task_user_leave(shard->mgr->node_mgr, ginfo->legs[m->leg], m);
+    }
+    pthread_mutex_unlock(&shard->lock);
+
+    if(!m)
         return -EINVAL;
 
-    ginfo->users--;
-    list_del(&uinfo->entry);
+    free(m);
+    return 0;
+}
 
-    turn_task_user_leave(cm->node_mgr, ginfo->turn_handle, uinfo);
+static int cmd_leave_group_handle(cli_shard_t *shard, struct pack_leave_group *pr)
+{
+    uint32_t groupid;
+    user_info_t *uinfo;
 
+    uinfo = cli_shard_get_user(shard, pr->userid);
+    if(!uinfo)
+        return -EINVAL;
+
+    pthread_mutex_lock(&shard->lock);
+    groupid = uinfo->groupid;
+    uinfo->groupid = GROUP_NONE;
+    pthread_mutex_unlock(&shard->lock);
+
+    if(groupid == GROUP_NONE) 
+        return -EINVAL;
+
+    cli_mgr_post(shard, MSG_CENTER_LEAVE, groupid, pr->userid, NULL);
     return 0;
 }
 
-static int cmd_hbeat_handle(cli_mgr_t *cm, uint32_t userid)
+static int cmd_hbeat_handle(cli_shard_t *shard, uint32_t userid)
 {
     user_info_t *uinfo;
 
-    uinfo = cli_mgr_get_user(cm, userid);
+    uinfo = cli_shard_get_user(shard, userid);
     if(!uinfo)
         return -EINVAL;
 
@@ -547,12 +1296,70 @@ static int cmd_hbeat_handle(cli_mgr_t *cm, uint32_t userid)
 }
 
 
-static void cli_mgr_handle(void *opaque, uint8_t *data, int len, void *from)
+static void shard_msg_dispatch(cli_shard_t *shard, int type, struct pack_center_msg *msg)
 {
     int ret = 0;
-    cli_mgr_t *cm = (cli_mgr_t *)opaque;
+
+    rcu_read_lock();
+    switch(type) {
+        case MSG_CENTER_JOIN:
+            ret = group_join(shard, msg->arg, msg->id, &msg->client);
+            break;
+        case MSG_CENTER_LEAVE:
+            ret = group_leave(shard, msg->arg, msg->id);
+            break;
+        case MSG_CENTER_DELETE:
+            ret = group_delete(shard, msg->arg, msg->id);
+            break;
+        case MSG_CENTER_LIST:
+            ret = group_list_page(shard, msg->id, msg->arg, &msg->client, NULL, 0);
+            break;
+        case MSG_CENTER_MEMBER:
+        case MSG_CENTER_UNMEMBER:
+            user_set_group(shard, msg->id, msg->arg, type == MSG_CENTER_MEMBER);
+            break;
+        default:
+            logw("unknown center message. type:%d\n", type);
+            break;
+    }
+    rcu_read_unlock();
+
+    if(ret)
+        logd("shard %d message %d for %u: %d.\n", shard->index, type, msg->id, ret);
+}
+
+static void shard_msg_handle(void *opaque, uint8_t *data, int len)
+{
+    cli_shard_t *shard = (cli_shard_t *)opaque;
+    struct shard_msg *msg = (struct shard_msg *)data;
+
+    if(data == NULL || len != sizeof(*msg))
+        return;
+
+    shard_msg_dispatch(shard, msg->type, &msg->body);
+}
+
+/* the center server at @addr, -1 if it is none of them. */
+static int cli_mgr_center_index(cli_mgr_t *cm, struct sockaddr *addr)
+{
+    int i;
+    struct sockaddr_in *in = (struct sockaddr_in *)addr;
+
+    for(i=0; i<cm->part.count; i++) {
+        if(cm->part.centers[i].sin_addr.s_addr == in->sin_addr.s_addr &&
+                cm->part.centers[i].sin_port == in->sin_port)
+            return i;
+    }
+    return -1;
+}
+
+static void cli_mgr_handle(void *opaque, uint8_t *data, int len, void *from)
+{
+    int ret = 0, extra;
+    cli_shard_t *shard = (cli_shard_t *)opaque;
     pack_head_t *head;
     void *payload;
+    struct pack_center_msg *msg;
     struct sockaddr *cliaddr = from;
 
     logd("client manager receive pack. len:%d\n", len);
@@ -571,47 +1378,84 @@ static void cli_mgr_handle(void *opaque, uint8_t *data, int len, void *from)
         return;
 
     if(head->type == MSG_CLI_ACK) {
-        cli_ack_handle(cm, head->seqnum);
+        cli_ack_handle(shard, head->seqnum);
     }
 
-    cli_mgr_send_ack(cm, head);
+    cli_mgr_send_ack(shard, head);
+
+    /*
+     * each request starts with the userid, and each center message with
+     * its id, it is steered to the socket of its shard. Here only if the
+     * steering is off.
+     */
+    if(head->type != MSG_CLI_LOGIN && len >= sizeof(*head) + sizeof(uint32_t))
+        shard = cli_mgr_shard(shard->mgr, *(uint32_t *)payload);
+
+    if(head->type >= MSG_CENTER_JOIN) {
+        if(len < sizeof(*head) + sizeof(struct pack_center_msg) ||
+                cli_mgr_center_index(shard->mgr, cliaddr) < 0) {
+            logw("center message %d from an unknown server.\n", head->type);
+            return;
+        }
+        extra = len - sizeof(*head) - sizeof(struct pack_center_msg);
+        msg = (struct pack_center_msg *)payload;
+        if(head->type == MSG_CENTER_RELAY) {
+            client_relay_handle(shard, msg, extra);
+        } else if(head->type == MSG_CENTER_LIST &&
+                extra >= (int)sizeof(struct pack_list_group_result)) {
+            rcu_read_lock();
+            group_list_page(shard, msg->id, msg->arg, &msg->client,
+                    (struct pack_list_group_result *)(msg + 1),
+                    extra - sizeof(struct pack_list_group_result));
+            rcu_read_unlock();
+        } else
+            shard_msg_dispatch(shard, head->type, (struct pack_center_msg *)payload);
+        return;
+    }
 
+    /*
+     * users and groups are looked up without lock, keep them alive
+     * until the request is handled.
+     */
+    rcu_read_lock();
     switch(head->type) {
         case MSG_CLI_LOGIN:
             //uint32_t id = period; /*XXX*/
-            ret = cmd_login_handle(cm, cliaddr);
+            ret = cmd_login_handle(shard, cliaddr,
+                    len >= sizeof(*head) + sizeof(uint32_t));
             break;
         case MSG_CLI_LOGOUT:
         {
             uint32_t uid = *(uint32_t *)payload;
-            ret = cmd_logout_handle(cm, uid);
+            ret = cmd_logout_handle(shard, uid);
             break;
         }
         case MSG_CLI_CREATE_GROUP:
-            ret = cmd_create_group_handle(cm, (struct pack_creat_group *)payload);
+            ret = cmd_create_group_handle(shard, (struct pack_creat_group *)payload);
             break;
         case MSG_CLI_DELETE_GROUP:
-            ret = cmd_delete_group_handle(cm, (struct pack_del_group *)payload);
+            ret = cmd_delete_group_handle(shard, (struct pack_del_group *)payload);
             break;
         case MSG_CLI_LIST_GROUP:
-            ret = cmd_list_group_handle(cm, (struct pack_list_group *)payload);
+            ret = cmd_list_group_handle(shard, (struct pack_list_group *)payload);
             break;
         case MSG_CLI_JOIN_GROUP:
-            ret = cmd_join_group_handle(cm, (struct pack_join_group *)payload);
+            ret = cmd_join_group_handle(shard, (struct pack_join_group *)payload);
             break;
         case MSG_CLI_LEAVE_GROUP:
-            ret = cmd_leave_group_handle(cm, (struct pack_leave_group *)payload);
+            ret = cmd_leave_group_handle(shard, (struct pack_leave_group *)payload);
             break;
         case MSG_CLI_HBEAT:
         {
             uint32_t uid = *(uint32_t *)payload;
-            ret = cmd_hbeat_handle(cm, uid);
+            ret = cmd_hbeat_handle(shard, uid);
             break;
         }
         default:
             logw("unknown packet. type:%d\n", head->type);
             break;
     }
+    rcu_read_unlock();
 
     if(ret) {
         logw("packet handle fatal. type:%d\n", head->type);
@@ -624,13 +1468,130 @@ static void cli_mgr_close(void *opaque)
 
 }
 
+/*
+ * a request goes to the shard of its user, userid % count without the
+ * partition, the first word of each request. A login has no user yet, an index out of the
+ * group lets the kernel pick a socket by hash.
+ */
+static int cli_shard_attach_steering(int sock, int count)
+{
+    const uint32_t ofs = pack_head_len();
+    struct sock_filter code[] = {
+        BPF_STMT(BPF_LD | BPF_B | BPF_ABS, offsetof(pack_head_t, type)),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, MSG_CLI_LOGIN, 0, 1),
+        BPF_STMT(BPF_RET | BPF_K, count),
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        BPF_STMT(BPF_LD | BPF_B | BPF_ABS, ofs + 3),
+        BPF_STMT(BPF_ALU | BPF_LSH | BPF_K, 8),
+        BPF_STMT(BPF_MISC | BPF_TAX, 0),
+        BPF_STMT(BPF_LD | BPF_B | BPF_ABS, ofs + 2),
+        BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+        BPF_STMT(BPF_ALU | BPF_LSH | BPF_K, 8),
+        BPF_STMT(BPF_MISC | BPF_TAX, 0),
+        BPF_STMT(BPF_LD | BPF_B | BPF_ABS, ofs + 1),
+        BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+        BPF_STMT(BPF_ALU | BPF_LSH | BPF_K, 8),
+        BPF_STMT(BPF_MISC | BPF_TAX, 0),
+        BPF_STMT(BPF_LD | BPF_B | BPF_ABS, ofs),
+        BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+#else
+        BPF_STMT(BPF_LD | BPF_W | BPF_ABS, ofs),
+#endif
+        BPF_STMT(BPF_ALU | BPF_AND | BPF_K, CENTER_ID_MASK),
+        BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, count),
+        BPF_STMT(BPF_RET | BPF_A, 0),
+    };
+    struct sock_fprog prog = {
+        .len = ARRAY_SIZE(code),
+        .filter = code,
+    };
+
+    return setsockopt(sock, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog));
+}
 
-#define ID_FRIST_NUM 	(1)
-
-cli_mgr_t *cli_mgr_init(node_mgr_t *nodemgr) 
+/* one socket of the reuseport group for each shard, in shard order. */
+static int cli_mgr_open_sockets(int *socks, int count, int port)
 {
     int i;
-    int clifd;
+
+    if(count == 1) {
+        socks[0] = create_cli_mgr_channel(port);
+        return socks[0] < 0 ? -1 : 0;
+    }
+
+    for(i=0; i<count; i++) {
+        socks[i] = socket_reuseport_server(port, SOCK_DGRAM);
+        if(socks[i] < 0)
+            goto fail;
+
+        if(i == 0 && cli_shard_attach_steering(socks[0], count) < 0) {
+            loge("client reuseport steering: %s.\n", strerror(errno));
+            i++;
+            goto fail;
+        }
+    }
+    return 0;
+
+fail:
+    while(i-- > 0) {
+        if(socks[i] >= 0)
+            close(socks[i]);
+    }
+    return -1;
+}
+
+static cli_shard_t *cli_shard_create(cli_mgr_t *cm, int index, int sock)
+{
+    cli_shard_t *shard;
+
+    shard = malloc(sizeof(*shard));
+    if(!shard)
+        return NULL;
+
+    shard->index = index;
+    shard->mgr = cm;
+
+    ida_init(&shard->uid_pool);
+    ida_init(&shard->gid_pool);
+
+    shard->user_count = 0;
+    shard->group_count = 0;
+    shard->nextseq = 0;
+
+    if(htable_init(&shard->user_map, &user_map_params))
+        goto fail;
+    if(htable_init(&shard->group_map, &group_map_params)) {
+        htable_destroy(&shard->user_map);
+        goto fail;
+    }
+
+    hbeat_god_init(&shard->hbeat_god, client_user_dead);
+    pthread_mutex_init(&shard->lock, NULL);
+
+    shard->ioasync = ioasync_init();
+    shard->hand = iohandler_udp_create(shard->ioasync, sock, 
+            cli_mgr_handle, cli_mgr_close, shard);
+
+    shard->inbox = iohandler_local_create(shard->ioasync,
+            shard_msg_handle, cli_mgr_close, shard);
+    shard->post = iohandler_local_create(shard->ioasync,
+            NULL, cli_mgr_close, shard);
+    iohandler_local_connect(shard->post, shard->inbox);
+
+    return shard;
+
+fail:
+    ida_destroy(&shard->uid_pool);
+    ida_destroy(&shard->gid_pool);
+    free(shard);
+    return NULL;
+}
+
+
+cli_mgr_t *cli_mgr_init(node_mgr_t *nodemgr, int shards, struct center_partition *part) 
+{
+    int i, port;
+    int socks[CLI_SHARDS_MAX];
     cli_mgr_t *cm;
 
     logd("client manager running.\n");
@@ -638,27 +1599,58 @@ cli_mgr_t *cli_mgr_init(node_mgr_t *nodemgr)
     if(!cm)
         return NULL;
 
-    ida_init(&cm->uid_pool);
-    ida_init(&cm->gid_pool);
+    if(part) {
+        cm->part = *part;
+    } else {
+        memset(&cm->part, 0, sizeof(cm->part));
+        cm->part.count = 1;
+        cm->part.centers[0].sin_family = AF_INET;
+        cm->part.centers[0].sin_port = htons(CLIENT_LOGIN_PORT);
+    }
+    port = ntohs(cm->part.centers[cm->part.index].sin_port);
+
+    if(shards <= 0)
+        shards = sysconf(_SC_NPROCESSORS_ONLN);
+    if(shards <= 0)
+        shards = 1;
+    if(shards > CLI_SHARDS_MAX)
+        shards = CLI_SHARDS_MAX;
+
+    if(cli_mgr_open_sockets(socks, shards, port)) {
+        if(shards == 1) {
+            free(cm);
+            return NULL;
+        }
+        logw("client manager in one shard, not %d.\n", shards);
+        shards = 1;
+        if(cli_mgr_open_sockets(socks, shards, port)) {
+            free(cm);
+            return NULL;
+        }
+    }
 
-    cm->user_count = 0;
-    cm->group_count = 0;
-    cm->nextseq = 0;
+    cm->shard_count = shards;
     cm->node_mgr = nodemgr;
+    cm->leg_users = GROUP_LEG_MAX_USER;
+    cm->group_dir = group_dir_alloc(0);
+    pthread_mutex_init(&cm->lock, NULL);
 
-    clifd = create_cli_mgr_channel();
-    cm->hand = iohandler_udp_create(get_global_ioasync(), clifd, 
-            cli_mgr_handle, cli_mgr_close, cm);
-
-    for (i = 0; i < HASH_USER_CAPACITY; i++)
-        INIT_HLIST_HEAD(&cm->user_map[i]);
-
-    for (i = 0; i < HASH_GROUP_CAPACITY; i++)
-        INIT_HLIST_HEAD(&cm->group_map[i]);
-
-    hbeat_god_init(&cm->hbeat_god, client_user_dead);
+    for(i=0; i<shards; i++) {
+        cm->shards[i] = cli_shard_create(cm, i, socks[i]);
+        if(!cm->shards[i])
+            fatal("client manager shard %d create failed.\n", i);
+    }
+    logi("client manager in %d shards, center %d of %d.\n", shards,
+            cm->part.index, cm->part.count);
 
-    pthread_mutex_init(&cm->lock, NULL);
+    nodemgr_set_migrated_notify(nodemgr, group_task_migrated, cm);
     return cm;
 }
 
+/* the users of one leg before a group spans another node. */
+void cli_mgr_set_leg_users(cli_mgr_t *cm, int count)
+{
+    if(count > 0)
+        cm->leg_users = count;
+}
+
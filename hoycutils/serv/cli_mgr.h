@@ -15,28 +15,57 @@
 
 #include <stdint.h>
 #include <pthread.h>
+#include <netinet/in.h>
 
 #include <common/list.h>
+#include <common/rcu.h>
 #include <common/ioasync.h>
 #include <common/idr.h>
+#include <common/htable.h>
 #include <common/hbeat.h>
 
 #include <protos.h>
 
 #include "node_mgr.h"
 
-#define GROUP_MAX_USER 		(8)
+/* the turn task keeps any number, see common/fanout.h. */
+#define GROUP_MAX_USER 		(1024)
 
-#define HASH_USER_SHIFT 	    (9)
-#define HASH_USER_CAPACITY 	    (1 << HASH_USER_SHIFT)
-#define HASH_USER_MASK 			(HASH_USER_CAPACITY - 1)
+/*
+ * A group is relayed by up to GROUP_MAX_LEGS turn tasks, each on its own
+ * node where there are enough, linked to each other. A new leg is placed
+ * once all legs have GROUP_LEG_MAX_USER users, see cli_mgr_set_leg_users().
+ */
+#define GROUP_MAX_LEGS 		(8)
+#define GROUP_LEG_MAX_USER 	(256)
+
+/* initial sizes, the maps grow as needed. */
+#define USER_MAP_INIT_SIZE 	    (512)
+#define GROUP_MAP_INIT_SIZE     (256)
 
-#define HASH_GROUP_SHIFT        (8)
-#define HASH_GROUP_CAPACITY     (1 << HASH_GROUP_SHIFT)
-#define HASH_GROUP_MASK         (HASH_GROUP_CAPACITY - 1)
+/* a group as listed, see cmd_list_group_handle(). */
+struct group_entry {
+    uint32_t groupid;
+    uint16_t flags;
+    uint16_t namelen;
+    char name[GROUP_NAME_MAX];
+};
+
+/*
+ * the groups in groupid order, for listing without the manager lock.
+ * Each create or delete publishes a new copy, the old one is freed
+ * after a grace period.
+ */
+struct group_dir {
+    struct rcu_head rcu;
+    int count;
+    struct group_entry entries[0];
+};
 
 typedef struct _user_info user_info_t;
+typedef struct _group_member group_member_t;
 typedef struct _group_info group_info_t;
+typedef struct _cli_shard cli_shard_t;
 typedef struct _cli_mgr cli_mgr_t; 
 
 
@@ -45,19 +74,27 @@ enum user_state {
     USER_STATE_LOGIN,
 };
 
+/* the groupid of a user in no group. */
+#define GROUP_NONE 		(~0U)
 
 struct _user_info {
     uint32_t userid; 	/* session id */
     int state;
     struct sockaddr addr;
-    group_info_t *group;
+    uint32_t groupid;   /* told by the shard of the group */
     hbeat_node_t hbeat;
 
-    struct list_head entry;
-    struct hlist_node hentry;
-    cli_mgr_t *mgr;
+    cli_shard_t *shard;
+    struct rcu_head rcu;
 };
 
+/* a user in a group, kept by the shard of the group. */
+struct _group_member {
+    uint32_t userid;
+    struct sockaddr addr;
+    int leg;            /* the turn task of the group relaying this user */
+    struct list_head entry;
+};
 
 struct _group_info {
     uint32_t groupid;
@@ -66,29 +103,89 @@ struct _group_info {
     char passwd[GROUP_PASSWD_MAX];
 
     int users;
-    struct list_head userlist;
-    struct hlist_node hentry;
-    unsigned long turn_handle;
+    struct list_head userlist;  /* group_member_t */
+
+    /* turn tasks, legs[0] is placed when the group is created. */
+    unsigned long legs[GROUP_MAX_LEGS];
+    int leg_users[GROUP_MAX_LEGS];
+    int nlegs;
+    int leg_pending;    /* a leg is being assigned */
+    uint32_t leg_userid;    /* the user whose join waits for it */
+    int deleted;        /* freed by the pending leg assign */
+    struct rcu_head rcu;
 };
 
-struct _cli_mgr {
-    struct ida uid_pool; 	/* user id pool */
-    struct ida gid_pool; 	/* group id pool */
+#define CLI_SHARDS_MAX 		(64)
+
+/*
+ * Center servers can split the users and groups too, each one keeps the
+ * ids with its partition in the top bits, see struct center_partition.
+ */
+#define CENTER_ID_SHIFT 		(24)
+#define CENTER_ID_MASK 			((1U << CENTER_ID_SHIFT) - 1)
+#define CENTER_PARTITIONS_MAX 	(64)
+
+static inline int center_id_partition(uint32_t id)
+{
+    return id >> CENTER_ID_SHIFT;
+}
+
+/*
+ * the center servers in partition order, by their client address. A
+ * client logs in to its home center, chosen by its address, the other
+ * centers are asked for the groups they keep.
+ */
+struct center_partition {
+    int index;          /* of this center */
+    int count;
+    struct sockaddr_in centers[CENTER_PARTITIONS_MAX];
+};
+
+/*
+ * The users and groups of the manager are split over shards, user and
+ * group ids are allocated so that id % shard count is the shard keeping
+ * them. Each shard has its own reactor and socket on CLIENT_LOGIN_PORT,
+ * the kernel steers the requests of a user to the socket of its shard.
+ * What a request does to a group of another shard is passed on to that
+ * shard as a message, a shard only changes its own users and groups.
+ */
+struct _cli_shard {
+    int index;
+    cli_mgr_t *mgr;
+    ioasync_t *ioasync;
     iohandler_t *hand;
+    iohandler_t *inbox;     /* messages from the other shards */
+    iohandler_t *post;      /* the sending end of the inbox */
 
-    struct hlist_head user_map[HASH_USER_CAPACITY];
-    struct hlist_head group_map[HASH_GROUP_CAPACITY];
+    struct ida uid_pool; 	/* user id pool */
+    struct ida gid_pool; 	/* group id pool */
+    struct htable user_map; 	/* key: userid */
+    struct htable group_map; 	/* key: groupid */
     int user_count;
     int group_count;
 
-    node_mgr_t *node_mgr;
     uint16_t nextseq;
-    struct list_head group_list;
     hbeat_god_t hbeat_god;
     pthread_mutex_t lock;
 };
 
-cli_mgr_t *cli_mgr_init(node_mgr_t *nodemgr);
+struct _cli_mgr {
+    cli_shard_t *shards[CLI_SHARDS_MAX];
+    int shard_count;
+    struct center_partition part;
+
+    struct group_dir *group_dir;    /* of all the shards */
+    node_mgr_t *node_mgr;
+    int leg_users;
+    pthread_mutex_t lock;   /* group_dir updates */
+};
+
+/*
+ * @shards: sockets on the client port, 0 for one per online cpu.
+ * @part: NULL for the only center server, on CLIENT_LOGIN_PORT.
+ */
+cli_mgr_t *cli_mgr_init(node_mgr_t *nodemgr, int shards, struct center_partition *part);
+void cli_mgr_set_leg_users(cli_mgr_t *cm, int count);
 
 #endif
 
@@ -40,6 +40,11 @@
 static const struct option longopts[] = {
     {"mode", required_argument, 0, 'm'},
     {"server", required_argument, 0, 's'},
+    {"reuseport", required_argument, 0, 'r'},
+    {"leg-users", required_argument, 0, 'l'},
+    {"user-shards", required_argument, 0, 'u'},
+    {"partition", required_argument, 0, 'p'},
+    {"centers", required_argument, 0, 'c'},
     {"deamon", 0, 0, 'd'},
     {"version", 0, 0, 'v'},
     {"help", 0, 0, 'h'},
@@ -113,7 +118,7 @@ static void signals_init(void)
 static void do_help(void)
 {
     int len = 0;
-    char buf[1024] = { 0 };
+    char buf[2048] = { 0 };
 
     len += sprintf(buf + len, "Compile Date: %s,Time: %s, Version: %s\n", 
             __DATE__, __TIME__, VERSION);
@@ -122,11 +127,17 @@ static void do_help(void)
             "usage: serv command [command options]\n" 
             "\n"
             "Command syntax:\n"
-            "\tserv [-m full|node|center] [-s Host Address]\n"
+            "\tserv [-m full|node|center] [-s Host Address] [-r Workers] [-l Users] [-u Shards]\n"
+            "\t     [-p Partition] [-c host:port,host:port...]\n"
             "\n"
             "Command parameters:\n"
             "\t'-m' or '--mode'    - Specify the server working mode.\n"
             "\t'-s' or '--server'  - Name of center server host address.\n"
+            "\t'-r' or '--reuseport' - Node server task workers sharing one port.\n"
+            "\t'-l' or '--leg-users' - Group users on one node server before another is used.\n"
+            "\t'-u' or '--user-shards' - Center server threads sharing the users, one per cpu by default.\n"
+            "\t'-p' or '--partition' - The ids kept by this center server, or the center a node server serves.\n"
+            "\t'-c' or '--centers' - Client addresses of all the center servers, in partition order.\n"
             "\t'-v' or '--version' - show version num.\n"
             "\t'-h' or '--help'    - show this help message.\n");
 
@@ -141,7 +152,7 @@ int main(int argc, char **argv)
     int mode = SERV_MODE_FULL_FUNC;
     char *chost = LOCAL_HOST;
 
-    while((opt = getopt_long(argc, argv, "m:s:dvh", longopts, NULL)) > 0) {
+    while((opt = getopt_long(argc, argv, "m:s:r:l:u:p:c:dvh", longopts, NULL)) > 0) {
         switch(opt) {
             case 'm':
                 mode = serv_mode_parse(optarg);
@@ -149,6 +160,22 @@ int main(int argc, char **argv)
             case 's':
                 chost = optarg;
                 break;
+            case 'r':
+                node_serv_set_reuseport(atoi(optarg));
+                break;
+            case 'l':
+                center_serv_set_leg_users(atoi(optarg));
+                break;
+            case 'u':
+                center_serv_set_user_shards(atoi(optarg));
+                break;
+            case 'p':
+                center_serv_set_partition(atoi(optarg));
+                node_serv_set_partition(atoi(optarg));
+                break;
+            case 'c':
+                center_serv_set_centers(optarg);
+                break;
             case 'd':
                 deamon = 1;
                 break;
@@ -180,7 +207,10 @@ int main(int argc, char **argv)
         center_serv_init();
     }
 
-    if(mode & SERV_MODE_NODE_SERV)
+    /* both servers in one process, skip the loopback socket. */
+    if(mode == SERV_MODE_FULL_FUNC)
+        node_serv_init_local();
+    else if(mode & SERV_MODE_NODE_SERV)
         node_serv_init(chost);
 
     console_loop();
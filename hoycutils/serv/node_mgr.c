@@ -17,6 +17,7 @@
 #include <string.h>
 #include <stdio.h>
 #include <errno.h>
+#include <time.h>
 #include <arpa/inet.h>
 
 #include <common/log.h>
@@ -27,6 +28,28 @@
 #include "node_mgr.h"
 #include "task.h"
 
+/*
+ * Load score of a node, about 1000 for a busy cpu. New tasks go to the
+ * less loaded of two nodes picked at random.
+ */
+#define NODE_LOAD_PPS_UNIT      (100)       /* packets/s for one point */
+#define NODE_LOAD_BPS_UNIT      (100000)    /* bytes/s for one point */
+#define NODE_LOAD_QUEUE_WEIGHT  (10)        /* for each packet waiting */
+#define NODE_LOAD_TASK_WEIGHT   (10)        /* for each task placed */
+/* the last placement is kept until it is this much (%) more loaded. */
+#define NODE_LOAD_HYSTERESIS    (25)
+
+#define NODE_PENDING_CAPACITY   (64)
+
+static const struct htable_params pending_params =
+    HTABLE_PARAMS(task_handle_t, taskid, NODE_PENDING_CAPACITY);
+
+static void task_assign_done(task_handle_t *task, struct sockaddr *addr);
+static void node_slots_add(node_info_t *node, struct pack_task_slots *ps, int len);
+static void node_task_migrated(node_info_t *node, struct pack_task_assign_response *pt);
+static int init_task_reclaim_pkt(task_handle_t *task, task_baseinfo_t *base,
+        struct pack_task_reclaim *pkt);
+
 
 static int node_register(node_mgr_t *mgr, node_info_t *node)
 {
@@ -44,6 +67,8 @@ static void node_unregister(node_mgr_t *mgr, node_info_t *node)
     pthread_mutex_lock(&mgr->lock);
     list_del(&node->entry);
     mgr->node_count--;
+    if(mgr->last_node == node)
+        mgr->last_node = NULL;
     pthread_mutex_unlock(&mgr->lock);
 }
 
@@ -79,9 +104,28 @@ static void copy_sockaddr(void *dst, void *src)
 }
 #endif
 
-static void node_hand_fn(void* opaque, uint8_t *data, int len)
+static void node_load_update(node_info_t *node, struct pack_node_load *load)
+{
+    unsigned int score;
+
+    score = load->cpu + load->pps / NODE_LOAD_PPS_UNIT +
+        load->bps / NODE_LOAD_BPS_UNIT + load->queue_depth * NODE_LOAD_QUEUE_WEIGHT;
+
+    pthread_mutex_lock(&node->lock);
+    node->load = *load;
+    /* smoothed, a burst moves it a quarter of the way. */
+    if(node->load_reports++)
+        node->load_score = (node->load_score * 3 + score) / 4;
+    else
+        node->load_score = score;
+    pthread_mutex_unlock(&node->lock);
+
+    logv("node load: pps:%d, bps:%d, cpu:%d, queue:%d, score:%d\n",
+            load->pps, load->bps, load->cpu, load->queue_depth, node->load_score);
+}
+
+static void node_pack_handle(node_info_t *node, uint8_t *data, int len)
 {
-    node_info_t *node = (node_info_t *)opaque;
     pack_head_t *head;
     void *payload;
 
@@ -105,9 +149,18 @@ static void node_hand_fn(void* opaque, uint8_t *data, int len)
         case MSG_TASK_ASSIGN_RESPONSE:
         {
             struct pack_task_assign_response *pt;
+            task_handle_t *task;
 
             pt = (struct pack_task_assign_response *)payload;
-            response_post(&node->waits, MSG_TASK_ASSIGN_RESPONSE, pt->taskid, &pt->addr);
+
+            pthread_mutex_lock(&node->lock);
+            task = htable_remove(&node->pending, pt->taskid);
+            pthread_mutex_unlock(&node->lock);
+
+            if(task)
+                task_assign_done(task, &pt->addr);
+            else
+                response_post(&node->waits, MSG_TASK_ASSIGN_RESPONSE, pt->taskid, &pt->addr);
 
 #ifdef DDEBUG
             {
@@ -119,15 +172,53 @@ static void node_hand_fn(void* opaque, uint8_t *data, int len)
 
             break;
         }
+        case MSG_NODE_LOAD_REPORT:
+        {
+            if(len < sizeof(*head) + sizeof(struct pack_node_load))
+                break;
+
+            node_load_update(node, (struct pack_node_load *)payload);
+            break;
+        }
+        case MSG_TASK_SLOTS:
+        {
+            node_slots_add(node, (struct pack_task_slots *)payload,
+                    len - sizeof(*head));
+            break;
+        }
+        case MSG_TASK_MIGRATED:
+        {
+            if(len < sizeof(*head) + sizeof(struct pack_task_assign_response))
+                break;
+
+            node_task_migrated(node, (struct pack_task_assign_response *)payload);
+            break;
+        }
         default:
             break;
     }
 }
 
+static void node_stream_pack_fn(void *opaque, uint8_t *pack, int len)
+{
+    node_pack_handle((node_info_t *)opaque, pack, len);
+}
+
+/* the channel is a stream, a read may hold several packs or part of one. */
+static void node_hand_fn(void* opaque, uint8_t *data, int len)
+{
+    node_info_t *node = (node_info_t *)opaque;
+
+    if(!data)
+        return;
+    pack_stream_input(&node->stream, data, len, node_stream_pack_fn, node);
+}
+
 static void node_close_fn(void *user)
 {
     node_info_t *node = (node_info_t *)user;
     node_unregister(node->mgr, node);
+    pack_stream_release(&node->stream);
 }
 
 
@@ -136,33 +227,85 @@ static inline int calc_node_priority(int old_prio, int regulate)
     return old_prio + regulate;	
 }
 
-static inline int calc_node_weight(node_info_t *n)
+/*
+ * the reported load, and the tasks placed on the node so far, which
+ * also spreads the tasks placed before the next report. A task of
+ * priority p weighs as 1 + p tasks.
+ */
+static inline unsigned int calc_node_weight(node_info_t *n)
 {
-    if(!n)
-        return 0x7fffffff;
-
-    /* ingore priority */
-    return n->task_count;
+    return n->load_score + (n->task_count + n->priority) * NODE_LOAD_TASK_WEIGHT;
 }
 
 static int node_weight_compare(node_info_t *n1, node_info_t *n2)
 {
-    int n1_weight = calc_node_weight(n1);
-    int n2_weight = calc_node_weight(n2);
+    unsigned int n1_weight = calc_node_weight(n1);
+    unsigned int n2_weight = calc_node_weight(n2);
 
-    return n1_weight - n2_weight;
+    if(n1_weight == n2_weight)
+        return 0;
+    return n1_weight < n2_weight ? -1 : 1;
 }
 
-static node_info_t *nodemgr_choice_node(node_mgr_t *mgr, int priority)
+static node_info_t *nodemgr_nth_node(node_mgr_t *mgr, int n)
+{
+    node_info_t *p;
+
+    list_for_each_entry(p, &mgr->nodelist, entry) {
+        if(!n--)
+            return p;
+    }
+    return NULL;
+}
+
+/* the least loaded node but @apart, mgr->lock held. */
+static node_info_t *nodemgr_other_node(node_mgr_t *mgr, node_info_t *apart)
 {
     node_info_t *p, *node = NULL;
 
     list_for_each_entry(p, &mgr->nodelist, entry) {
-        if(node_weight_compare(node, p)) {
+        if(p != apart && (!node || node_weight_compare(p, node) < 0))
             node = p;
-        }
+    }
+    return node;
+}
+
+/*
+ * power of two choices: the less loaded of two random nodes. The last
+ * node chosen is kept while it is within NODE_LOAD_HYSTERESIS of it, so
+ * close loads do not flip the placement back and forth, but a task of
+ * a raised @priority takes the less loaded one. A task to be placed
+ * @apart goes to another node when there is one.
+ */
+static node_info_t *nodemgr_choice_node(node_mgr_t *mgr, int priority,
+        node_info_t *apart)
+{
+    node_info_t *a, *b, *node, *last, *other;
+
+    pthread_mutex_lock(&mgr->lock);
+    if(!mgr->node_count) {
+        pthread_mutex_unlock(&mgr->lock);
+        return NULL;
     }
 
+    a = nodemgr_nth_node(mgr, rand_r(&mgr->seed) % mgr->node_count);
+    b = nodemgr_nth_node(mgr, rand_r(&mgr->seed) % mgr->node_count);
+    node = node_weight_compare(a, b) <= 0 ? a : b;
+
+    last = mgr->last_node;
+    if(priority <= TASK_PRIORITY_NORMAL && last && last != node && (unsigned long long)calc_node_weight(last) * 100 <=
+            (unsigned long long)calc_node_weight(node) * (100 + NODE_LOAD_HYSTERESIS))
+        node = last;
+
+    mgr->last_node = node;
+
+    if(apart && node == apart) {
+        other = nodemgr_other_node(mgr, apart);
+        if(other)
+            node = other;
+    }
+    pthread_mutex_unlock(&mgr->lock);
+
     return node;
 }
 
@@ -216,28 +359,56 @@ static void node_unregister_task(node_info_t *node, task_handle_t *task)
     pthread_mutex_unlock(&node->lock);
 }
 
-task_handle_t *nodemgr_task_assign(node_mgr_t *mgr, int type, int priority,
-        task_baseinfo_t *base)
+static void node_task_migrated(node_info_t *node, struct pack_task_assign_response *pt)
+{
+    node_mgr_t *mgr = node->mgr;
+    task_handle_t *task, *found = NULL;
+
+    pthread_mutex_lock(&node->lock);
+    list_for_each_entry(task, &node->tasklist, entry) {
+        if(task->taskid == pt->taskid) {
+            task->addr = *((struct sockaddr_in *)&pt->addr);
+            found = task;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&node->lock);
+
+    if(!found) {
+        logw("migrated task %d not found.\n", pt->taskid);
+        return;
+    }
+
+    logd("task %d migrated to port %d.\n", found->taskid, ntohs(found->addr.sin_port));
+    if(mgr->migrated)
+        mgr->migrated(found, mgr->migrated_arg);
+}
+
+static task_handle_t *nodemgr_task_create(node_mgr_t *mgr, int type, int priority,
+        task_handle_t *apart)
 {
-    int len;
     node_info_t *node;
-    struct pack_task_assign *pkt;
     task_handle_t *task;
-	iowait_watcher_t watcher;
-
-    if(!mgr)
-        return NULL;
 
     task = malloc(sizeof(*task));
     if(!task)
         return NULL;
 
-    node = nodemgr_choice_node(mgr, priority);
+    node = nodemgr_choice_node(mgr, priority, apart ? apart->node : NULL);
+    if(!node) {
+        loge("no node server for the task.\n");
+        goto fail;
+    }
 
     task->node = node;
     task->taskid = alloc_taskid(mgr);
     task->type = type;
     task->priority = priority;
+    task->assigned = NULL;
+    task->arg = NULL;
+    task->slot = 0;
+    task->assign = NULL;
+    task->assign_len = 0;
     task->ops = find_task_protos_by_type(type);
     if(!task->ops) {
         logi("not found task protocol by type:%d.\n", type);
@@ -245,6 +416,18 @@ task_handle_t *nodemgr_task_assign(node_mgr_t *mgr, int type, int priority,
     }
 
     node_register_task(node, task);
+    return task;
+
+fail:
+    free(task);
+    return NULL;
+}
+
+static void nodemgr_task_send_assign(task_handle_t *task, task_baseinfo_t *base)
+{
+    int len;
+    node_info_t *node = task->node;
+    struct pack_task_assign *pkt;
 
     pkt = (struct pack_task_assign *)nodemgr_task_pkt_alloc(node);
 
@@ -253,12 +436,44 @@ task_handle_t *nodemgr_task_assign(node_mgr_t *mgr, int type, int priority,
     pkt->type = task->type;
     pkt->taskid = task->taskid;
     pkt->priority = task->priority;
+    pkt->slot = task->slot;
+
+    /* kept to assign it again without the slot, see task_assign_timeout(). */
+    if(task->slot) {
+        task->assign = malloc(len);
+        if(task->assign) {
+            memcpy(task->assign, pkt, len);
+            task->assign_len = len;
+        }
+    }
+
+    nodemgr_task_pkt_send(node, MSG_TASK_ASSIGN, pkt, len);
+}
+
+task_handle_t *nodemgr_task_assign(node_mgr_t *mgr, int type, int priority,
+        task_baseinfo_t *base)
+{
+    node_info_t *node;
+    task_handle_t *task;
+	iowait_watcher_t watcher;
+
+    if(!mgr)
+        return NULL;
+
+    task = nodemgr_task_create(mgr, type, priority, NULL);
+    if(!task)
+        return NULL;
+    node = task->node;
 
 	iowait_watcher_init(&watcher, MSG_TASK_ASSIGN_RESPONSE, task->taskid, 
 			&task->addr, sizeof(task->addr));
-	iowait_register_watcher(&node->waits, &watcher);
+	if(iowait_register_watcher(&node->waits, &watcher)) {
+        node_unregister_task(node, task);
+        free(task);
+        return NULL;
+    }
 
-    nodemgr_task_pkt_send(node, MSG_TASK_ASSIGN, pkt, len);
+    nodemgr_task_send_assign(task, base);
 
     /* get node server port by assign request. */
     wait_for_response(&node->waits, &watcher);
@@ -266,10 +481,204 @@ task_handle_t *nodemgr_task_assign(node_mgr_t *mgr, int type, int priority,
 			task->taskid, inet_ntoa(task->addr.sin_addr), ntohs(task->addr.sin_port));
 
     return task;
+}
 
-fail:
+static void node_slots_add(node_info_t *node, struct pack_task_slots *ps, int len)
+{
+    int i, tail;
+
+    if(len < sizeof(*ps) ||
+            len < sizeof(*ps) + ps->count * sizeof(struct pack_task_slot))
+        return;
+
+    pthread_mutex_lock(&node->lock);
+    for(i=0; i<ps->count; i++) {
+        if(node->slot_count >= NODE_TASK_SLOTS_BATCH) {
+            logw("node task slots full, %d dropped.\n", ps->count - i);
+            break;
+        }
+        tail = (node->slot_head + node->slot_count) % NODE_TASK_SLOTS_BATCH;
+        node->slots[tail] = ps->slots[i];
+        node->slot_count++;
+    }
+    pthread_mutex_unlock(&node->lock);
+}
+
+static int node_slot_take(node_info_t *node, struct pack_task_slot *slot)
+{
+    int ret = -EAGAIN;
+
+    pthread_mutex_lock(&node->lock);
+    if(node->slot_count) {
+        *slot = node->slots[node->slot_head];
+        node->slot_head = (node->slot_head + 1) % NODE_TASK_SLOTS_BATCH;
+        node->slot_count--;
+        ret = 0;
+    }
+    pthread_mutex_unlock(&node->lock);
+    return ret;
+}
+
+/* the response arrived, it was taken off node->pending. */
+static void task_assign_done(task_handle_t *task, struct sockaddr *addr)
+{
+    node_mgr_t *mgr = task->node->mgr;
+    struct sockaddr_in *in = (struct sockaddr_in *)addr;
+
+    del_timer_sync(&task->timeout);
+
+    /*
+     * already answered from the slot, this is the confirmation. A task
+     * placed elsewhere moves its clients, like a migrated one.
+     */
+    if(task->slot) {
+        task->slot = 0;
+        free(task->assign);
+        task->assign = NULL;
+        if(task->addr.sin_addr.s_addr == in->sin_addr.s_addr &&
+                task->addr.sin_port == in->sin_port)
+            return;
+
+        logw("task %d not placed on its reserved slot, now on port %d.\n",
+                task->taskid, ntohs(in->sin_port));
+        task->addr = *in;
+        if(mgr->migrated)
+            mgr->migrated(task, mgr->migrated_arg);
+        return;
+    }
+
+    task->addr = *((struct sockaddr_in *)addr);
+    logd("task worker(%d) address: %s, port: %d.\n", 
+			task->taskid, inet_ntoa(task->addr.sin_addr), ntohs(task->addr.sin_port));
+
+    task->assigned(task, 0, task->arg);
+}
+
+/*
+ * The slot of @task is not confirmed: the node may have it or not, it is
+ * reclaimed and assigned again with a round trip. The owner has the task
+ * already, the response moves its clients, see task_assign_done().
+ */
+static void task_assign_resend(task_handle_t *task)
+{
+    int ret, len;
+    node_info_t *node = task->node;
+    struct pack_task_reclaim *reclaim;
+    struct pack_task_assign *pkt;
+
+    reclaim = (struct pack_task_reclaim *)nodemgr_task_pkt_alloc(node);
+    len = init_task_reclaim_pkt(task, NULL, reclaim);
+    reclaim->taskid = task->taskid;
+    reclaim->type = task->type;
+    nodemgr_task_pkt_send(node, MSG_TASK_RECLAIM, reclaim, len);
+
+    pkt = (struct pack_task_assign *)nodemgr_task_pkt_alloc(node);
+    len = task->assign_len;
+    memcpy(pkt, task->assign, len);
+    pkt->slot = 0;
+    free(task->assign);
+    task->assign = NULL;
+
+    pthread_mutex_lock(&node->lock);
+    ret = htable_insert(&node->pending, task);
+    pthread_mutex_unlock(&node->lock);
+    if(!ret)
+        mod_timer(&task->timeout, curr_time_ms() + WAIT_RES_DEAD_LINE);
+
+    nodemgr_task_pkt_send(node, MSG_TASK_ASSIGN, pkt, len);
+}
+
+static void task_assign_timeout(unsigned long data)
+{
+    task_handle_t *task = (task_handle_t *)data;
+    node_info_t *node = task->node;
+    task_handle_t *pending;
+
+    pthread_mutex_lock(&node->lock);
+    pending = htable_remove(&node->pending, task->taskid);
+    pthread_mutex_unlock(&node->lock);
+
+    /* the response won, see task_assign_done(). */
+    if(pending != task)
+        return;
+
+    /* the owner has the task already, it is assigned again once. */
+    if(task->slot && task->assign) {
+        logw("task %d on slot %d not confirmed, assigned again.\n",
+                task->taskid, task->slot);
+        task_assign_resend(task);
+        return;
+    }
+    if(task->slot) {
+        loge("task %d on slot %d not confirmed.\n", task->taskid, task->slot);
+        task->slot = 0;
+        return;
+    }
+
+    loge("task %d assign timeout.\n", task->taskid);
+
+    /* the node may still create it, have it dropped. */
+    nodemgr_task_reclaim(node->mgr, task, NULL);
+    task->assigned(task, -ETIMEDOUT, task->arg);
     free(task);
-    return NULL;
+}
+
+/*
+ * Like nodemgr_task_assign(), but returns once the request is sent. @fn
+ * is called when the node server answers, or after WAIT_RES_DEAD_LINE,
+ * so any number of assigns can be in flight without a thread waiting
+ * for each. When the node has a reserved slot, @fn is called at once
+ * with the slot address and the node confirms in the background.
+ * Returns 0 if @fn will be called.
+ */
+int nodemgr_task_assign_async(node_mgr_t *mgr, int type, int priority,
+        task_baseinfo_t *base, task_assigned_fn fn, void *arg)
+{
+    return nodemgr_task_assign_apart(mgr, type, priority, base, NULL, fn, arg);
+}
+
+/* nodemgr_task_assign_async() on another node than the one of @apart. */
+int nodemgr_task_assign_apart(node_mgr_t *mgr, int type, int priority,
+        task_baseinfo_t *base, task_handle_t *apart, task_assigned_fn fn, void *arg)
+{
+    int ret;
+    node_info_t *node;
+    task_handle_t *task;
+    struct pack_task_slot slot = { .slot = 0 };
+
+    if(!mgr || !fn)
+        return -EINVAL;
+
+    task = nodemgr_task_create(mgr, type, priority, apart);
+    if(!task)
+        return -EINVAL;
+    node = task->node;
+
+    task->assigned = fn;
+    task->arg = arg;
+    if(!node_slot_take(node, &slot)) {
+        task->slot = slot.slot;
+        task->addr = *((struct sockaddr_in *)&slot.addr);
+    }
+    init_timer(&task->timeout);
+    setup_timer(&task->timeout, task_assign_timeout, (unsigned long)task);
+
+    pthread_mutex_lock(&node->lock);
+    ret = htable_insert(&node->pending, task);
+    pthread_mutex_unlock(&node->lock);
+    if(ret) {
+        node_unregister_task(node, task);
+        free(task);
+        return ret;
+    }
+
+    mod_timer(&task->timeout, curr_time_ms() + WAIT_RES_DEAD_LINE);
+    nodemgr_task_send_assign(task, base);
+
+    /* sent first, the node has the task before the client can use it. */
+    if(slot.slot)
+        fn(task, 0, arg);
+    return 0;
 }
 
 
@@ -285,11 +694,19 @@ static int init_task_reclaim_pkt(task_handle_t *task, task_baseinfo_t *base,
 }
 
 
+/* @fn tells the owner of a task that its clients must use task->addr now. */
+void nodemgr_set_migrated_notify(node_mgr_t *mgr, task_migrated_fn fn, void *arg)
+{
+    mgr->migrated_arg = arg;
+    mgr->migrated = fn;
+}
+
 int nodemgr_task_reclaim(node_mgr_t *mgr, task_handle_t *task,
         task_baseinfo_t *base)
 {
     int len;
     node_info_t *node;
+    task_handle_t *pending;
     struct pack_task_reclaim *pkt;
 
     if(!mgr)
@@ -297,6 +714,18 @@ int nodemgr_task_reclaim(node_mgr_t *mgr, task_handle_t *task,
 
     node = task->node;
 
+    /* reclaimed before the node confirmed its slot. */
+    pthread_mutex_lock(&node->lock);
+    pending = htable_lookup(&node->pending, task->taskid);
+    if(pending == task)
+        htable_remove(&node->pending, task->taskid);
+    pthread_mutex_unlock(&node->lock);
+    if(pending == task) {
+        del_timer_sync(&task->timeout);
+        free(task->assign);
+        task->assign = NULL;
+    }
+
     node_unregister_task(node, task);
 
     pkt = (struct pack_task_reclaim *)nodemgr_task_pkt_alloc(node);
@@ -347,26 +776,62 @@ int nodemgr_task_control(node_mgr_t *mgr, task_handle_t *task,
     return 0;
 }
 
-static void nodemgr_accept_fn(void* user, int acceptfd)
+static node_info_t *node_info_create(node_mgr_t *mgr, int fd)
 {
     node_info_t *node;
-    socklen_t addrlen;
-    node_mgr_t *mgr = (node_mgr_t *)user;
-
-    logd("accept node server connect.\n");
 
     node = malloc(sizeof(*node));
     if(!node)
-        return;
+        return NULL;
 
-    node->fd = acceptfd;
+    node->fd = fd;
     node->mgr = mgr;
-    node->hand = iohandler_create(get_global_ioasync(), acceptfd,
-            node_hand_fn, node_close_fn, node);
+    node->hand = NULL;
+    pack_stream_init(&node->stream);
 
     node->nextseq = 0;
     node->task_count = 0;
+    node->priority = 0;
+    memset(&node->load, 0, sizeof(node->load));
+    node->load_score = 0;
+    node->load_reports = 0;
     INIT_LIST_HEAD(&node->tasklist);
+    if(htable_init(&node->pending, &pending_params))
+        goto fail;
+    if(iowait_init(&node->waits)) {
+        htable_destroy(&node->pending);
+        goto fail;
+    }
+    node->slot_head = node->slot_count = 0;
+    pthread_mutex_init(&node->lock, NULL);
+    return node;
+
+fail:
+    free(node);
+    return NULL;
+}
+
+/* a node that was never registered. */
+static void node_info_destroy(node_info_t *node)
+{
+    iowait_destroy(&node->waits);
+    pthread_mutex_destroy(&node->lock);
+    htable_destroy(&node->pending);
+    pack_stream_release(&node->stream);
+    free(node);
+}
+
+static void nodemgr_accept_fn(void* user, int acceptfd)
+{
+    node_info_t *node;
+    socklen_t addrlen;
+    node_mgr_t *mgr = (node_mgr_t *)user;
+
+    logd("accept node server connect.\n");
+
+    node = node_info_create(mgr, acceptfd);
+    if(!node)
+        return;
 
     addrlen = sizeof(node->addr);
     if (getsockname(acceptfd, (struct sockaddr*)&node->addr, &addrlen) < 0) {
@@ -374,12 +839,58 @@ static void nodemgr_accept_fn(void* user, int acceptfd)
         goto fail;
     }
 
-    iowait_init(&node->waits);
+    node->hand = iohandler_create(get_global_ioasync(), acceptfd,
+            node_hand_fn, node_close_fn, node);
+
     node_register(mgr, node);
     return;
 
 fail:
-    free(node);
+    node_info_destroy(node);
+}
+
+/*
+ * attach a node server running in the same process. @peer is the local
+ * iohandler of the node server, the node management traffic is passed
+ * in memory instead of through the loopback tcp connection.
+ */
+int nodemgr_local_connect(node_mgr_t *mgr, iohandler_t *peer)
+{
+    int ret;
+    node_info_t *node;
+
+    if(!mgr || !peer)
+        return -EINVAL;
+
+    logd("accept local node server connect.\n");
+
+    node = node_info_create(mgr, -1);
+    if(!node)
+        return -ENOMEM;
+
+    node->addr.sin_family = AF_INET;
+    node->addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    node->addr.sin_port = 0;
+
+    node->hand = iohandler_local_create(get_global_ioasync(),
+            node_hand_fn, node_close_fn, node);
+    if(!node->hand) {
+        ret = -ENOMEM;
+        goto fail;
+    }
+
+    ret = iohandler_local_connect(node->hand, peer);
+    if(ret) {
+        iohandler_shutdown(node->hand);
+        goto fail;
+    }
+
+    node_register(mgr, node);
+    return 0;
+
+fail:
+    node_info_destroy(node);
+    return ret;
 }
 
 
@@ -388,7 +899,8 @@ static void nodemgr_close_fn(void *user)
 }
 
 
-node_mgr_t *node_mgr_init(void)
+/* @partition: of the center server, its node servers connect there. */
+node_mgr_t *node_mgr_init(int partition)
 {
     int sock;
     node_mgr_t *nodemgr;
@@ -397,10 +909,15 @@ node_mgr_t *node_mgr_init(void)
     if(!nodemgr)
         return NULL;
 
-    sock = socket_inaddr_any_server(NODE_SERV_LOGIN_PORT, SOCK_STREAM);
+    sock = socket_inaddr_any_server(NODE_SERV_LOGIN_PORT + partition, SOCK_STREAM);
     nodemgr->hand = iohandler_accept_create(get_global_ioasync(), sock,
             nodemgr_accept_fn, nodemgr_close_fn, nodemgr);
 
+    nodemgr->node_count = 0;
+    nodemgr->last_node = NULL;
+    nodemgr->seed = time(NULL) ^ getpid();
+    nodemgr->migrated = NULL;
+    nodemgr->migrated_arg = NULL;
     INIT_LIST_HEAD(&nodemgr->nodelist);
     ida_init(&nodemgr->taskids);
     pthread_mutex_init(&nodemgr->lock, NULL);
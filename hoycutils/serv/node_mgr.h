@@ -21,25 +21,50 @@
 #include <common/idr.h>
 #include <common/iowait.h>
 #include <common/ioasync.h>
+#include <common/htable.h>
+#include <common/timer.h>
+#include <common/pack_head.h>
 
 #include "task.h"
 
 typedef struct _node_mgr node_mgr_t;
 typedef struct _node_info node_info_t;
+typedef struct _task_handle task_handle_t;
+
+/* a task moved to another worker of its node, task->addr is the new one. */
+typedef void (*task_migrated_fn)(task_handle_t *task, void *arg);
+
+/*
+ * @err: 0 assigned, -ETIMEDOUT no response, the task is freed after it.
+ * It may be called before nodemgr_task_assign_async() returns.
+ */
+typedef void (*task_assigned_fn)(task_handle_t *task, int err, void *arg);
 
 struct _node_info {
     int fd;
     iohandler_t *hand;
     iowait_t waits;
+    struct pack_stream stream;  /* a pack cut by the end of a read */
     int nextseq;
     int task_count;
     int priority;
 
+    /* the last load report and the smoothed score of the reports. */
+    struct pack_node_load load;
+    unsigned int load_score;
+    int load_reports;
+
     struct list_head entry;
     struct sockaddr_in addr;
     node_mgr_t *mgr;
 
     struct list_head tasklist;
+    struct htable pending;      /* key: taskid, async assigns not answered yet */
+
+    /* task slots reserved by the node server, see MSG_TASK_SLOTS. */
+    struct pack_task_slot slots[NODE_TASK_SLOTS_BATCH];
+    int slot_head;
+    int slot_count;
     pthread_mutex_t lock;
 };
 
@@ -50,9 +75,15 @@ struct _node_mgr {
 
     struct list_head nodelist;
     pthread_mutex_t lock;
+
+    node_info_t *last_node;     /* the last placement, kept with hysteresis */
+    unsigned int seed;
+
+    task_migrated_fn migrated;
+    void *migrated_arg;
 };
 
-typedef struct _task_handle {
+struct _task_handle {
     int taskid;
     int type;
     int priority;
@@ -62,11 +93,25 @@ typedef struct _task_handle {
 
     node_info_t *node;
     struct list_head entry;
-} task_handle_t;
 
-node_mgr_t *node_mgr_init(void);
+    /* nodemgr_task_assign_async() */
+    task_assigned_fn assigned;
+    void *arg;
+    struct timer_list timeout;
+    uint32_t slot;      /* placed on a reserved slot, not confirmed yet */
+    void *assign;       /* the assign on the slot, sent again if unconfirmed */
+    int assign_len;
+};
+
+node_mgr_t *node_mgr_init(int partition);
+int nodemgr_local_connect(node_mgr_t *mgr, iohandler_t *peer);
 task_handle_t *nodemgr_task_assign(node_mgr_t *mgr, int type, int priority, task_baseinfo_t *base);
+int nodemgr_task_assign_async(node_mgr_t *mgr, int type, int priority,
+        task_baseinfo_t *base, task_assigned_fn fn, void *arg);
+int nodemgr_task_assign_apart(node_mgr_t *mgr, int type, int priority,
+        task_baseinfo_t *base, task_handle_t *apart, task_assigned_fn fn, void *arg);
 int nodemgr_task_reclaim(node_mgr_t *mgr, task_handle_t *task, task_baseinfo_t *base);
+void nodemgr_set_migrated_notify(node_mgr_t *mgr, task_migrated_fn fn, void *arg);
 int nodemgr_task_control(node_mgr_t *mgr, task_handle_t *task, int opt, task_baseinfo_t *base);
 
 #endif
@@ -22,14 +22,18 @@
 #include <errno.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
+#include <linux/filter.h>
 
 #include <common/ioasync.h>
 #include <common/list.h>
+#include <common/rcu.h>
 #include <common/wait.h>
 #include <common/sockets.h>
 #include <common/log.h>
 #include <common/utils.h>
-#include <common/hash.h>
+#include <common/htable.h>
+#include <common/rbtree.h>
+#include <common/timer.h>
 #include <common/packet.h>
 #include <common/ethtools.h>
 #include <common/pack_head.h>
@@ -39,9 +43,27 @@
 
 #define WORKER_MAX_TASK_COUNT 	(512)
 
-#define HASH_WORKER_SHIFT 	    (5)
-#define HASH_WORKER_CAPACITY 	(1 << HASH_WORKER_SHIFT)
-#define HASH_WORKER_MASK 		(HASH_WORKER_CAPACITY - 1)
+/*
+ * A task moves off a worker that has this many pps and twice the pps
+ * of the least busy one. The old copy keeps relaying while the clients
+ * switch to the new address.
+ */
+#define TASK_REBALANCE_MIN_PPS  (2000)
+#define TASK_MIGRATE_DRAIN_MS   (3000)
+
+/* relay destinations sent by one worker, the rest go to the others. */
+#define TASK_FANOUT_CHUNK       (64)
+
+/*
+ * receive buffer of a task worker. A sender bursts at its paced rate and
+ * a linked leg copies each request once more, the default buffer
+ * overflows within a few ms. Capped by net.core.rmem_max.
+ */
+#define TASK_WORKER_RCVBUF      (4 * 1024 * 1024)
+
+#ifndef SO_ATTACH_REUSEPORT_CBPF
+#define SO_ATTACH_REUSEPORT_CBPF    (51)
+#endif
 
 struct _node_serv;
 typedef struct _node_serv  node_serv_t;
@@ -51,13 +73,42 @@ typedef struct _node_serv  node_serv_t;
 
 struct _node_serv {
     iohandler_t *mgr_hand;
+    struct pack_stream stream;  /* a pack cut by the end of a read */
     int worker_count;
     struct list_head worker_list;
     int nextseq;
 
     int task_count;
-    task_worker_t *suit_worker;
+    struct htable tasks_map;    /* key: task id, the tasks of all workers */
+    struct rb_root worker_tree; /* by task count, the least loaded first */
     pthread_mutex_t lock;
+
+    /*
+     * reuseport: the task workers share one port, the kernel steers
+     * each request to shards[taskid % shard_count].
+     */
+    int reuseport;
+    int shard_count;
+    task_worker_t **shards;
+
+    int partition;              /* of the center server to serve */
+
+    /* task slots advertised to the node manager, see node_serv_slots_fill(). */
+    struct htable slots;        /* key: slot id */
+    uint32_t nextslot;
+    int slot_count;
+
+    /* load reports to the node manager, see node_serv_load_report(). */
+    struct timer_list load_timer;
+    uint64_t load_stamp;
+    uint64_t load_cpu;
+    unsigned long load_packets;
+    unsigned long load_bytes;
+    /* traffic of the workers already freed. */
+    unsigned long retired_packets;
+    unsigned long retired_bytes;
+
+    int draining;               /* migrated tasks whose old copy still runs */
 };
 
 struct _task_worker {
@@ -67,48 +118,114 @@ struct _task_worker {
     struct sockaddr addr;
 
     int task_count;
-    struct hlist_head tasks_map[HASH_WORKER_CAPACITY]; 	/*key: task id*/
+    struct htable tasks_map; 	/*key: task id*/
     pthread_mutex_t lock;
 
     node_serv_t *owner;
     struct list_head entry;
+    struct rb_node load_entry;
+    int shard;      /* index in ns->shards, -1: a port of its own */
+
+    /* statistics, updated by the worker thread only. */
+    unsigned long packets;
+    unsigned long bytes;
+    unsigned long load_packets;
+    unsigned long pps;
 };
 
 
+/* a place kept for a task on a worker, counted in its task_count. */
+struct task_slot {
+    uint32_t slot;
+    task_worker_t *worker;      /* NULL: reuseport, placed by task id */
+};
+
 static node_serv_t node_serv;
 
+static const struct htable_params task_map_params =
+    HTABLE_PARAMS(task_t, taskid, WORKER_MAX_TASK_COUNT);
+
+static const struct htable_params slot_params =
+    HTABLE_PARAMS(struct task_slot, slot, NODE_TASK_SLOTS_BATCH);
+
 
 task_t *create_task(int priv_size)
 {
     task_t *task;
 
     task = malloc(sizeof(*task) + priv_size);
+    if(!task)
+        return NULL;
+
+    task->packets = task->load_packets = task->pps = 0;
+    task->priv_size = priv_size;
+    task->ops = NULL;
     return task;
 }
 
-void release_task(task_t *task) 
+static void release_task_rcu(struct rcu_head *head)
 {
+    task_t *task = container_of(head, task_t, rcu);
+
+    if(task->ops && task->ops->free_handle)
+        task->ops->free_handle(task);
     free(task);
 }
 
+/* task workers look tasks up without lock, free after a grace period. */
+void release_task(task_t *task) 
+{
+    call_rcu(&task->rcu, release_task_rcu);
+}
+
 static task_t *worker_get_task_by_id(task_worker_t *worker, uint32_t taskid);
 
 static task_t *find_node_serv_task(node_serv_t *ns, int taskid)
 {
     task_t *task;
-    task_worker_t *worker;
 
     pthread_mutex_lock(&ns->lock);
-    list_for_each_entry(worker, &ns->worker_list, entry) {
-        task = worker_get_task_by_id(worker, taskid);
-        if(task) {
-            pthread_mutex_unlock(&ns->lock);
-            return task;
-        }
+    task = htable_lookup(&ns->tasks_map, taskid);
+    pthread_mutex_unlock(&ns->lock);
+
+    return task;
+}
+
+/* the worker tree is ordered by task count, all under ns->lock. */
+static void worker_load_insert(node_serv_t *ns, task_worker_t *worker)
+{
+    struct rb_node **p = &ns->worker_tree.rb_node;
+    struct rb_node *parent = NULL;
+    task_worker_t *w;
+
+    while(*p) {
+        parent = *p;
+        w = rb_entry(parent, task_worker_t, load_entry);
+
+        if(worker->task_count < w->task_count)
+            p = &(*p)->rb_left;
+        else
+            p = &(*p)->rb_right;
     }
 
-    pthread_mutex_unlock(&ns->lock);
-    return NULL;
+    rb_link_node(&worker->load_entry, parent, p);
+    rb_insert_color(&worker->load_entry, &ns->worker_tree);
+}
+
+static inline void worker_load_erase(node_serv_t *ns, task_worker_t *worker)
+{
+    rb_erase(&worker->load_entry, &ns->worker_tree);
+}
+
+static task_worker_t *least_loaded_worker(node_serv_t *ns)
+{
+    struct rb_node *node;
+
+    node = rb_first(&ns->worker_tree);
+    if(!node)
+        return NULL;
+
+    return rb_entry(node, task_worker_t, load_entry);
 }
 
 
@@ -163,10 +280,11 @@ void task_worker_pkt_sendto(task_t *task, int type,
 
     dump_data("task worker send data", data, len);
 
+    worker->packets++;
+    worker->bytes += pkb->len;
     iohandler_pkt_sendto(worker->hand, pkb, to);
 }
 
-#if 0
 void task_worker_pkt_multicast(task_t *task, int type, 
         void *data, int len, struct sockaddr *dst_ptr, int count)
 {
@@ -175,7 +293,7 @@ void task_worker_pkt_multicast(task_t *task, int type,
     task_worker_t *worker = task->worker;
 
     head = (pack_head_t *)((uint8_t *)data - pack_head_len());
-    pkb = data_to_packet(head);
+    pkb = data_to_pack_buf(head);
 
     init_pack(head, type, len);
     head->seqnum = worker->nextseq++;
@@ -184,14 +302,119 @@ void task_worker_pkt_multicast(task_t *task, int type,
 
     dump_data("task worker multicast data", data, len);
 
-    ioasync_pkt_multicast(worker->hand, pkb, dst_ptr, count);
+    worker->packets += count;
+    worker->bytes += pkb->len * count;
+    iohandler_pkt_multicast(worker->hand, pkb, dst_ptr, count);
+}
+
+/*
+ * Relay the data of a received task request as is. The new header is
+ * written once over the request header in front of the data, and the
+ * received buffer goes out by reference, nothing is copied.
+ */
+int task_worker_pkt_forward(task_t *task, int type, 
+        struct pack_task_req *pack, struct sockaddr *dst_ptr, int count)
+{
+    return task_worker_pkt_fanout(task, type, pack, dst_ptr, count, -1);
+}
+
+/*
+ * A copy of the received request to task @peer of another node server,
+ * at @to. It goes before the request is relayed here, which rewrites
+ * the header in front of the data.
+ */
+int task_worker_pkt_link(task_t *task, struct pack_task_req *pack,
+        uint32_t peer, struct sockaddr *to)
+{
+    int len, avail;
+    pack_buf_t *pkb;
+    pack_head_t *head;
+    struct pack_task_req *req;
+
+    head = (pack_head_t *)((uint8_t *)pack - pack_head_len());
+    pkb = data_to_pack_buf(head);
+
+    avail = pkb->len - (pack->data - pack_buf_data(pkb));
+    if(avail < 0 || pack->datalen > avail)
+        return -EINVAL;
+    len = sizeof(*pack) + pack->datalen;
+
+    req = task_worker_pkt_alloc(task);
+    memcpy(req, pack, len);
+    req->taskid = peer;
+
+    task_worker_pkt_sendto(task, MSG_TASK_LINK, req, len, to);
+    return 0;
+}
+
+/*
+ * task_worker_pkt_forward() to the addresses of @dst_ptr but the one at
+ * @skip, -1 for none. A large group is sent in chunks of
+ * TASK_FANOUT_CHUNK. With reuseport, this worker sends the first and the
+ * other workers of the port one each in turn, so one relay is spread
+ * over their threads; the members see the one source port all the same.
+ * A worker of a port of its own sends them all. The buffer is shared.
+ */
+int task_worker_pkt_fanout(task_t *task, int type, struct pack_task_req *pack,
+        struct sockaddr *dst_ptr, int count, int skip)
+{
+    int i, n, len, avail, end, total;
+    int shard;
+    pack_buf_t *pkb;
+    pack_head_t *head;
+    task_worker_t *worker = task->worker;
+    task_worker_t *sender = worker;
+    node_serv_t *ns = worker->owner;
+
+    head = (pack_head_t *)((uint8_t *)pack - pack_head_len());
+    pkb = data_to_pack_buf(head);
+
+    avail = pkb->len - (pack->data - pack_buf_data(pkb));
+    if(avail < 0 || pack->datalen > avail)
+        return -EINVAL;
+    len = pack->datalen;
+
+    if(skip >= count)
+        skip = -1;
+    total = skip < 0 ? count : count - 1;
+    if(total <= 0)
+        return 0;
+
+    head = (pack_head_t *)(pack->data - pack_head_len());
+    init_pack(head, type, len);
+    head->seqnum = worker->nextseq++;
+
+    pack_buf_pull(pkb, (uint8_t *)head - pack_buf_data(pkb));
+
+    worker->packets += total;
+    worker->bytes += pkb->len * total;
+
+    /* the shard workers live as long as the node server. */
+    shard = worker->shard;
+
+    /* the receive path frees its own reference after the handler. */
+    for(i=0; i<count; i+=n) {
+        if(i == skip) {
+            n = 1;
+            continue;
+        }
+        end = (skip > i) ? skip : count;
+        n = min(end - i, TASK_FANOUT_CHUNK);
+
+        iohandler_pkt_multicast(sender->hand, pack_buf_get(pkb), &dst_ptr[i], n);
+        if(shard >= 0) {
+            shard = (shard + 1) % ns->shard_count;
+            sender = ns->shards[shard];
+        }
+    }
+    return 0;
 }
-#endif
 
 
 /*XXX*/
 static int task_req_handle(task_worker_t *worker, struct pack_task_req *pack, void *from)
 {
+    int ret;
     task_t *task;
     struct task_operations *ops;
 
@@ -199,13 +422,44 @@ static int task_req_handle(task_worker_t *worker, struct pack_task_req *pack, vo
     if(!ops)
         return -EINVAL;
 
+    rcu_read_lock();
     task = worker_get_task_by_id(worker, pack->taskid);
     if(!task) {
+        rcu_read_unlock();
         loge("not found task by taskid:%d.\n", pack->taskid);
         return -EINVAL;
     }
+    task->packets++;
+
+    ret = ops->task_handle(task, pack, from);
+    rcu_read_unlock();
+
+    return ret;
+}
+
+static int task_link_handle(task_worker_t *worker, struct pack_task_req *pack, void *from)
+{
+    int ret;
+    task_t *task;
+    struct task_operations *ops;
+
+    ops = find_task_protos_by_type(pack->type);
+    if(!ops || !ops->link_handle)
+        return -EINVAL;
+
+    rcu_read_lock();
+    task = worker_get_task_by_id(worker, pack->taskid);
+    if(!task) {
+        rcu_read_unlock();
+        logd("link: not found task by taskid:%d.\n", pack->taskid);
+        return -EINVAL;
+    }
+    task->packets++;
 
-    return ops->task_handle(task, pack, from);
+    ret = ops->link_handle(task, pack, from);
+    rcu_read_unlock();
+
+    return ret;
 }
 
 
@@ -218,6 +472,9 @@ static void task_worker_handle(void *opaque, uint8_t *data, int len, void *from)
 
     logd("task worker receive pack. len:%d\n", len);
 
+    worker->packets++;
+    worker->bytes += len;
+
     if(data == NULL || len < sizeof(*head))
         return;
 
@@ -239,6 +496,12 @@ static void task_worker_handle(void *opaque, uint8_t *data, int len, void *from)
             ret = task_req_handle(worker, pack, from);
             break;
         }
+        case MSG_TASK_LINK:
+        {
+            struct pack_task_req *pack = (struct pack_task_req *)payload;
+            ret = task_link_handle(worker, pack, from);
+            break;
+        }
         default:
             logw("unknown packet(%d).\n", head->type);
             break;
@@ -255,10 +518,9 @@ static void task_worker_close(void *opaque)
 
 }
 
-static task_worker_t *create_task_worker(node_serv_t *ns)
+static task_worker_t *task_worker_create(node_serv_t *ns, int sock)
 {
-    int i;
-    int sock;
+    int rcvbuf = TASK_WORKER_RCVBUF;
     struct sockaddr_in addr;
     socklen_t addrlen;
     task_worker_t *tworker;
@@ -266,7 +528,6 @@ static task_worker_t *create_task_worker(node_serv_t *ns)
 
     /* XXX FIXME */
     get_ipaddr(NULL, host);
-    sock = socket_inaddr_any_server(0, SOCK_DGRAM);
 
     /* get the actual port number assigned by the system */
     addrlen = sizeof(addr);
@@ -279,6 +540,9 @@ static task_worker_t *create_task_worker(node_serv_t *ns)
     logd("assign task worker address: %s, port: %d.\n", 
             inet_ntoa(addr.sin_addr), ntohs(addr.sin_port));
 
+    if(setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf)) < 0)
+        logw("task worker receive buffer: %s.\n", strerror(errno));
+
     /* XXX */
     addr.sin_addr.s_addr = inet_addr(host);
 
@@ -286,41 +550,148 @@ static task_worker_t *create_task_worker(node_serv_t *ns)
     if(!tworker)
         goto out;
 
+    if(htable_init(&tworker->tasks_map, &task_map_params)) {
+        free(tworker);
+        tworker = NULL;
+        goto out;
+    }
+
     tworker->addr = *((struct sockaddr *)&addr);
     tworker->task_count = 0;
     tworker->owner = ns;
+    tworker->shard = -1;
 
     tworker->ioasync = ioasync_init();
     tworker->hand = iohandler_udp_create(tworker->ioasync, sock,
             task_worker_handle, task_worker_close, tworker);
 
-    for (i = 0; i < HASH_WORKER_CAPACITY; i++)
-        INIT_HLIST_HEAD(&tworker->tasks_map[i]);
-
     tworker->nextseq = 0;
+    tworker->packets = tworker->bytes = 0;
+    tworker->load_packets = tworker->pps = 0;
     pthread_mutex_init(&tworker->lock, NULL);
 
     list_add_tail(&tworker->entry, &ns->worker_list);
+    worker_load_insert(ns, tworker);
     ns->worker_count++;
 out:
     return tworker;
 }
 
+static task_worker_t *create_task_worker(node_serv_t *ns)
+{
+    int sock;
+
+    sock = socket_inaddr_any_server(0, SOCK_DGRAM);
+    if(sock < 0)
+        return NULL;
+
+    return task_worker_create(ns, sock);
+}
+
 static void free_task_worker(task_worker_t *worker) 
 {
     node_serv_t *ns = worker->owner;
 
     list_del(&worker->entry);
+    worker_load_erase(ns, worker);
     ns->worker_count--;
-
-    if(ns->suit_worker == worker)
-        ns->suit_worker = NULL;
+    ns->retired_packets += worker->packets;
+    ns->retired_bytes += worker->bytes;
 
     iohandler_shutdown(worker->hand);
     ioasync_release(worker->ioasync);
+    htable_destroy(&worker->tasks_map);
     free(worker);
 }
 
+/*
+ * The program runs on each datagram to the reuseport group and returns
+ * the index of the socket that takes it, the sockets are numbered in
+ * bind order. It reads the taskid of struct pack_task_req, which is in
+ * host order.
+ */
+static int task_worker_attach_steering(int sock, int count)
+{
+    const uint32_t ofs = pack_head_len() + offsetof(struct pack_task_req, taskid);
+    struct sock_filter code[] = {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        BPF_STMT(BPF_LD | BPF_B | BPF_ABS, ofs + 3),
+        BPF_STMT(BPF_ALU | BPF_LSH | BPF_K, 8),
+        BPF_STMT(BPF_MISC | BPF_TAX, 0),
+        BPF_STMT(BPF_LD | BPF_B | BPF_ABS, ofs + 2),
+        BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+        BPF_STMT(BPF_ALU | BPF_LSH | BPF_K, 8),
+        BPF_STMT(BPF_MISC | BPF_TAX, 0),
+        BPF_STMT(BPF_LD | BPF_B | BPF_ABS, ofs + 1),
+        BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+        BPF_STMT(BPF_ALU | BPF_LSH | BPF_K, 8),
+        BPF_STMT(BPF_MISC | BPF_TAX, 0),
+        BPF_STMT(BPF_LD | BPF_B | BPF_ABS, ofs),
+        BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+#else
+        BPF_STMT(BPF_LD | BPF_W | BPF_ABS, ofs),
+#endif
+        BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, count),
+        BPF_STMT(BPF_RET | BPF_A, 0),
+    };
+    struct sock_fprog prog = {
+        .len = ARRAY_SIZE(code),
+        .filter = code,
+    };
+
+    return setsockopt(sock, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog));
+}
+
+/* one worker and reactor thread for each socket of the group. */
+static int node_serv_shards_create(node_serv_t *ns, int count)
+{
+    int i, sock;
+    int port = 0;
+    struct sockaddr_in addr;
+    socklen_t addrlen;
+    task_worker_t *worker;
+
+    ns->shards = calloc(count, sizeof(*ns->shards));
+    if(!ns->shards)
+        return -ENOMEM;
+
+    for(i=0; i<count; i++) {
+        sock = socket_reuseport_server(port, SOCK_DGRAM);
+        if(sock < 0)
+            goto fail;
+
+        if(i == 0) {
+            addrlen = sizeof(addr);
+            if(getsockname(sock, (struct sockaddr *)&addr, &addrlen) < 0 ||
+                    task_worker_attach_steering(sock, count) < 0) {
+                loge("reuseport steering: %s.\n", strerror(errno));
+                close(sock);
+                goto fail;
+            }
+            port = ntohs(addr.sin_port);
+        }
+
+        worker = task_worker_create(ns, sock);
+        if(!worker)
+            goto fail;
+        worker->shard = i;
+        ns->shards[i] = worker;
+    }
+
+    ns->shard_count = count;
+    logi("node server: %d task workers on port %d.\n", count, port);
+    return 0;
+
+fail:
+    for(i=0; i<count; i++) {
+        if(ns->shards[i])
+            free_task_worker(ns->shards[i]);
+    }
+    free(ns->shards);
+    ns->shards = NULL;
+    return -EINVAL;
+}
+
 static void *node_serv_pkt_alloc(node_serv_t *ns)
 {
     pack_buf_t *pkb;
@@ -358,6 +729,8 @@ static task_t *node_serv_task_assign(struct pack_task_assign *pt)
         return NULL;
 
     task = ops->assign_handle(pt);
+    if(!task)
+        return NULL;
 
     task->taskid = pt->taskid;
     task->type = pt->type;
@@ -421,78 +794,99 @@ static int task_assign_response(node_serv_t *ns, task_t *task)
 
 static void worker_add_task(task_worker_t *worker, task_t *task)
 {
-    uint32_t key;
+    node_serv_t *ns = worker->owner;
 
-    key = hash_32(task->taskid, HASH_WORKER_SHIFT);
+    worker_load_erase(ns, worker);
 
     pthread_mutex_lock(&worker->lock);
     worker->task_count++;
     task->worker = worker;
 
     logd("worker add task. taskid:%d\n", task->taskid);
-    hlist_add_head(&task->hentry, &worker->tasks_map[key]);
+    htable_insert(&worker->tasks_map, task);
 
     pthread_mutex_unlock(&worker->lock);
+
+    worker_load_insert(ns, worker);
 }
 
+/*
+ * lock-free, the caller must be in a rcu read-side critical section
+ * for as long as the returned task is used, or hold ns->lock which
+ * serializes all task register/unregister.
+ */
 static task_t *worker_get_task_by_id(task_worker_t *worker, uint32_t taskid)
 {
-    task_t *task;
-    uint32_t key;
-    struct hlist_node *tmp;
-
-    key = hash_32(taskid, HASH_WORKER_SHIFT);
-
-    pthread_mutex_lock(&worker->lock);
-
-    hlist_for_each_entry(task, tmp, &worker->tasks_map[key], hentry) {
-        if(task->taskid == taskid) {
-            pthread_mutex_unlock(&worker->lock);
-            return task;
-        }
-    }
-
-    pthread_mutex_unlock(&worker->lock);
-    return NULL;
+    return htable_lookup(&worker->tasks_map, taskid);
 }
 
 
 static void worker_remove_task(task_worker_t *worker, task_t *task)
 {
+    int count;
+    node_serv_t *ns = worker->owner;
+
+    worker_load_erase(ns, worker);
+
     pthread_mutex_lock(&worker->lock);
 
-    hlist_del_init(&task->hentry);
-    worker->task_count--;
+    htable_remove(&worker->tasks_map, task->taskid);
+    count = --worker->task_count;
+
+    pthread_mutex_unlock(&worker->lock);
+
+    worker_load_insert(ns, worker);
 
     /*XXX*/
-    if(worker->task_count == 0)
+    if(count == 0 && worker->shard < 0)
         free_task_worker(worker);
+}
+
+/* reserve @n more task slots on @worker, or release them if negative. */
+static void worker_reserve(task_worker_t *worker, int n)
+{
+    node_serv_t *ns = worker->owner;
+
+    worker_load_erase(ns, worker);
 
+    pthread_mutex_lock(&worker->lock);
+    worker->task_count += n;
     pthread_mutex_unlock(&worker->lock);
+
+    worker_load_insert(ns, worker);
 }
 
-static int node_serv_task_register(node_serv_t *ns, task_t *task)
+static int node_serv_task_register(node_serv_t *ns, task_t *task, uint32_t slot)
 {
     int ret = 0;
-    task_worker_t *pos, *worker = NULL;
-    int count = WORKER_MAX_TASK_COUNT;
+    task_worker_t *worker;
+    struct task_slot *ts;
 
     pthread_mutex_lock(&ns->lock);
-    worker = ns->suit_worker;
-    if(worker && worker->task_count < WORKER_MAX_TASK_COUNT)
-        goto found;
-
-    /* slow path */
-    list_for_each_entry(pos, &ns->worker_list, entry) {
-        if(count < pos->task_count) {
-            count = pos->task_count;
-            worker = pos;
+    if(slot) {
+        ts = htable_remove(&ns->slots, slot);
+        if(ts) {
+            ns->slot_count--;
+            worker = ts->worker;
+            free(ts);
+            if(worker) {
+                /* the reservation becomes the task. */
+                worker_reserve(worker, -1);
+                goto found;
+            }
+        } else {
+            logw("task %d: slot %d not reserved.\n", task->taskid, slot);
         }
     }
 
-    if(count != WORKER_MAX_TASK_COUNT) {
+    if(ns->shard_count) {
+        /* where the steering program sends its requests. */
+        worker = ns->shards[task->taskid % ns->shard_count];
         goto found;
-    } else {
+    }
+
+    worker = least_loaded_worker(ns);
+    if(!worker || worker->task_count >= WORKER_MAX_TASK_COUNT) {
         worker = create_task_worker(ns);
         if(!worker) {
             ret = -EINVAL;
@@ -502,9 +896,8 @@ static int node_serv_task_register(node_serv_t *ns, task_t *task)
 
 found:
     ns->task_count++;
+    htable_insert(&ns->tasks_map, task);
     worker_add_task(worker, task);
-
-    ns->suit_worker = worker;	
 out:
     pthread_mutex_unlock(&ns->lock);
     return ret;
@@ -515,6 +908,7 @@ static void node_serv_task_unregister(node_serv_t *ns, task_t *task)
     task_worker_t *worker = task->worker;
 
     pthread_mutex_lock(&ns->lock);
+    htable_remove(&ns->tasks_map, task->taskid);
     worker_remove_task(worker, task);
     ns->task_count--;
     task->worker = NULL;
@@ -523,10 +917,60 @@ static void node_serv_task_unregister(node_serv_t *ns, task_t *task)
 }
 
 
-static void node_serv_handle(void *opaque, uint8_t *data, int len)
+/*
+ * Reserve task slots up to NODE_TASK_SLOTS_BATCH and advertise the new
+ * ones, the node manager answers assigns from them at once and the
+ * MSG_TASK_ASSIGN that follows names the slot it used.
+ */
+static void node_serv_slots_fill(node_serv_t *ns)
+{
+    int n = 0;
+    struct pack_task_slots *pkt;
+    struct task_slot *ts;
+    task_worker_t *worker;
+
+    pkt = (struct pack_task_slots *)node_serv_pkt_alloc(ns);
+
+    pthread_mutex_lock(&ns->lock);
+    while(ns->slot_count < NODE_TASK_SLOTS_BATCH) {
+        worker = NULL;
+        if(!ns->shard_count) {
+            worker = least_loaded_worker(ns);
+            if(!worker || worker->task_count >= WORKER_MAX_TASK_COUNT) {
+                worker = create_task_worker(ns);
+                if(!worker)
+                    break;
+            }
+        }
+
+        ts = malloc(sizeof(*ts));
+        if(!ts)
+            break;
+
+        if(++ns->nextslot == 0)
+            ns->nextslot++;
+        ts->slot = ns->nextslot;
+        ts->worker = worker;
+        htable_insert(&ns->slots, ts);
+        ns->slot_count++;
+        if(worker)
+            worker_reserve(worker, 1);
+
+        pkt->slots[n].slot = ts->slot;
+        pkt->slots[n].addr = worker ? worker->addr : ns->shards[0]->addr;
+        n++;
+    }
+    pthread_mutex_unlock(&ns->lock);
+
+    logd("node server: %d task slots reserved.\n", n);
+    pkt->count = n;
+    node_serv_pkt_send(ns, MSG_TASK_SLOTS, pkt,
+            sizeof(*pkt) + n * sizeof(struct pack_task_slot));
+}
+
+static void node_serv_pack_handle(node_serv_t *ns, uint8_t *data, int len)
 {
     int ret = 0;
-    node_serv_t *ns = (node_serv_t *)opaque;
     pack_head_t *head;
     task_t *task;
     void *payload;
@@ -552,15 +996,26 @@ static void node_serv_handle(void *opaque, uint8_t *data, int len)
         {
             struct pack_task_assign *pt = (struct pack_task_assign *)payload;
             task = node_serv_task_assign(pt);
-            node_serv_task_register(ns, task);
+            if(!task) {
+                ret = -ENOMEM;
+                break;
+            }
+            node_serv_task_register(ns, task, pt->slot);
 
             ret = task_assign_response(ns, task);
+
+            if(pt->slot && ns->slot_count <= NODE_TASK_SLOTS_BATCH / 2)
+                node_serv_slots_fill(ns);
             break;
         }
         case MSG_TASK_RECLAIM:
         {
             struct pack_task_reclaim *pt = (struct pack_task_reclaim *)payload;
             task = find_node_serv_task(ns, pt->taskid);
+            if(!task) {
+                ret = -EINVAL;
+                break;
+            }
 
             node_serv_task_unregister(ns, task);
             ret = node_serv_task_reclaim(task, pt);
@@ -569,9 +1024,15 @@ static void node_serv_handle(void *opaque, uint8_t *data, int len)
         case MSG_TASK_CONTROL:
         {
             struct pack_task_control *pt = (struct pack_task_control *)payload;
-            task = find_node_serv_task(ns, pt->taskid);
 
-            ret = node_serv_task_control(task, pt->opt, pt);
+            /* not while node_serv_task_migrate() copies the task. */
+            pthread_mutex_lock(&ns->lock);
+            task = htable_lookup(&ns->tasks_map, pt->taskid);
+            if(task)
+                ret = node_serv_task_control(task, pt->opt, pt);
+            else
+                ret = -EINVAL;
+            pthread_mutex_unlock(&ns->lock);
             break;
         }
         default:
@@ -583,35 +1044,357 @@ static void node_serv_handle(void *opaque, uint8_t *data, int len)
     }
 }
 
+static void node_serv_stream_pack_fn(void *opaque, uint8_t *pack, int len)
+{
+    node_serv_pack_handle((node_serv_t *)opaque, pack, len);
+}
+
+/* the channel is a stream, a read may hold several packs or part of one. */
+static void node_serv_handle(void *opaque, uint8_t *data, int len)
+{
+    node_serv_t *ns = (node_serv_t *)opaque;
+
+    if(!data)
+        return;
+    pack_stream_input(&ns->stream, data, len, node_serv_stream_pack_fn, ns);
+}
+
+
+struct task_drain {
+    struct timer_list timer;
+    task_t *task;
+};
+
+/* the clients moved to the new copy, stop the old one. */
+static void task_migrate_drained(unsigned long data)
+{
+    struct task_drain *drain = (struct task_drain *)data;
+    task_t *task = drain->task;
+    node_serv_t *ns = task->worker->owner;
+
+    pthread_mutex_lock(&ns->lock);
+    worker_remove_task(task->worker, task);
+    task->worker = NULL;
+    ns->draining--;
+    pthread_mutex_unlock(&ns->lock);
+
+    logd("task %d drained.\n", task->taskid);
+    release_task(task);
+    free(drain);
+}
+
+/*
+ * Move @task to worker @to, under ns->lock. The copy takes the requests
+ * once the clients have the new address from the node manager, the old
+ * task stays on its worker for TASK_MIGRATE_DRAIN_MS and relays what is
+ * still sent to the old address.
+ */
+static int node_serv_task_migrate(node_serv_t *ns, task_t *task, task_worker_t *to)
+{
+    task_t *ntask;
+    struct task_drain *drain;
+    struct pack_task_assign_response *pkt;
+
+    ntask = create_task(task->priv_size);
+    if(!ntask)
+        return -ENOMEM;
+
+    drain = malloc(sizeof(*drain));
+    if(!drain) {
+        free(ntask);
+        return -ENOMEM;
+    }
+
+    memcpy(ntask, task, sizeof(*task) + task->priv_size);
+    ntask->packets = ntask->load_packets = ntask->pps = 0;
+    if(task->ops->migrate_handle && task->ops->migrate_handle(task, ntask)) {
+        free(drain);
+        free(ntask);
+        return -ENOMEM;
+    }
+
+    htable_remove(&ns->tasks_map, task->taskid);
+    htable_insert(&ns->tasks_map, ntask);
+    worker_add_task(to, ntask);
+
+    drain->task = task;
+    init_timer(&drain->timer);
+    setup_timer(&drain->timer, task_migrate_drained, (unsigned long)drain);
+    mod_timer(&drain->timer, curr_time_ms() + TASK_MIGRATE_DRAIN_MS);
+    ns->draining++;
+
+    pkt = (struct pack_task_assign_response *)node_serv_pkt_alloc(ns);
+    pkt->taskid = ntask->taskid;
+    pkt->type = ntask->type;
+    pkt->addr = to->addr;
+    node_serv_pkt_send(ns, MSG_TASK_MIGRATED, pkt, sizeof(*pkt));
+    return 0;
+}
+
+/*
+ * Under ns->lock, after the pps of the last interval are taken. The
+ * busiest task that at most evens the hottest and the coolest worker
+ * moves over, to a new worker if there is only one and a cpu is left.
+ * Not with reuseport, where the task id decides the worker.
+ */
+static void node_serv_rebalance(node_serv_t *ns)
+{
+    task_worker_t *worker, *hot = NULL, *cold = NULL;
+    task_t *task, *move = NULL;
+    struct htable_iter iter;
+    unsigned long limit;
+
+    if(ns->shard_count || ns->draining)
+        return;
+
+    list_for_each_entry(worker, &ns->worker_list, entry) {
+        if(!hot || worker->pps > hot->pps)
+            hot = worker;
+        if(worker->task_count < WORKER_MAX_TASK_COUNT &&
+                (!cold || worker->pps < cold->pps))
+            cold = worker;
+    }
+
+    if(!hot || hot->pps < TASK_REBALANCE_MIN_PPS || hot->task_count < 2)
+        return;
+
+    if(!cold || cold == hot || hot->pps < cold->pps * 2) {
+        if(ns->worker_count >= sysconf(_SC_NPROCESSORS_ONLN))
+            return;
+        cold = NULL;
+    }
+
+    limit = (hot->pps - (cold ? cold->pps : 0)) / 2;
+    htable_for_each(&hot->tasks_map, &iter, task) {
+        if(task->pps <= limit && (!move || task->pps > move->pps))
+            move = task;
+    }
+    if(!move || !move->pps)
+        return;
+
+    if(!cold) {
+        cold = create_task_worker(ns);
+        if(!cold)
+            return;
+    }
+
+    logi("migrate task %d (%lu pps) from a worker of %lu pps to one of %lu pps.\n",
+            move->taskid, move->pps, hot->pps, cold->pps);
+    node_serv_task_migrate(ns, move, cold);
+}
+
+static uint64_t node_serv_cpu_us(void)
+{
+    struct timespec tm;
+
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &tm);
+    return tm.tv_sec * 1000000ULL + tm.tv_nsec / 1000;
+}
+
+/*
+ * Every NODE_LOAD_REPORT_INTERVAL, the traffic, cpu time and backlog of
+ * the task workers go to the node manager, which places new tasks by
+ * them.
+ */
+static void node_serv_load_report(unsigned long data)
+{
+    node_serv_t *ns = (node_serv_t *)data;
+    struct pack_node_load *pkt;
+    task_worker_t *worker;
+    task_t *task;
+    struct htable_iter iter;
+    unsigned long packets, bytes;
+    uint64_t now, cpu, elapsed;
+    int depth = 0;
+
+    pkt = (struct pack_node_load *)node_serv_pkt_alloc(ns);
+
+    now = curr_time_ms();
+    cpu = node_serv_cpu_us();
+    elapsed = now - ns->load_stamp;
+    if(!elapsed)
+        elapsed = 1;
+
+    pthread_mutex_lock(&ns->lock);
+    packets = ns->retired_packets;
+    bytes = ns->retired_bytes;
+    list_for_each_entry(worker, &ns->worker_list, entry) {
+        packets += worker->packets;
+        bytes += worker->bytes;
+        depth += iohandler_queue_depth(worker->hand);
+
+        worker->pps = (worker->packets - worker->load_packets) * MSEC_PER_SEC / elapsed;
+        worker->load_packets = worker->packets;
+    }
+    htable_for_each(&ns->tasks_map, &iter, task) {
+        task->pps = (task->packets - task->load_packets) * MSEC_PER_SEC / elapsed;
+        task->load_packets = task->packets;
+    }
+    pkt->workers = ns->worker_count;
+    pkt->tasks = ns->task_count;
+
+    node_serv_rebalance(ns);
+    pthread_mutex_unlock(&ns->lock);
+
+    pkt->pps = (packets - ns->load_packets) * MSEC_PER_SEC / elapsed;
+    pkt->bps = (bytes - ns->load_bytes) * MSEC_PER_SEC / elapsed;
+    pkt->cpu = (cpu - ns->load_cpu) / elapsed;
+    pkt->queue_depth = depth;
+
+    ns->load_stamp = now;
+    ns->load_cpu = cpu;
+    ns->load_packets = packets;
+    ns->load_bytes = bytes;
+
+    logv("node load: pps:%d, bps:%d, cpu:%d, workers:%d, tasks:%d, queue:%d\n",
+            pkt->pps, pkt->bps, pkt->cpu, pkt->workers, pkt->tasks, pkt->queue_depth);
+    node_serv_pkt_send(ns, MSG_NODE_LOAD_REPORT, pkt, sizeof(*pkt));
+
+    mod_timer(&ns->load_timer, now + NODE_LOAD_REPORT_INTERVAL);
+}
+
+static void node_serv_load_start(node_serv_t *ns)
+{
+    ns->load_stamp = curr_time_ms();
+    ns->load_cpu = node_serv_cpu_us();
+    ns->load_packets = ns->load_bytes = 0;
+
+    init_timer(&ns->load_timer);
+    setup_timer(&ns->load_timer, node_serv_load_report, (unsigned long)ns);
+    mod_timer(&ns->load_timer, ns->load_stamp + NODE_LOAD_REPORT_INTERVAL);
+}
 
 static void node_serv_close(void *opaque)
 {
+    node_serv_t *ns = (node_serv_t *)opaque;
+
+    pack_stream_release(&ns->stream);
+}
+
+
+static int node_serv_setup(node_serv_t *ns)
+{
+    if(htable_init(&ns->tasks_map, &task_map_params))
+        return -ENOMEM;
+    if(htable_init(&ns->slots, &slot_params)) {
+        htable_destroy(&ns->tasks_map);
+        return -ENOMEM;
+    }
+
+    pack_stream_init(&ns->stream);
+    ns->task_count = 0;
+    ns->nextseq = 0;
+    ns->worker_count = 0;
+    INIT_LIST_HEAD(&ns->worker_list);
+    ns->worker_tree = RB_ROOT;
+    ns->nextslot = 0;
+    ns->slot_count = 0;
+    ns->draining = 0;
+    ns->retired_packets = ns->retired_bytes = 0;
+    pthread_mutex_init(&ns->lock, NULL);
 
+    ns->shard_count = 0;
+    ns->shards = NULL;
+    if(ns->reuseport > 1 && node_serv_shards_create(ns, ns->reuseport))
+        logw("reuseport task workers not available, one port for each worker.\n");
+    return 0;
+}
+
+/* before node_serv_init(), @count task workers share one port. */
+void node_serv_set_reuseport(int count)
+{
+    node_serv.reuseport = count;
 }
 
+/* before node_serv_init(), serve the center server of @partition. */
+void node_serv_set_partition(int partition)
+{
+    node_serv.partition = partition;
+}
 
 int node_serv_init(const char *host)
 {
     int socket;
     node_serv_t *ns = &node_serv;
 
-    logi("node server start. host:%s\n", host);
-    socket = socket_network_client(host, NODE_SERV_LOGIN_PORT, SOCK_STREAM);
+    logi("node server start. host:%s, partition:%d\n", host, ns->partition);
+    socket = socket_network_client(host, NODE_SERV_LOGIN_PORT + ns->partition,
+            SOCK_STREAM);
     if(socket < 0) {
         loge("connect to server fail.\n");
         return -EINVAL;
     }
 
+    if(node_serv_setup(ns)) {
+        close(socket);
+        return -ENOMEM;
+    }
     ns->mgr_hand = iohandler_create(get_global_ioasync(), socket,
             node_serv_handle, node_serv_close, ns);
-
-    ns->task_count = 0;
-    ns->nextseq = 0;
-    ns->worker_count = 0;
-    INIT_LIST_HEAD(&ns->worker_list);
-    ns->suit_worker = NULL;
-    pthread_mutex_init(&ns->lock, NULL);
+    node_serv_load_start(ns);
+    node_serv_slots_fill(ns);
 
     return 0;
 }
 
+/*
+ * A node server with @workers task workers and no node manager, tasks
+ * are put on it with node_serv_task_add(). For the relay path in tests.
+ */
+int node_serv_init_standalone(int workers)
+{
+    int i, ret;
+    node_serv_t *ns = &node_serv;
+
+    ret = node_serv_setup(ns);
+    if(ret)
+        return ret;
+
+    pthread_mutex_lock(&ns->lock);
+    for(i=0; i<workers; i++) {
+        if(!create_task_worker(ns)) {
+            ret = -ENOMEM;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&ns->lock);
+    return ret;
+}
+
+/* on the least loaded worker, see node_serv_init_standalone(). */
+int node_serv_task_add(task_t *task)
+{
+    return node_serv_task_register(&node_serv, task, 0);
+}
+
+/*
+ * the center server runs in the same process, talk to the node manager
+ * through a local iohandler instead of a loopback tcp connection.
+ */
+int node_serv_init_local(void)
+{
+    int ret;
+    node_serv_t *ns = &node_serv;
+
+    logi("node server start. local\n");
+
+    ret = node_serv_setup(ns);
+    if(ret)
+        return ret;
+    ns->mgr_hand = iohandler_local_create(get_global_ioasync(),
+            node_serv_handle, node_serv_close, ns);
+    if(!ns->mgr_hand)
+        return -ENOMEM;
+
+    ret = center_serv_local_connect(ns->mgr_hand);
+    if(ret) {
+        loge("connect to local server fail.\n");
+        iohandler_shutdown(ns->mgr_hand);
+        ns->mgr_hand = NULL;
+        return ret;
+    }
+
+    node_serv_load_start(ns);
+    node_serv_slots_fill(ns);
+    return 0;
+}
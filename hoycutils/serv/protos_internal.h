@@ -15,7 +15,8 @@
 
 #include <sys/socket.h>
 
-#define NODE_SERV_LOGIN_PORT 	(9123) 	/* listen by center server. */
+/* listen by center server, plus the partition of the center server. */
+#define NODE_SERV_LOGIN_PORT 	(9123)
 
 
 /* node server ------> center server */
@@ -25,6 +26,9 @@ enum node_center_msg_type {
      * MSG_NODE_UNREGISTER, 
      */
     MSG_TASK_ASSIGN_RESPONSE,
+    MSG_NODE_LOAD_REPORT,
+    MSG_TASK_SLOTS,
+    MSG_TASK_MIGRATED,      /* struct pack_task_assign_response, the new worker */
 };
 
 /* center server ----> node server */
@@ -34,6 +38,39 @@ enum center_node_msg_type {
     MSG_TASK_CONTROL,
 };
 
+/*
+ * center server <----> center server, on the client port. Numbered
+ * after the client messages, they are told apart by type.
+ */
+enum center_center_msg_type {
+    MSG_CENTER_JOIN = 32,   /* to the center of the group */
+    MSG_CENTER_LEAVE,
+    MSG_CENTER_DELETE,
+    MSG_CENTER_LIST,        /* a page from cursor @id for the client, the page so far may follow */
+    MSG_CENTER_MEMBER,      /* to the center of the user, it is in the group */
+    MSG_CENTER_UNMEMBER,    /* to the center of the user, the group is gone */
+    MSG_CENTER_RELAY,       /* to the center of the user, a response to pass on */
+};
+
+/* a client another center answers. */
+struct center_client {
+    uint32_t userid;
+    struct sockaddr addr;
+};
+
+/*
+ * @id leads as the userid of a client request does, the message goes to
+ * the shard of @id. JOIN, LEAVE and DELETE: @id is the group and @arg
+ * the user. MEMBER and UNMEMBER: @id is the user and @arg the group.
+ * LIST: @id is the cursor and @arg the count. RELAY: @id is the user and
+ * @arg the type of the response following the message.
+ */
+struct pack_center_msg {
+    uint32_t id;
+    uint32_t arg;
+    struct center_client client;    /* JOIN, LIST and RELAY */
+};
+
 #define TASK_PRIORITY_MIN 		(0)
 #define TASK_PRIORITY_MAX 		(8)
 #define TASK_PRIORITY_NORMAL 	TASK_PRIORITY_MIN
@@ -42,6 +79,7 @@ struct pack_task_assign {
     uint32_t taskid;
     uint8_t type;
     uint8_t priority;
+    uint32_t slot;      /* reserved by MSG_TASK_SLOTS, 0: none */
 };
 
 struct pack_task_reclaim {
@@ -63,6 +101,36 @@ struct pack_task_assign_response {
     struct sockaddr addr;
 };
 
+#define NODE_LOAD_REPORT_INTERVAL   (1000)  /* ms */
+
+/* node server load of the last report interval. */
+struct pack_node_load {
+    uint32_t pps;           /* task worker packets in and out per second */
+    uint32_t bps;           /* bytes per second */
+    uint32_t cpu;           /* cpu time, per mille of one cpu */
+    uint32_t workers;
+    uint32_t tasks;
+    uint32_t queue_depth;   /* packets waiting in the task worker queues */
+};
+
+
+/*
+ * The node server keeps this many task slots reserved on its workers
+ * and advertises them ahead of time, the node manager answers assigns
+ * from them without waiting for the node server.
+ */
+#define NODE_TASK_SLOTS_BATCH       (16)
+
+struct pack_task_slot {
+    uint32_t slot;
+    struct sockaddr addr;   /* the task worker that takes the task */
+};
+
+struct pack_task_slots {
+    uint32_t count;
+    struct pack_task_slot slots[0];
+};
+
 
 typedef struct _client_tuple {
     uint32_t userid;
@@ -13,9 +13,19 @@
 #ifndef _SERV_SERV_H_
 #define _SERV_SERV_H_
 
+#include <common/ioasync.h>
 
 int center_serv_init();
+int center_serv_local_connect(iohandler_t *peer);
+void center_serv_set_leg_users(int count);
+void center_serv_set_user_shards(int count);
+void center_serv_set_partition(int partition);
+void center_serv_set_centers(const char *centers);
 int node_serv_init();
+int node_serv_init_local(void);
+int node_serv_init_standalone(int workers);
+void node_serv_set_reuseport(int count);
+void node_serv_set_partition(int partition);
 
 
 #endif
@@ -16,6 +16,7 @@
 #include <stdint.h>
 
 #include <protos.h>
+#include <common/rcu.h>
 #include "protos_internal.h"
 
 typedef struct _task_baseinfo {
@@ -29,9 +30,16 @@ typedef struct task {
     int type;
     int priority;
 
-    struct hlist_node hentry;
     task_worker_t *worker;
     struct task_operations *ops;
+    struct rcu_head rcu;
+
+    /* requests received, by the worker thread, see node_serv_rebalance(). */
+    unsigned long packets;
+    unsigned long load_packets;
+    unsigned long pps;
+
+    int priv_size;
     uint8_t priv_data[0];
 } task_t;
 
@@ -57,8 +65,14 @@ struct task_operations {
     int (*control_handle)(task_t *task, int opt, struct pack_task_control *pkt);
 
     int (*init_assign_response_pkt)(task_t *task, struct pack_task_assign_response *pkt);
+    /* @ntask is a copy of @task, take copies of what it points to. */
+    int (*migrate_handle)(task_t *task, task_t *ntask);
+    /* frees what the private data points to, after a grace period. */
+    void (*free_handle)(task_t *task);
 
     int (*task_handle)(task_t *task, struct pack_task_req *pack, void *from);
+    /* a request relayed by a peer task, see task_worker_pkt_link(). */
+    int (*link_handle)(task_t *task, struct pack_task_req *pack, void *from);
 };
 
 static inline int default_init_assign_pkt(task_baseinfo_t *base, struct pack_task_assign *pkt)
@@ -95,6 +109,15 @@ void task_worker_pkt_free(task_t *task, void *data);
 void task_worker_pkt_sendto(task_t *task, int type, void *data, int len, struct sockaddr *to);
 void task_worker_pkt_multicast(task_t *task, int type, 
         void *data, int len, struct sockaddr *dst_ptr, int count);
+int task_worker_pkt_forward(task_t *task, int type, 
+        struct pack_task_req *pack, struct sockaddr *dst_ptr, int count);
+int task_worker_pkt_fanout(task_t *task, int type, struct pack_task_req *pack,
+        struct sockaddr *dst_ptr, int count, int skip);
+int task_worker_pkt_link(task_t *task, struct pack_task_req *pack,
+        uint32_t peer, struct sockaddr *to);
+
+/* without a node manager, see node_serv_init_standalone(). */
+int node_serv_task_add(task_t *task);
 
 
 void task_protos_init(void);
@@ -22,6 +22,7 @@
 #include <common/packet.h>
 #include <common/pack_head.h>
 #include <common/iowait.h>
+#include <common/fanout.h>
 #include <arpa/inet.h>
 
 #include <protos.h>
@@ -34,11 +35,13 @@
 struct turn_assign_data {
     task_baseinfo_t base;
     group_info_t *group;
+    group_member_t *member; /* the only client of a further leg, if set */
 };
 
 struct turn_control_data {
     task_baseinfo_t base;
-    user_info_t *user;
+    group_member_t *member;
+    task_handle_t *peer;    /* links */
 };
 
 
@@ -49,25 +52,78 @@ unsigned long turn_task_assign(node_mgr_t *mgr, group_info_t *group)
 
     init_taskbase_info(&data.base);
     data.group = group;
+    data.member = NULL;
 
     task = nodemgr_task_assign(mgr, TASK_TURN, TASK_PRIORITY_NORMAL, &data.base);
 
     return (unsigned long)task;
 }
 
+/* the assign packet is built before this returns, @group is not kept. */
+int turn_task_assign_async(node_mgr_t *mgr, group_info_t *group,
+        task_assigned_fn fn, void *arg)
+{
+    struct turn_assign_data data;
+
+    init_taskbase_info(&data.base);
+    data.group = group;
+    data.member = NULL;
+
+    return nodemgr_task_assign_async(mgr, TASK_TURN, TASK_PRIORITY_NORMAL,
+            &data.base, fn, arg);
+}
+
+/*
+ * @member is in the assign, the task knows it before the user is told
+ * where to relay, as for the creator of a group.
+ */
+int turn_leg_assign_async(node_mgr_t *mgr, group_info_t *group, group_member_t *member,
+        unsigned long apart, task_assigned_fn fn, void *arg)
+{
+    struct turn_assign_data data;
+
+    init_taskbase_info(&data.base);
+    data.group = group;
+    data.member = member;
+
+    return nodemgr_task_assign_apart(mgr, TASK_TURN, TASK_PRIORITY_NORMAL,
+            &data.base, (task_handle_t *)apart, fn, arg);
+}
+
 int turn_task_reclaim(node_mgr_t *mgr, unsigned long handle)
 {
     return nodemgr_task_reclaim(mgr, (task_handle_t *)handle, NULL);
 }
 
-int turn_task_control(node_mgr_t *mgr, unsigned long handle, int opt, user_info_t *user)
+int turn_task_control(node_mgr_t *mgr, unsigned long handle, int opt, group_member_t *member)
 {
     struct turn_control_data data;
 
-    data.user = user;
+    data.member = member;
+    data.peer = NULL;
     return nodemgr_task_control(mgr, (task_handle_t *)handle, opt, &data.base);
 }
 
+int turn_task_link(node_mgr_t *mgr, unsigned long handle, unsigned long peer)
+{
+    struct turn_control_data data;
+
+    data.member = NULL;
+    data.peer = (task_handle_t *)peer;
+    return nodemgr_task_control(mgr, (task_handle_t *)handle,
+            TURN_TYPE_LINK_ADD, &data.base);
+}
+
+int turn_task_unlink(node_mgr_t *mgr, unsigned long handle, unsigned long peer)
+{
+    struct turn_control_data data;
+
+    data.member = NULL;
+    data.peer = (task_handle_t *)peer;
+    return nodemgr_task_control(mgr, (task_handle_t *)handle,
+            TURN_TYPE_LINK_DEL, &data.base);
+}
+
 int get_turn_info(node_mgr_t *mgr, unsigned long handle, struct turn_info *info)
 {
     task_handle_t *task = (task_handle_t *)handle;
@@ -83,7 +139,7 @@ static int init_turn_task_assign(task_baseinfo_t *base,
 {
     int i = 0;
     int len;
-    user_info_t *user;
+    group_member_t *member;
     struct pack_turn_assign *ta;
     struct turn_assign_data *turn = (struct turn_assign_data *)base;
     group_info_t *group = turn->group;
@@ -92,18 +148,26 @@ static int init_turn_task_assign(task_baseinfo_t *base,
         return -EINVAL;
 
     ta = (struct pack_turn_assign *)pkt;
+    if(turn->member) {
+        ta->groupid = group->groupid;
+        ta->cli_count = 1;
+        ta->tuple[0].userid = turn->member->userid;
+        ta->tuple[0].addr = turn->member->addr;
+        return sizeof(*ta) + sizeof(client_tuple_t);
+    }
+
     len = sizeof(*ta) + sizeof(client_tuple_t)*group->users;
 
     ta->groupid = group->groupid;
     ta->cli_count = group->users;
 
     /* Usually, Only creater. */
-    list_for_each_entry(user, &group->userlist, entry) {
+    list_for_each_entry(member, &group->userlist, entry) {
         if(i >= ta->cli_count)
             fatal("group count bug.\n");
 
-        ta->tuple[i].userid = user->userid;
-        ta->tuple[i].addr = user->addr;
+        ta->tuple[i].userid = member->userid;
+        ta->tuple[i].addr = member->addr;
         i++;
     }
 
@@ -125,17 +189,24 @@ static int init_turn_task_control(task_baseinfo_t *base,
         struct pack_task_control *pkt)
 {
     int len;
-    user_info_t *user;
+    group_member_t *member;
     struct pack_turn_control *tc;
     struct turn_control_data *data = (struct turn_control_data *)base;
 
-    user = data->user;
+    member = data->member;
 
     tc = (struct pack_turn_control *)pkt;
     len = sizeof(*tc);
 
-    tc->tuple.userid = user->userid;
-    tc->tuple.addr = user->addr;
+    /* a link names the peer task and where it runs. */
+    if(data->peer) {
+        tc->tuple.userid = data->peer->taskid;
+        memcpy(&tc->tuple.addr, &data->peer->addr, sizeof(tc->tuple.addr));
+        return len;
+    }
+
+    tc->tuple.userid = member->userid;
+    tc->tuple.addr = member->addr;
 
     return len;
 }
@@ -143,22 +214,15 @@ static int init_turn_task_control(task_baseinfo_t *base,
 
 /*************************************************************/
 
-enum cli_state {
-    STATE_INVAILD,
-    STATE_PENDING,
-    STATE_RUNNING,
-};
-
-struct cli {
-    uint32_t userid;
-    struct sockaddr_in addr;
-    uint8_t state;
-};
-
+/*
+ * the clients of a group, running once their first packet came in. A
+ * group too large for one node has a task on each of several nodes,
+ * the links are the tasks of the other legs, keyed by taskid.
+ */
 struct turn_task {
     uint32_t groupid;
-    int cli_count;
-    struct cli cli[GROUP_MAX_USER];
+    fanout_t *members;
+    fanout_t *links;
 };
 
 static task_t *turn_task_assign_handle(struct pack_task_assign *pkt)
@@ -171,15 +235,25 @@ static task_t *turn_task_assign_handle(struct pack_task_assign *pkt)
     ta = (struct pack_turn_assign *)pkt;
 
     task = create_task(sizeof(*ttask));
+    if(!task)
+        return NULL;
+
     ttask = (struct turn_task *)&task->priv_data;
     ttask->groupid = ta->groupid;
-    ttask->cli_count = ta->cli_count;
-
-    for(i=0; i<ta->cli_count; i++) {
-        ttask->cli[i].userid = ta->tuple[i].userid;
-        ttask->cli[i].addr = *((struct sockaddr_in *)&ta->tuple[i].addr);
-        ttask->cli[i].state = STATE_PENDING;
+    ttask->members = fanout_create(ta->cli_count);
+    if(!ttask->members) {
+        free(task);
+        return NULL;
     }
+    ttask->links = fanout_create(4);
+    if(!ttask->links) {
+        fanout_release(ttask->members);
+        free(task);
+        return NULL;
+    }
+
+    for(i=0; i<ta->cli_count; i++)
+        fanout_add(ttask->members, ta->tuple[i].userid, &ta->tuple[i].addr, 0);
 
     return task;
 }
@@ -197,7 +271,6 @@ static int turn_task_reclaim_handle(task_t *task, struct pack_task_reclaim *pkt)
 
 static int turn_task_control_handle(task_t *task, int opt, struct pack_task_control *pkt)
 {
-    int i;
     struct pack_turn_control *tc;
     struct turn_task *ttask;
 
@@ -206,22 +279,15 @@ static int turn_task_control_handle(task_t *task, int opt, struct pack_task_cont
 
     switch(opt) {
         case TURN_TYPE_USER_JOIN:
-            if(ttask->cli_count >= GROUP_MAX_USER)
-                return -EINVAL;
-
-            ttask->cli[ttask->cli_count].userid = tc->tuple.userid;
-            ttask->cli[ttask->cli_count].addr = *((struct sockaddr_in *)&tc->tuple.addr);
-            ttask->cli[ttask->cli_count].state = STATE_PENDING;
-            ttask->cli_count++;
-            break;
+            return fanout_add(ttask->members, tc->tuple.userid, &tc->tuple.addr, 0);
         case TURN_TYPE_USER_LEAVE:
-            for(i=0; i<ttask->cli_count; i++) {
-                if(ttask->cli[i].userid == tc->tuple.userid) {
-                    ttask->cli[i] = ttask->cli[--ttask->cli_count];
-                    break;
-                }
-            }
-            break;
+            return fanout_del(ttask->members, tc->tuple.userid);
+        case TURN_TYPE_LINK_ADD:
+            /* again after the peer moved, to the new address. */
+            fanout_del(ttask->links, tc->tuple.userid);
+            return fanout_add(ttask->links, tc->tuple.userid, &tc->tuple.addr, 1);
+        case TURN_TYPE_LINK_DEL:
+            return fanout_del(ttask->links, tc->tuple.userid);
         default:
             break;
     }
@@ -229,6 +295,30 @@ static int turn_task_control_handle(task_t *task, int opt, struct pack_task_cont
     return 0;
 }
 
+static int turn_task_migrate_handle(task_t *task, task_t *ntask)
+{
+    struct turn_task *ttask = (struct turn_task *)&task->priv_data;
+    struct turn_task *nttask = (struct turn_task *)&ntask->priv_data;
+
+    nttask->members = fanout_copy(ttask->members);
+    if(!nttask->members)
+        return -ENOMEM;
+    nttask->links = fanout_copy(ttask->links);
+    if(!nttask->links) {
+        fanout_release(nttask->members);
+        return -ENOMEM;
+    }
+    return 0;
+}
+
+static void turn_task_free_handle(task_t *task)
+{
+    struct turn_task *ttask = (struct turn_task *)&task->priv_data;
+
+    fanout_release(ttask->members);
+    fanout_release(ttask->links);
+}
+
 /*
    int init_turn_task_assign_response(task_t *task, struct pack_task_base *pkt)
    {
@@ -244,48 +334,55 @@ static int turn_task_control_handle(task_t *task, int opt, struct pack_task_cont
  */
 
 
+/* under rcu_read_lock(), see task_req_handle(). */
 static int turn_task_handle(task_t *task, struct pack_task_req *pack, void *from)
 {
     int i;
-    void *data;
+    uint32_t userid = pack->userid;
     struct turn_task *ttask;
+    struct fanout_member *m;
+    struct fanout_peers *peers, *links;
 
     ttask = (struct turn_task *)&task->priv_data;
 
-    /* FIXME:XXX */
-    data = task_worker_pkt_alloc(task); 
-    memcpy(data, pack->data, pack->datalen);
+    m = fanout_lookup(ttask->members, userid);
+    if(m && !m->running) {
+        struct sockaddr_in *address = (struct sockaddr_in *)from;
+        uint32_t *ack;
 
-    for(i=0; i<ttask->cli_count; i++) {
-//        struct sockaddr_in *addr;
+        fanout_run(ttask->members, userid, from);
+        logi("client %d turn state change to running. addr:%s, port:%d\n", 
+                userid, inet_ntoa(address->sin_addr), ntohs(address->sin_port));
 
-        if(pack->userid == ttask->cli[i].userid) {
-            if(ttask->cli[i].state == STATE_PENDING) {
-                struct sockaddr_in *address = (struct sockaddr_in *)from;
+        /* the client checks in until it is told, see client_checkin(). */
+        ack = task_worker_pkt_alloc(task);
+        *ack = userid;
+        task_worker_pkt_sendto(task, MSG_TURN_CHECKIN_ACK, ack, sizeof(*ack), from);
+    }
 
-                ttask->cli[i].state = STATE_RUNNING;
-                ttask->cli[i].addr = *address;
-                logi("client %d turn state change to running. addr:%s, port:%d\n", 
-                        pack->userid, inet_ntoa(address->sin_addr), ntohs(address->sin_port));
-            }
-            continue;
-        }
+    /* the other legs first, the relay below rewrites the packet. */
+    links = fanout_peers(ttask->links);
+    for(i=0; i<links->count; i++)
+        task_worker_pkt_link(task, pack, links->ids[i], &links->dst[i]);
 
-        if(ttask->cli[i].state != STATE_RUNNING)
-            continue;
+    /* the received packet is relayed, only the addresses differ. */
+    peers = fanout_peers(ttask->members);
+    return task_worker_pkt_fanout(task, MSG_TURN_PACK, pack, peers->dst,
+            peers->count, fanout_peer_index(peers, m));
+}
 
-       task_worker_pkt_get(task, data);
-       task_worker_pkt_sendto(task, MSG_TURN_PACK, 
-            data, pack->datalen, (struct sockaddr *)&ttask->cli[i].addr);
+/* a request another leg received, for the clients here only. */
+static int turn_task_link_handle(task_t *task, struct pack_task_req *pack, void *from)
+{
+    struct turn_task *ttask;
+    struct fanout_peers *peers;
 
-/*
- *     logd("[%d] turn pack to user:%d, addr:%s, port:%d\n", i, ttask->cli[i].userid, 
- *               inet_ntoa(addr->sin_addr), ntohs(addr->sin_port));
- */
-    }
-    task_worker_pkt_free(task, data);
+    ttask = (struct turn_task *)&task->priv_data;
 
-    return 0;
+    peers = fanout_peers(ttask->members);
+    return task_worker_pkt_fanout(task, MSG_TURN_PACK, pack, peers->dst,
+            peers->count, fanout_peer_index(peers,
+                fanout_lookup(ttask->members, pack->userid)));
 }
 
 struct task_operations turn_ops = {
@@ -300,10 +397,13 @@ struct task_operations turn_ops = {
     .assign_handle = turn_task_assign_handle,
     .reclaim_handle = turn_task_reclaim_handle,
     .control_handle = turn_task_control_handle,
+    .migrate_handle = turn_task_migrate_handle,
+    .free_handle = turn_task_free_handle,
 
     //	.init_assign_response_pkt = init_turn_task_assign_response,
 
     .task_handle = turn_task_handle,
+    .link_handle = turn_task_link_handle,
 };
 
 int turn_init(void) 
@@ -20,6 +20,8 @@
 enum turn_control_type {
     TURN_TYPE_USER_JOIN,
     TURN_TYPE_USER_LEAVE,
+    TURN_TYPE_LINK_ADD,
+    TURN_TYPE_LINK_DEL,
 };
 
 struct turn_info
@@ -29,19 +31,30 @@ struct turn_info
 };
 
 unsigned long turn_task_assign(node_mgr_t *mgr, group_info_t *group);
+int turn_task_assign_async(node_mgr_t *mgr, group_info_t *group,
+        task_assigned_fn fn, void *arg);
+/* a further task of @group for @member only, on another node than @apart. */
+int turn_leg_assign_async(node_mgr_t *mgr, group_info_t *group, group_member_t *member,
+        unsigned long apart, task_assigned_fn fn, void *arg);
 int turn_task_reclaim(node_mgr_t *mgr, unsigned long handle);
-int turn_task_control(node_mgr_t *mgr, unsigned long handle, int opt, user_info_t *user);
+int turn_task_control(node_mgr_t *mgr, unsigned long handle, int opt, group_member_t *member);
+
+/* the requests of @handle are relayed to @peer too, one way. */
+int turn_task_link(node_mgr_t *mgr, unsigned long handle, unsigned long peer);
+int turn_task_unlink(node_mgr_t *mgr, unsigned long handle, unsigned long peer);
 
 int get_turn_info(node_mgr_t *mgr, unsigned long handle, struct turn_info *info);
 
-static inline int turn_task_user_join(node_mgr_t *mgr, unsigned long handle, user_info_t *user)
+static inline int turn_task_user_join(node_mgr_t *mgr, unsigned long handle,
+        group_member_t *member)
 {
-    return turn_task_control(mgr, handle, TURN_TYPE_USER_JOIN, user);
+    return turn_task_control(mgr, handle, TURN_TYPE_USER_JOIN, member);
 }
 
-static inline int turn_task_user_leave(node_mgr_t *mgr, unsigned long handle, user_info_t *user)
+static inline int turn_task_user_leave(node_mgr_t *mgr, unsigned long handle,
+        group_member_t *member)
 {
-    return turn_task_control(mgr, handle, TURN_TYPE_USER_LEAVE, user);
+    return turn_task_control(mgr, handle, TURN_TYPE_USER_LEAVE, member);
 }
 
 int turn_init(void);
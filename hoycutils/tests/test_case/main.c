@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <string.h>
 
 #include <common/core.h>
 #include <common/init.h>
@@ -17,8 +18,33 @@ struct test_case cases[] = {
 	{"configs", "", test_configs},
 	{"workqueue", "", test_workqueue},
 	{"timer", "", test_timer},
+	{"pack_stream", "packs split across stream reads", test_pack_stream},
+	{"fifo", "lock-free spsc fifo throughput", test_fifo},
+	{"rcu", "rcu reclamation, lock-free idr_find", test_rcu},
+	{"htable", "open addressing hash table vs hlist", test_htable},
+	{"bitmap", "simd bitmap kernels vs generic", test_bitmap},
+	{"data_frag", "4MB image: shuffled, fec, nack, paced, by mtu", test_data_frag},
+	{"img_sync", "lz and xor delta state images, samples/test.bmp", test_img_sync},
+	{"multicast", "relay fan-out pps, sendmmsg vs sendto", test_multicast},
+	{"fanout", "group membership table, relay at 8, 64, 512 members", test_fanout},
+	{"hbeat", "heartbeat expiry of 100k nodes, half of them beating, tick cost", test_hbeat},
 };
 
+/* with no arguments run every case, otherwise only the named ones. */
+static int case_selected(int argc, char **argv, const char *name)
+{
+	int i;
+
+	if(argc <= 1)
+		return 1;
+
+	for(i=1; i<argc; i++) {
+		if(!strcmp(argv[i], name))
+			return 1;
+	}
+	return 0;
+}
+
 
 int main(int argc, char **argv)
 {
@@ -31,12 +57,12 @@ int main(int argc, char **argv)
 
 	for(i=0; i<ARRAY_SIZE(cases); i++) {
 		tcase = cases + i;
-		if(tcase->func != NULL) {
+		if(tcase->func != NULL && case_selected(argc, argv, tcase->name)) {
 			printf("\n\n==========================================================\n");
 			printf("test case [%d]: %s\n", i, tcase->name);
 			//printf("%s\n", tcase->desc);
 
-			ret = tcase->func(argc - 1, ++argv);
+			ret = tcase->func(argc - 1, argv + 1);
 			if(ret) {
 				result++;
 			}
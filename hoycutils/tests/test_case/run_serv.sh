@@ -0,0 +1,89 @@
+#!/bin/bash
+#
+# Runs serv processes on localhost and checks a group of serv_client
+# processes gets its state images through them.
+#
+#   run_serv.sh legs    a center and two node servers, one user a leg
+#   run_serv.sh partition
+#                       two center servers keeping half the users and groups
+#                       each, answers for the other's users pass its center
+#   run_serv.sh shards  login and heart beat rate of one user shard and
+#                       of SHARDS, one a cpu by default (USERS users, 256)
+#
+# TOP is the build tree, the one above tests/ by default.
+
+TOP=${TOP:-$(cd "$(dirname "$0")/../.." && pwd)}
+SERV=$TOP/serv/serv
+CLIENT=$TOP/tests/test_case/serv_client
+LOGS=${LOGS:-$(mktemp -d /tmp/run_serv.XXXXXX)}
+HOST=127.0.0.1
+mkdir -p $LOGS
+
+# serv quits on end of stdin, @1 seconds after it is started.
+serv_start() {
+    local secs=$1 log=$2
+    shift 2
+    (sleep $secs | timeout $secs $SERV "$@" > $LOGS/$log.log 2>&1 &)
+}
+
+serv_stop() {
+    pkill -f "^$SERV" 2>/dev/null
+    sleep 0.3
+}
+
+# a sender and a receiver of one group, every image sent has to arrive.
+clients_run() {
+    local ret
+
+    timeout 14 $CLIENT $HOST tx 8 > $LOGS/tx.log 2>&1 &
+    timeout 12 $CLIENT $HOST rx 9 8 > $LOGS/rx.log 2>&1
+    ret=$?
+    wait $! || ret=1
+    cat $LOGS/tx.log $LOGS/rx.log
+    return $ret
+}
+
+scenario_legs() {
+    serv_start 20 center -m center -l 1
+    sleep 0.5
+    serv_start 19 node1 -m node -s $HOST
+    serv_start 19 node2 -m node -s $HOST
+    sleep 1.5
+    clients_run
+}
+
+scenario_partition() {
+    local centers=$HOST:8123,$HOST:8133
+
+    serv_start 20 center0 -m full -p 0 -c $centers
+    serv_start 20 center1 -m full -p 1 -c $centers
+    sleep 1
+    clients_run
+}
+
+scenario_shards() {
+    local shards ret=0
+
+    for shards in 1 ${SHARDS:-$(nproc)}; do
+        serv_start 8 center$shards -m center -u $shards
+        sleep 0.5
+        echo "$shards user shards:"
+        $CLIENT $HOST load ${USERS:-256} 3 || ret=1
+        serv_stop
+    done
+    return $ret
+}
+
+scenario=${1:-legs}
+if ! type scenario_$scenario > /dev/null 2>&1; then
+    echo "unknown scenario: $scenario"
+    exit 2
+fi
+
+serv_stop
+scenario_$scenario
+ret=$?
+serv_stop
+
+echo "$scenario: $([ $ret -eq 0 ] && echo success || echo failed), logs in $LOGS"
+exit $ret
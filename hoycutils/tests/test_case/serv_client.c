@@ -0,0 +1,302 @@
+/*
+ * tests/test_case/serv_client.c
+ *
+ * A client of a running serv, driven by run_serv.sh.
+ *
+ *   serv_client <host> tx <images>     create a group, send the images
+ *   serv_client <host> rx <seconds> <images>
+ *                                      join the first group listed
+ *   serv_client <host> load <users> <seconds>
+ *                                      log in and heart beat from raw sockets
+ *
+ * tx exits 0 when every image is sent, and stays a while to answer the
+ * nacks. rx exits 0 when the images sent all came within the seconds and
+ * match samples/test.bmp, load when every user is logged in.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <common/core.h>
+#include <common/pack_head.h>
+#include <protos.h>
+#include <client.h>
+
+#define SERV_CLIENT_IMG         TEST_SAMPLES_DIR "/test.bmp"
+#define SERV_CLIENT_IMG_MAX     (4 * 1024 * 1024)
+/* the images go out paced, then the receivers may still ask for fragments. */
+#define SERV_CLIENT_SENT_WAIT   (10)
+#define SERV_CLIENT_LINGER      (2)
+
+static uint8_t *img_data;
+static int img_len;
+static int img_got;
+static int img_good;
+static volatile int img_sent;
+
+static int serv_client_event(int event, void *arg1, void *arg2)
+{
+    if(event == EVENT_STATE_IMG_SENT)
+        img_sent++;
+    if(event != EVENT_STATE_IMG)
+        return 0;
+
+    img_got++;
+    if((long)arg2 == img_len && !memcmp(arg1, img_data, img_len))
+        img_good++;
+    return 0;
+}
+
+static int serv_client_load_img(void)
+{
+    FILE *fp;
+
+    fp = fopen(SERV_CLIENT_IMG, "rb");
+    if(!fp)
+        return -1;
+
+    img_data = malloc(SERV_CLIENT_IMG_MAX);
+    img_len = fread(img_data, 1, SERV_CLIENT_IMG_MAX, fp);
+    fclose(fp);
+    return img_len > 0 ? 0 : -1;
+}
+
+static int serv_client_tx(int images)
+{
+    int i, ret, queued = 0;
+
+    ret = client_create_group(1, "serv_client", "");
+    printf("create group: %d\n", ret);
+    if(ret)
+        return ret;
+
+    /* let the receivers join. */
+    sleep(2);
+    for(i=0; i<images; i++) {
+        ret = client_send_state_img(img_data, img_len);
+        if(ret < 0)
+            printf("send image %d: %d\n", i, ret);
+        else
+            queued++;
+        usleep(300 * 1000);
+    }
+
+    for(i=0; i<SERV_CLIENT_SENT_WAIT * 10 && img_sent < queued; i++)
+        usleep(100 * 1000);
+    printf("images sent: %d of %d\n", img_sent, images);
+
+    sleep(SERV_CLIENT_LINGER);
+    return img_sent == images ? 0 : -1;
+}
+
+static int serv_client_rx(int seconds, int images)
+{
+    int i, ret, count = 0;
+    struct group_description groups[8];
+
+    sleep(1);
+    ret = client_list_group(0, 8, groups, &count);
+    printf("list group: %d, %d groups\n", ret, count);
+    if(ret || !count)
+        return -1;
+
+    ret = client_join_group(&groups[0], "");
+    printf("join group: %d\n", ret);
+    if(ret)
+        return ret;
+
+    for(i=0; i<seconds * 10 && img_got < images; i++)
+        usleep(100 * 1000);
+    printf("images received: %d of %d, %d good\n", img_got, images, img_good);
+    return (img_good == images && img_got == images) ? 0 : -1;
+}
+
+
+/*
+ * The load users speak the protocol from their own sockets, the client
+ * library is one user a process.
+ */
+#define LOAD_USERS_MAX          (1024)
+#define LOAD_HBEATS_ROUND       (8)     /* heart beats of a user before a list */
+#define LOAD_BATCH              (16)    /* users waited for at once, in the socket buffer */
+#define LOAD_WAIT_MS            (1000)
+
+struct load_user {
+    int fd;
+    uint32_t userid;
+    int waiting;
+};
+
+static struct load_user load_users[LOAD_USERS_MAX];
+static struct pollfd load_polls[LOAD_BATCH];
+
+static uint64_t load_time_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void load_send(struct load_user *user, int type, void *data, int len)
+{
+    uint8_t buf[256];
+    pack_head_t *head = (pack_head_t *)buf;
+
+    init_pack(head, type, len);
+    memcpy(head->data, data, len);
+    send(user->fd, buf, pack_head_len() + len, 0);
+}
+
+/* the responses to @count users from @first, those still waiting at the end. */
+static int load_wait(int first, int count, int type)
+{
+    int i, n, left = count;
+    uint8_t buf[2048];
+    uint64_t end;
+    struct load_user *user;
+    pack_head_t *head = (pack_head_t *)buf;
+
+    for(i=0; i<count; i++) {
+        load_users[first + i].waiting = 1;
+        load_polls[i].fd = load_users[first + i].fd;
+        load_polls[i].events = POLLIN;
+    }
+
+    end = load_time_ms() + LOAD_WAIT_MS;
+    while(left && load_time_ms() < end) {
+        if(poll(load_polls, count, LOAD_WAIT_MS) <= 0)
+            continue;
+
+        for(i=0; i<count; i++) {
+            if(!(load_polls[i].revents & POLLIN))
+                continue;
+
+            user = &load_users[first + i];
+            n = recv(user->fd, buf, sizeof(buf), 0);
+            if(n < (int)pack_head_len() || head->type != type || !user->waiting)
+                continue;
+
+            if(type == MSG_LOGIN_RESPONSE)
+                user->userid = *(uint32_t *)head->data;
+            user->waiting = 0;
+            left--;
+        }
+    }
+    return left;
+}
+
+/*
+ * Each user logs in, then heart beats in rounds: LOAD_HBEATS_ROUND heart
+ * beats and a list request, whose response shows the round is handled.
+ */
+static int serv_client_load(const char *host, int users, int seconds)
+{
+    int i, j, n, lost = 0, rounds = 0, lost_total = 0;
+    uint64_t start, elapsed;
+    struct sockaddr_in addr;
+    struct pack_list_group list;
+
+    if(users > LOAD_USERS_MAX)
+        users = LOAD_USERS_MAX;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(CLIENT_LOGIN_PORT);
+    inet_aton(host, &addr.sin_addr);
+
+    for(i=0; i<users; i++) {
+        load_users[i].fd = socket(AF_INET, SOCK_DGRAM, 0);
+        if(load_users[i].fd < 0 ||
+                connect(load_users[i].fd, (struct sockaddr *)&addr, sizeof(addr)))
+            return -errno;
+    }
+
+    start = load_time_ms();
+    for(i=0; i<users; i+=n) {
+        n = min(users - i, LOAD_BATCH);
+        for(j=0; j<n; j++)
+            load_send(&load_users[i + j], MSG_CLI_LOGIN, NULL, 0);
+        lost += load_wait(i, n, MSG_LOGIN_RESPONSE);
+    }
+    elapsed = load_time_ms() - start;
+    printf("login: %d users in %llu ms, %llu logins/s, %d lost\n", users - lost,
+            (unsigned long long)elapsed,
+            (unsigned long long)(users - lost) * 1000 / (elapsed ? elapsed : 1), lost);
+    if(lost)
+        return -ETIMEDOUT;
+
+    start = load_time_ms();
+    do {
+        for(i=0; i<users; i+=n) {
+            n = min(users - i, LOAD_BATCH);
+            for(j=0; j<n * LOAD_HBEATS_ROUND; j++)
+                load_send(&load_users[i + j % n], MSG_CLI_HBEAT,
+                        &load_users[i + j % n].userid, sizeof(uint32_t));
+
+            list.pos = 0;
+            list.count = 1;
+            for(j=0; j<n; j++) {
+                list.userid = load_users[i + j].userid;
+                load_send(&load_users[i + j], MSG_CLI_LIST_GROUP, &list, sizeof(list));
+            }
+            lost_total += load_wait(i, n, MSG_LIST_GROUP_RESPONSE);
+        }
+        rounds++;
+        elapsed = load_time_ms() - start;
+    } while(elapsed < seconds * 1000);
+
+    printf("heart beat: %d rounds in %llu ms, %llu requests/s, %d lost\n",
+            rounds, (unsigned long long)elapsed,
+            (unsigned long long)(rounds * users - lost_total) * (LOAD_HBEATS_ROUND + 1) *
+            1000 / elapsed, lost_total);
+
+    for(i=0; i<users; i++) {
+        load_send(&load_users[i], MSG_CLI_LOGOUT, &load_users[i].userid, sizeof(uint32_t));
+        close(load_users[i].fd);
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int ret;
+
+    if(argc < 4) {
+        fprintf(stderr, "usage: %s <host> tx <images> | rx <seconds> <images> | "
+                "load <users> <seconds>\n", argv[0]);
+        return 2;
+    }
+
+    if(!strcmp(argv[2], "load"))
+        return serv_client_load(argv[1], atoi(argv[3]),
+                argc > 4 ? atoi(argv[4]) : 3) ? 1 : 0;
+
+    if(serv_client_load_img()) {
+        fprintf(stderr, "cannot read %s\n", SERV_CLIENT_IMG);
+        return 2;
+    }
+
+    client_init(argv[1], CLI_MODE_FULL_FUNCTION, serv_client_event);
+    ret = client_login();
+    printf("login: %d\n", ret);
+    if(ret)
+        return 1;
+
+    if(!strcmp(argv[2], "tx"))
+        ret = serv_client_tx(atoi(argv[3]));
+    else if(!strcmp(argv[2], "rx"))
+        ret = serv_client_rx(atoi(argv[3]), argc > 4 ? atoi(argv[4]) : 1);
+    else
+        ret = -1;
+
+    return ret ? 1 : 0;
+}
@@ -0,0 +1,218 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <common/bitmap.h>
+#include <common/non-atomic.h>
+#include <common/cpufeature.h>
+#include <common/timer.h>
+
+#include "test_util.h"
+
+
+#define BM_TEST_BITS 		(1 << 24)
+#define BM_TEST_HOLES 		(64)
+#define BM_TEST_ROUNDS 		(16)
+#define BM_SMALL_CALLS 		(1 << 20)
+#define BM_SMALL_TRIES 		(3)
+
+/* odd sizes make sure the partial words are handled. */
+static const unsigned int bm_test_sizes[] = { 1, 63, 64, 65, 200, 511, 4099 };
+
+struct bm_result {
+	unsigned long find;
+	unsigned long find_zero;
+	unsigned long logic;
+	unsigned long weight;
+	unsigned long hweight;
+};
+
+static unsigned long *bm_a, *bm_b, *bm_dst;
+
+
+static unsigned long bm_rand(void)
+{
+	return ((unsigned long)rand() << 33) ^ ((unsigned long)rand() << 11) ^ rand();
+}
+
+/* a mostly full bitmap with a few holes, a mostly empty one with a few bits. */
+static void bm_test_fill(void)
+{
+	int i;
+
+	bitmap_fill(bm_a, BM_TEST_BITS);
+	bitmap_zero(bm_b, BM_TEST_BITS);
+
+	srand(1);
+	for (i = 0; i < BM_TEST_HOLES; i++) {
+		__clear_bit(bm_rand() % BM_TEST_BITS, bm_a);
+		__set_bit(bm_rand() % BM_TEST_BITS, bm_b);
+	}
+}
+
+/*
+ * results of the small sizes, any ops table must give the same ones.
+ * The tables are called directly, bitmaps this small skip them.
+ */
+static unsigned long bm_test_small(void)
+{
+	int i, j;
+	unsigned int n;
+	unsigned long sum = 0, bit;
+
+	for (i = 0; i < ARRAY_SIZE(bm_test_sizes); i++) {
+		n = bm_test_sizes[i];
+		for (j = 0; j < n; j += 7) {
+			bit = bitmap_ops->find_next_bit(bm_b, n, j, 0UL) +
+				bitmap_ops->find_next_bit(bm_a, n, j, ~0UL);
+			sum = sum * 31 + bit;
+		}
+		sum = sum * 31 + bitmap_ops->and_bits(bm_dst, bm_a, bm_b, n);
+		sum = sum * 31 + bitmap_ops->andnot_bits(bm_dst, bm_a, bm_b, n);
+		sum = sum * 31 + bitmap_ops->weight(bm_a, n);
+		sum = sum * 31 + bitmap_ops->weight64(bm_a[j % n] ^ j);
+	}
+	return sum;
+}
+
+/* the best of BM_SMALL_TRIES, in ns a call of each. */
+static uint64_t bm_small_cost(unsigned int n, int api, unsigned long *sum)
+{
+	int i, t;
+	uint64_t start, cost, best = ~0ULL;
+
+	for (t = 0; t < BM_SMALL_TRIES; t++) {
+		start = test_time_ns();
+		for (i = 0; i < BM_SMALL_CALLS; i++) {
+			const unsigned long *b = bm_b + (i & 1023);
+
+			if (api)
+				*sum += find_first_bit(b, n) + find_first_zero_bit(bm_a, n) +
+					bitmap_weight(b, n) + hweight_long(b[0]);
+			else
+				*sum += _find_next_bit_generic(b, n, 0, 0UL) +
+					_find_next_bit_generic(bm_a, n, 0, ~0UL) +
+					__bitmap_weight_generic(b, n) + __hweight64_generic(b[0]);
+		}
+		cost = test_time_ns() - start;
+		best = min(best, cost);
+	}
+	return best / BM_SMALL_CALLS;
+}
+
+/*
+ * Small bitmaps through the api against the generic code it used to call
+ * directly: the dispatch must not make them slower.
+ */
+static int bm_test_small_cost(void)
+{
+	int i, errors = 0;
+	unsigned int n;
+	unsigned long sum = 0;
+	uint64_t api, generic;
+	static const unsigned int sizes[] = { 64, 200, 511 };
+
+	for (i = 0; i < ARRAY_SIZE(sizes); i++) {
+		n = sizes[i];
+		api = bm_small_cost(n, 1, &sum);
+		generic = bm_small_cost(n, 0, &sum);
+		printf("bitmap: %3u bits, api %3llu ns, generic %3llu ns a call\n", n,
+				(unsigned long long)api, (unsigned long long)generic);
+		if (api > generic * 3 / 2 + 2) {
+			printf("bitmap: %u bits slower than the generic code.\n", n);
+			errors++;
+		}
+	}
+	return errors + (sum == 0);
+}
+
+static int bm_test_run(const struct bitmap_ops *ops, struct bm_result *res)
+{
+	int r;
+	unsigned long bit, sum;
+	uint64_t start;
+	uint64_t cost[5];
+
+	bitmap_ops = ops;
+	memset(res, 0, sizeof(*res));
+
+	start = curr_time_ms();
+	for (r = 0; r < BM_TEST_ROUNDS; r++)
+		for_each_set_bit(bit, bm_b, BM_TEST_BITS)
+			res->find += bit;
+	cost[0] = curr_time_ms() - start;
+
+	start = curr_time_ms();
+	for (r = 0; r < BM_TEST_ROUNDS; r++)
+		for_each_clear_bit(bit, bm_a, BM_TEST_BITS)
+			res->find_zero += bit;
+	cost[1] = curr_time_ms() - start;
+
+	start = curr_time_ms();
+	for (r = 0; r < BM_TEST_ROUNDS; r++) {
+		res->logic += bitmap_and(bm_dst, bm_a, bm_b, BM_TEST_BITS - 3);
+		bitmap_or(bm_dst, bm_dst, bm_b, BM_TEST_BITS);
+		bitmap_xor(bm_dst, bm_dst, bm_a, BM_TEST_BITS);
+		res->logic += bitmap_andnot(bm_dst, bm_a, bm_dst, BM_TEST_BITS - 3);
+	}
+	res->logic += bitmap_weight(bm_dst, BM_TEST_BITS);
+	cost[2] = curr_time_ms() - start;
+
+	start = curr_time_ms();
+	for (r = 0; r < BM_TEST_ROUNDS; r++)
+		res->weight += bitmap_weight(bm_a, BM_TEST_BITS - 5);
+	cost[3] = curr_time_ms() - start;
+
+	start = curr_time_ms();
+	sum = 0;
+	for (r = 0; r < BM_TEST_ROUNDS; r++)
+		for (bit = 0; bit < BITS_TO_LONGS(BM_TEST_BITS); bit++)
+			sum += hweight_long(bm_a[bit] ^ bit);
+	res->hweight = sum + bm_test_small();
+	cost[4] = curr_time_ms() - start;
+
+	printf("bitmap: %-12s find %4llums, find_zero %4llums, and/or/xor/andnot %4llums, "
+			"weight %4llums, hweight %4llums\n", ops->name,
+			(unsigned long long)cost[0], (unsigned long long)cost[1],
+			(unsigned long long)cost[2], (unsigned long long)cost[3],
+			(unsigned long long)cost[4]);
+	return 0;
+}
+
+int test_bitmap(int argc, char **argv)
+{
+	int errors = 0;
+	const struct bitmap_ops **ops;
+	const struct bitmap_ops *saved = bitmap_ops;
+	struct bm_result expect, res;
+
+	bm_a = malloc(BITS_TO_LONGS(BM_TEST_BITS) * sizeof(unsigned long));
+	bm_b = malloc(BITS_TO_LONGS(BM_TEST_BITS) * sizeof(unsigned long));
+	bm_dst = malloc(BITS_TO_LONGS(BM_TEST_BITS) * sizeof(unsigned long));
+
+	bm_test_fill();
+	printf("bitmap: %d bits x %d rounds, selected: %s\n",
+			BM_TEST_BITS, BM_TEST_ROUNDS, saved->name);
+
+	/* the first table is the generic one, the reference. */
+	for (ops = bitmap_ops_table; *ops; ops++) {
+		if (!bitmap_ops_usable(*ops))
+			continue;
+
+		bm_test_run(*ops, ops == bitmap_ops_table ? &expect : &res);
+		if (ops != bitmap_ops_table && memcmp(&expect, &res, sizeof(res))) {
+			printf("bitmap: %s results differ from generic.\n", (*ops)->name);
+			errors++;
+		}
+	}
+	bitmap_ops = saved;
+
+	errors += bm_test_small_cost();
+
+	free(bm_a);
+	free(bm_b);
+	free(bm_dst);
+
+	printf("bitmap test %s.\n", errors ? "failed" : "success");
+	return errors;
+}
@@ -5,5 +5,15 @@ extern int test_list(int argc, char **argv);
 extern int test_configs(int argc, char **argv);
 extern int test_workqueue(int argc, char **argv);
 extern int test_timer(int argc, char **argv);
+extern int test_pack_stream(int argc, char **argv);
+extern int test_fifo(int argc, char **argv);
+extern int test_rcu(int argc, char **argv);
+extern int test_htable(int argc, char **argv);
+extern int test_bitmap(int argc, char **argv);
+extern int test_data_frag(int argc, char **argv);
+extern int test_img_sync(int argc, char **argv);
+extern int test_multicast(int argc, char **argv);
+extern int test_fanout(int argc, char **argv);
+extern int test_hbeat(int argc, char **argv);
 
 #endif
@@ -2,11 +2,13 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
 
 #include <common/list.h>
 #include <common/log.h>
 #include <common/configs.h>
 #include <common/workqueue.h>
+#include <common/pack_head.h>
 
 
 struct test_list_st
@@ -120,3 +122,70 @@ int test_timer(int argc, char **argv)
     return ret;
 }
 
+
+#define STREAM_TEST_PACKS   (3)
+
+struct stream_test {
+    int packs;
+    int bad;
+};
+
+static void stream_test_pack(void *opaque, uint8_t *pack, int len)
+{
+    int i;
+    pack_head_t *head = (pack_head_t *)pack;
+    struct stream_test *st = (struct stream_test *)opaque;
+
+    if(len != pack_head_len() + head->datalen || head->type != st->packs)
+        st->bad++;
+    for(i=0; i<head->datalen; i++) {
+        if(head->data[i] != (uint8_t)(head->type + i))
+            st->bad++;
+    }
+    st->packs++;
+}
+
+/* three packs back to back, split in two reads at every offset. */
+int test_pack_stream(int argc, char **argv)
+{
+    int i, j, len, cut, ret = 0;
+    uint8_t buf[1024];
+    pack_head_t *head;
+    struct pack_stream ps;
+    struct stream_test st;
+
+    len = 0;
+    for(i=0; i<STREAM_TEST_PACKS; i++) {
+        head = (pack_head_t *)(buf + len);
+        init_pack(head, i, 100 * (i + 1));
+        for(j=0; j<head->datalen; j++)
+            head->data[j] = i + j;
+        len += pack_head_len() + head->datalen;
+    }
+
+    pack_stream_init(&ps);
+    for(cut=0; cut<=len; cut++) {
+        st.packs = st.bad = 0;
+        pack_stream_input(&ps, buf, cut, stream_test_pack, &st);
+        pack_stream_input(&ps, buf + cut, len - cut, stream_test_pack, &st);
+        if(st.packs != STREAM_TEST_PACKS || st.bad || ps.len) {
+            printf("cut at %d: %d packs, %d bad, %d kept\n", cut, st.packs, st.bad, ps.len);
+            ret = -1;
+        }
+    }
+
+    /* a corrupt length drops what is kept, the next pack still comes. */
+    head = (pack_head_t *)buf;
+    head->datalen = PACK_STREAM_MAX_LEN;
+    st.packs = st.bad = 0;
+    if(pack_stream_input(&ps, buf, pack_head_len(), stream_test_pack, &st) != -EINVAL || ps.len)
+        ret = -1;
+    head->datalen = 100;
+    pack_stream_input(&ps, buf, len, stream_test_pack, &st);
+    if(st.packs != STREAM_TEST_PACKS || st.bad)
+        ret = -1;
+    pack_stream_release(&ps);
+
+    printf("pack stream test %s.\n", ret ? "failed" : "success");
+    return ret;
+}
@@ -0,0 +1,410 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+#include <common/data_frag.h>
+#include <common/bitmap.h>
+#include <common/non-atomic.h>
+#include <common/timer.h>
+
+
+#define FRAG_TEST_LEN 		(4 * 1024 * 1024)
+#define FRAG_TEST_FRAGLEN 	(512)
+#define FRAG_TEST_MAX_FRAGS ((FRAG_TEST_LEN + FRAG_TEST_FRAGLEN - 1) / FRAG_TEST_FRAGLEN)
+#define FRAG_TEST_FEC_GROUP (8)
+/* data fragments plus one parity per group. */
+#define FRAG_TEST_MAX_PKTS  (FRAG_TEST_MAX_FRAGS + FRAG_TEST_MAX_FRAGS / FRAG_TEST_FEC_GROUP + 1)
+#define FRAG_TEST_MIN_RATE  (128 * 1024)
+#define FRAG_TEST_MAX_RATE  (256 * 1024 * 1024)
+/* IP/UDP and the packet headers in front of every fragment on the wire. */
+#define FRAG_TEST_HDR_LEN   (64)
+#define FRAG_TEST_MTU_ROUNDS (4)
+/* nacks while the paced sender is busy, one every interval ms. */
+#define FRAG_TEST_PACE_NACKS    (40)
+#define FRAG_TEST_PACE_INTERVAL (10)
+
+/* 0: the fixed 512 bytes fragments. */
+static const int frag_test_mtus[] = { 0, 576, 1280, 1500, 9000 };
+
+struct frag_test_pkt {
+    data_vec_t v;
+    uint8_t data[FRAG_TEST_FRAGLEN];
+};
+
+static uint8_t *frag_test_src;
+static struct frag_test_pkt **frag_test_pkts;
+static int frag_test_count;
+static int frag_test_inputs;
+static int frag_test_freed;
+static int frag_test_errors;
+static int frag_test_nacks;
+static int frag_test_sent;
+/* if set, output goes to this receiver right away, through the losses. */
+static data_frags_t *frag_test_sender, *frag_test_receiver;
+static int frag_test_loss;
+static int frag_test_lost;
+static DECLARE_BITMAP(frag_test_dropped, FRAG_TEST_MAX_FRAGS);
+/* the datagram socket fragments go through, and the packet count. */
+static int frag_test_sock[2];
+static int frag_test_pkts_sent;
+
+
+/* lose one fragment in 64 and the tail, the first time they are sent. */
+static int frag_test_drop(data_vec_t *v)
+{
+    int idx = v->ofs / FRAG_TEST_FRAGLEN;
+
+    if(!frag_test_loss || v->parity)
+        return 0;
+    if(idx % 64 != 13 && idx < FRAG_TEST_MAX_FRAGS - 3)
+        return 0;
+    return !__test_and_set_bit(idx, frag_test_dropped);
+}
+
+/* the sender side, copy each fragment into its own "packet". */
+static void frag_test_output(void *opaque, data_vec_t *v)
+{
+    struct frag_test_pkt *pkt;
+
+    pkt = malloc(sizeof(*pkt));
+    pkt->v = *v;
+    pkt->v.data = pkt->data;
+    memcpy(pkt->data, v->data, v->len);
+
+    if(frag_test_receiver) {
+        if(frag_test_drop(&pkt->v)) {
+            free(pkt);
+            frag_test_lost++;
+            return;
+        }
+        data_defrag(frag_test_receiver, &pkt->v, pkt);
+        return;
+    }
+    frag_test_pkts[frag_test_count++] = pkt;
+}
+
+static void frag_test_sock_output(void *opaque, data_vec_t *v)
+{
+    uint8_t pkt[sizeof(*v) + FRAG_MAX_LEN];
+
+    memcpy(pkt, v, sizeof(*v));
+    memcpy(pkt + sizeof(*v), v->data, v->len);
+    if(send(frag_test_sock[0], pkt, sizeof(*v) + v->len, 0) < 0)
+        frag_test_errors++;
+    frag_test_pkts_sent++;
+}
+
+static void *frag_test_sock_receiver(void *args)
+{
+    int len, ret;
+    data_vec_t v;
+    data_frags_t *frags = (data_frags_t *)args;
+    static uint8_t pkt[sizeof(v) + FRAG_MAX_LEN];
+    int inputs = frag_test_inputs;
+
+    while(frag_test_inputs == inputs) {
+        len = recv(frag_test_sock[1], pkt, sizeof(pkt), 0);
+        if(len < (int)sizeof(v))
+            break;
+        memcpy(&v, pkt, sizeof(v));
+        v.data = pkt + sizeof(v);
+        /* in order, parity rebuilds the last of a group before it arrives. */
+        ret = data_defrag(frags, &v, NULL);
+        if(ret < 0 && ret != -EEXIST)
+            frag_test_errors++;
+    }
+    return NULL;
+}
+
+/* the paced sender outputs from its timer, retransmits from the caller. */
+static void frag_test_count_output(void *opaque, data_vec_t *v)
+{
+    __atomic_add_fetch(&frag_test_pkts_sent, 1, __ATOMIC_RELAXED);
+}
+
+static void frag_test_sent_cb(void *opaque, int seq)
+{
+    frag_test_sent++;
+}
+
+static void frag_test_nack(void *opaque, data_nack_t *nack)
+{
+    frag_test_nacks++;
+    if(data_frag_retransmit(frag_test_sender, nack) <= 0)
+        frag_test_errors++;
+}
+
+static void frag_test_input(void *opaque, void *data, int len)
+{
+    frag_test_inputs++;
+    if(len != FRAG_TEST_LEN || memcmp(data, frag_test_src, len))
+        frag_test_errors++;
+}
+
+static void frag_test_free(void *opaque, void *frag_pkt)
+{
+    frag_test_freed++;
+    free(frag_pkt);
+}
+
+/*
+ * Fragment the image, deliver the fragments in random order and check
+ * it comes out once. With @group, one data fragment of every group is
+ * lost, the last one among them, and parity has to rebuild them all.
+ */
+static int data_frag_run(int group)
+{
+    int i, j, ret;
+    int idx, lost = 0;
+    uint64_t start, cost;
+    struct frag_test_pkt *pkt, dup;
+    data_frags_t *frags;
+
+    frag_test_count = frag_test_inputs = frag_test_freed = frag_test_errors = 0;
+
+    frags = data_frag_init(FRAG_TEST_FRAGLEN, frag_test_input,
+            frag_test_output, frag_test_free, NULL);
+    data_frag_set_fec(frags, group);
+    data_frag(frags, frag_test_src, FRAG_TEST_LEN);
+
+    if(group) {
+        for(i=0, j=0; i<frag_test_count; i++) {
+            pkt = frag_test_pkts[i];
+            idx = pkt->v.ofs / FRAG_TEST_FRAGLEN;
+            if(!pkt->v.parity && idx % group == (idx / group) % group) {
+                free(pkt);
+                lost++;
+                continue;
+            }
+            frag_test_pkts[j++] = pkt;
+        }
+        frag_test_count = j;
+    }
+
+    /* arrive in random order, the last fragment somewhere in the middle. */
+    srand(1);
+    for(i=frag_test_count - 1; i>0; i--) {
+        j = rand() % (i + 1);
+        pkt = frag_test_pkts[i];
+        frag_test_pkts[i] = frag_test_pkts[j];
+        frag_test_pkts[j] = pkt;
+    }
+
+    /* packets are released by data_defrag(), keep a copy for the duplicate. */
+    dup = *frag_test_pkts[0];
+    dup.v.data = dup.data;
+
+    start = curr_time_ms();
+    for(i=0; i<frag_test_count; i++) {
+        pkt = frag_test_pkts[i];
+        /* a duplicate is dropped. */
+        if(i == frag_test_count / 2) {
+            ret = data_defrag(frags, &dup.v, NULL);
+            if(ret != -EEXIST)
+                frag_test_errors++;
+        }
+        ret = data_defrag(frags, &pkt->v, pkt);
+        if(ret < 0)
+            frag_test_errors++;
+    }
+    cost = curr_time_ms() - start;
+
+    if(frag_test_inputs != 1 || frag_test_freed != frag_test_count)
+        frag_test_errors++;
+
+    data_frag_release(frags);
+
+    printf("data_frag: %d packets (fec group %d, %d lost) reassembled in %llums.\n",
+            frag_test_count, group, lost, (unsigned long long)cost);
+
+    return frag_test_errors;
+}
+
+/*
+ * Send through a sender and a receiver with nacks on, at once or paced
+ * with @async. With @loss, the lost fragments and the whole tail, last
+ * fragment included, have to be nacked back from the sender's window.
+ */
+static int data_frag_send_run(int async, int loss)
+{
+    int ret;
+    uint64_t start, cost;
+    data_frags_t *sender, *receiver;
+
+    frag_test_count = frag_test_inputs = frag_test_freed = frag_test_errors = 0;
+    frag_test_nacks = frag_test_sent = frag_test_lost = 0;
+
+    sender = data_frag_init(FRAG_TEST_FRAGLEN, frag_test_input,
+            frag_test_output, frag_test_free, NULL);
+    receiver = data_frag_init(FRAG_TEST_FRAGLEN, frag_test_input,
+            frag_test_output, frag_test_free, NULL);
+    data_frag_set_nack(sender, 2, frag_test_nack);
+    data_frag_set_nack(receiver, 2, frag_test_nack);
+    data_frag_set_pacing(sender, FRAG_TEST_MIN_RATE, FRAG_TEST_MAX_RATE,
+            frag_test_sent_cb);
+
+    frag_test_sender = sender;
+    frag_test_receiver = receiver;
+    frag_test_loss = loss;
+    bitmap_zero(frag_test_dropped, FRAG_TEST_MAX_FRAGS);
+
+    start = curr_time_ms();
+    if(async) {
+        /* the caller is not held up by the pacing. */
+        ret = data_frag_async(sender, frag_test_src, FRAG_TEST_LEN);
+        if(ret < 0 || curr_time_ms() - start > 10)
+            frag_test_errors++;
+    } else {
+        data_frag(sender, frag_test_src, FRAG_TEST_LEN);
+    }
+
+    while(!(frag_test_inputs && (!async || frag_test_sent)) &&
+            curr_time_ms() - start < 5000)
+        usleep(1000);
+    cost = curr_time_ms() - start;
+
+    if(frag_test_inputs != 1 || (async && frag_test_sent != 1) ||
+            (loss && !frag_test_nacks))
+        frag_test_errors++;
+
+    data_frag_release(receiver);
+    data_frag_release(sender);
+    frag_test_receiver = frag_test_sender = NULL;
+    frag_test_loss = 0;
+
+    printf("data_frag: %s, %d fragments lost, %d nacks, complete after %llums.\n",
+            async ? "paced" : "at once", frag_test_lost, frag_test_nacks,
+            (unsigned long long)cost);
+
+    return frag_test_errors;
+}
+
+/*
+ * Nack the first fragment of a paced image over and over while it is
+ * sent: the rate has to come down from where it started instead of
+ * growing, the nacks of one period halve it once.
+ */
+static int data_frag_pace_run(void)
+{
+    int i, seq, ret;
+    long start_rate, rate;
+    data_nack_t nack;
+    data_frags_t *sender;
+
+    frag_test_errors = frag_test_pkts_sent = 0;
+
+    sender = data_frag_init(FRAG_TEST_FRAGLEN, frag_test_input,
+            frag_test_count_output, NULL, NULL);
+    data_frag_set_nack(sender, 2, NULL);
+    data_frag_set_pacing(sender, FRAG_TEST_MIN_RATE, FRAG_TEST_MAX_RATE, NULL);
+
+    start_rate = data_frag_pace_rate(sender);
+    seq = data_frag_async(sender, frag_test_src, FRAG_TEST_LEN);
+    if(seq < 0)
+        frag_test_errors++;
+
+    memset(&nack, 0, sizeof(nack));
+    nack.seq = seq;
+    nack.nr_ranges = 1;
+    nack.ranges[0].start = 0;
+    nack.ranges[0].count = 1;
+
+    usleep(FRAG_TEST_PACE_INTERVAL * 1000);
+    for(i=0; i<FRAG_TEST_PACE_NACKS; i++) {
+        ret = data_frag_retransmit(sender, &nack);
+        if(ret < 0)
+            frag_test_errors++;
+        usleep(FRAG_TEST_PACE_INTERVAL * 1000);
+    }
+
+    rate = data_frag_pace_rate(sender);
+    if(rate >= start_rate)
+        frag_test_errors++;
+
+    data_frag_release(sender);
+
+    printf("data_frag: paced at %ldKB/s, %ldKB/s after %d nacks, %d packets out.\n",
+            start_rate >> 10, rate >> 10, FRAG_TEST_PACE_NACKS, frag_test_pkts_sent);
+
+    return frag_test_errors;
+}
+
+/*
+ * Fragments sized for @mtu, sent one datagram each through a socket to
+ * a receiver thread, like a state image to the node server.
+ */
+static int data_frag_mtu_run(int mtu)
+{
+    int i;
+    int fraglen = mtu ? mtu - FRAG_TEST_HDR_LEN : FRAG_TEST_FRAGLEN;
+    uint64_t start, cost;
+    pthread_t th;
+    data_frags_t *sender, *receiver;
+
+    frag_test_inputs = frag_test_errors = frag_test_pkts_sent = 0;
+
+    if(socketpair(AF_UNIX, SOCK_DGRAM, 0, frag_test_sock))
+        return 1;
+
+    sender = data_frag_init(FRAG_TEST_FRAGLEN, frag_test_input,
+            frag_test_sock_output, NULL, NULL);
+    receiver = data_frag_init(FRAG_TEST_FRAGLEN, frag_test_input,
+            NULL, NULL, NULL);
+    data_frag_set_fec(sender, FRAG_TEST_FEC_GROUP);
+    data_frag_set_fec(receiver, FRAG_TEST_FEC_GROUP);
+    if(data_frag_set_fraglen(sender, fraglen))
+        frag_test_errors++;
+
+    start = curr_time_ms();
+    for(i=0; i<FRAG_TEST_MTU_ROUNDS; i++) {
+        pthread_create(&th, NULL, frag_test_sock_receiver, receiver);
+        data_frag(sender, frag_test_src, FRAG_TEST_LEN);
+        pthread_join(th, NULL);
+    }
+    cost = curr_time_ms() - start;
+
+    if(frag_test_inputs != FRAG_TEST_MTU_ROUNDS)
+        frag_test_errors++;
+
+    data_frag_release(receiver);
+    data_frag_release(sender);
+    close(frag_test_sock[0]);
+    close(frag_test_sock[1]);
+
+    printf("data_frag: mtu %4d, %4d bytes fragments, %5d packets per image, %4lluMB/s.\n",
+            mtu, fraglen, frag_test_pkts_sent / FRAG_TEST_MTU_ROUNDS,
+            (unsigned long long)((uint64_t)FRAG_TEST_LEN * FRAG_TEST_MTU_ROUNDS *
+                MSEC_PER_SEC / (cost ? cost : 1) >> 20));
+
+    return frag_test_errors;
+}
+
+int test_data_frag(int argc, char **argv)
+{
+    int i;
+    int errors;
+
+    frag_test_src = malloc(FRAG_TEST_LEN);
+    frag_test_pkts = malloc(FRAG_TEST_MAX_PKTS * sizeof(*frag_test_pkts));
+    for(i=0; i<FRAG_TEST_LEN; i++)
+        frag_test_src[i] = i * 7 + (i >> 9);
+
+    errors = data_frag_run(0);
+    errors += data_frag_run(FRAG_TEST_FEC_GROUP);
+    errors += data_frag_send_run(0, 1);
+    errors += data_frag_send_run(1, 0);
+    errors += data_frag_send_run(1, 1);
+    errors += data_frag_pace_run();
+    for(i=0; i<ARRAY_SIZE(frag_test_mtus); i++)
+        errors += data_frag_mtu_run(frag_test_mtus[i]);
+
+    free(frag_test_pkts);
+    free(frag_test_src);
+
+    printf("data_frag test %s.\n", errors ? "failed" : "success");
+    return errors;
+}
@@ -0,0 +1,305 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <common/core.h>
+#include <common/rcu.h>
+#include <common/timer.h>
+#include <common/packet.h>
+#include <common/pack_head.h>
+#include <common/fanout.h>
+
+#include "serv.h"
+#include "task.h"
+#include "test_util.h"
+
+#define FANOUT_TEST_MAX         (512)
+#define FANOUT_TEST_IDS         (2048)
+#define FANOUT_TEST_OPS         (20000)
+#define FANOUT_TEST_LOOKUPS     (200000)
+/* packets received in each relay benchmark, about. */
+#define FANOUT_TEST_PACKETS     (100000)
+#define FANOUT_TEST_PKT_LEN     (256)
+#define FANOUT_TEST_WINDOW      (8)
+/* the node server workers a relay is spread over. */
+#define FANOUT_TEST_WORKERS     (4)
+
+static const int fanout_test_sizes[] = { 8, 64, 512 };
+
+/* a member as the turn task kept them, a fixed array scanned per relay. */
+struct fanout_test_cli {
+    uint32_t userid;
+    struct sockaddr addr;
+    int running;
+};
+
+static struct test_peers fanout_test_peer;
+static volatile unsigned long fanout_test_sink;
+
+
+static struct sockaddr fanout_test_mkaddr(uint32_t id)
+{
+    struct sockaddr_in in;
+    struct sockaddr addr;
+
+    memset(&in, 0, sizeof(in));
+    in.sin_family = AF_INET;
+    in.sin_addr.s_addr = htonl(0x0a000000 | id);
+    in.sin_port = htons(id & 0xffff);
+    memcpy(&addr, &in, sizeof(addr));
+    return addr;
+}
+
+/* every running member once in the peers array, where its index says. */
+static int fanout_test_check(fanout_t *fo, int *state)
+{
+    int i, running = 0, members = 0;
+    struct fanout_member *m;
+    struct fanout_peers *peers = fanout_peers(fo);
+
+    for(i=0; i<FANOUT_TEST_IDS; i++) {
+        m = fanout_lookup(fo, i);
+        if(!!m != !!state[i])
+            return 1;
+        if(!m)
+            continue;
+        members++;
+        if(m->running != (state[i] == 2))
+            return 1;
+        if(!m->running)
+            continue;
+        running++;
+        if(fanout_peer_index(peers, m) < 0 ||
+                memcmp(&peers->dst[m->index], &m->addr, sizeof(m->addr)))
+            return 1;
+    }
+    return running != peers->count || members != fanout_size(fo);
+}
+
+/* random joins, first packets and leaves against a plain array. */
+static int fanout_test_ops(void)
+{
+    int i, id, ret, errors = 0;
+    int state[FANOUT_TEST_IDS] = { 0 };    /* 0: none, 1: pending, 2: running */
+    struct sockaddr addr;
+    fanout_t *fo, *copy;
+
+    fo = fanout_create(8);
+    srand(7);
+
+    rcu_read_lock();
+    for(i=0; i<FANOUT_TEST_OPS; i++) {
+        id = rand() % FANOUT_TEST_IDS;
+        addr = fanout_test_mkaddr(id);
+
+        switch(rand() % 3) {
+            case 0:
+                ret = fanout_add(fo, id, &addr, rand() & 1);
+                if(state[id] ? ret != -EEXIST : ret)
+                    errors++;
+                if(!state[id])
+                    state[id] = fanout_lookup(fo, id)->running ? 2 : 1;
+                break;
+            case 1:
+                ret = fanout_run(fo, id, &addr);
+                if(state[id] ? ret : ret != -ENOENT)
+                    errors++;
+                if(state[id])
+                    state[id] = 2;
+                break;
+            case 2:
+                ret = fanout_del(fo, id);
+                if(state[id] ? ret : ret != -ENOENT)
+                    errors++;
+                state[id] = 0;
+                break;
+        }
+
+        if(i % 1000 == 0 && fanout_test_check(fo, state))
+            errors++;
+    }
+    errors += fanout_test_check(fo, state);
+
+    copy = fanout_copy(fo);
+    errors += fanout_test_check(copy, state);
+    rcu_read_unlock();
+
+    synchronize_rcu();
+    fanout_release(copy);
+    fanout_release(fo);
+
+    printf("fanout: %d membership changes, %s.\n", FANOUT_TEST_OPS,
+            errors ? "inconsistent" : "consistent");
+    return errors;
+}
+
+/* per relay: find the sender and the addresses to send to. */
+static void fanout_test_lookup(int n)
+{
+    int i, j, k, count;
+    uint32_t userid;
+    uint64_t start, scan, table;
+    unsigned long sum = 0;
+    struct fanout_test_cli *cli;
+    struct sockaddr *dst;
+    struct fanout_member *m;
+    struct fanout_peers *peers;
+    fanout_t *fo;
+
+    cli = malloc(sizeof(*cli) * n);
+    dst = malloc(sizeof(*dst) * n);
+    fo = fanout_create(n);
+    for(i=0; i<n; i++) {
+        cli[i].userid = i * 7 + 1;
+        cli[i].addr = fanout_test_mkaddr(i);
+        cli[i].running = 1;
+        fanout_add(fo, cli[i].userid, &cli[i].addr, 1);
+    }
+
+    start = test_time_ns();
+    for(k=0; k<FANOUT_TEST_LOOKUPS; k++) {
+        userid = (k % n) * 7 + 1;
+        count = 0;
+        for(j=0; j<n; j++) {
+            if(cli[j].userid == userid || !cli[j].running)
+                continue;
+            dst[count++] = cli[j].addr;
+        }
+        sum += count;
+    }
+    scan = test_time_ns() - start;
+
+    rcu_read_lock();
+    start = test_time_ns();
+    for(k=0; k<FANOUT_TEST_LOOKUPS; k++) {
+        userid = (k % n) * 7 + 1;
+        m = fanout_lookup(fo, userid);
+        peers = fanout_peers(fo);
+        sum += peers->count - (fanout_peer_index(peers, m) >= 0);
+    }
+    table = test_time_ns() - start;
+    rcu_read_unlock();
+
+    fanout_test_sink = sum;
+    printf("fanout %3d members: scan %6lluns, table %4lluns per relay\n", n,
+            (unsigned long long)scan / FANOUT_TEST_LOOKUPS,
+            (unsigned long long)table / FANOUT_TEST_LOOKUPS);
+
+    fanout_release(fo);
+    free(dst);
+    free(cli);
+}
+
+/*
+ * each member in turn sends, the packet is relayed to all the others by
+ * task_worker_pkt_fanout() as the turn task does, a group over
+ * TASK_FANOUT_CHUNK is spread over the workers of the node server.
+ */
+static int fanout_test_relay(task_t *task, int n)
+{
+    int i, k, skip, relays, expect;
+    uint64_t start, cost;
+    pack_buf_t *pkb;
+    struct pack_task_req *pack;
+    struct fanout_member *m;
+    struct fanout_peers *peers;
+    struct test_peers *tp = &fanout_test_peer;
+    fanout_t *fo;
+
+    fo = fanout_create(n);
+    for(i=0; i<n; i++)
+        fanout_add(fo, i, &tp->addr[i], 1);
+
+    relays = FANOUT_TEST_PACKETS / (n - 1);
+    test_peers_start(tp, n);
+
+    start = curr_time_ms();
+    for(k=0; k<relays; k++) {
+        if(test_peers_wait(tp, k * (n - 1), FANOUT_TEST_WINDOW * n))
+            break;
+
+        /* as received by the worker of the task. */
+        pack = task_worker_pkt_alloc(task);
+        pack->taskid = task->taskid;
+        pack->userid = k % n;
+        pack->type = 0;
+        pack->datalen = FANOUT_TEST_PKT_LEN;
+        memset(pack->data, 0x5a, FANOUT_TEST_PKT_LEN);
+        pkb = data_to_pack_buf((uint8_t *)pack - pack_head_len());
+        pkb->len = pack_head_len() + sizeof(*pack) + FANOUT_TEST_PKT_LEN;
+
+        rcu_read_lock();
+        m = fanout_lookup(fo, k % n);
+        peers = fanout_peers(fo);
+        skip = fanout_peer_index(peers, m);
+        task_worker_pkt_fanout(task, MSG_TURN_PACK, pack, peers->dst,
+                peers->count, skip);
+        rcu_read_unlock();
+
+        /* the reference of the receive path. */
+        task_worker_pkt_free(task, pack);
+    }
+
+    expect = relays * (n - 1);
+    test_peers_wait(tp, expect, 0);
+
+    cost = curr_time_ms() - start;
+    if(!cost)
+        cost = 1;
+    test_peers_stop(tp);
+
+    printf("fanout %3d members, %d workers: %d relays, %d packets in %llums, %llu pps%s\n",
+            n, FANOUT_TEST_WORKERS, relays, tp->received, (unsigned long long)cost,
+            (unsigned long long)tp->received * MSEC_PER_SEC / cost,
+            tp->received < expect ? ", lost" : "");
+
+    synchronize_rcu();
+    fanout_release(fo);
+    return tp->received < expect;
+}
+
+int test_fanout(int argc, char **argv)
+{
+    int i;
+    int errors = 0;
+    task_t *tasks[FANOUT_TEST_WORKERS];
+
+    errors += fanout_test_ops();
+
+    for(i=0; i<ARRAY_SIZE(fanout_test_sizes); i++)
+        fanout_test_lookup(fanout_test_sizes[i]);
+
+    if(test_peers_open(&fanout_test_peer, FANOUT_TEST_MAX, 256 * 1024)) {
+        printf("fanout test: open peers failed.\n");
+        return -1;
+    }
+
+    /*
+     * a task on each worker, the first one relays. The node server stays
+     * up until the program exits.
+     */
+    if(node_serv_init_standalone(FANOUT_TEST_WORKERS)) {
+        printf("fanout test: node server failed.\n");
+        test_peers_close(&fanout_test_peer);
+        return -1;
+    }
+    for(i=0; i<FANOUT_TEST_WORKERS; i++) {
+        tasks[i] = create_task(0);
+        tasks[i]->taskid = i + 1;
+        node_serv_task_add(tasks[i]);
+    }
+
+    for(i=0; i<ARRAY_SIZE(fanout_test_sizes); i++)
+        errors += fanout_test_relay(tasks[0], fanout_test_sizes[i]);
+
+    test_peers_close(&fanout_test_peer);
+
+    printf("fanout test %s.\n", errors ? "failed" : "success");
+    return errors;
+}
+
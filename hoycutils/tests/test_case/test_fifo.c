@@ -0,0 +1,162 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include <common/fifo.h>
+#include <common/timer.h>
+
+
+#define FIFO_BENCH_SIZE     (64 * 1024)
+#define FIFO_BENCH_CHUNK    (4 * 1024)
+#define FIFO_BENCH_BYTES    (64 * 1024 * 1024UL)
+
+enum {
+    FIFO_BENCH_LOCKED,
+    FIFO_BENCH_SPSC,
+    FIFO_BENCH_ZERO_COPY,
+};
+
+struct fifo_bench {
+    struct fifo fifo;
+    int mode;
+    pthread_mutex_t lock;
+    uint8_t pattern[FIFO_BENCH_SIZE + 256];
+    int error;
+};
+
+/* The stream is the byte sequence 0,1,...,255,0,1,... so any byte at
+ * position pos is pattern[pos & 0xff]. */
+static inline const uint8_t *bench_src(struct fifo_bench *fb, unsigned long pos)
+{
+    return fb->pattern + (pos & 0xff);
+}
+
+static void *fifo_bench_producer(void *args)
+{
+    struct fifo_bench *fb = (struct fifo_bench *)args;
+    struct fifo *fifo = &fb->fifo;
+    unsigned long pos = 0;
+    unsigned int n;
+    void *ptr;
+
+    while(pos < FIFO_BENCH_BYTES) {
+        switch(fb->mode) {
+            case FIFO_BENCH_LOCKED:
+                n = fifo_in_mutex(fifo, bench_src(fb, pos),
+                        FIFO_BENCH_CHUNK, &fb->lock);
+                break;
+            case FIFO_BENCH_SPSC:
+                n = fifo_in_spsc(fifo, bench_src(fb, pos), FIFO_BENCH_CHUNK);
+                break;
+            default:
+                n = fifo_prepare(fifo, &ptr, FIFO_BENCH_CHUNK);
+                memcpy(ptr, bench_src(fb, pos), n);
+                fifo_commit(fifo, n);
+                break;
+        }
+        /* full, let the consumer run on a uniprocessor */
+        if(!n)
+            sched_yield();
+        pos += n;
+    }
+    return NULL;
+}
+
+static void *fifo_bench_consumer(void *args)
+{
+    struct fifo_bench *fb = (struct fifo_bench *)args;
+    struct fifo *fifo = &fb->fifo;
+    uint8_t buf[FIFO_BENCH_CHUNK];
+    unsigned long pos = 0;
+    unsigned int n;
+    void *ptr;
+
+    while(pos < FIFO_BENCH_BYTES) {
+        switch(fb->mode) {
+            case FIFO_BENCH_LOCKED:
+                n = fifo_out_mutex(fifo, buf, sizeof(buf), &fb->lock);
+                ptr = buf;
+                break;
+            case FIFO_BENCH_SPSC:
+                n = fifo_out_spsc(fifo, buf, sizeof(buf));
+                ptr = buf;
+                break;
+            default:
+                n = fifo_out_linear(fifo, &ptr, FIFO_BENCH_CHUNK);
+                break;
+        }
+
+        if(n && memcmp(ptr, bench_src(fb, pos), n))
+            fb->error++;
+
+        if(fb->mode == FIFO_BENCH_ZERO_COPY)
+            fifo_skip_count(fifo, n);
+        if(!n)
+            sched_yield();
+        pos += n;
+    }
+    return NULL;
+}
+
+static int fifo_bench_run(struct fifo_bench *fb, int mode, const char *desc)
+{
+    pthread_t producer, consumer;
+    struct fifo *fifo = &fb->fifo;
+    uint64_t start, cost;
+
+    fifo_reset(fifo);
+    fb->mode = mode;
+    fb->error = 0;
+
+    start = curr_time_ms();
+    pthread_create(&consumer, NULL, fifo_bench_consumer, fb);
+    pthread_create(&producer, NULL, fifo_bench_producer, fb);
+    pthread_join(producer, NULL);
+    pthread_join(consumer, NULL);
+    cost = curr_time_ms() - start;
+    if(!cost)
+        cost = 1;
+
+    printf("fifo %-10s: %luMB in %llums, %llu MB/s, %s\n", desc,
+            FIFO_BENCH_BYTES >> 20, (unsigned long long)cost,
+            (unsigned long long)((FIFO_BENCH_BYTES >> 20) * MSEC_PER_SEC / cost),
+            fb->error ? "corrupted" : "ok");
+
+    return fb->error;
+}
+
+int test_fifo(int argc, char **argv)
+{
+    int i;
+    int ret = 0;
+    struct fifo_bench *fb;
+    struct fifo *fifo;
+
+    fb = malloc(sizeof(*fb));
+    if(!fb)
+        return -1;
+
+    for(i=0; i<sizeof(fb->pattern); i++)
+        fb->pattern[i] = (uint8_t)i;
+
+    fifo = &fb->fifo;
+    pthread_mutex_init(&fb->lock, NULL);
+    if(fifo_alloc(fifo, FIFO_BENCH_SIZE)) {
+        free(fb);
+        return -1;
+    }
+
+    ret |= fifo_bench_run(fb, FIFO_BENCH_LOCKED, "locked");
+    ret |= fifo_bench_run(fb, FIFO_BENCH_SPSC, "spsc");
+    ret |= fifo_bench_run(fb, FIFO_BENCH_ZERO_COPY, "zero-copy");
+
+    printf("fifo test %s.\n", ret ? "failed" : "success");
+
+    fifo_free(fifo);
+    free(fb);
+    return ret;
+}
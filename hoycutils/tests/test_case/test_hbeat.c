@@ -0,0 +1,141 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <common/core.h>
+#include <common/timer.h>
+#include <common/hbeat.h>
+
+#include "test_util.h"
+
+#define HBEAT_TEST_NODES        (100000)
+#define HBEAT_TEST_TIMEOUT      (2 * MSEC_PER_SEC)
+#define HBEAT_TEST_PERIOD       (200)
+/* a timeout and a tick after the last heartbeat of the odd nodes, and some. */
+#define HBEAT_TEST_RUN          (HBEAT_TEST_TIMEOUT + HBEAT_TICK + 1500)
+/* taken out before they expire, every so many nodes. */
+#define HBEAT_TEST_RM_STEP      (101)
+
+/* a tick is timed with few and with many nodes, none of them due. */
+#define HBEAT_TEST_TICK_FEW     (1000)
+#define HBEAT_TEST_TICK_MANY    (1000000)
+#define HBEAT_TEST_TICK_TIMEOUT (30 * MSEC_PER_SEC)
+#define HBEAT_TEST_TICKS        (1000)
+#define HBEAT_TEST_TICK_NS_MAX  (100 * 1000)
+
+struct hbeat_test_node {
+    hbeat_node_t hbeat;
+    int dead;
+};
+
+static struct hbeat_test_node *hbeat_test_nodes;
+
+static void hbeat_test_dead(hbeat_node_t *hbeat)
+{
+    struct hbeat_test_node *n = container_of(hbeat, struct hbeat_test_node, hbeat);
+
+    __atomic_add_fetch(&n->dead, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * The average cost of a tick of a god of @count nodes. Its timer is
+ * stopped, the ticks are run here, each on the bucket of now.
+ */
+static uint64_t hbeat_test_tick_cost(int count)
+{
+    int i;
+    uint64_t t, cost = 0;
+    hbeat_god_t god;
+    struct hbeat_test_node *nodes;
+
+    nodes = calloc(count, sizeof(*nodes));
+    if(!nodes)
+        return ~0ULL;
+
+    hbeat_god_init(&god, hbeat_test_dead);
+    hbeat_god_set_timeout(&god, HBEAT_TEST_TICK_TIMEOUT);
+    del_timer_sync(&god.timer);
+
+    for(i=0; i<count; i++)
+        hbeat_add_to_god(&god, &nodes[i].hbeat);
+
+    for(i=0; i<HBEAT_TEST_TICKS; i++) {
+        god.tick = curr_time_ms() / HBEAT_TICK;
+        t = test_time_ns();
+        hbeat_god_handle((unsigned long)&god);
+        cost += test_time_ns() - t;
+        del_timer_sync(&god.timer);
+    }
+
+    for(i=0; i<count; i++) {
+        if(nodes[i].dead)
+            cost = ~0ULL;
+    }
+    free(nodes);
+    return cost == ~0ULL ? cost : cost / HBEAT_TEST_TICKS;
+}
+
+/*
+ * the even nodes keep beating, the odd ones stop at once and must expire
+ * once each, the removed ones never.
+ */
+int test_hbeat(int argc, char **argv)
+{
+    int i, errors = 0;
+    int dead = 0, beats = 0;
+    uint64_t start, end, cost = 0, t;
+    uint64_t few, many;
+    hbeat_god_t god;
+
+    hbeat_test_nodes = calloc(HBEAT_TEST_NODES, sizeof(*hbeat_test_nodes));
+    if(!hbeat_test_nodes)
+        return -1;
+
+    hbeat_god_init(&god, hbeat_test_dead);
+    hbeat_god_set_timeout(&god, HBEAT_TEST_TIMEOUT);
+
+    for(i=0; i<HBEAT_TEST_NODES; i++)
+        hbeat_add_to_god(&god, &hbeat_test_nodes[i].hbeat);
+
+    for(i=1; i<HBEAT_TEST_NODES; i+=2 * HBEAT_TEST_RM_STEP)
+        hbeat_rm_from_god(&god, &hbeat_test_nodes[i].hbeat);
+
+    start = curr_time_ms();
+    end = start + HBEAT_TEST_RUN;
+    while(curr_time_ms() < end) {
+        t = test_time_ns();
+        for(i=0; i<HBEAT_TEST_NODES; i+=2)
+            user_heartbeat(&hbeat_test_nodes[i].hbeat);
+        cost += test_time_ns() - t;
+        beats += HBEAT_TEST_NODES / 2;
+        usleep(HBEAT_TEST_PERIOD * 1000);
+    }
+
+    for(i=0; i<HBEAT_TEST_NODES; i++) {
+        int expect = (i & 1) && (i - 1) % (2 * HBEAT_TEST_RM_STEP);
+        int n = __atomic_load_n(&hbeat_test_nodes[i].dead, __ATOMIC_RELAXED);
+
+        dead += n;
+        if(n != expect)
+            errors++;
+    }
+
+    del_timer_sync(&god.timer);
+    free(hbeat_test_nodes);
+
+    printf("hbeat: %d nodes, %d dead, %lluns per heartbeat.\n",
+            HBEAT_TEST_NODES, dead, beats ? (unsigned long long)cost / beats : 0ULL);
+
+    /* a tick walks the due nodes only, not the whole population. */
+    few = hbeat_test_tick_cost(HBEAT_TEST_TICK_FEW);
+    many = hbeat_test_tick_cost(HBEAT_TEST_TICK_MANY);
+    printf("hbeat: %lluns per tick of %d nodes, %lluns of %d, none due.\n",
+            (unsigned long long)few, HBEAT_TEST_TICK_FEW,
+            (unsigned long long)many, HBEAT_TEST_TICK_MANY);
+    if(few > HBEAT_TEST_TICK_NS_MAX || many > HBEAT_TEST_TICK_NS_MAX)
+        errors++;
+
+    printf("hbeat test %s.\n", errors ? "failed" : "success");
+    return errors;
+}
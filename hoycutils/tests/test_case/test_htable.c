@@ -0,0 +1,204 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include <common/list.h>
+#include <common/rcu.h>
+#include <common/htable.h>
+#include <common/timer.h>
+
+
+#define HT_TEST_OBJS 		(1 << 18)
+#define HT_TEST_STABLE 		(1024)
+#define HT_TEST_READERS 	(2)
+#define HT_TEST_ROUNDS 		(4)
+
+/* the same bucket count as the server maps used to have. */
+#define HT_TEST_HLIST_SZ 	(1024)
+
+struct ht_obj {
+    int id;
+    int magic;
+    struct hlist_node hentry;
+};
+
+static struct ht_obj *ht_objs;
+static struct htable ht_test;
+static pthread_mutex_t ht_test_lock = PTHREAD_MUTEX_INITIALIZER;
+static volatile int ht_test_stop;
+static int ht_test_errors;
+static unsigned long ht_test_reads;
+
+
+/* the stable ids never leave the table, readers must always find them. */
+static void *ht_test_reader(void *args)
+{
+    int id = 0;
+    unsigned long reads = 0;
+    struct ht_obj *obj;
+
+    while(!ht_test_stop) {
+        rcu_read_lock();
+        obj = htable_lookup(&ht_test, id);
+        if(!obj || obj->id != id)
+            __atomic_add_fetch(&ht_test_errors, 1, __ATOMIC_RELAXED);
+        rcu_read_unlock();
+
+        id = (id + 1) % HT_TEST_STABLE;
+        reads++;
+    }
+
+    __atomic_add_fetch(&ht_test_reads, reads, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+static int ht_test_concurrent(void)
+{
+    int i, r;
+    pthread_t readers[HT_TEST_READERS];
+    struct htable_params params = HTABLE_PARAMS(struct ht_obj, id, 0);
+
+    htable_init(&ht_test, &params);
+    for(i=0; i<HT_TEST_STABLE; i++)
+        htable_insert(&ht_test, &ht_objs[i]);
+
+    ht_test_stop = 0;
+    for(i=0; i<HT_TEST_READERS; i++)
+        pthread_create(&readers[i], NULL, ht_test_reader, NULL);
+
+    /* grow and shrink back repeatedly, every round goes through resizes. */
+    for(r=0; r<HT_TEST_ROUNDS; r++) {
+        for(i=HT_TEST_STABLE; i<HT_TEST_OBJS; i++) {
+            pthread_mutex_lock(&ht_test_lock);
+            htable_insert(&ht_test, &ht_objs[i]);
+            pthread_mutex_unlock(&ht_test_lock);
+        }
+        for(i=HT_TEST_STABLE; i<HT_TEST_OBJS; i++) {
+            pthread_mutex_lock(&ht_test_lock);
+            if(htable_remove(&ht_test, i) != &ht_objs[i])
+                ht_test_errors++;
+            pthread_mutex_unlock(&ht_test_lock);
+        }
+    }
+
+    ht_test_stop = 1;
+    for(i=0; i<HT_TEST_READERS; i++)
+        pthread_join(readers[i], NULL);
+
+    if(htable_size(&ht_test) != HT_TEST_STABLE)
+        ht_test_errors++;
+
+    rcu_barrier();
+    htable_destroy(&ht_test);
+
+    printf("htable: %lu lookups during %d resize rounds, %d errors.\n",
+            ht_test_reads, HT_TEST_ROUNDS, ht_test_errors);
+    return ht_test_errors;
+}
+
+static int ht_test_basic(void)
+{
+    int i, count = 0, errors = 0;
+    struct ht_obj *obj;
+    struct htable_iter iter;
+    struct htable_params params = HTABLE_PARAMS(struct ht_obj, id, 16);
+
+    htable_init(&ht_test, &params);
+    for(i=0; i<HT_TEST_OBJS; i+=2)
+        htable_insert(&ht_test, &ht_objs[i]);
+
+    if(htable_insert(&ht_test, &ht_objs[0]) != -EEXIST)
+        errors++;
+
+    for(i=0; i<HT_TEST_OBJS; i++) {
+        obj = htable_lookup(&ht_test, i);
+        if((i & 1) ? obj != NULL : obj != &ht_objs[i])
+            errors++;
+    }
+
+    /* removing the current object while iterating is allowed. */
+    htable_for_each(&ht_test, &iter, obj) {
+        if(obj->id % 4 == 0 && htable_remove(&ht_test, obj->id) != obj)
+            errors++;
+        count++;
+    }
+    if(count != HT_TEST_OBJS / 2 || htable_size(&ht_test) != HT_TEST_OBJS / 4)
+        errors++;
+
+    rcu_barrier();
+    htable_destroy(&ht_test);
+    return errors;
+}
+
+static void ht_test_bench(void)
+{
+    int i, r;
+    uint64_t start, ht_cost, hl_cost;
+    unsigned long found = 0;
+    struct ht_obj *obj;
+    struct hlist_node *pos;
+    struct hlist_head *hlist;
+    struct htable_params params = HTABLE_PARAMS(struct ht_obj, id, 0);
+
+    hlist = calloc(HT_TEST_HLIST_SZ, sizeof(*hlist));
+    htable_init(&ht_test, &params);
+    for(i=0; i<HT_TEST_OBJS; i++) {
+        htable_insert(&ht_test, &ht_objs[i]);
+        hlist_add_head(&ht_objs[i].hentry, &hlist[i % HT_TEST_HLIST_SZ]);
+    }
+
+    start = curr_time_ms();
+    for(r=0; r<HT_TEST_ROUNDS; r++) {
+        for(i=0; i<HT_TEST_OBJS; i++) {
+            obj = htable_lookup(&ht_test, (i * 7919) % HT_TEST_OBJS);
+            found += !!obj;
+        }
+    }
+    ht_cost = curr_time_ms() - start;
+
+    start = curr_time_ms();
+    for(r=0; r<HT_TEST_ROUNDS; r++) {
+        for(i=0; i<HT_TEST_OBJS; i++) {
+            int id = (i * 7919) % HT_TEST_OBJS;
+            hlist_for_each_entry(obj, pos, &hlist[id % HT_TEST_HLIST_SZ], hentry) {
+                if(obj->id == id) {
+                    found++;
+                    break;
+                }
+            }
+        }
+    }
+    hl_cost = curr_time_ms() - start;
+
+    printf("htable: %d lookups, htable %llums, hlist[%d] %llums (%lu found).\n",
+            HT_TEST_OBJS * HT_TEST_ROUNDS, (unsigned long long)ht_cost,
+            HT_TEST_HLIST_SZ, (unsigned long long)hl_cost, found);
+
+    htable_destroy(&ht_test);
+    free(hlist);
+}
+
+int test_htable(int argc, char **argv)
+{
+    int i;
+    int errors;
+
+    ht_objs = calloc(HT_TEST_OBJS, sizeof(*ht_objs));
+    for(i=0; i<HT_TEST_OBJS; i++)
+        ht_objs[i].id = i;
+
+    ht_test_errors = 0;
+    ht_test_reads = 0;
+
+    errors = ht_test_basic();
+    errors += ht_test_concurrent();
+    ht_test_bench();
+
+    free(ht_objs);
+
+    printf("htable test %s.\n", errors ? "failed" : "success");
+    return errors;
+}
@@ -0,0 +1,217 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include <common/lz.h>
+#include <common/img_sync.h>
+
+#include "test_util.h"
+
+#ifndef TEST_SAMPLES_DIR
+#define TEST_SAMPLES_DIR    "samples"
+#endif
+
+#define IMG_TEST_BMP        TEST_SAMPLES_DIR "/test.bmp"
+#define IMG_TEST_SYN_LEN    (720 * 1280 * 3 + 54)
+#define IMG_TEST_FRAMES     (64)
+#define IMG_TEST_KEYINT     (16)
+/* a sprite moving over the picture, like a game frame. */
+#define IMG_TEST_SPRITE     (64)
+#define IMG_TEST_SRC        (7)
+
+static uint8_t *img_test_frame;
+static int img_test_len;
+static int img_test_decoded;
+static int img_test_errors;
+
+static void img_test_image(void *arg, int src, void *data, int len)
+{
+    img_test_decoded++;
+    if(src != IMG_TEST_SRC || len != img_test_len ||
+            memcmp(data, img_test_frame, len))
+        img_test_errors++;
+}
+
+/* the sample image, or a gradient of the same size when it is not found. */
+static uint8_t *img_test_load(int *len)
+{
+    int i;
+    long size;
+    uint8_t *img;
+    FILE *fp;
+
+    fp = fopen(IMG_TEST_BMP, "rb");
+    if(fp) {
+        fseek(fp, 0, SEEK_END);
+        size = ftell(fp);
+        fseek(fp, 0, SEEK_SET);
+        img = malloc(size);
+        if(fread(img, 1, size, fp) == size) {
+            fclose(fp);
+            *len = size;
+            printf("img_sync: %s, %ld bytes.\n", IMG_TEST_BMP, size);
+            return img;
+        }
+        free(img);
+        fclose(fp);
+    }
+
+    img = malloc(IMG_TEST_SYN_LEN);
+    for(i=0; i<IMG_TEST_SYN_LEN; i++)
+        img[i] = (i % 2160) / 9 + (i / 2160) / 5;
+    *len = IMG_TEST_SYN_LEN;
+    printf("img_sync: %s not found, synthetic %d bytes.\n", IMG_TEST_BMP, *len);
+    return img;
+}
+
+/* move the sprite to frame @n, 24 bits rows of a bmp as the layout. */
+static void img_test_step(uint8_t *img, int len, int n)
+{
+    int x, y;
+    int stride = 720 * 3;
+    int ofs = 54 + ((n * 7) % 1000) * stride + (n * 11 % 600) * 3;
+
+    for(y=0; y<IMG_TEST_SPRITE; y++) {
+        for(x=0; x<IMG_TEST_SPRITE * 3; x++) {
+            if(ofs + y * stride + x < len)
+                img[ofs + y * stride + x] ^= (x + y + n) | 0x80;
+        }
+    }
+    /* and a score counter. */
+    img[len - 1] = n;
+}
+
+static int img_test_lz(const uint8_t *img, int len)
+{
+    int i, zlen, ret, errors = 0;
+    uint8_t *z, *out, *rnd;
+
+    z = malloc(lz_compress_bound(len));
+    out = malloc(len);
+
+    zlen = lz_compress(img, len, z, lz_compress_bound(len));
+    ret = lz_decompress(z, zlen, out, len);
+    if(zlen <= 0 || ret != len || memcmp(out, img, len))
+        errors++;
+
+    /* truncated or too small output must fail, not overrun. */
+    if(lz_decompress(z, zlen / 2, out, len) == len)
+        errors++;
+    if(lz_decompress(z, zlen, out, len - 1) >= 0)
+        errors++;
+    if(lz_compress(img, len, z, zlen - 1) != -ENOSPC)
+        errors++;
+
+    /* incompressible and tiny inputs. */
+    rnd = malloc(len);
+    srand(1);
+    for(i=0; i<len; i++)
+        rnd[i] = rand();
+    for(i=0; i<=16; i++) {
+        zlen = lz_compress(rnd, i * (len / 16), z, lz_compress_bound(len));
+        ret = lz_decompress(z, zlen, out, len);
+        if(ret != i * (len / 16) || memcmp(out, rnd, ret))
+            errors++;
+    }
+    for(i=0; i<32; i++) {
+        zlen = lz_compress(img, i, z, lz_compress_bound(len));
+        if(lz_decompress(z, zlen, out, len) != i || memcmp(out, img, i))
+            errors++;
+    }
+
+    free(rnd);
+    free(out);
+    free(z);
+    return errors;
+}
+
+int test_img_sync(int argc, char **argv)
+{
+    int i, len, ret, errors = 0;
+    uint8_t *img, *enc, *junk;
+    long long key_bytes = 0, delta_bytes = 0;
+    int keys = 0, deltas = 0;
+    uint64_t start, enc_cost = 0, dec_cost = 0;
+    img_sync_t *tx, *rx, *late;
+
+    img = img_test_load(&len);
+    img_test_frame = img;
+    img_test_len = len;
+    img_test_decoded = img_test_errors = 0;
+
+    errors += img_test_lz(img, len);
+
+    enc = malloc(img_sync_bound(len));
+    tx = img_sync_init(IMG_TEST_KEYINT);
+    rx = img_sync_init(IMG_TEST_KEYINT);
+    late = img_sync_init(IMG_TEST_KEYINT);
+
+    for(i=0; i<IMG_TEST_FRAMES; i++) {
+        if(i)
+            img_test_step(img, len, i);
+
+        start = test_time_ns();
+        ret = img_sync_encode(tx, IMG_TEST_SRC, img, len, enc);
+        enc_cost += test_time_ns() - start;
+        if(ret <= 0 || ret > img_sync_bound(len)) {
+            errors++;
+            break;
+        }
+        if(i % IMG_TEST_KEYINT == 0) {
+            key_bytes += ret;
+            keys++;
+        } else {
+            delta_bytes += ret;
+            deltas++;
+        }
+
+        start = test_time_ns();
+        if(img_sync_decode(rx, enc, ret, img_test_image, NULL) != len)
+            errors++;
+        dec_cost += test_time_ns() - start;
+
+        /* joined late: deltas wait for the next keyframe. */
+        if(i >= 3) {
+            int r = img_sync_decode(late, enc, ret, img_test_image, NULL);
+            if(i < IMG_TEST_KEYINT ? r != -EAGAIN : r != len)
+                errors++;
+        }
+    }
+
+    /* a forced keyframe after a loss, and junk is rejected. */
+    img_sync_force_key(tx);
+    ret = img_sync_encode(tx, IMG_TEST_SRC, img, len, enc);
+    if(ret < key_bytes / keys / 2 ||
+            img_sync_decode(rx, enc, ret, img_test_image, NULL) != len)
+        errors++;
+    junk = malloc(ret);
+    memcpy(junk, enc, ret);
+    memset(junk + IMG_SYNC_HDR_LEN, 0xff, (ret - IMG_SYNC_HDR_LEN) / 2);
+    if(img_sync_decode(late, junk, ret, img_test_image, NULL) >= 0 ||
+            img_sync_decode(late, enc, IMG_SYNC_HDR_LEN - 1, img_test_image, NULL) >= 0)
+        errors++;
+    free(junk);
+
+    if(img_test_decoded != IMG_TEST_FRAMES * 2 - IMG_TEST_KEYINT + 1)
+        errors++;
+    errors += img_test_errors;
+
+    printf("img_sync: %d frames of %d bytes, %lld bytes on wire (%.2f%%).\n",
+            IMG_TEST_FRAMES, len, key_bytes + delta_bytes,
+            100.0 * (key_bytes + delta_bytes) / ((long long)len * IMG_TEST_FRAMES));
+    printf("img_sync: keyframe %lld bytes, delta %lld bytes average.\n",
+            key_bytes / keys, deltas ? delta_bytes / deltas : 0);
+    printf("img_sync: encode %.0fMB/s, decode %.0fMB/s.\n",
+            (double)len * IMG_TEST_FRAMES * 1000 / (enc_cost ? enc_cost : 1),
+            (double)len * IMG_TEST_FRAMES * 1000 / (dec_cost ? dec_cost : 1));
+
+    img_sync_release(late);
+    img_sync_release(rx);
+    img_sync_release(tx);
+    free(enc);
+    free(img);
+
+    printf("img_sync test %s.\n", errors ? "failed" : "success");
+    return errors;
+}
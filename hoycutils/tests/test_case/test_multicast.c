@@ -0,0 +1,96 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include <common/core.h>
+#include <common/timer.h>
+#include <common/packet.h>
+#include <common/ioasync.h>
+
+#include "test_util.h"
+
+#define MCAST_TEST_MAX_PEERS    (64)
+#define MCAST_TEST_FANOUTS      (5000)
+#define MCAST_TEST_PKT_LEN      (512)
+/* fan-outs in flight, the receivers must not drop. */
+#define MCAST_TEST_WINDOW       (32)
+
+static const int mcast_test_peers[] = { 2, 3, 4, 8, 16, 64 };
+
+static struct test_peers mcast_test_peer;
+
+
+/* relay pps with one packet per address, or one sendmmsg per fan-out. */
+static int mcast_test_run(iohandler_t *ioh, int n, int mmsg)
+{
+    int i, j, expect;
+    pack_buf_t *pkb;
+    uint64_t start, cost;
+    struct test_peers *peers = &mcast_test_peer;
+
+    test_peers_start(peers, n);
+
+    start = curr_time_ms();
+    for(i=0; i<MCAST_TEST_FANOUTS; i++) {
+        if(test_peers_wait(peers, i * n, MCAST_TEST_WINDOW * n))
+            break;
+
+        pkb = iohandler_pack_buf_alloc(ioh);
+        memset(pkb->data, 0x5a, MCAST_TEST_PKT_LEN - 1);
+        pkb->data[MCAST_TEST_PKT_LEN - 1] = 0xa5;
+        pkb->len = MCAST_TEST_PKT_LEN;
+
+        if(mmsg) {
+            iohandler_pkt_multicast(ioh, pkb, peers->addr, n);
+        } else {
+            pack_buf_get_n(pkb, n - 1);
+            for(j=0; j<n; j++)
+                iohandler_pkt_sendto(ioh, pkb, &peers->addr[j]);
+        }
+    }
+
+    expect = MCAST_TEST_FANOUTS * n;
+    test_peers_wait(peers, expect, 0);
+
+    cost = curr_time_ms() - start;
+    if(!cost)
+        cost = 1;
+    test_peers_stop(peers);
+
+    printf("multicast %2d peers, %-8s: %d packets in %llums, %llu pps%s\n",
+            n, mmsg ? "sendmmsg" : "sendto", peers->received,
+            (unsigned long long)cost,
+            (unsigned long long)peers->received * MSEC_PER_SEC / cost,
+            peers->received < expect ? ", lost" : "");
+
+    return peers->errors || peers->received < expect;
+}
+
+int test_multicast(int argc, char **argv)
+{
+    int i, n;
+    int errors = 0;
+    iohandler_t *ioh;
+
+    if(test_peers_open(&mcast_test_peer, MCAST_TEST_MAX_PEERS, 1024 * 1024)) {
+        printf("multicast test: open peers failed.\n");
+        return -1;
+    }
+    mcast_test_peer.check_len = MCAST_TEST_PKT_LEN;
+
+    ioh = test_udp_sender();
+
+    for(i=0; i<ARRAY_SIZE(mcast_test_peers); i++) {
+        n = mcast_test_peers[i];
+        errors += mcast_test_run(ioh, n, 0);
+        errors += mcast_test_run(ioh, n, 1);
+    }
+
+    iohandler_shutdown(ioh);
+    test_peers_close(&mcast_test_peer);
+
+    printf("multicast test %s.\n", errors ? "failed" : "success");
+    return errors;
+}
@@ -0,0 +1,140 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <common/rcu.h>
+#include <common/idr.h>
+#include <common/timer.h>
+
+
+#define RCU_TEST_READERS 	(4)
+#define RCU_TEST_UPDATES 	(20000)
+#define RCU_TEST_IDS 		(1024)
+
+#define RCU_OBJ_ALIVE 		(0x5a5a5a5a)
+#define RCU_OBJ_DEAD 		(0xdeaddead)
+
+struct rcu_obj {
+    unsigned int magic;
+    int id;
+    struct rcu_head rcu;
+};
+
+static struct rcu_obj *rcu_test_ptr;
+static struct idr rcu_test_idr;
+static pthread_mutex_t rcu_test_lock = PTHREAD_MUTEX_INITIALIZER;
+static volatile int rcu_test_stop;
+static int rcu_test_errors;
+static unsigned long rcu_test_reads;
+
+
+static void rcu_obj_free(struct rcu_head *head)
+{
+    struct rcu_obj *obj = container_of(head, struct rcu_obj, rcu);
+
+    /* a reader still holding @obj would see this. */
+    obj->magic = RCU_OBJ_DEAD;
+    free(obj);
+}
+
+static struct rcu_obj *rcu_obj_alloc(int id)
+{
+    struct rcu_obj *obj;
+
+    obj = malloc(sizeof(*obj));
+    obj->magic = RCU_OBJ_ALIVE;
+    obj->id = id;
+    return obj;
+}
+
+static void *rcu_test_reader(void *args)
+{
+    int id = 0;
+    unsigned long reads = 0;
+    struct rcu_obj *obj;
+
+    while(!rcu_test_stop) {
+        rcu_read_lock();
+        obj = rcu_dereference(rcu_test_ptr);
+        if(obj && obj->magic != RCU_OBJ_ALIVE)
+            __atomic_add_fetch(&rcu_test_errors, 1, __ATOMIC_RELAXED);
+
+        obj = idr_find(&rcu_test_idr, id);
+        if(obj && (obj->magic != RCU_OBJ_ALIVE || obj->id != id))
+            __atomic_add_fetch(&rcu_test_errors, 1, __ATOMIC_RELAXED);
+        rcu_read_unlock();
+
+        id = (id + 1) % RCU_TEST_IDS;
+        reads++;
+    }
+
+    __atomic_add_fetch(&rcu_test_reads, reads, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+static void rcu_test_update(int i)
+{
+    int id;
+    struct rcu_obj *obj, *old;
+
+    obj = rcu_obj_alloc(i);
+    old = rcu_test_ptr;
+    rcu_assign_pointer(rcu_test_ptr, obj);
+    if(old)
+        call_rcu(&old->rcu, rcu_obj_free);
+
+    /* remove an id and insert it again, idr layers come and go. */
+    id = i % RCU_TEST_IDS;
+    pthread_mutex_lock(&rcu_test_lock);
+    old = idr_find(&rcu_test_idr, id);
+    if(old)
+        idr_remove(&rcu_test_idr, id);
+
+    obj = rcu_obj_alloc(id);
+    if(idr_alloc(&rcu_test_idr, obj, id, id + 1) != id) {
+        free(obj);
+        __atomic_add_fetch(&rcu_test_errors, 1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&rcu_test_lock);
+
+    if(old)
+        call_rcu(&old->rcu, rcu_obj_free);
+}
+
+int test_rcu(int argc, char **argv)
+{
+    int i;
+    uint64_t start, cost;
+    pthread_t readers[RCU_TEST_READERS];
+
+    idr_init(&rcu_test_idr);
+    rcu_test_stop = 0;
+    rcu_test_errors = 0;
+    rcu_test_reads = 0;
+
+    for(i=0; i<RCU_TEST_READERS; i++)
+        pthread_create(&readers[i], NULL, rcu_test_reader, NULL);
+
+    start = curr_time_ms();
+    for(i=0; i<RCU_TEST_UPDATES; i++) {
+        rcu_test_update(i);
+        if(i % 1000 == 0)
+            synchronize_rcu();
+    }
+
+    rcu_test_stop = 1;
+    for(i=0; i<RCU_TEST_READERS; i++)
+        pthread_join(readers[i], NULL);
+
+    /* all deferred frees must have run after the barrier. */
+    rcu_barrier();
+    cost = curr_time_ms() - start;
+
+    printf("rcu: %d updates, %lu lock-free reads in %llums.\n", RCU_TEST_UPDATES,
+            rcu_test_reads, (unsigned long long)cost);
+
+    printf("rcu test %s.\n", rcu_test_errors ? "failed" : "success");
+    return rcu_test_errors;
+}
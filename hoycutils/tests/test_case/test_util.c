@@ -0,0 +1,128 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sched.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <common/timer.h>
+#include <common/packet.h>
+#include <common/ioasync.h>
+
+#include "test_util.h"
+
+
+static void *test_peers_receiver(void *args)
+{
+    int i, len;
+    uint8_t buf[PACKET_MAX_PAYLOAD];
+    struct test_peers *peers = args;
+
+    while(!peers->stop) {
+        for(i=0; i<peers->active; i++) {
+            while((len = recv(peers->sock[i], buf, sizeof(buf), MSG_DONTWAIT)) >= 0) {
+                if(peers->check_len && (len != peers->check_len ||
+                            buf[0] != 0x5a || buf[len - 1] != 0xa5))
+                    __atomic_add_fetch(&peers->errors, 1, __ATOMIC_RELAXED);
+                __atomic_add_fetch(&peers->received, 1, __ATOMIC_RELAXED);
+            }
+        }
+        sched_yield();
+    }
+    return NULL;
+}
+
+int test_peers_open(struct test_peers *peers, int count, int rcvbuf)
+{
+    int i;
+    socklen_t addrlen;
+    struct sockaddr_in addr;
+
+    memset(peers, 0, sizeof(*peers));
+    if(count > TEST_PEERS_MAX)
+        return -EINVAL;
+
+    for(i=0; i<count; i++) {
+        peers->sock[i] = socket(AF_INET, SOCK_DGRAM, 0);
+        if(peers->sock[i] < 0)
+            goto fail;
+        peers->count++;
+        setsockopt(peers->sock[i], SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addrlen = sizeof(addr);
+        if(bind(peers->sock[i], (struct sockaddr *)&addr, sizeof(addr)) ||
+                getsockname(peers->sock[i], (struct sockaddr *)&addr, &addrlen))
+            goto fail;
+        memcpy(&peers->addr[i], &addr, sizeof(addr));
+    }
+    return 0;
+
+fail:
+    test_peers_close(peers);
+    return -errno;
+}
+
+void test_peers_close(struct test_peers *peers)
+{
+    int i;
+
+    for(i=0; i<peers->count; i++)
+        close(peers->sock[i]);
+    peers->count = 0;
+}
+
+void test_peers_start(struct test_peers *peers, int active)
+{
+    peers->active = active;
+    peers->received = peers->errors = 0;
+    peers->stop = 0;
+    pthread_create(&peers->thread, NULL, test_peers_receiver, peers);
+}
+
+void test_peers_stop(struct test_peers *peers)
+{
+    peers->stop = 1;
+    pthread_join(peers->thread, NULL);
+}
+
+int test_peers_wait(struct test_peers *peers, int sent, int window)
+{
+    int received, last = -1;
+    uint64_t stall = curr_time_ms();
+
+    while(sent - (received = __atomic_load_n(&peers->received, __ATOMIC_RELAXED)) > window) {
+        if(received != last) {
+            last = received;
+            stall = curr_time_ms();
+        } else if(curr_time_ms() - stall > TEST_PEERS_STALL_MS) {
+            return -ETIMEDOUT;
+        }
+        sched_yield();
+    }
+    return 0;
+}
+
+static void test_udp_handlefrom(void *priv, uint8_t *data, int len, void *from)
+{
+}
+
+static void test_udp_close(void *priv)
+{
+}
+
+iohandler_t *test_udp_sender(void)
+{
+    int fd;
+
+    fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if(fd < 0)
+        return NULL;
+
+    return iohandler_udp_create(get_global_ioasync(), fd,
+            test_udp_handlefrom, test_udp_close, NULL);
+}
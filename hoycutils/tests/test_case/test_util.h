@@ -0,0 +1,51 @@
+#ifndef _TEST_CASE_TEST_UTIL_H_
+#define _TEST_CASE_TEST_UTIL_H_
+
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+#include <common/ioasync.h>
+
+static inline uint64_t test_time_ns(void)
+{
+    struct timespec tm;
+
+    clock_gettime(CLOCK_MONOTONIC, &tm);
+    return tm.tv_sec * 1000000000ULL + tm.tv_nsec;
+}
+
+#define TEST_PEERS_MAX          (512)
+/* a relay benchmark gives up after so long without a packet. */
+#define TEST_PEERS_STALL_MS     (1000)
+
+/*
+ * udp sockets on loopback a relay benchmark sends to, a thread counts
+ * what the first active ones receive. With check_len set, a packet
+ * must be that long and framed by 0x5a ... 0xa5.
+ */
+struct test_peers {
+    int count;
+    int active;
+    int sock[TEST_PEERS_MAX];
+    struct sockaddr addr[TEST_PEERS_MAX];
+    int check_len;
+    int received;
+    int errors;
+    volatile int stop;
+    pthread_t thread;
+};
+
+int test_peers_open(struct test_peers *peers, int count, int rcvbuf);
+void test_peers_close(struct test_peers *peers);
+/* count from 0 again, what the first @active peers receive. */
+void test_peers_start(struct test_peers *peers, int active);
+void test_peers_stop(struct test_peers *peers);
+/* until at most @window of @sent packets are missing, -ETIMEDOUT on a stall. */
+int test_peers_wait(struct test_peers *peers, int sent, int window);
+
+/* an udp iohandler on the global ioasync that only sends. */
+iohandler_t *test_udp_sender(void);
+
+#endif